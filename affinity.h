@@ -0,0 +1,23 @@
+#pragma once
+#include <pthread.h>
+#include <sched.h>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+// pin a thread to a single cpu, cpu < 0 leaves the thread unpinned
+inline bool pin_thread(std::thread& t, int cpu, const char* who) {
+    if (cpu < 0) {
+        return true;
+    }
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+    int rc = pthread_setaffinity_np(t.native_handle(), sizeof(mask), &mask);
+    if (rc != 0) {
+        std::cerr << "[" << who << "] unable to pin cpu " << cpu << ": " << std::strerror(rc) << std::endl;
+        return false;
+    }
+    std::cout << "[" << who << "] cpu pinned to core " << cpu << std::endl;
+    return true;
+}
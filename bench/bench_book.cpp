@@ -0,0 +1,87 @@
+// book rebuild: std::map per side against the flat tick-indexed FlatBook on the same update stream
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <vector>
+#include "../l2_book.h"
+
+using namespace std::chrono;
+
+struct Update {
+    uint32_t price;
+    int64_t qty;
+    bool bid;
+};
+
+// a snapshot of 5000 levels a side, then updates within 200 ticks of a drifting mid
+static std::vector<Update> make_stream(size_t n) {
+    std::vector<Update> out;
+    out.reserve(n + 10'000);
+    std::mt19937_64 rng(11);
+    uint32_t mid = 6'000'000;
+    for (uint32_t k = 1; k <= 5000; ++k) {
+        out.push_back({mid - k, 100'000'000, true});
+        out.push_back({mid + k, 100'000'000, false});
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (rng() % 16 == 0) {
+            mid += (rng() & 1) ? 1 : -1;
+        }
+        const bool bid = rng() & 1;
+        const auto k = static_cast<uint32_t>(rng() % 200);
+        const int64_t qty = rng() % 3 == 0 ? 0 : static_cast<int64_t>(rng() % 1000) * 100'000;
+        out.push_back({bid ? mid - 1 - k : mid + 1 + k, qty, bid});
+    }
+    return out;
+}
+
+int main(int argc, char** argv) {
+    const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20'000'000;
+    const auto stream = make_stream(n);
+
+    double map_s;
+    uint64_t map_check = 0;
+    {
+        std::map<uint32_t, int64_t> side[2];
+        const auto t0 = steady_clock::now();
+        for (size_t i = 0; i < stream.size(); ++i) {
+            const Update& u = stream[i];
+            auto& s = side[u.bid];
+            if (u.qty == 0) {
+                s.erase(u.price);
+            }
+            else {
+                s[u.price] = u.qty;
+            }
+            // best bid every 64 updates, what a sampler would ask for
+            if ((i & 63) == 0 && !side[1].empty()) {
+                map_check += side[1].rbegin()->first;
+            }
+        }
+        map_s = duration<double>(steady_clock::now() - t0).count();
+    }
+
+    double flat_s;
+    uint64_t flat_check = 0;
+    {
+        FlatBook book;
+        const auto t0 = steady_clock::now();
+        for (size_t i = 0; i < stream.size(); ++i) {
+            const Update& u = stream[i];
+            book.apply(u.price, u.qty, u.bid);
+            L2Level best;
+            if ((i & 63) == 0 && book.best_bid(best)) {
+                flat_check += best.price;
+            }
+        }
+        flat_s = duration<double>(steady_clock::now() - t0).count();
+    }
+
+    std::printf("updates %zu\n", stream.size());
+    std::printf("std::map   %8.1f Mupd/s\n", stream.size() / map_s / 1e6);
+    std::printf("FlatBook   %8.1f Mupd/s  (%.1fx)%s\n", stream.size() / flat_s / 1e6, map_s / flat_s,
+                map_check == flat_check ? "" : "  MISMATCH");
+    return map_check == flat_check ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+// writer drain throughput: per-row dequeue vs batched read_span + column scatter
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include "../l2_writer.h"
+#include "../row_scatter.h"
+#include "../spsc.h"
+
+using namespace std::chrono;
+
+static constexpr size_t kQueueCapacity = 1ull << 18;
+static constexpr size_t kBatchRows = 4096;
+using Queue = LockFreeQueue<L2Row, kQueueCapacity>;
+
+struct Columns {
+    std::vector<uint64_t> ts;
+    std::vector<uint32_t> px;
+    std::vector<int64_t> qty;
+    std::vector<uint8_t> side;
+    std::atomic<uint64_t> rows{0};
+
+    explicit Columns(size_t n) : ts(n), px(n), qty(n), side(n) {}
+};
+
+static void fill(Queue& q, uint64_t& ts) {
+    for (size_t i = 0; i < q.capacity(); ++i) {
+        const L2Row r{ts++, 12'500'000 * static_cast<int64_t>(i & 63), static_cast<uint32_t>(6'000'000 + (i & 255)),
+                      static_cast<uint8_t>(i & 1)};
+        q.enqueue(r);
+    }
+}
+
+// the pre-batch writer loop: one optional<L2Row>, four stores and a release per row
+static size_t drain_per_row(Queue& q, Columns& c) {
+    size_t n = 0;
+    while (auto row = q.dequeue()) {
+        const uint64_t idx = c.rows.load(std::memory_order_relaxed);
+        c.ts[idx] = row->ts_ns;
+        c.px[idx] = row->price;
+        c.qty[idx] = row->qty;
+        c.side[idx] = row->side;
+        c.rows.store(idx + 1, std::memory_order_release);
+        ++n;
+    }
+    return n;
+}
+
+static size_t drain_batched(Queue& q, Columns& c, scatter_fn scatter) {
+    size_t n = 0;
+    while (true) {
+        auto batch = q.read_span(kBatchRows);
+        if (batch.empty()) {
+            break;
+        }
+        uint64_t idx = c.rows.load(std::memory_order_relaxed);
+        for (auto part : {batch.first, batch.second}) {
+            scatter(part.data(), part.size(), c.ts.data() + idx, c.px.data() + idx,
+                    c.qty.data() + idx, c.side.data() + idx);
+            idx += part.size();
+        }
+        c.rows.store(idx, std::memory_order_release);
+        q.commit_read(batch.size());
+        n += batch.size();
+    }
+    return n;
+}
+
+template <typename Drain>
+static double measure(const char* name, int rounds, Drain&& drain) {
+    auto q = std::make_unique<Queue>();
+    Columns c(q->capacity());
+    uint64_t ts = 1'700'000'000'000'000'000ull;
+    double best = 0;
+    for (int r = 0; r < rounds; ++r) {
+        fill(*q, ts);
+        c.rows.store(0, std::memory_order_relaxed);
+        const auto t0 = steady_clock::now();
+        const size_t n = drain(*q, c);
+        const double s = duration<double>(steady_clock::now() - t0).count();
+        best = std::max(best, static_cast<double>(n) / s);
+    }
+    std::printf("%-22s %10.1f Mrows/s\n", name, best / 1e6);
+    return best;
+}
+
+int main(int argc, char** argv) {
+    const int rounds = argc > 1 ? std::atoi(argv[1]) : 50;
+
+    const double base = measure("per-row dequeue", rounds,
+                                [](Queue& q, Columns& c) { return drain_per_row(q, c); });
+    const double scalar = measure("batched scalar", rounds,
+                                  [](Queue& q, Columns& c) { return drain_batched(q, c, &scatter_rows_scalar); });
+    const double best = measure("batched dispatched", rounds,
+                                [](Queue& q, Columns& c) { return drain_batched(q, c, select_scatter()); });
+
+    std::printf("speedup scalar x%.2f dispatched x%.2f\n", scalar / base, best / base);
+    return 0;
+}
@@ -0,0 +1,110 @@
+// compressed hour files: ratio, encode time, and decode throughput against reading the raw columns
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "../l2_compact.h"
+#include "../l2_reader.h"
+#include "../l2_writer.h"
+
+using namespace std::chrono;
+
+// coinbase-like stream: ~40us between rows, prices walking a few ticks around the mid,
+// quantities with up to 8 decimals, a quarter of updates deleting a level
+static void write_hour(const std::string& dir, uint64_t hour_s, size_t rows) {
+    L2WriterOpt opt{dir, "BENCH-USD"};
+    opt.initial_rows_per_hr = rows;
+    L2Writer w(opt);
+    w.start();
+
+    std::mt19937_64 rng(7);
+    std::exponential_distribution<double> gap(1.0 / 40'000.0);
+    uint64_t ts = hour_s * 1'000'000'000ull;
+    uint32_t mid = 6'000'000;
+    for (size_t i = 0; i < rows; ++i) {
+        ts += static_cast<uint64_t>(gap(rng)) + 1;
+        if (rng() % 8 == 0) {
+            mid += (rng() & 1) ? 1 : -1;
+        }
+        const bool bid = rng() & 1;
+        const uint32_t px = bid ? mid - static_cast<uint32_t>(rng() % 50) : mid + static_cast<uint32_t>(rng() % 50);
+        const int64_t qty = rng() % 4 == 0 ? 0 : static_cast<int64_t>(rng() % 500'000'000);
+        while (!w.enqueue({ts, qty, px, static_cast<uint8_t>(bid)})) {
+        }
+    }
+    w.stop();
+    w.join();
+}
+
+template <typename F>
+static double best_of(int runs, F&& f) {
+    double best = 1e30;
+    for (int r = 0; r < runs; ++r) {
+        const auto t0 = steady_clock::now();
+        f();
+        best = std::min(best, duration<double>(steady_clock::now() - t0).count());
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    const size_t rows = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20'000'000;
+    const std::string dir = argc > 2 ? argv[2] : "/tmp/bench_l2z";
+    const uint64_t hour_s = 1'700'000'000ull / 3600 * 3600;
+
+    write_hour(dir, hour_s, rows);
+    const std::string raw_path = l2col_hour_path(dir, hour_s);
+    const std::string z_path = l2z_path_for(raw_path);
+
+    L2HourFile raw;
+    if (!raw.open(raw_path)) {
+        std::fprintf(stderr, "%s\n", raw.error().c_str());
+        return 1;
+    }
+    std::string err;
+    const double enc_s = best_of(1, [&] { (void)l2z_write(raw, z_path, err); });
+    L2ZFile z;
+    if (!z.open(z_path)) {
+        std::fprintf(stderr, "%s\n", z.error().c_str());
+        return 1;
+    }
+
+    std::vector<uint64_t> ts(rows);
+    std::vector<uint32_t> px(rows);
+    std::vector<int64_t> qty(rows);
+    std::vector<uint8_t> side(rows);
+
+    // raw: copying the mapped columns out of the page cache, the best case for the raw file
+    const double raw_s = best_of(5, [&] {
+        raw.for_each_segment(0, raw.rows(), [&](const L2Segment& s) {
+            std::memcpy(ts.data() + s.row_base, s.ts.data(), s.ts.size_bytes());
+            std::memcpy(px.data() + s.row_base, s.price.data(), s.price.size_bytes());
+            std::memcpy(qty.data() + s.row_base, s.qty.data(), s.qty.size_bytes());
+            std::memcpy(side.data() + s.row_base, s.side.data(), s.side.size_bytes());
+        });
+    });
+    const double dec_s = best_of(5, [&] { z.decode(ts.data(), px.data(), qty.data(), side.data()); });
+
+    size_t bad = 0;
+    for (size_t i = 0; i < rows; ++i) {
+        const L2Row r = raw.row(i);
+        bad += r.ts_ns != ts[i] || r.price != px[i] || r.qty != qty[i] ||
+            r.side != side[i];
+    }
+    if (bad) {
+        std::fprintf(stderr, "%zu rows decoded differently\n", bad);
+        return 1;
+    }
+
+    const double raw_bytes = static_cast<double>(rows) * 21.0;
+    std::printf("rows %zu  raw %.1f MB  l2z %.1f MB  ratio %.2fx  encode %.2f s\n", rows, raw_bytes / 1e6,
+                static_cast<double>(z.bytes()) / 1e6, raw_bytes / static_cast<double>(z.bytes()), enc_s);
+    std::printf("raw copy    %8.1f Mrows/s  %6.2f GB/s of columns\n", rows / raw_s / 1e6, raw_bytes / raw_s / 1e9);
+    std::printf("l2z decode  %8.1f Mrows/s  %6.2f GB/s of columns (%.2f GB/s read from disk)\n", rows / dec_s / 1e6,
+                raw_bytes / dec_s / 1e9, static_cast<double>(z.bytes()) / dec_s / 1e9);
+    return 0;
+}
@@ -0,0 +1,524 @@
+// l2_data parsing: the byte-scanning parser the feed used before against the structural index
+// parser with each kernel this cpu supports, in message bytes per second. then the price and qty
+// field decoders alone: the float ones the parser had before fixed point against the templated
+// per product ones, in ns per level. the parse is also timed on the messages cut into websocket
+// fragments, as the feed parses them
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../l2_parser.h"
+
+using namespace std::chrono;
+
+// checksum over every decoded level, so all parsers can be checked against each other
+struct Sink {
+    uint64_t levels{0};
+    uint64_t sum{0};
+
+    void add(uint64_t ts, uint32_t price, int64_t qty, bool bid) noexcept {
+        sum = (sum ^ ts ^ (uint64_t{price} << 1) ^ (static_cast<uint64_t>(qty) << 20) ^ bid) * 0x9e3779b97f4a7c15ull;
+        ++levels;
+    }
+};
+
+// reference decimal to fixed point, digit by digit
+static int64_t ref_fixed(const char* p, int decimals) noexcept {
+    int64_t v = 0;
+    while (*p >= '0' && *p <= '9') {
+        v = v * 10 + (*p++ - '0');
+    }
+    if (*p == '.') {
+        ++p;
+    }
+    for (int i = 0; i < decimals; ++i) {
+        v = v * 10 + ((*p >= '0' && *p <= '9') ? *p++ - '0' : 0);
+    }
+    return v;
+}
+
+// "21921.74" -> 2192174, the price decoder before per product scales
+static uint32_t float_era_price100(const char* p) noexcept {
+    uint32_t int_part = 0;
+    while (*p >= '0' && *p <= '9') {
+        int_part = int_part * 10 + static_cast<uint32_t>(*p++ - '0');
+    }
+    if (*p == '.') {
+        ++p;
+        uint32_t frac_part = 0;
+        if (*p >= '0' && *p <= '9') {
+            frac_part += static_cast<uint32_t>(*p++ - '0') * 10u;
+        }
+        if (*p >= '0' && *p <= '9') {
+            frac_part += static_cast<uint32_t>(*p - '0');
+        }
+        return int_part * 100u + frac_part;
+    }
+    return int_part * 100u;
+}
+
+// the float qty decoder before fixed point, fraction 8 digits at a time
+static float float_era_qty(const char* p, const char* end) noexcept {
+    uint64_t int_part = 0;
+    while (*p >= '0' && *p <= '9') {
+        int_part = int_part * 10 + static_cast<uint64_t>(*p++ - '0');
+    }
+    if (*p != '.') {
+        return static_cast<float>(int_part);
+    }
+    ++p;
+    const size_t n = std::min<size_t>(static_cast<size_t>(end - p), 9);
+    uint64_t frac_part = 0;
+    if (n == 9) {
+        frac_part = uint64_t{l2_digits8(p, 8)} * 10 + static_cast<uint64_t>(p[8] - '0');
+    }
+    else if (n) {
+        frac_part = l2_digits8(p, n);
+    }
+    static const float inv10[10] = {1.0f, 1e-1f, 1e-2f, 1e-3f, 1e-4f, 1e-5f, 1e-6f, 1e-7f, 1e-8f, 1e-9f};
+    return static_cast<float>(int_part) + static_cast<float>(frac_part) * inv10[n];
+}
+
+// field decoders as they were, digit by digit
+static float legacy_qty(const char* p) noexcept {
+    uint64_t int_part = 0;
+    while (*p >= '0' && *p <= '9') {
+        int_part = int_part * 10 + static_cast<uint64_t>(*p++ - '0');
+    }
+    if (*p != '.') {
+        return static_cast<float>(int_part);
+    }
+    ++p;
+    uint64_t frac_part = 0;
+    int n = 0;
+    while (*p >= '0' && *p <= '9' && n < 9) {
+        frac_part = frac_part * 10 + static_cast<uint64_t>(*p++ - '0');
+        ++n;
+    }
+    static const float inv10[10] = {1.0f, 1e-1f, 1e-2f, 1e-3f, 1e-4f, 1e-5f, 1e-6f, 1e-7f, 1e-8f, 1e-9f};
+    return static_cast<float>(int_part) + static_cast<float>(frac_part) * inv10[n];
+}
+
+static uint64_t legacy_ts(const char* ts, const char* endq) noexcept {
+    int y = (ts[0] - '0') * 1000 + (ts[1] - '0') * 100 + (ts[2] - '0') * 10 + (ts[3] - '0');
+    int mo = (ts[5] - '0') * 10 + (ts[6] - '0');
+    int d = (ts[8] - '0') * 10 + (ts[9] - '0');
+    int hh = (ts[11] - '0') * 10 + (ts[12] - '0');
+    int mm = (ts[14] - '0') * 10 + (ts[15] - '0');
+    int ss = (ts[17] - '0') * 10 + (ts[18] - '0');
+    thread_local int last_ymd = -1;
+    thread_local int64_t last_days = 0;
+    int ymd = y * 10000 + mo * 100 + d;
+    if (ymd != last_ymd) {
+        last_days = l2_days_from_civil(y, static_cast<unsigned>(mo), static_cast<unsigned>(d));
+        last_ymd = ymd;
+    }
+    uint32_t frac_ns = 0;
+    const char* s = ts + 19;
+    if (s < endq && *s == '.') {
+        ++s;
+        int n = 0;
+        while (s < endq && n < 9 && *s >= '0' && *s <= '9') {
+            frac_ns = frac_ns * 10u + static_cast<uint32_t>(*s - '0');
+            ++s;
+            ++n;
+        }
+        while (n < 9) {
+            frac_ns *= 10u;
+            ++n;
+        }
+    }
+    int64_t secs = last_days * 86400 + hh * 3600 + mm * 60 + ss;
+    return static_cast<uint64_t>(secs) * 1000000000ULL + frac_ns;
+}
+
+// the feed's scanner before the structural index: memcmp searches for the keys and an 8 byte
+// swar search for every quote and brace. Fixed decodes the fields exactly into 2 and 8 decimals
+// for the reference checksum, otherwise with the float decoders of that time for timing
+template <bool Fixed>
+static void legacy_parse(const char* buf, size_t len, Sink& sink) {
+    static constexpr char PREFIX[] = R"({"channel":"l2_data")";
+    if (len < sizeof(PREFIX) - 1 || memcmp(buf, PREFIX, sizeof(PREFIX) - 1)) {
+        return;
+    }
+    if (len >= 3 && buf[len - 3] == '[' && buf[len - 2] == ']') {
+        return;
+    }
+
+    auto find_char_fast = [](const char* p, const char* end, char target) noexcept -> const char* {
+        for (int i = 0; i < 8 && p < end; ++i, ++p) {
+            if (*p == target) {
+                return p;
+            }
+        }
+        constexpr uint64_t m1 = 0x0101010101010101ULL;
+        constexpr uint64_t m2 = 0x8080808080808080ULL;
+        const uint64_t rep = m1 * static_cast<unsigned char>(target);
+        while (p + 8 <= end) {
+            uint64_t w;
+            memcpy(&w, p, 8);
+            uint64_t x = w ^ rep;
+            uint64_t z = (x - m1) & ~x & m2;
+            if (z) {
+                return p + (static_cast<unsigned>(__builtin_ctzll(z)) >> 3);
+            }
+            p += 8;
+        }
+        while (p < end && *p != target) {
+            ++p;
+        }
+        return (p < end) ? p : nullptr;
+    };
+
+    const char* end = buf + len;
+    const char* p = buf;
+    static constexpr char PRODUCT_KEY[] = R"("product_id":")";
+    static constexpr size_t PRODUCT_KEY_LEN = sizeof(PRODUCT_KEY) - 1;
+    static constexpr char TYPE_KEY[] = R"("type":")";
+    static constexpr size_t TYPE_KEY_LEN = sizeof(TYPE_KEY) - 1;
+
+    while (true) {
+        while (p < end - TYPE_KEY_LEN && memcmp(p, TYPE_KEY, TYPE_KEY_LEN) != 0) {
+            ++p;
+        }
+        if (p >= end - TYPE_KEY_LEN) {
+            return;
+        }
+        p += TYPE_KEY_LEN;
+        while (p < end - PRODUCT_KEY_LEN) {
+            if (memcmp(p, PRODUCT_KEY, PRODUCT_KEY_LEN) == 0) {
+                p += PRODUCT_KEY_LEN;
+                break;
+            }
+            ++p;
+        }
+        if (p >= end - PRODUCT_KEY_LEN) {
+            return;
+        }
+        const char* id_end = find_char_fast(p, end, '"');
+        if (!id_end) {
+            return;
+        }
+        p = id_end + 1;
+        while (p < end - 11) {
+            if (memcmp(p, "\"updates\":[", 11) == 0) {
+                p += 11;
+                break;
+            }
+            ++p;
+        }
+        if (p >= end - 11) {
+            return;
+        }
+
+        while (p < end && *p != ']') {
+            p = find_char_fast(p, end, '{');
+            if (!p) {
+                break;
+            }
+            ++p;
+            const char* obj_end = find_char_fast(p, end, '}');
+            if (!obj_end) {
+                break;
+            }
+            const char* k = find_char_fast(p, obj_end, '"');
+            const char* v = k + 1 + 4 + 2 + 1;
+            const bool is_bid = (*v == 'b');
+            const char* v_end = find_char_fast(v, obj_end, '"');
+            p = v_end + 1;
+            k = find_char_fast(p, obj_end, '"');
+            v = k + 1 + 10 + 2 + 1;
+            const char* ts_end = find_char_fast(v, obj_end, '"');
+            const uint64_t timestamp = legacy_ts(v, ts_end);
+            p = ts_end + 1;
+            k = find_char_fast(p, obj_end, '"');
+            v = k + 1 + 11 + 2 + 1;
+            const char* pv = v;
+            v_end = find_char_fast(v, obj_end, '"');
+            p = v_end + 1;
+            k = find_char_fast(p, obj_end, '"');
+            v = k + 1 + 12 + 2 + 1;
+            if constexpr (Fixed) {
+                sink.add(timestamp, static_cast<uint32_t>(ref_fixed(pv, 2)), ref_fixed(v, 8), is_bid);
+            }
+            else {
+                const float qty = (*v == '0' && v[1] != '.') ? 0.0f : legacy_qty(v);
+                uint32_t q;
+                std::memcpy(&q, &qty, sizeof(q));
+                sink.add(timestamp, float_era_price100(pv), q, is_bid);
+            }
+            p = obj_end + 1;
+        }
+    }
+}
+
+// coinbase formatted messages: snapshots of `depth` levels a side and updates of 1..20 levels
+static std::string make_msg(std::mt19937_64& rng, bool snapshot, uint32_t levels, uint64_t seq) {
+    std::string out = R"({"channel":"l2_data","client_id":"","timestamp":"2024-05-14T13:20:01.123456789Z","sequence_num":)";
+    out += std::to_string(seq);
+    out += snapshot ? R"(,"events":[{"type":"snapshot","product_id":"BTC-USD","updates":[)"
+                    : R"(,"events":[{"type":"update","product_id":"BTC-USD","updates":[)";
+    char lvl[192];
+    // event times come with 6 or 9 fraction digits
+    const int ts_digits = (rng() & 1) ? 9 : 6;
+    for (uint32_t i = 0; i < levels; ++i) {
+        const bool bid = snapshot ? i % 2 == 0 : (rng() & 1);
+        const uint64_t k = snapshot ? i / 2 + 1 : rng() % 50 + 1;
+        const uint64_t px = bid ? 6'000'000 - k : 6'000'000 + k;
+        const bool remove = !snapshot && rng() % 4 == 0;
+        char qty[32];
+        if (remove) {
+            std::snprintf(qty, sizeof(qty), "0");
+        }
+        else {
+            // coinbase trims trailing zeros, so fractions run 1 to 8 digits
+            const int digits = 1 + static_cast<int>(rng() % 8);
+            std::snprintf(qty, sizeof(qty), "%llu.%0*llu", static_cast<unsigned long long>(rng() % 5), digits,
+                          static_cast<unsigned long long>(rng() % 100'000'000) % static_cast<unsigned long long>(std::pow(10, digits)));
+        }
+        std::snprintf(lvl, sizeof(lvl),
+                      R"(%s{"side":"%s","event_time":"2024-05-14T13:20:01.%0*lluZ","price_level":"%llu.%02llu","new_quantity":"%s"})",
+                      i ? "," : "", bid ? "bid" : "offer", ts_digits,
+                      static_cast<unsigned long long>(rng() % 1'000'000'000) % (ts_digits == 9 ? 1'000'000'000ull : 1'000'000ull),
+                      static_cast<unsigned long long>(px / 100), static_cast<unsigned long long>(px % 100), qty);
+        out += lvl;
+    }
+    out += "]}]}";
+    return out;
+}
+
+// value strings of the first 4096 price and qty fields, [first, second) without the quotes. they
+// are copied next to each other, quoted like in a message, so the timed loop stays in cache
+using Field = std::pair<const char*, const char*>;
+
+static void collect_fields(const std::vector<std::string>& msgs, std::string& buf, std::vector<Field>& px,
+                           std::vector<Field>& qty) {
+    constexpr size_t kMax = 4096;
+    std::vector<std::pair<size_t, size_t>> at[2];
+    buf.assign(16, ' ');
+    for (const auto& m : msgs) {
+        size_t pos = 0;
+        while (at[0].size() < kMax && (pos = m.find(R"("price_level":")", pos)) != std::string::npos) {
+            const size_t q = m.find(R"("new_quantity":")", pos);
+            if (q == std::string::npos) {
+                break;
+            }
+            const size_t pv = pos + 15;
+            const size_t qv = q + 16;
+            for (auto [k, v] : {std::pair<int, size_t>{0, pv}, std::pair<int, size_t>{1, qv}}) {
+                const size_t e = m.find('"', v);
+                buf += R"(":")";
+                at[k].push_back({buf.size(), buf.size() + e - v});
+                buf.append(m, v, e - v);
+                buf += '"';
+            }
+            pos = qv;
+        }
+    }
+    for (int k = 0; k < 2; ++k) {
+        for (auto [b, e] : at[k]) {
+            (k ? qty : px).push_back({buf.data() + b, buf.data() + e});
+        }
+    }
+}
+
+template <typename F>
+static double ns_per_level(size_t levels, F&& f) {
+    double best = 1e30;
+    for (int runs = 0; runs < 5; ++runs) {
+        const auto t0 = steady_clock::now();
+        f();
+        best = std::min(best, duration<double>(steady_clock::now() - t0).count());
+    }
+    return best * 1e9 / static_cast<double>(levels);
+}
+
+template <typename F>
+static double bytes_per_s(const std::vector<std::string>& msgs, size_t bytes, F&& f) {
+    // repeat until a run takes long enough to time, then keep the best of five such runs
+    size_t reps = 1;
+    double best = 0.0;
+    for (int runs = 0; runs < 5;) {
+        const auto t0 = steady_clock::now();
+        for (size_t r = 0; r < reps; ++r) {
+            for (const auto& m : msgs) {
+                f(m);
+            }
+        }
+        const double s = duration<double>(steady_clock::now() - t0).count();
+        if (s < 0.1) {
+            reps *= 2;
+            continue;
+        }
+        best = std::max(best, static_cast<double>(bytes * reps) / s);
+        ++runs;
+    }
+    return best;
+}
+
+static bool run(const char* name, const std::vector<std::string>& msgs) {
+    size_t bytes = 0;
+    for (const auto& m : msgs) {
+        bytes += m.size();
+    }
+    if (!bytes) {
+        return true;
+    }
+
+    Sink ref;
+    for (const auto& m : msgs) {
+        legacy_parse<true>(m.data(), m.size(), ref);
+    }
+    std::printf("%s: %zu messages, %.1f KB avg, %lu levels\n", name, msgs.size(),
+                static_cast<double>(bytes) / static_cast<double>(msgs.size()) / 1024.0,
+                static_cast<unsigned long>(ref.levels));
+
+    Sink s;
+    const double legacy = bytes_per_s(msgs, bytes, [&](const std::string& m) { legacy_parse<false>(m.data(), m.size(), s); });
+    std::printf("  %-10s parse %8.0f MB/s\n", "legacy", legacy / 1e6);
+
+    bool ok = true;
+    const L2Decoder dec = l2_decoder_for(2, 8);
+    std::vector<uint32_t> idx;
+    for (const StructIndexKernel& k : struct_index_kernels()) {
+        const double index = bytes_per_s(msgs, bytes, [&](const std::string& m) {
+            if (idx.size() < m.size() + 64) {
+                idx.resize(m.size() + 64);
+            }
+            s.levels += k.fn(m.data(), m.size(), idx.data());
+        });
+
+        L2Parser parser(k);
+        Sink check;
+        for (const auto& m : msgs) {
+            parser.parse(m.data(), m.size(), [&](const L2ParsedEvent&) { return &dec; },
+                         [&](const L2ParsedLevel& l) { check.add(l.ts_ns, l.price, l.qty, l.bid); });
+        }
+        const bool same = check.levels == ref.levels && check.sum == ref.sum;
+        ok &= same;
+
+        const double parse = bytes_per_s(msgs, bytes, [&](const std::string& m) {
+            parser.parse(m.data(), m.size(), [&](const L2ParsedEvent&) { return &dec; },
+                         [&](const L2ParsedLevel& l) { s.add(l.ts_ns, l.price, l.qty, l.bid); });
+        });
+        std::printf("  %-10s index %8.0f MB/s  parse %8.0f MB/s  (%.2fx)%s\n", k.name, index / 1e6, parse / 1e6,
+                    parse / legacy, same ? "" : "  MISMATCH");
+
+        // the same messages in websocket fragments, 8 KB as the feed receives them and 61 bytes to
+        // split every level somewhere
+        const auto fragmented = [&](const std::string& m, size_t frag, Sink& out) {
+            for (size_t off = 0; off < m.size(); off += frag) {
+                const size_t n = std::min(frag, m.size() - off);
+                parser.feed(m.data() + off, n, off == 0, off + n == m.size(), [&](const L2ParsedEvent&) { return &dec; },
+                            [&](const L2ParsedLevel& l) { out.add(l.ts_ns, l.price, l.qty, l.bid); });
+            }
+        };
+        bool frag_same = true;
+        uint64_t carried = 0;
+        for (const size_t frag : {size_t{8192}, size_t{61}}) {
+            const uint64_t carried0 = parser.carried();
+            Sink f;
+            for (const auto& m : msgs) {
+                fragmented(m, frag, f);
+            }
+            frag_same &= f.levels == ref.levels && f.sum == ref.sum;
+            if (frag == 8192) {
+                carried = parser.carried() - carried0;
+            }
+        }
+        ok &= frag_same;
+        const double frag_parse = bytes_per_s(msgs, bytes, [&](const std::string& m) { fragmented(m, 8192, s); });
+        std::printf("  %-10s 8 KB fragments parse %8.0f MB/s, %.2f%% of bytes carried%s\n", k.name, frag_parse / 1e6,
+                    100.0 * static_cast<double>(carried) /
+                        static_cast<double>(std::max<size_t>(1, bytes)),
+                    frag_same ? "" : "  MISMATCH");
+    }
+    // field decoders on the same values, repeated so a run is long enough to time
+    std::string fields;
+    std::vector<Field> px;
+    std::vector<Field> qty;
+    collect_fields(msgs, fields, px, qty);
+    const size_t reps = std::max<size_t>(1, 20'000'000 / std::max<size_t>(1, px.size()));
+    const size_t levels = px.size() * reps;
+    uint64_t acc = 0;
+    const double float_ns = ns_per_level(levels, [&] {
+        for (size_t r = 0; r < reps; ++r) {
+            for (size_t i = 0; i < px.size(); ++i) {
+                const char* q = qty[i].first;
+                const float f = (*q == '0' && q[1] != '.') ? 0.0f : float_era_qty(q, qty[i].second);
+                uint32_t b;
+                std::memcpy(&b, &f, sizeof(b));
+                acc += float_era_price100(px[i].first) ^ b;
+            }
+        }
+    });
+    const double fixed_ns = ns_per_level(levels, [&] {
+        for (size_t r = 0; r < reps; ++r) {
+            for (size_t i = 0; i < px.size(); ++i) {
+                acc += l2_decode_price<2>(px[i].first, px[i].second) ^
+                    static_cast<uint64_t>(l2_decode_qty<8>(qty[i].first, qty[i].second));
+            }
+        }
+    });
+    const L2Decoder* sel = &dec;
+    const double selected_ns = ns_per_level(levels, [&] {
+        for (size_t r = 0; r < reps; ++r) {
+            for (size_t i = 0; i < px.size(); ++i) {
+                acc += sel->price(px[i].first, px[i].second) ^
+                    static_cast<uint64_t>(sel->qty(qty[i].first, qty[i].second));
+            }
+        }
+    });
+    bool exact = true;
+    for (size_t i = 0; i < px.size(); ++i) {
+        exact &= dec.price(px[i].first, px[i].second) == ref_fixed(px[i].first, 2) &&
+            dec.qty(qty[i].first, qty[i].second) == ref_fixed(qty[i].first, 8);
+    }
+    ok &= exact;
+    std::printf("  fields     float %.2f ns/level  fixed<2,8> %.2f ns/level  per product pointer %.2f ns/level%s\n",
+                float_ns, fixed_ns, selected_ns, exact ? "" : "  MISMATCH");
+
+    // keeps the timed loops from being optimized away
+    if ((s.sum ^ acc) == 42) {
+        std::printf("\n");
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> snapshots;
+    std::vector<std::string> updates;
+    if (argc > 1) {
+        // captured messages, one per line
+        for (int i = 1; i < argc; ++i) {
+            std::ifstream in(argv[i]);
+            std::string line;
+            while (std::getline(in, line)) {
+                if (line.find(R"("type":"snapshot")") != std::string::npos) {
+                    snapshots.push_back(line);
+                }
+                else if (!line.empty()) {
+                    updates.push_back(line);
+                }
+            }
+        }
+    }
+    else {
+        std::mt19937_64 rng(5);
+        for (uint64_t i = 0; i < 4; ++i) {
+            snapshots.push_back(make_msg(rng, true, 2 * 2500, i));
+        }
+        for (uint64_t i = 0; i < 20'000; ++i) {
+            updates.push_back(make_msg(rng, false, 1 + static_cast<uint32_t>(rng() % 20), i));
+        }
+    }
+
+    const bool ok = run("snapshots", snapshots) & run("updates", updates);
+    return ok ? 0 : 1;
+}
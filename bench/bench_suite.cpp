@@ -0,0 +1,474 @@
+// benchmark suite: the feed's l2_data handling on a message corpus, the spsc queue between two
+// pinned threads at several capacities and the writer's persist rate on tmpfs and on disk. every
+// case is one json line on stdout with ns/op, bytes/s and latency percentiles, log output goes to
+// stderr. `bench --diff OLD NEW` lines up two saved runs case by case.
+#include <immintrin.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../affinity.h"
+#include "../coinbase_feed.h"
+#include "../latency_histogram.h"
+#include "../l2_writer.h"
+#include "../spsc.h"
+
+using namespace std::chrono;
+
+#ifndef BENCH_CORPUS
+#define BENCH_CORPUS "bench/corpus/level2.jsonl"
+#endif
+
+struct Options {
+    std::string corpus{BENCH_CORPUS};
+    std::string tmpfs{"/dev/shm"};
+    std::string disk{"."};
+    std::string only;
+    // producer and consumer side of every two thread case
+    int cpu_a{-1};
+    int cpu_b{-1};
+    uint64_t rows{1ull << 21};
+    double seconds{0.5};
+};
+
+// one case, printed as a json line. percentiles are left out when there is no histogram
+static void emit(const char* bench, const std::string& name, uint64_t ops, double ns_per_op, double bytes_per_s,
+                 const LatencyHistogram* lat) {
+    std::printf(R"({"bench":"%s","case":"%s","ops":%lu,"ns_per_op":%.2f,"bytes_per_s":%.0f)", bench, name.c_str(),
+                static_cast<unsigned long>(ops), ns_per_op, bytes_per_s);
+    if (lat && lat->count()) {
+        std::printf(R"(,"p50_ns":%lu,"p90_ns":%lu,"p99_ns":%lu,"p999_ns":%lu,"max_ns":%lu)",
+                    static_cast<unsigned long>(lat->percentile(0.5)), static_cast<unsigned long>(lat->percentile(0.9)),
+                    static_cast<unsigned long>(lat->percentile(0.99)),
+                    static_cast<unsigned long>(lat->percentile(0.999)), static_cast<unsigned long>(lat->max()));
+    }
+    std::printf("}\n");
+    std::fflush(stdout);
+}
+
+static void emit_meta(const Options& o) {
+    std::string model = "unknown";
+    std::ifstream in("/proc/cpuinfo");
+    for (std::string line; std::getline(in, line);) {
+        if (line.rfind("model name", 0) == 0) {
+            model = line.substr(line.find(':') + 2);
+            break;
+        }
+    }
+    std::printf(R"({"bench":"meta","cpu":"%s","cpus":%u,"compiler":"%s","pinned":"%d,%d"})" "\n", model.c_str(),
+                std::thread::hardware_concurrency(), __VERSION__, o.cpu_a, o.cpu_b);
+}
+
+static uint64_t wall_ns() noexcept {
+    return static_cast<uint64_t>(duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count());
+}
+
+// spin a little, then give the cpu away, so two threads sharing a core still make progress
+struct Backoff {
+    uint32_t spins{0};
+
+    void wait() noexcept {
+        if (++spins < 64) {
+            _mm_pause();
+        }
+        else {
+            std::this_thread::yield();
+        }
+    }
+    void reset() noexcept { spins = 0; }
+};
+
+// handle_level2 over every message of one kind, repeated until opt.seconds of work. each message
+// is timed on its own for the percentiles
+static void bench_feed_case(CoinbaseFeed& feed, const char* name, const std::vector<std::string>& msgs,
+                            const Options& opt) {
+    if (msgs.empty()) {
+        return;
+    }
+    for (const auto& m : msgs) {
+        feed.handle_level2(m.data(), m.size());
+    }
+    LatencyHistogram lat;
+    uint64_t ops = 0, bytes = 0, busy_ns = 0;
+    const auto stop = steady_clock::now() + duration<double>(opt.seconds);
+    while (steady_clock::now() < stop) {
+        for (const auto& m : msgs) {
+            const auto t0 = steady_clock::now();
+            feed.handle_level2(m.data(), m.size());
+            const auto ns = static_cast<uint64_t>(duration_cast<nanoseconds>(steady_clock::now() - t0).count());
+            lat.record(ns);
+            busy_ns += ns;
+            bytes += m.size();
+        }
+        ops += msgs.size();
+    }
+    emit("feed.level2", name, ops, static_cast<double>(busy_ns) / ops, bytes / (busy_ns / 1e9), &lat);
+}
+
+static std::string product_of(const std::string& msg) {
+    static constexpr char KEY[] = R"("product_id":")";
+    const auto at = msg.find(KEY);
+    if (at == std::string::npos) {
+        return {};
+    }
+    const auto start = at + sizeof(KEY) - 1;
+    return msg.substr(start, msg.find('"', start) - start);
+}
+
+static bool bench_feed(const Options& opt) {
+    std::ifstream in(opt.corpus);
+    if (!in) {
+        std::cerr << "[bench] cannot open corpus " << opt.corpus << '\n';
+        return false;
+    }
+    std::vector<std::string> snapshots, updates;
+    Config cfg;
+    for (std::string line; std::getline(in, line);) {
+        if (line.empty()) {
+            continue;
+        }
+        const std::string p = product_of(line);
+        if (!p.empty() && std::find(cfg.products.begin(), cfg.products.end(), p) == cfg.products.end()) {
+            cfg.products.push_back(p);
+            // the corpus is coinbase's usd books, 2 price and 8 qty decimals
+            cfg.decimals[p] = L2Decimals{};
+        }
+        (line.find(R"("type":"snapshot")") != std::string::npos ? snapshots : updates).push_back(std::move(line));
+    }
+    cfg.base_dir = opt.tmpfs + "/bench_feed_" + std::to_string(getpid());
+    cfg.lookup_increments = false;
+    cfg.writer_cpus.assign(cfg.products.size(), opt.cpu_b);
+
+    {
+        CoinbaseFeed feed(cfg);
+        feed.start_writers();
+        // a pinned thread plays the event loop
+        std::thread t([&] {
+            bench_feed_case(feed, "snapshots", snapshots, opt);
+            bench_feed_case(feed, "updates", updates, opt);
+        });
+        (void)pin_thread(t, opt.cpu_a, "bench");
+        t.join();
+        feed.join();
+    }
+    std::error_code ec;
+    std::filesystem::remove_all(cfg.base_dir, ec);
+    return true;
+}
+
+// rows through a LockFreeQueue from one pinned thread to another. every 64th row carries its
+// enqueue time, the consumer records how long it sat in the queue
+template <size_t CAP>
+static void bench_spsc_case(const Options& opt) {
+    using Queue = LockFreeQueue<L2Row, CAP>;
+    auto q = std::make_unique<Queue>();
+    const uint64_t n = opt.rows * 4;
+    LatencyHistogram lat;
+    std::atomic<int> ready{0};
+    steady_clock::time_point t0, t1;
+
+    std::thread consumer([&] {
+        ready.fetch_add(1);
+        while (ready.load() < 2) {
+            std::this_thread::yield();
+        }
+        Backoff b;
+        for (uint64_t got = 0; got < n;) {
+            if (auto r = q->dequeue()) {
+                if (r->ts_ns) {
+                    lat.record(wall_ns() - r->ts_ns);
+                }
+                ++got;
+                b.reset();
+            }
+            else {
+                b.wait();
+            }
+        }
+        t1 = steady_clock::now();
+    });
+    std::thread producer([&] {
+        ready.fetch_add(1);
+        while (ready.load() < 2) {
+            std::this_thread::yield();
+        }
+        t0 = steady_clock::now();
+        Backoff b;
+        for (uint64_t i = 0; i < n; ++i) {
+            const L2Row r{(i & 63) ? 0 : wall_ns(), static_cast<int64_t>(i), static_cast<uint32_t>(i),
+                          static_cast<uint8_t>(i & 1)};
+            while (!q->enqueue(r)) {
+                b.wait();
+            }
+            b.reset();
+        }
+    });
+    (void)pin_thread(producer, opt.cpu_a, "bench");
+    (void)pin_thread(consumer, opt.cpu_b, "bench");
+    producer.join();
+    consumer.join();
+
+    const double s = duration<double>(t1 - t0).count();
+    emit("spsc", "cap=" + std::to_string(CAP), n, s * 1e9 / n, n * sizeof(L2Row) / s, &lat);
+}
+
+static bool bench_spsc(const Options& opt) {
+    bench_spsc_case<1ull << 10>(opt);
+    bench_spsc_case<1ull << 14>(opt);
+    bench_spsc_case<1ull << 18>(opt);
+    return true;
+}
+
+// opt.rows rows stamped with wall clock into an L2Writer, timed until all are persisted. latency
+// is the writer's own persist histogram: time from the row's stamp to its persist. closing the
+// hour file afterwards is timed as writer.close
+static bool bench_writer_case(const char* name, const std::string& dir, uint32_t fsync_every, L2Backend backend,
+                              const Options& opt) {
+    const std::string base = dir + "/bench_writer_" + std::to_string(getpid());
+    LatencyHistogram lat;
+    L2WriterOpt wo{base, "BENCH-USD"};
+    wo.cpu = opt.cpu_b;
+    wo.persist_latency = &lat;
+    wo.fsync_every_rows = fsync_every;
+    wo.backend = backend;
+    const uint64_t n = opt.rows;
+    double s = 0;
+    double close_s = 0;
+    {
+        L2Writer w(wo);
+        w.start();
+        std::thread producer([&] {
+            const auto t0 = steady_clock::now();
+            Backoff b;
+            uint32_t px = 6'000'000;
+            for (uint64_t i = 0; i < n; ++i) {
+                px += (i & 7) == 0 ? ((i >> 3) & 1 ? 1 : -1) : 0;
+                const L2Row r{wall_ns(), static_cast<int64_t>((i & 1023) * 1'000'000), px + static_cast<uint32_t>(i & 15),
+                              static_cast<uint8_t>(i & 1)};
+                while (!w.enqueue(r)) {
+                    b.wait();
+                }
+                b.reset();
+            }
+            while (w.persisted() < n) {
+                std::this_thread::sleep_for(microseconds(100));
+            }
+            s = duration<double>(steady_clock::now() - t0).count();
+        });
+        (void)pin_thread(producer, opt.cpu_a, "bench");
+        producer.join();
+        const auto t0 = steady_clock::now();
+        w.stop();
+        w.join();
+        close_s = duration<double>(steady_clock::now() - t0).count();
+    }
+    std::error_code ec;
+    std::filesystem::remove_all(base, ec);
+    // column bytes per row: ts 8, price 4, qty 8, side 1
+    emit("writer.persist", name, n, s * 1e9 / n, n * 21.0 / s, &lat);
+    emit("writer.close", name, 1, close_s * 1e9, 0, nullptr);
+    return true;
+}
+
+// opt.rows rows spread over kHours hours of synthetic time, so the writer rotates kHours - 1 times.
+// the producer stops for 20 ms when the stream reaches the last 30 s of an hour, the wall time
+// the file thread has to prepare the next one when rows come in live. latency is the time the
+// writer thread spent in each rotation, ns_per_op is its median
+static bool bench_rotate_case(const char* name, const std::string& dir, L2Backend backend, uint32_t prepare_ahead_s,
+                              const Options& opt) {
+    constexpr uint64_t kHours = 8;
+    const std::string base = dir + "/bench_rotate_" + std::to_string(getpid());
+    LatencyHistogram lat;
+    L2WriterOpt wo{base, "BENCH-USD"};
+    wo.cpu = opt.cpu_b;
+    wo.rotate_latency = &lat;
+    wo.backend = backend;
+    wo.prepare_ahead_s = prepare_ahead_s;
+    const uint64_t n = opt.rows;
+    const uint64_t hour0 = wall_ns() / 3'600'000'000'000ull * 3'600'000'000'000ull;
+    const uint64_t step = kHours * 3'600'000'000'000ull / n;
+    {
+        L2Writer w(wo);
+        w.start();
+        std::thread producer([&] {
+            Backoff b;
+            for (uint64_t i = 0; i < n; ++i) {
+                const uint64_t ts = hour0 + i * step;
+                const L2Row r{ts, static_cast<int64_t>((i & 1023) * 1'000'000), 6'000'000 + static_cast<uint32_t>(i & 15),
+                              static_cast<uint8_t>(i & 1)};
+                if (ts / 1'000'000'000ull % 3600 == 3570 && (ts - step) / 1'000'000'000ull % 3600 == 3569) {
+                    std::this_thread::sleep_for(milliseconds(20));
+                }
+                while (!w.enqueue(r)) {
+                    b.wait();
+                }
+                b.reset();
+                // the first hour is opened, not rotated to
+                if (i == 0) {
+                    while (!w.persisted()) {
+                        std::this_thread::sleep_for(microseconds(100));
+                    }
+                    lat.reset();
+                }
+            }
+            while (w.persisted() < n) {
+                std::this_thread::sleep_for(microseconds(100));
+            }
+        });
+        (void)pin_thread(producer, opt.cpu_a, "bench");
+        producer.join();
+        w.stop();
+        w.join();
+    }
+    std::error_code ec;
+    std::filesystem::remove_all(base, ec);
+    emit("writer.rotate", name, lat.count(), static_cast<double>(lat.percentile(0.5)), 0, &lat);
+    return true;
+}
+
+static bool bench_writer(const Options& opt) {
+    return bench_writer_case("tmpfs", opt.tmpfs, 0, L2Backend::Mmap, opt) &
+        bench_writer_case("disk", opt.disk, 0, L2Backend::Mmap, opt) &
+        bench_writer_case("disk fsync 64k", opt.disk, 1u << 16, L2Backend::Mmap, opt) &
+        bench_writer_case("disk direct", opt.disk, 0, L2Backend::Direct, opt) &
+        bench_writer_case("disk direct fsync 64k", opt.disk, 1u << 16, L2Backend::Direct, opt) &
+        bench_rotate_case("disk", opt.disk, L2Backend::Mmap, 60, opt) &
+        bench_rotate_case("disk unprepared", opt.disk, L2Backend::Mmap, 0, opt) &
+        bench_rotate_case("disk direct", opt.disk, L2Backend::Direct, 60, opt) &
+        bench_rotate_case("disk direct unprepared", opt.disk, L2Backend::Direct, 0, opt);
+}
+
+// value of "key": in a json line written by emit, numbers and strings only
+static std::string field(const std::string& line, const char* key) {
+    const std::string k = std::string("\"") + key + "\":";
+    auto at = line.find(k);
+    if (at == std::string::npos) {
+        return {};
+    }
+    at += k.size();
+    if (line[at] == '"') {
+        return line.substr(at + 1, line.find('"', at + 1) - at - 1);
+    }
+    return line.substr(at, line.find_first_of(",}", at) - at);
+}
+
+static bool load_run(const char* path, std::map<std::string, std::string>& out) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "[bench] cannot open " << path << '\n';
+        return false;
+    }
+    for (std::string line; std::getline(in, line);) {
+        const std::string bench = field(line, "bench");
+        if (!bench.empty() && bench != "meta") {
+            out[bench + " / " + field(line, "case")] = line;
+        }
+    }
+    return true;
+}
+
+static int diff_runs(const char* a_path, const char* b_path) {
+    std::map<std::string, std::string> a, b;
+    if (!load_run(a_path, a) || !load_run(b_path, b)) {
+        return 1;
+    }
+    std::printf("%-36s %12s %12s %8s %12s %12s\n", "case", "old ns/op", "new ns/op", "change", "old p99", "new p99");
+    for (const auto& [key, line] : b) {
+        const auto it = a.find(key);
+        const double nb = std::atof(field(line, "ns_per_op").c_str());
+        if (it == a.end()) {
+            std::printf("%-36s %12s %12.2f %8s %12s %12s\n", key.c_str(), "-", nb, "new", "-",
+                        field(line, "p99_ns").c_str());
+            continue;
+        }
+        const double na = std::atof(field(it->second, "ns_per_op").c_str());
+        std::printf("%-36s %12.2f %12.2f %+7.1f%% %12s %12s\n", key.c_str(), na, nb, na > 0 ? (nb / na - 1) * 100 : 0.0,
+                    field(it->second, "p99_ns").c_str(), field(line, "p99_ns").c_str());
+    }
+    return 0;
+}
+
+static void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [--only feed|spsc|writer] [--corpus FILE] [--cpus A,B] [--tmpfs DIR]\n"
+        << "       [--disk DIR] [--rows N] [--seconds S]\n"
+        << "       " << argv0 << " --diff OLD.jsonl NEW.jsonl\n"
+        << "  two thread cases put the producer on cpu A and the consumer on B, default 0,1 when the\n"
+        << "  machine has two cpus. writer cases write into --tmpfs (default /dev/shm) and --disk (default .)\n";
+}
+
+int main(int argc, char** argv) {
+    if (argc == 4 && std::strcmp(argv[1], "--diff") == 0) {
+        return diff_runs(argv[2], argv[3]);
+    }
+    Options opt;
+    if (std::thread::hardware_concurrency() >= 2) {
+        opt.cpu_a = 0;
+        opt.cpu_b = 1;
+    }
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const bool has_val = i + 1 < argc;
+            if (arg == "--only" && has_val) {
+                opt.only = argv[++i];
+            }
+            else if (arg == "--corpus" && has_val) {
+                opt.corpus = argv[++i];
+            }
+            else if (arg == "--cpus" && has_val) {
+                const std::string v = argv[++i];
+                const auto comma = v.find(',');
+                if (comma == std::string::npos) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                opt.cpu_a = std::stoi(v.substr(0, comma));
+                opt.cpu_b = std::stoi(v.substr(comma + 1));
+            }
+            else if (arg == "--tmpfs" && has_val) {
+                opt.tmpfs = argv[++i];
+            }
+            else if (arg == "--disk" && has_val) {
+                opt.disk = argv[++i];
+            }
+            else if (arg == "--rows" && has_val) {
+                opt.rows = std::stoull(argv[++i]);
+            }
+            else if (arg == "--seconds" && has_val) {
+                opt.seconds = std::stod(argv[++i]);
+            }
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+    } catch (const std::exception&) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // the components log to std::cout, stdout is kept for the json lines
+    std::cout.rdbuf(std::cerr.rdbuf());
+    emit_meta(opt);
+    const std::pair<const char*, std::function<bool(const Options&)>> suites[] = {
+        {"feed", &bench_feed}, {"spsc", &bench_spsc}, {"writer", &bench_writer}};
+    bool ok = true;
+    for (const auto& [name, run] : suites) {
+        if (opt.only.empty() || opt.only == name) {
+            ok &= run(opt);
+        }
+    }
+    return ok ? 0 : 1;
+}
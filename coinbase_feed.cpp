@@ -3,8 +3,11 @@
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include "coinbase_feed.h"
+#include "affinity.h"
 #include <curl/curl.h>
 #include <netinet/tcp.h>
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
 #include <cstring>
 #include <filesystem>
@@ -40,8 +43,9 @@ std::string CoinbaseFeed::path_for_ts(uint64_t ts_ns) const {
     struct tm tm{};
     localtime_r(&sec, &tm);
 
-    char day[9];
-    char hhmm[5];
+    // room for any int, the compiler cannot tell the fields are in range
+    char day[36];
+    char hhmm[16];
 
     std::snprintf(day, sizeof(day), "%02d%02d%04d", tm.tm_mon + 1, tm.tm_mday, tm.tm_year + 1900);
     std::snprintf(hhmm, sizeof(hhmm), "%02d00", tm.tm_hour);
@@ -59,24 +63,265 @@ inline uint64_t now_ns() {
         high_resolution_clock::now().time_since_epoch()).count();
 }
 
+bool Endpoint::parse(const std::string& url, Endpoint& out) {
+    Endpoint e;
+    std::string rest;
+    if (url.rfind("wss://", 0) == 0) {
+        e.tls = true;
+        e.port = 443;
+        rest = url.substr(6);
+    }
+    else if (url.rfind("ws://", 0) == 0) {
+        e.tls = false;
+        e.port = 80;
+        rest = url.substr(5);
+    }
+    else {
+        return false;
+    }
+
+    const auto slash = rest.find('/');
+    e.path = slash == std::string::npos ? "/" : rest.substr(slash);
+    std::string host = rest.substr(0, slash);
+    const auto colon = host.rfind(':');
+    if (colon != std::string::npos) {
+        e.port = std::stoi(host.substr(colon + 1));
+        host.resize(colon);
+    }
+    if (host.empty()) {
+        return false;
+    }
+    e.host = host;
+    out = e;
+    return true;
+}
+
+static size_t curl_append(char* p, size_t size, size_t n, void* out) {
+    static_cast<std::string*>(out)->append(p, size * n);
+    return size * n;
+}
+
+// digits after the point of a quoted increment in a json body, "0.00010000" -> 4
+static bool increment_decimals(const std::string& body, const char* key, uint8_t& out) {
+    const std::string k = std::string("\"") + key + "\":\"";
+    const auto at = body.find(k);
+    if (at == std::string::npos) {
+        return false;
+    }
+    const char* p = body.c_str() + at + k.size();
+    const char* dot = nullptr;
+    const char* last = nullptr;
+    for (; *p && *p != '"'; ++p) {
+        if (*p == '.') {
+            dot = p;
+        }
+        else if (dot && *p != '0') {
+            last = p;
+        }
+    }
+    if (*p != '"') {
+        return false;
+    }
+    out = static_cast<uint8_t>(last ? last - dot : 0);
+    return true;
+}
+
+// what send_request frames with no products, the slots hold it and every product id quoted
+static constexpr char kLongestRequest[] = R"({"type":"unsubscribe","product_ids":[],"channel":"market_trades"})";
+
+// body of a GET on the exchange's public api, false unless it answers 200
+static bool http_get(const std::string& url, std::string& body) {
+    CURL* c = curl_easy_init();
+    if (!c) {
+        return false;
+    }
+    curl_easy_setopt(c, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(c, CURLOPT_USERAGENT, "coinbase-data-recorder");
+    curl_easy_setopt(c, CURLOPT_TIMEOUT, 5L);
+    curl_easy_setopt(c, CURLOPT_WRITEFUNCTION, &curl_append);
+    curl_easy_setopt(c, CURLOPT_WRITEDATA, &body);
+    long status = 0;
+    const bool ok = curl_easy_perform(c) == CURLE_OK &&
+        curl_easy_getinfo(c, CURLINFO_RESPONSE_CODE, &status) == CURLE_OK && status == 200;
+    curl_easy_cleanup(c);
+    return ok;
+}
+
+// quote and base increments of a product from the exchange's public product endpoint
+static bool fetch_decimals(const std::string& product, L2Decimals& out) {
+    std::string body;
+    return http_get("https://api.exchange.coinbase.com/products/" + product, body) &&
+        increment_decimals(body, "quote_increment", out.price) && increment_decimals(body, "base_increment", out.qty);
+}
+
+// last traded price of a product from its ticker
+static bool fetch_price(const std::string& product, double& out) {
+    std::string body;
+    if (!http_get("https://api.exchange.coinbase.com/products/" + product + "/ticker", body)) {
+        return false;
+    }
+    static constexpr char KEY[] = R"("price":")";
+    const auto at = body.find(KEY);
+    if (at == std::string::npos) {
+        return false;
+    }
+    out = std::strtod(body.c_str() + at + sizeof(KEY) - 1, nullptr);
+    return out > 0;
+}
+
 CoinbaseFeed::CoinbaseFeed(const Config& cfg)
-    : product_id_{cfg.pair}
-      , price_scale_(100), writer_{L2WriterOpt{root_, product_id_}} {
+    : n_legs_(cfg.redundant ? 2 : 1), endpoint_{cfg.endpoint}
+      , cpu_(cfg.cpu), loop_wait_(cfg.loop_wait), parser_cpu_(cfg.parser_cpu), root_{cfg.base_dir} {
     curl_global_init(CURL_GLOBAL_DEFAULT);
+    // the decoders are fixed for the life of the feed, the scales go into every hour file. prices
+    // are 32 bit units of the price increment, a product whose price would not fit is not recorded
+    for (const auto& p : cfg.products) {
+        L2Decimals d;
+        const auto it = cfg.decimals.find(p);
+        if (it != cfg.decimals.end()) {
+            d = it->second;
+        }
+        else if (!cfg.lookup_increments || !fetch_decimals(p, d)) {
+            std::cerr << "[CoinbaseFeed] no increments for " << p << ", using " << int{d.price} << " price and "
+                << int{d.qty} << " qty decimals\n";
+        }
+        if (d.price > L2_MAX_DECIMALS || d.qty > L2_MAX_DECIMALS) {
+            std::cerr << "[CoinbaseFeed] " << p << " has more than " << int{L2_MAX_DECIMALS}
+                << " decimals, extra digits are dropped\n";
+        }
+        const L2Decoder dec = l2_decoder_for(d.price, d.qty);
+        double price = 0;
+        if (cfg.lookup_increments && fetch_price(p, price) &&
+            price * kPriceHeadroom > l2_price_limit(dec.price_decimals)) {
+            std::cerr << "[CoinbaseFeed] " << p << " trades at " << price << ", " << int{dec.price_decimals}
+                << " price decimals hold up to " << l2_price_limit(dec.price_decimals) << ", not recording it\n";
+            continue;
+        }
+        products_.push_back(p);
+        decoders_.push_back(dec);
+    }
+    price_gap_.assign(products_.size(), 0);
+    size_t request_bytes = sizeof(kLongestRequest);
+    for (const auto& p : products_) {
+        request_bytes += p.size() + 3;
+    }
+    for (size_t l = 0; l < legs_.size(); ++l) {
+        legs_[l].self = this;
+        legs_[l].id = static_cast<int>(l);
+        legs_[l].synced.assign(products_.size(), 0);
+        legs_[l].retry.leg = &legs_[l];
+        // receive and send buffers are sized up front, the event loop does not allocate
+        legs_[l].rx_buf.reserve(kRxReserve);
+        for (auto& slot : legs_[l].tx_slot) {
+            slot.resize(LWS_PRE + std::max(kTxReserve, request_bytes));
+        }
+    }
+    if (cfg.redundant) {
+        arb_.resize(products_.size());
+    }
+    if (cfg.pipeline) {
+        ring_ = std::make_unique<ByteRing>(std::max<size_t>(cfg.ring_bytes, 1u << 20));
+        ring_waiter_ = std::make_unique<Waiter>(cfg.parser_wait);
+        std::cout << "[CoinbaseFeed] pipelined, " << (ring_->capacity() >> 10) << " KB frame ring, parser waits "
+            << wait_mode_name(cfg.parser_wait) << '\n';
+    }
+    writers_.reserve(products_.size());
+    for (size_t i = 0; i < products_.size(); ++i) {
+        L2WriterOpt opt{(std::filesystem::path(root_) / products_[i]).string(), products_[i]};
+        opt.price_decimals = decoders_[i].price_decimals;
+        opt.qty_decimals = decoders_[i].qty_decimals;
+        if (i < cfg.writer_cpus.size()) {
+            opt.cpu = cfg.writer_cpus[i];
+        }
+        if (i < cfg.writer_waits.size()) {
+            opt.wait = cfg.writer_waits[i];
+        }
+        opt.persist_latency = cfg.persist_latency;
+        opt.compactor = cfg.compactor;
+        opt.backend = cfg.backend;
+        opt.huge_pages = cfg.huge_pages;
+        opt.bbo = cfg.bbo;
+        opt.bbo_levels = cfg.bbo_levels;
+        opt.record_from_ns = cfg.record_from_ns;
+        opt.record_until_ns = cfg.record_until_ns;
+        opt.spill_file_bytes = cfg.spill_file_bytes;
+        opt.stats = cfg.stats ? cfg.stats->find(products_[i]) : nullptr;
+        stats_.push_back(opt.stats);
+        writers_.push_back(std::make_unique<L2Writer>(opt));
+        if (cfg.trades) {
+            ColWriterOpt topt{opt.base_dir, products_[i]};
+            topt.price_decimals = opt.price_decimals;
+            topt.qty_decimals = opt.qty_decimals;
+            topt.record_from_ns = cfg.record_from_ns;
+            topt.record_until_ns = cfg.record_until_ns;
+            trade_writers_.push_back(std::make_unique<ColWriter<TradeSchema>>(topt));
+        }
+    }
+    last_trade_id_.assign(trade_writers_.size(), 0);
+    if (cfg.journal) {
+        FrameJournalOpt jopt;
+        jopt.dir = (std::filesystem::path(root_) / "journal" / cfg.journal_name).string();
+        jopt.name = cfg.journal_name;
+        jopt.legs = static_cast<uint16_t>(n_legs_);
+        for (size_t i = 0; i < products_.size(); ++i) {
+            if (i) {
+                jopt.products += ',';
+            }
+            jopt.products += products_[i] + '=' + std::to_string(decoders_[i].price_decimals) + ':' +
+                std::to_string(decoders_[i].qty_decimals);
+        }
+        journal_ = std::make_unique<FrameJournal>(jopt);
+        std::cout << "[CoinbaseFeed] journaling frames to " << jopt.dir << '\n';
+    }
+    last_ts_.assign(products_.size(), 0);
+    std::cout << "[CoinbaseFeed] parser kernel " << legs_[0].parser.kernel_name() << '\n';
     const char* k = std::getenv("COINBASE_KEY_NAME");
     const char* p = std::getenv("COINBASE_PRIVATE_KEY");
     if (k && p) {
         creds_ = CoinbaseCredentials{k, p};
     }
 
-    mlockall(MCL_CURRENT | MCL_FUTURE);
+    if (cfg.lock_memory) {
+        lock_hot_memory();
+    }
+}
+
+// only what every frame touches is pinned, the hour file mappings and the rest of the process
+// page as usual
+void CoinbaseFeed::lock_hot_memory() {
+    bool ok = true;
+    for (auto& w : writers_) {
+        ok &= w->lock_queue();
+    }
+    for (auto& w : trade_writers_) {
+        ok &= w->lock_queue();
+    }
+    if (ring_) {
+        ok &= ring_->lock_memory();
+    }
+    for (auto& leg : legs_) {
+        ok &= ::mlock(leg.rx_buf.data(), leg.rx_buf.capacity()) == 0;
+        for (const auto& slot : leg.tx_slot) {
+            ok &= ::mlock(slot.data(), slot.size()) == 0;
+        }
+    }
+    if (!ok) {
+        std::cerr << "[CoinbaseFeed] mlock failed, check RLIMIT_MEMLOCK: " << std::strerror(errno) << '\n';
+    }
 }
 
 CoinbaseFeed::~CoinbaseFeed() {
     stop();
-    writer_.stop();
+    for (auto& w : writers_) {
+        w->stop();
+    }
+    for (auto& w : trade_writers_) {
+        w->stop();
+    }
     open_hour_ = ~0ull;
     if (run_thread_ && run_thread_->joinable()) run_thread_->join();
+    if (parse_thread_ && parse_thread_->joinable()) parse_thread_->join();
+    journal_.reset();
     curl_global_cleanup();
 }
 
@@ -85,17 +330,15 @@ void CoinbaseFeed::start() {
         return;
     }
     run_thread_ = std::make_unique<std::thread>(&CoinbaseFeed::run, this);
-    cpu_set_t mask;
-    CPU_ZERO(&mask);
-    CPU_SET(0, &mask);
-    int rc = pthread_setaffinity_np(run_thread_->native_handle(), sizeof(mask), &mask);
-    if (rc != 0) {
-        std::cerr << "[CoinbaseFeed] unable to pin cpu" << std::strerror(rc) << std::endl;
+    (void)pin_thread(*run_thread_, cpu_, "CoinbaseFeed");
+    if (ring_) {
+        parse_thread_ = std::make_unique<std::thread>(&CoinbaseFeed::parse_loop, this);
+        (void)pin_thread(*parse_thread_, parser_cpu_, "CoinbaseFeed parser");
     }
-    else {
-        std::cout << "[CoinbaseFeed] cpu pinned to core 0" << std::endl;
+    if (journal_) {
+        journal_->start();
     }
-    writer_.start();
+    start_writers();
     //  sched_param sch{ .sched_priority = 80 };
     //  if (pthread_setschedparam(run_thread_->native_handle(),
     //                            SCHED_FIFO, &sch) != 0) {
@@ -104,6 +347,15 @@ void CoinbaseFeed::start() {
     // std::cout << "scheduled fifo + high priority" << std::endl;
 }
 
+void CoinbaseFeed::start_writers() {
+    for (auto& w : writers_) {
+        w->start();
+    }
+    for (auto& w : trade_writers_) {
+        w->start();
+    }
+}
+
 void CoinbaseFeed::stop() {
     if (!running_.exchange(false)) {
         return;
@@ -113,16 +365,25 @@ void CoinbaseFeed::stop() {
         lws_cancel_service(ctx_);
     }
 
-
-    // // FILE* f = fopen("latencies.csv", "w");
-    // // for (double t : latencies_) {
-    // //     fprintf(f, "%f\n", t);
-    // // }
-    // fclose(f);
 }
 
 void CoinbaseFeed::join() {
     if (run_thread_ && run_thread_->joinable()) run_thread_->join();
+    // the parser thread drains what the loop left in the ring, then the writers drain their queues
+    if (parse_thread_ && parse_thread_->joinable()) parse_thread_->join();
+    // the loop has returned, nothing more is appended
+    if (journal_) {
+        journal_->stop();
+        journal_->join();
+    }
+    for (auto& w : writers_) {
+        w->stop();
+        w->join();
+    }
+    for (auto& w : trade_writers_) {
+        w->stop();
+        w->join();
+    }
 }
 
 static inline void save_snapshot_json(const char* data, size_t len) {
@@ -133,14 +394,22 @@ static inline void save_snapshot_json(const char* data, size_t len) {
 
 int CoinbaseFeed::lws_cb(lws* wsi, lws_callback_reasons why,
                          void* user, void* in, size_t len) {
-    auto* self = static_cast<CoinbaseFeed*>(user);
+    auto* leg = static_cast<Leg*>(user);
+    if (!leg) {
+        return 0;
+    }
+    CoinbaseFeed* self = leg->self;
 
     switch (why) {
     case LWS_CALLBACK_CLIENT_ESTABLISHED:
         {
-            self->client_ = wsi;
-            self->state_ = FeedState::Connected;
-            std::cout << "[CoinbaseFeed] OPEN\n";
+            leg->wsi = wsi;
+            leg->state = FeedState::Connected;
+            leg->failures = 0;
+            if (leg->connects++) {
+                self->reconnects_.fetch_add(1, std::memory_order_relaxed);
+            }
+            std::cout << "[CoinbaseFeed] OPEN leg " << leg->id << "\n";
             int one = 1;
             setsockopt(lws_get_socket_fd(wsi),IPPROTO_TCP,TCP_NODELAY, &one, sizeof(one));
             int prio = 6;
@@ -148,70 +417,152 @@ int CoinbaseFeed::lws_cb(lws* wsi, lws_callback_reasons why,
 
             int tos = IPTOS_LOWDELAY;
             setsockopt(lws_get_socket_fd(wsi), IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
-            self->subscribe_to_level2();
+            // the sequence restarts with the connection, reset_leg cleared last_seq when the
+            // previous one went down. a fresh subscribe makes a pending resubscribe moot
+            leg->resubscribe_pending.store(false, std::memory_order_relaxed);
+            self->subscribe_to_level2(*leg);
             break;
         }
 
     case LWS_CALLBACK_CLIENT_RECEIVE:
         {
-            auto* self = static_cast<CoinbaseFeed*>(user);
             bool first = lws_is_first_fragment(wsi);
             bool final = lws_is_final_fragment(wsi);
-
-            if (first && final) {
-                // self->ct++;
-                // uint64_t t0 = tsc();
-                self->handle_level2_update(static_cast<char*>(in), len);
-                // uint64_t t1 = tsc();
-                // double time = cycles_to_ns(t1 - t0);
-                // self->latencies_.push_back(time);
-                // if (self->ct == 500) {
-                //     int sum = 0;
-                //     for (auto& i : self->latencies_) {
-                //         sum += i;
-                //     }
-                //     double avg = static_cast<double>(sum) / self->latencies_.size();
-                //     std::cout << "average latency is " << avg << std::endl;
-                //     std::cout << "num samples " << self->latencies_.size() << std::endl;
-                //     exit(0);
-                // }
-                break;
+            if (self->journal_) {
+                self->journal_->append(static_cast<uint16_t>(leg->id), static_cast<const char*>(in), len,
+                                       (first ? JRNL_FIRST : 0) | (final ? JRNL_FINAL : 0));
             }
-
-            // if fragmented message, build in receive buffer
-            self->rx_buf_.append(static_cast<char*>(in), len);
-
-            if (final) {
-                self->handle_level2_update(self->rx_buf_.data(), self->rx_buf_.size());
-                self->rx_buf_.clear();
+            if (self->ring_) {
+                self->ring_push(*leg, static_cast<const char*>(in), len,
+                                (first ? FRAME_FIRST : 0) | (final ? FRAME_FINAL : 0));
             }
+            else {
+                if constexpr (kStageStats) {
+                    if (first) {
+                        leg->rx_tsc = stats_tsc();
+                    }
+                }
+                self->on_fragment(*leg, static_cast<char*>(in), len, first, final);
+            }
+            self->take_resubscribe(*leg);
         }
         break;
 
     case LWS_CALLBACK_CLIENT_WRITEABLE:
-        if (!self->tx_buf_.empty()) {
-            std::vector<unsigned char> buf(LWS_PRE + self->tx_buf_.size());
-            std::memcpy(buf.data() + LWS_PRE,
-                        self->tx_buf_.data(), self->tx_buf_.size());
-            lws_write(wsi, buf.data() + LWS_PRE,
-                      self->tx_buf_.size(), LWS_WRITE_TEXT);
-            self->tx_buf_.clear();
+        if (leg->tx_head != leg->tx_tail) {
+            const uint32_t s = leg->tx_head % kTxSlots;
+            lws_write(wsi, leg->tx_slot[s].data() + LWS_PRE, leg->tx_len[s], LWS_WRITE_TEXT);
+            ++leg->tx_head;
+            // one frame per writeable callback
+            if (leg->tx_head != leg->tx_tail) {
+                lws_callback_on_writable(wsi);
+            }
         }
         break;
 
-    case LWS_CALLBACK_CLIENT_CLOSED:
     case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
-        {
-            std::cerr << "[CoinbaseFeed] CLOSED/ERROR\n";
-            self->running_ = false;
-            break;
-        }
+        self->leg_down(*leg, in ? static_cast<const char*>(in) : "connection error");
+        break;
+
+    case LWS_CALLBACK_CLIENT_CLOSED:
+        self->leg_down(*leg, "closed");
+        break;
 
     default: break;
     }
     return 0;
 }
 
+void CoinbaseFeed::connect(Leg& leg) {
+    lws_client_connect_info cc{};
+    cc.context = ctx_;
+    cc.address = endpoint_.host.c_str();
+    cc.port = endpoint_.port;
+    cc.path = endpoint_.path.c_str();
+    cc.ssl_connection = endpoint_.tls ? LCCSCF_USE_SSL | LCCSCF_ALLOW_INSECURE : 0;
+    cc.host = cc.origin = cc.address;
+    cc.protocol = "json";
+    cc.userdata = &leg;
+    cc.pwsi = &leg.wsi;
+
+    leg.state = FeedState::Connecting;
+    if (!lws_client_connect_via_info(&cc)) {
+        std::cerr << "[CoinbaseFeed] dial failed leg " << leg.id << "\n";
+        leg.wsi = nullptr;
+        leg.state = FeedState::Disconnected;
+        schedule_reconnect(leg);
+    }
+}
+
+// exponential backoff from 250ms up to 30s, with up to 25% jitter so legs and
+// processes that dropped together do not redial in lockstep
+void CoinbaseFeed::schedule_reconnect(Leg& leg) {
+    if (!running_ || !ctx_) {
+        return;
+    }
+    const uint32_t shift = std::min<uint32_t>(leg.failures, 7);
+    const uint64_t delay_ms = std::min<uint64_t>(30'000, 250ull << shift);
+    thread_local std::minstd_rand rng{std::random_device{}()};
+    const uint64_t jitter_ms = rng() % (delay_ms / 4 + 1);
+    ++leg.failures;
+
+    std::cerr << "[CoinbaseFeed] leg " << leg.id << " reconnecting in " << delay_ms + jitter_ms << "ms\n";
+    lws_sul_schedule(ctx_, 0, &leg.retry.sul, &CoinbaseFeed::retry_cb,
+                     static_cast<lws_usec_t>(delay_ms + jitter_ms) * LWS_US_PER_MS);
+}
+
+void CoinbaseFeed::retry_cb(lws_sorted_usec_list_t* sul) {
+    Leg* leg = reinterpret_cast<RetryTimer*>(sul)->leg;
+    if (leg->self->running_ && leg->state == FeedState::Disconnected) {
+        leg->self->connect(*leg);
+    }
+}
+
+void CoinbaseFeed::leg_down(Leg& leg, const char* why) {
+    std::cerr << "[CoinbaseFeed] CLOSED/ERROR leg " << leg.id << ": " << why << "\n";
+    leg.wsi = nullptr;
+    leg.state = FeedState::Disconnected;
+    leg.tx_head = leg.tx_tail;
+    // connections closed by a shutdown mark nothing, and are not journaled either
+    if (journal_ && running_) {
+        journal_->append(static_cast<uint16_t>(leg.id), nullptr, 0, JRNL_LEG_DOWN);
+    }
+    if (ring_) {
+        ring_push(leg, nullptr, 0, FRAME_LEG_DOWN);
+    }
+    else {
+        reset_leg(leg, running_);
+    }
+    schedule_reconnect(leg);
+}
+
+// the parse side of a leg going down: the message in progress is dropped and the leg's products
+// lose their sync, with gap markers when mark is set (not while shutting down). runs where the
+// leg's fragments are parsed
+void CoinbaseFeed::reset_leg(Leg& leg, bool mark) {
+    leg.last_seq = ~0ull;
+    leg.rx_buf.clear();
+    leg.streaming = false;
+    leg.deferred = false;
+    if (mark) {
+        mark_gaps(leg);
+    }
+    else {
+        leg.arb_open = -1;
+    }
+    std::fill(leg.synced.begin(), leg.synced.end(), 0);
+}
+
+// a leg that goes down has its synced flags cleared, so they alone say whether it is complete
+bool CoinbaseFeed::other_leg_synced(const Leg& leg, size_t product) const noexcept {
+    for (size_t l = 0; l < n_legs_; ++l) {
+        if (&legs_[l] != &leg && legs_[l].synced[product]) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void CoinbaseFeed::run() {
     lws_context_creation_info info{};
     info.options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT |
@@ -231,292 +582,437 @@ void CoinbaseFeed::run() {
     ctx_ = lws_create_context(&info);
     if (!ctx_) {
         running_ = false;
+        finish_loop();
         return;
     }
 
-    lws_client_connect_info cc{};
-    cc.context = ctx_;
-    cc.address = "advanced-trade-ws.coinbase.com";
-    cc.port = 443;
-    cc.path = "/";
-    cc.ssl_connection = LCCSCF_USE_SSL | LCCSCF_ALLOW_INSECURE;
-    cc.host = cc.origin = cc.address;
-    cc.protocol = "json";
-    cc.userdata = this;
-    cc.pwsi = &client_;
-
-    if (!lws_client_connect_via_info(&cc)) {
-        std::cerr << "[CoinbaseFeed] dial failed\n";
-        running_ = false;
+    for (size_t l = 0; l < n_legs_; ++l) {
+        connect(legs_[l]);
     }
 
-    std::cout << "[CoinbaseFeed] event-loop running …\n";
-    while (running_)
-        lws_service(ctx_, 0);
+    std::cout << "[CoinbaseFeed] event-loop running, idles " << wait_mode_name(loop_wait_) << '\n';
+    // a negative timeout polls the sockets without blocking. a parked loop waits up to
+    // kLoopParkMs, stop() cancels the wait and the reconnect timers end it early
+    const int timeout_ms = loop_wait_ == WaitMode::Park ? kLoopParkMs : -1;
+    while (running_) {
+        lws_service(ctx_, timeout_ms);
+        if (loop_wait_ == WaitMode::SpinYield) {
+            ::sched_yield();
+        }
+    }
 
     std::cout << "[CoinbaseFeed] event-loop exited\n";
 
     lws_context_destroy(ctx_);
     ctx_ = nullptr;
+    finish_loop();
 }
 
-bool CoinbaseFeed::send_text(const std::string& p) {
-    tx_buf_ = p;
-    if (client_) {
-        lws_callback_on_writable(client_);
+// copies one fragment into the ring for the parser thread. a full ring means the parser is
+// behind, the loop waits for room rather than drop the frame, which leaves the rest in the socket
+// buffer and pushes back on the sender
+void CoinbaseFeed::ring_push(const Leg& leg, const char* buf, size_t len, uint16_t flags) {
+    const uint64_t tsc = __rdtsc();
+    const uint16_t tag = static_cast<uint16_t>(leg.id);
+    // a fragment longer than a record goes in pieces, the parser takes any split
+    while (len > ring_->max_payload()) {
+        const size_t n = ring_->max_payload();
+        ring_push(leg, buf, n, flags & ~FRAME_FINAL);
+        buf += n;
+        len -= n;
+        flags &= ~FRAME_FIRST;
     }
-    return true;
+    if (!ring_->push(buf, len, tag, flags, tsc)) {
+        ring_stalls_.store(ring_stalls_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        ring_waiter_->notify();
+        while (!ring_->push(buf, len, tag, flags, tsc)) {
+            _mm_pause();
+        }
+    }
+    ring_waiter_->notify();
 }
 
-void CoinbaseFeed::subscribe_to_level2() {
-    state_ = FeedState::Subscribed;
-    std::string sub = R"({"type":"subscribe","product_ids":[")" + product_id_ +
-        R"("],"channel":"level2"})";
-    send_text(sub);
-    std::cout << "[CoinbaseFeed] request sent for " << product_id_ << '\n';
+void CoinbaseFeed::start_parser() {
+    if (ring_ && !parse_thread_) {
+        // leg events mark gaps as they do on a live feed
+        running_.store(true);
+        parse_thread_ = std::make_unique<std::thread>(&CoinbaseFeed::parse_loop, this);
+    }
 }
 
-void CoinbaseFeed::handle_level2_update(const char* buf, size_t len) {
-    static constexpr char PREFIX[] = R"({"channel":"l2_data")";
-    if (len < sizeof(PREFIX) - 1 || memcmp(buf, PREFIX, sizeof(PREFIX) - 1)) {
-        return;
+void CoinbaseFeed::push_fragment(size_t leg, const char* buf, size_t len, bool first, bool final) {
+    ring_push(legs_[leg], buf, len, (first ? FRAME_FIRST : 0) | (final ? FRAME_FINAL : 0));
+    take_resubscribe(legs_[leg]);
+}
+
+void CoinbaseFeed::push_leg_down(size_t leg) {
+    legs_[leg].tx_head = legs_[leg].tx_tail;
+    ring_push(legs_[leg], nullptr, 0, FRAME_LEG_DOWN);
+}
+
+void CoinbaseFeed::finish_parser() {
+    finish_loop();
+    if (parse_thread_ && parse_thread_->joinable()) {
+        parse_thread_->join();
     }
-    if (len >= 3 && buf[len - 3] == '[' && buf[len - 2] == ']') {
-        return;
+    running_.store(false);
+    for (auto& leg : legs_) {
+        take_resubscribe(leg);
     }
+}
 
+void CoinbaseFeed::finish_loop() {
+    if (ring_) {
+        loop_done_.store(true, std::memory_order_release);
+        ring_waiter_->wake();
+    }
+}
 
-    auto find_char_fast = [](const char* p, const char* end, char target) noexcept -> const char* {
-        // if target is close by, fast path
-        for (int i = 0; i < 8 && p < end; ++i, ++p) {
-            if (*p == target) {
-                return p;
+// pipelined mode's parser thread: fragments go through on_fragment and leg events through
+// reset_leg exactly as the callbacks would have handled them, in the order they were received.
+// it exits once the loop has returned and the ring is empty
+void CoinbaseFeed::parse_loop() {
+    ByteRing::Record r;
+    for (;;) {
+        if (ring_->front(r)) {
+            ring_waiter_->reset();
+            Leg& leg = legs_[r.tag];
+            if (r.flags & FRAME_LEG_DOWN) {
+                reset_leg(leg, running_);
+            }
+            else {
+                const bool first = r.flags & FRAME_FIRST;
+                if constexpr (kStageStats) {
+                    if (first) {
+                        leg.rx_tsc = r.stamp;
+                    }
+                }
+                on_fragment(leg, r.data, r.len, first, r.flags & FRAME_FINAL);
             }
+            ring_->pop();
+            continue;
         }
+        if (loop_done_.load(std::memory_order_acquire) && ring_->empty()) {
+            break;
+        }
+        ring_waiter_->idle([&] { return !ring_->empty() || loop_done_.load(std::memory_order_relaxed); });
+    }
+}
 
-        constexpr uint64_t m1 = 0x0101010101010101ULL;
-        constexpr uint64_t m2 = 0x8080808080808080ULL;
+// frames a channel request for all products straight into the leg's next free slot. false when
+// every slot is still waiting for lws, the requests in them already resubscribe
+bool CoinbaseFeed::send_request(Leg& leg, const char* type, const char* channel) {
+    if (leg.tx_tail - leg.tx_head == kTxSlots) {
+        std::cerr << "[CoinbaseFeed] " << kTxSlots << " requests waiting on leg " << leg.id << ", dropping "
+            << type << ' ' << channel << '\n';
+        return false;
+    }
+    const uint32_t s = leg.tx_tail % kTxSlots;
+    char* const out = reinterpret_cast<char*>(leg.tx_slot[s].data() + LWS_PRE);
+    char* p = out;
+    const auto put = [&p](std::string_view v) {
+        std::memcpy(p, v.data(), v.size());
+        p += v.size();
+    };
+    put(R"({"type":")");
+    put(type);
+    put(R"(","product_ids":[)");
+    for (size_t i = 0; i < products_.size(); ++i) {
+        put(i ? R"(,")" : R"(")");
+        put(products_[i]);
+        put(R"(")");
+    }
+    put(R"(],"channel":")");
+    put(channel);
+    put(R"("})");
+    leg.tx_len[s] = static_cast<size_t>(p - out);
+    ++leg.tx_tail;
+    if (leg.wsi) {
+        lws_callback_on_writable(leg.wsi);
+    }
+    return true;
+}
 
-        // 8 byte lanes, each lane stores target char
-        const uint64_t rep = m1 * static_cast<unsigned char>(target);
-        while (p + 8 <= end) {
-            uint64_t w;
-            memcpy(&w, p, 8);
-            uint64_t x = w ^ rep;
-            uint64_t z = (x - m1) & ~x & m2;
-            if (z) {
-                return p + (static_cast<unsigned>(__builtin_ctzll(z)) >> 3);
-            }
-            p += 8;
-        }
+void CoinbaseFeed::subscribe_to_level2(Leg& leg) {
+    leg.state = FeedState::Subscribed;
+    send_request(leg, "subscribe", "level2");
+    if (!trade_writers_.empty()) {
+        send_request(leg, "subscribe", "market_trades");
+    }
+    std::cout << "[CoinbaseFeed] request sent for " << products_.size() << " products on leg " << leg.id << '\n';
+}
 
-        // const __m256i target_vec = _mm256_set1_epi8(target);
-        // while (p + 32 <= end) {
-        //     __m256i chunk = _mm256_loadu_si256((const __m256i*)p);
-        //     __m256i matches = _mm256_cmpeq_epi8(chunk, target_vec);
-        //     uint32_t mask = _mm256_movemask_epi8(matches);
-        //     if (mask) {
-        //         return p + __builtin_ctz(mask);
-        //     }
-        //     p += 32;
-        // }
+// the parser thread after a gap, or a writer that lost rows, asks for a resubscribe here, the
+// leg's next frame picks it up on the event loop
+void CoinbaseFeed::take_resubscribe(Leg& leg) {
+    if (leg.resubscribe_pending.load(std::memory_order_relaxed) &&
+        leg.resubscribe_pending.exchange(false, std::memory_order_acquire)) {
+        resubscribe(leg);
+    }
+}
 
-        while (p < end && *p != target) {
-            ++p;
-        }
-        return (p < end) ? p : nullptr;
-    };
+// drops the subscription and takes it again, the exchange answers with fresh snapshots
+void CoinbaseFeed::resubscribe(Leg& leg) {
+    send_request(leg, "unsubscribe", "level2");
+    send_request(leg, "subscribe", "level2");
+    if (!trade_writers_.empty()) {
+        send_request(leg, "unsubscribe", "market_trades");
+        send_request(leg, "subscribe", "market_trades");
+    }
+    std::cout << "[CoinbaseFeed] resubscribing " << products_.size() << " products on leg " << leg.id << '\n';
+}
 
-    auto parse_price_fast = [](const char* p) -> uint32_t {
-        uint32_t int_part = 0;
-        while (*p >= '0' && *p <= '9') {
-            int_part = int_part * 10 + (*p++ - '0');
-        }
-        if (*p == '.') {
-            ++p;
-            uint32_t frac_part = 0;
-            if (*p >= '0' && *p <= '9') {
-                frac_part += static_cast<uint32_t>(*p++ - '0') * 10u;
+// l2_data messages are parsed as their fragments land, so the levels of a large snapshot reach
+// the writers while the rest of it is still arriving. other messages are short and rare, a
+// fragmented one is put together in rx_buf first
+void CoinbaseFeed::on_fragment(Leg& leg, const char* buf, size_t len, bool first, bool final) {
+    if (first) {
+        // single writer, a plain store avoids the locked add
+        messages_.store(messages_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        leg.rx_buf.clear();
+        leg.streaming = false;
+        // sequence_num and the channel are near the start, a first fragment too short to hold
+        // them waits for the whole message
+        leg.deferred = !final && len < kStreamMin;
+        if (!leg.deferred) {
+            check_sequence(leg, buf, len);
+            leg.streaming = handle_level2_update(leg, buf, len, true, final);
+            if (leg.streaming) {
+                return;
             }
-            if (*p >= '0' && *p <= '9') {
-                frac_part += static_cast<uint32_t>(*p - '0');
-            }
-            return int_part * 100u + frac_part;
-        }
-        return int_part * 100u;
-    };
-
-    auto parse_quantity_fast = [](const char* p) -> float {
-        uint64_t int_part = 0;
-        while (*p >= '0' && *p <= '9') {
-            int_part = int_part * 10 + static_cast<uint64_t>(*p++ - '0');
         }
-        if (*p != '.') {
-            return static_cast<float>(int_part);
+    }
+    else if (leg.streaming) {
+        handle_level2_update(leg, buf, len, false, final);
+        return;
+    }
+    if (!final) {
+        leg.rx_buf.append(buf, len);
+        return;
+    }
+    if (!leg.rx_buf.empty()) {
+        leg.rx_buf.append(buf, len);
+        buf = leg.rx_buf.data();
+        len = leg.rx_buf.size();
+    }
+    if (leg.deferred) {
+        leg.deferred = false;
+        check_sequence(leg, buf, len);
+        if (handle_level2_update(leg, buf, len, true, true)) {
+            leg.rx_buf.clear();
+            return;
         }
-        ++p;
-        uint64_t frac_part = 0;
-        int n = 0;
-        while (*p >= '0' && *p <= '9' && n < 9) {
-            frac_part = frac_part * 10 + static_cast<uint64_t>(*p++ - '0');
-            // count how many fractional digits
-            ++n;
-        }
-        static const float inv10[10] = {1.0f, 1e-1f, 1e-2f, 1e-3f, 1e-4f, 1e-5f, 1e-6f, 1e-7f, 1e-8f, 1e-9f};
-        return static_cast<float>(int_part) + static_cast<float>(frac_part) * inv10[n];
-    };
-
-    auto days_from_civil = [](int y, unsigned m, unsigned d) noexcept -> int64_t {
-        y -= (m <= 2);
-        const int era = (y >= 0 ? y : y - 399) / 400;
-        const unsigned yoe = static_cast<unsigned>(y - era * 400);
-        const unsigned mp = m + (m > 2 ? -3 : 9);
-        const unsigned doy = (153 * mp + 2) / 5 + d - 1;
-        const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + yoe / 400 + doy;
-        return static_cast<int64_t>(era) * 146097 + static_cast<int64_t>(doe) - 719468;
-    };
+    }
+    if (!trade_writers_.empty()) {
+        handle_trades(leg, buf, len);
+    }
+    leg.rx_buf.clear();
+}
 
-    auto parse_rfc3339_ns = [&](const char* ts, const char* endq) -> uint64_t {
-        int y = (ts[0] - '0') * 1000 + (ts[1] - '0') * 100 + (ts[2] - '0') * 10 + (ts[3] - '0');
-        int mo = (ts[5] - '0') * 10 + (ts[6] - '0');
-        int d = (ts[8] - '0') * 10 + (ts[9] - '0');
-        int hh = (ts[11] - '0') * 10 + (ts[12] - '0');
-        int mm = (ts[14] - '0') * 10 + (ts[15] - '0');
-        int ss = (ts[17] - '0') * 10 + (ts[18] - '0');
-
-        thread_local int last_ymd = -1;
-        thread_local int64_t last_days = 0;
-        int ymd = y * 10000 + mo * 100 + d;
-        if (ymd != last_ymd) {
-            last_days = days_from_civil(y, static_cast<unsigned>(mo),
-                                        static_cast<unsigned>(d));
-            last_ymd = ymd;
-        }
-
-        uint32_t frac_ns = 0;
-        const char* s = ts + 19;
-        if (s < endq && *s == '.') {
-            ++s;
-            int n = 0;
-            while (s < endq && n < 9 && *s >= '0' && *s <= '9') {
-                frac_ns = frac_ns * 10u + static_cast<uint32_t>(*s - '0');
-                ++s;
-                ++n;
+// the leg's stream broke. products it was the only complete source for get a gap marker,
+// with a healthy second leg nothing was lost and nothing is marked
+void CoinbaseFeed::mark_gaps(Leg& leg) {
+    leg.arb_open = -1;
+    for (size_t i = 0; i < writers_.size(); ++i) {
+        // updates the other leg left to this one are gone as well. no leg's stream is complete
+        // for the product then, the next snapshot from either is recorded
+        if (n_legs_ > 1 && arb_[i].lost(leg.id)) {
+            if (last_ts_[i]) {
+                writers_[i]->mark_gap(last_ts_[i]);
             }
-            while (n < 9) {
-                frac_ns *= 10u;
-                ++n;
+            for (size_t l = 0; l < n_legs_; ++l) {
+                legs_[l].synced[i] = 0;
             }
+            continue;
         }
-        int64_t secs = last_days * 86400 + hh * 3600 + mm * 60 + ss;
-        return static_cast<uint64_t>(secs) * 1000000000ULL + frac_ns;
-    };
-
-    const char* end = buf + len;
-    const char* p = buf;
-
-    while (p < end - 11) {
-        if (memcmp(p, "\"updates\":[", 11) == 0) {
-            p += 11;
-            break;
+        if (leg.synced[i] && last_ts_[i] && !other_leg_synced(leg, i)) {
+            writers_[i]->mark_gap(last_ts_[i]);
         }
-        ++p;
+        leg.synced[i] = 0;
     }
+}
 
-    if (p >= end - 11) {
-        return;
+// the leg handed over the last level of the update it opened in the arbiter
+void CoinbaseFeed::close_event(Leg& leg) {
+    if (leg.arb_open >= 0) {
+        arb_[leg.arb_open].close(leg.id);
+        leg.arb_open = -1;
     }
+}
 
-    while (p < end && *p != ']') {
-        p = find_char_fast(p, end, '{');
-        if (!p) {
-            break;
-        }
+// every message on a connection carries sequence_num, one past the previous message. a jump
+// means messages were lost, so the leg's products get gap markers and the leg resubscribes.
+bool CoinbaseFeed::check_sequence(Leg& leg, const char* buf, size_t len) {
+    static constexpr char SEQ_KEY[] = R"("sequence_num":)";
+    static constexpr size_t SEQ_KEY_LEN = sizeof(SEQ_KEY) - 1;
+
+    const char* end = buf + std::min<size_t>(len, 256);
+    const char* p = buf;
+    while (p < end - SEQ_KEY_LEN && memcmp(p, SEQ_KEY, SEQ_KEY_LEN) != 0) {
         ++p;
+    }
+    if (p >= end - SEQ_KEY_LEN) {
+        return true;
+    }
+    p += SEQ_KEY_LEN;
+    uint64_t seq = 0;
+    while (p < buf + len && *p >= '0' && *p <= '9') {
+        seq = seq * 10 + static_cast<uint64_t>(*p++ - '0');
+    }
 
-        const char* obj_end = find_char_fast(p, end, '}');
-        if (!obj_end) {
-            break;
-        }
+    const uint64_t expected = leg.last_seq + 1;
+    const bool first = leg.last_seq == ~0ull;
+    leg.last_seq = seq;
+    if (first || seq == expected) {
+        return true;
+    }
 
-        const char* k = find_char_fast(p, obj_end, '"');
-        if (!k) {
-            p = obj_end + 1;
-            continue;
-        }
+    seq_gaps_.fetch_add(1, std::memory_order_relaxed);
+    std::cerr << "[CoinbaseFeed] sequence gap on leg " << leg.id << ", expected " << expected << " got " << seq << '\n';
+    mark_gaps(leg);
+    if (ring_) {
+        // lws is not called from the parser thread
+        leg.resubscribe_pending.store(true, std::memory_order_release);
+    }
+    else {
+        resubscribe(leg);
+    }
+    return false;
+}
 
-        // side
-        const char* v = k + 1 + 4 + 2 + 1;
-        bool is_bid = (*v == 'b');
-        const char* v_end = find_char_fast(v, obj_end, '"');
-        if (!v_end) {
-            p = obj_end + 1;
-            continue;
-        }
-        p = v_end + 1;
+// fnv-1a of an event's first level, tells apart two updates of a product with the same event time
+static uint64_t level_hash(const char* p, size_t n) noexcept {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < n; ++i) {
+        h = (h ^ static_cast<uint8_t>(p[i])) * 1099511628211ull;
+    }
+    return h;
+}
 
-        // event_time
-        k = find_char_fast(p, obj_end, '"');
-        if (!k) {
-            p = obj_end + 1;
-            continue;
+// one fragment of an l2_data message, false when the first one is not l2_data. what the message's
+// current event is (product, snapshot, resync pending) is kept in the leg between fragments
+bool CoinbaseFeed::handle_level2_update(Leg& leg, const char* buf, size_t len, bool first, bool final) {
+    if (first && final && len >= 3 && buf[len - 3] == '[' && buf[len - 2] == ']') {
+        return true;
+    }
+
+    auto on_event = [&](const L2ParsedEvent& ev) -> const L2Decoder* {
+        // the previous event of the message is complete
+        close_event(leg);
+        const int product = product_index(ev.product, ev.product_len);
+        leg.product = product;
+        if (product < 0) {
+            return nullptr;
         }
-        v = k + 1 + 10 + 2 + 1;
-        const char* ts_end = find_char_fast(v, obj_end, '"');
-        if (!ts_end) {
-            p = obj_end + 1;
-            continue;
+        const bool snapshot = ev.snapshot;
+        leg.snapshot = snapshot;
+        // an update without levels has nothing to record
+        if (!snapshot && !ev.first_level_len) {
+            return nullptr;
         }
-        uint64_t timestamp = parse_rfc3339_ns(v, ts_end);
-        p = ts_end + 1;
-
-        // price
-        k = find_char_fast(p, obj_end, '"');
-        if (!k) {
-            p = obj_end + 1;
-            continue;
+        // in redundant mode only one copy of each event is recorded: a leg's snapshot only when no
+        // other leg already has a complete stream for the product, updates on first arrival
+        if (n_legs_ > 1) {
+            const bool keep = snapshot
+                ? !other_leg_synced(leg, static_cast<size_t>(product))
+                : arb_[product].first_arrival(leg.id, ev.ts_ns, level_hash(ev.first_level, ev.first_level_len));
+            if (!keep) {
+                if (snapshot) {
+                    leg.synced[product] = 1;
+                }
+                arb_dropped_.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            if (!snapshot) {
+                leg.arb_open = product;
+            }
         }
-        v = k + 1 + 11 + 2 + 1;
-        uint32_t price100 = parse_price_fast(v);
-        v_end = find_char_fast(v, obj_end, '"');
-        if (!v_end) {
-            p = obj_end + 1;
-            continue;
+        if (snapshot) {
+            leg.synced[product] = 1;
         }
-        p = v_end + 1;
+        leg.resync = snapshot;
+        return &decoders_[product];
+    };
 
-        // new quantity
-        k = find_char_fast(p, obj_end, '"');
-        if (!k) {
-            p = obj_end + 1;
-            continue;
+    auto on_level = [&](const L2ParsedLevel& lvl) {
+        const int product = leg.product;
+        L2Writer* writer = writers_[product].get();
+        if (leg.resync) {
+            writer->mark_resync(lvl.ts_ns);
+            leg.resync = false;
+            price_gap_[product] = 0;
         }
-        v = k + 1 + 12 + 2 + 1;
-        float qty;
-        if (*v == '0' && v[1] != '.') {
-            // if quantity is 0, skip to end
-            qty = 0.0f;
-            v_end = find_char_fast(v, obj_end, '"');
-            if (!v_end) {
-                p = obj_end + 1;
-                continue;
+        // a price past the product's scale cannot be stored. the level is left out, and the book is
+        // marked unknown until the next snapshot
+        if (lvl.price == L2_PRICE_OVERFLOW) [[unlikely]] {
+            price_overflows_.store(price_overflows_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            if (!price_gap_[product]) {
+                price_gap_[product] = 1;
+                std::cerr << "[CoinbaseFeed] " << products_[product] << " price past its scale, levels dropped\n";
+                writer->mark_gap(lvl.ts_ns);
+                last_ts_[product] = lvl.ts_ns;
             }
-            p = v_end + 1;
-        }
-        else {
-            qty = parse_quantity_fast(v);
-            v_end = find_char_fast(v, obj_end, '"');
-            if (!v_end) {
-                p = obj_end + 1;
-                continue;
+            return;
+        }
+        const uint64_t decoded = stats_tsc();
+        // the writer's queue and spill are both full. it marks a gap where the row was lost, and a
+        // resubscribe brings the book back
+        const L2Row row{lvl.ts_ns, lvl.qty, lvl.price, static_cast<uint8_t>(lvl.bid | (leg.snapshot ? ROW_SNAPSHOT : 0))};
+        if (!writer->enqueue(row, decoded)) [[unlikely]] {
+            leg.resubscribe_pending.store(true, std::memory_order_release);
+        }
+        last_ts_[product] = lvl.ts_ns;
+        if constexpr (kStageStats) {
+            if (ProductStats* st = stats_[product]) {
+                st->stage[STAGE_PARSE].record_single(decoded - leg.rx_tsc);
+                st->stage[STAGE_ENQUEUE].record_single(stats_tsc() - decoded);
             }
-            p = v_end + 1;
         }
+    };
 
-        //std::cout << timestamp << std::endl;
-
-        writer_.enqueue({timestamp, price100, qty, is_bid});
+    const bool l2 = leg.parser.feed(buf, len, first, final, on_event, on_level);
+    if (final) {
+        close_event(leg);
+    }
+    return l2;
+}
 
-        p = obj_end + 1;
+// trades need no book, a gap loses them and nothing else. what arrives is recorded once: a
+// message's trades are put in id order per product, and only ids above the last recorded one go
+// to the writer, which drops the other leg's copies and what a resubscribe's snapshot repeats
+bool CoinbaseFeed::handle_trades(Leg& leg, const char* buf, size_t len) {
+    trade_buf_.clear();
+    size_t product = 0;
+    auto on_product = [&](const char* id, size_t n) -> const L2Decoder* {
+        const int p = product_index(id, n);
+        if (p < 0) {
+            return nullptr;
+        }
+        product = static_cast<size_t>(p);
+        return &decoders_[product];
+    };
+    auto on_trade = [&](const L2ParsedTrade& t) {
+        if (t.price == L2_PRICE_OVERFLOW) [[unlikely]] {
+            price_overflows_.store(price_overflows_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+        trade_buf_.emplace_back(product, TradeRow{t.ts_ns, t.trade_id, t.size, t.price,
+                                                  t.buy ? TRADE_BUY : TRADE_SELL});
+    };
+    if (!leg.parser.parse_trades(buf, len, on_product, on_trade)) {
+        return false;
     }
+    std::sort(trade_buf_.begin(), trade_buf_.end(), [](const auto& a, const auto& b) {
+        return a.first != b.first ? a.first < b.first : a.second.trade_id < b.second.trade_id;
+    });
+    for (const auto& [p, row] : trade_buf_) {
+        // ids that are not numbers parse as 0 and cannot be told apart, those are all kept
+        if (row.trade_id && row.trade_id <= last_trade_id_[p]) {
+            continue;
+        }
+        last_trade_id_[p] = std::max(last_trade_id_[p], row.trade_id);
+        trade_writers_[p]->enqueue(row);
+        trades_.store(trades_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    return true;
 }
@@ -5,16 +5,88 @@
 #include <libwebsockets.h>
 //#include <simdjson.h>
 
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <cstring>
 #include <filesystem>
+#include <map>
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <vector>
 
+#include "col_writer.h"
+#include "frame_journal.h"
+#include "l2_parser.h"
 #include "l2_writer.h"
+#include "stage_stats.h"
+#include "trades.h"
+
+struct Endpoint {
+    std::string host{"advanced-trade-ws.coinbase.com"};
+    int port{443};
+    std::string path{"/"};
+    bool tls{true};
+
+    // ws://host[:port][/path] or wss://..., the port defaults to 80/443
+    static bool parse(const std::string& url, Endpoint& out);
+};
 
 struct Config {
-    std::string pair;
+    std::vector<std::string> products;
+    Endpoint endpoint;
+    // keep two connections for the same products and record whichever delivers an event first
+    bool redundant{false};
+    std::string base_dir;
+    // cpu for the event-loop thread, -1 leaves it unpinned
+    int cpu{-1};
+    // per-product writer cpus, indexed like products, -1 or missing leaves it unpinned
+    std::vector<int> writer_cpus;
+    // per-product writer wait strategy, indexed like products, missing uses the L2WriterOpt default
+    std::vector<WaitMode> writer_waits;
+    // handed to every writer as L2WriterOpt::persist_latency
+    LatencyHistogram* persist_latency{nullptr};
+    // handed to every writer as L2WriterOpt::compactor
+    L2Compactor* compactor{nullptr};
+    // handed to every writer as L2WriterOpt::backend
+    L2Backend backend{L2Backend::Mmap};
+    // handed to every writer as L2WriterOpt::huge_pages
+    bool huge_pages{false};
+    // handed to every writer as L2WriterOpt::bbo and bbo_levels
+    bool bbo{false};
+    uint16_t bbo_levels{0};
+    // also subscribe to market_trades and record every product's trades to hh00.trades
+    bool trades{false};
+    // fixed point scales by product id. products without an entry get theirs from the exchange's
+    // product endpoint when lookup_increments is set, else the L2Decimals default
+    std::map<std::string, L2Decimals> decimals;
+    bool lookup_increments{true};
+    // per product stage histograms and writer counters, DATA_WRITER_STATS builds only
+    StatsSegment* stats{nullptr};
+    // parse on a thread of its own: the event loop only copies frames into a ring of ring_bytes
+    // and a parser thread decodes them into the writers. parser_cpu -1 leaves it unpinned
+    bool pipeline{false};
+    size_t ring_bytes{4u << 20};
+    int parser_cpu{-1};
+    WaitMode parser_wait{WaitMode::Park};
+    // every received fragment also goes to base/journal/<journal_name>/yyyymmdd/hh00.frames, see
+    // FrameJournal. written on a thread of its own
+    bool journal{false};
+    std::string journal_name{"feed"};
+    // handed to every writer, see L2WriterOpt::record_from_ns. replays of a single hour set them
+    uint64_t record_from_ns{0};
+    uint64_t record_until_ns{~0ull};
+    // bound on each writer's spill file, see L2WriterOpt::spill_file_bytes. 0 spills to memory only
+    uint64_t spill_file_bytes{1ull << 30};
+    // mlock the writer queues, the frame ring and the legs' buffers so the hot path never faults on
+    // them. hour file mappings are never locked
+    bool lock_memory{false};
+    // how the event loop idles: park sleeps in poll until a socket, a timer or stop() wakes it,
+    // spin and yield poll without blocking
+    WaitMode loop_wait{WaitMode::Park};
 };
 
 struct CoinbaseCredentials {
@@ -23,30 +95,208 @@ struct CoinbaseCredentials {
 };
 
 class CoinbaseFeed final  {
+    enum class FeedState { Disconnected, Connecting, Connected, Subscribed };
+
+    struct Leg;
+
+    // lws timer for a leg's reconnect, the sul must stay the first member
+    struct RetryTimer {
+        lws_sorted_usec_list_t sul;
+        Leg* leg;
+    };
+
+    // requests a leg holds framed and waiting for lws, a resubscribe takes four
+    static constexpr uint32_t kTxSlots = 16;
+
+    // one websocket connection. a feed has one leg, or two in redundant mode
+    struct Leg {
+        CoinbaseFeed* self = nullptr;
+        int id = 0;
+        lws* wsi = nullptr;
+        FeedState state{FeedState::Disconnected};
+        // sequence_num of the last message on this connection, ~0 before the first one
+        uint64_t last_seq{~0ull};
+        // per product: a snapshot arrived since the last connect or gap, so the stream is complete
+        std::vector<uint8_t> synced;
+        // consecutive failed connects, drives the reconnect backoff
+        uint32_t failures{0};
+        uint64_t connects{0};
+        // tsc when the message being received started arriving, stats builds only
+        uint64_t rx_tsc{0};
+        // the parser thread saw a sequence gap or a writer lost rows, the event loop resubscribes
+        std::atomic<bool> resubscribe_pending{false};
+        // l2_data messages go through the leg's parser fragment by fragment, the state of the one
+        // in progress lives there and in the fields below. anything else is put together in rx_buf
+        L2Parser parser;
+        bool streaming{false};
+        // the first fragment was too short to tell, the message is handled once complete
+        bool deferred{false};
+        int product{-1};
+        bool snapshot{false};
+        // the resync marker takes the time of the first snapshot level so it lands in the same hour
+        bool resync{false};
+        // product whose update the leg opened in its arbiter, -1 when none is open
+        int arb_open{-1};
+        std::string rx_buf;
+        // requests framed where lws sends them from: each slot is LWS_PRE bytes of headroom, then
+        // the frame. slots [tx_head, tx_tail) wait for a writeable callback, oldest first
+        std::array<std::vector<unsigned char>, kTxSlots> tx_slot;
+        std::array<size_t, kTxSlots> tx_len{};
+        uint32_t tx_head{0};
+        uint32_t tx_tail{0};
+        RetryTimer retry{};
+    };
+
+    // a fragmented message other than l2_data is put together in rx_buf, sized once and grown by a
+    // larger message. tx slots are sized once to hold the longest request for the feed's products
+    static constexpr size_t kRxReserve = 256 * 1024;
+    static constexpr size_t kTxReserve = 4096;
+    // bytes of a first fragment needed to find sequence_num and the channel
+    static constexpr size_t kStreamMin = 256;
+    // a product is recorded only if its scale holds this many times its current price
+    static constexpr double kPriceHeadroom = 10;
+    // longest a parked event loop sleeps in poll with nothing to do
+    static constexpr int kLoopParkMs = 100;
+
+    // orders a product's updates by event time across legs. an update no newer than the last one
+    // recorded is the slower leg's copy, or one it already overtook, and is dropped however far
+    // behind that leg is. an update with the same event time is a copy only if its first level is
+    // the same too, two events may share a time. an event counts as recorded once its last level
+    // has been handed over: while one leg is still streaming it in, and until that leg has caught
+    // up with the copies the other leg delivered meanwhile, that leg leads and the other's copies
+    // are dropped. a leader that goes down owes those, see lost()
+    struct Arbiter {
+        // the newest event recorded in full, hash of its first level
+        uint64_t last_ts{0};
+        uint64_t last_hash{0};
+        // the leg whose copies are recorded while the others are dropped, -1 for whichever is first
+        int lead{-1};
+        // the leader is handing over the event at open_ts
+        bool open{false};
+        uint64_t open_ts{0};
+        uint64_t open_hash{0};
+        // the newest copy dropped because of the leader, settled once the leader records it
+        uint64_t owed_ts{0};
+        uint64_t owed_hash{0};
+
+        bool settled() const noexcept {
+            return owed_ts < last_ts || (owed_ts == last_ts && owed_hash == last_hash);
+        }
+
+        // true opens the event for the leg, it is recorded once close() says so
+        bool first_arrival(int leg, uint64_t ts_ns, uint64_t hash) noexcept {
+            if (ts_ns < last_ts || (ts_ns == last_ts && hash == last_hash)) {
+                return false;
+            }
+            if (lead >= 0 && lead != leg) {
+                if (ts_ns > owed_ts || (ts_ns == owed_ts && hash != owed_hash)) {
+                    owed_ts = ts_ns;
+                    owed_hash = hash;
+                }
+                return false;
+            }
+            lead = leg;
+            open = true;
+            open_ts = ts_ns;
+            open_hash = hash;
+            return true;
+        }
+
+        // the leg handed over the last level of the event it opened
+        void close(int leg) noexcept {
+            if (lead != leg || !open) {
+                return;
+            }
+            open = false;
+            last_ts = open_ts;
+            last_hash = open_hash;
+            if (settled()) {
+                lead = -1;
+            }
+        }
+
+        // the leg's stream broke. true when it was leading with copies it had not recorded yet:
+        // the other leg dropped them, so they are gone. an event cut short with nothing owed is
+        // not lost, the other leg's copy is still to come and is recorded over the partial one,
+        // levels carry the new quantity so the book ends up the same
+        bool lost(int leg) noexcept {
+            if (lead != leg) {
+                return false;
+            }
+            const bool owed = !settled();
+            lead = -1;
+            open = false;
+            owed_ts = 0;
+            owed_hash = 0;
+            return owed;
+        }
+    };
+
     lws_context* ctx_ = nullptr;
-    lws* client_ = nullptr;
-    std::string rx_buf_;
-    std::string tx_buf_;
+    std::array<Leg, 2> legs_;
+    size_t n_legs_;
+    const Endpoint endpoint_;
     //simdjson::ondemand::parser parser_;
     std::optional<CoinbaseCredentials> creds_;
-    const std::string product_id_;
-    const uint32_t price_scale_;
-    lws_ring* ring_ = nullptr;
-    uint32_t ring_tail_ = 0;
+    // the configured products whose price fits their scale
+    std::vector<std::string> products_;
+    // field decoders per product, same order as products_
+    std::vector<L2Decoder> decoders_;
+    // stats slots per product, same order as products_, null without a segment
+    std::vector<ProductStats*> stats_;
+    const int cpu_;
+    const WaitMode loop_wait_;
+    // pipelined mode: the event loop puts every fragment and leg event in ring_ and the parser
+    // thread handles them in order, so the legs' parse state and the writers' queues have a
+    // single producer. null when the callbacks parse
+    std::unique_ptr<ByteRing> ring_;
+    std::unique_ptr<Waiter> ring_waiter_;
+    std::unique_ptr<std::thread> parse_thread_;
+    const int parser_cpu_;
+    // set once the event loop has returned, nothing more goes into the ring
+    std::atomic<bool> loop_done_{false};
+    std::atomic<uint64_t> ring_stalls_{0};
+    // raw frames to disk when Config::journal is set
+    std::unique_ptr<FrameJournal> journal_;
+    // flags of a ring record, the tag is the leg id
+    enum : uint16_t { FRAME_FIRST = 1, FRAME_FINAL = 2, FRAME_LEG_DOWN = 4 };
     struct PSD {
-        CoinbaseFeed* self;
+        Leg* leg;
     };
 
-    std::string root_ = []{
-        if (const char* home = std::getenv("HOME")) {
-            return (std::filesystem::path(home) / "hft-data").string();
-        }
-        return std::string("/tmp/hft-data");
-    }();
+    const std::string root_;
 
-    L2Writer writer_;
+    // one writer per product, same order as products_
+    std::vector<std::unique_ptr<L2Writer>> writers_;
+    // trade writers, same order as products_ when Config::trades is set, else empty
+    std::vector<std::unique_ptr<ColWriter<TradeSchema>>> trade_writers_;
+    // highest trade id recorded per product. ids grow per product, so both legs' copies and the
+    // trades a snapshot repeats are dropped by id
+    std::vector<uint64_t> last_trade_id_;
+    // trades of the message being handled, recorded in id order once it is parsed
+    std::vector<std::pair<size_t, TradeRow>> trade_buf_;
     uint64_t open_hour_{~0ull};
-    uint64_t cap_estimate_{5'000'000};
+
+    std::atomic<uint64_t> messages_{0};
+    std::atomic<uint64_t> seq_gaps_{0};
+    std::atomic<uint64_t> reconnects_{0};
+    std::atomic<uint64_t> arb_dropped_{0};
+    std::atomic<uint64_t> trades_{0};
+    std::atomic<uint64_t> price_overflows_{0};
+    // per product: a level was dropped for its price and the gap is marked, until the next resync
+    std::vector<uint8_t> price_gap_;
+    std::vector<Arbiter> arb_;
+    // newest event time recorded per product, markers are stamped with it to stay in order
+    std::vector<uint64_t> last_ts_;
+
+    int product_index(const char* id, size_t n) const noexcept {
+        for (size_t i = 0; i < products_.size(); ++i) {
+            if (products_[i].size() == n && std::memcmp(products_[i].data(), id, n) == 0) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
 
 
     static inline uint64_t hour_start_from_ns(uint64_t ts_ns) noexcept {
@@ -58,20 +308,31 @@ class CoinbaseFeed final  {
     void ensure_writer_for(uint64_t ts_ns);
 
 
-    int ct = 0;
-
-
-    enum class FeedState { Disconnected, Connected, Subscribed };
-    //std::vector<double> latencies_{10000};
     void run();
     static int lws_cb(lws*, lws_callback_reasons, void*, void*, size_t);
-    void subscribe_to_level2();
-    void handle_level2_update(const char* buf, size_t len);
+    void connect(Leg& leg);
+    void schedule_reconnect(Leg& leg);
+    static void retry_cb(lws_sorted_usec_list_t* sul);
+    void leg_down(Leg& leg, const char* why);
+    void reset_leg(Leg& leg, bool mark);
+    void ring_push(const Leg& leg, const char* buf, size_t len, uint16_t flags);
+    void parse_loop();
+    void finish_loop();
+    void lock_hot_memory();
+    bool other_leg_synced(const Leg& leg, size_t product) const noexcept;
+    void on_fragment(Leg& leg, const char* buf, size_t len, bool first, bool final);
+    void subscribe_to_level2(Leg& leg);
+    void resubscribe(Leg& leg);
+    void take_resubscribe(Leg& leg);
+    bool check_sequence(Leg& leg, const char* buf, size_t len);
+    void mark_gaps(Leg& leg);
+    void close_event(Leg& leg);
+    bool handle_level2_update(Leg& leg, const char* buf, size_t len, bool first, bool final);
+    bool handle_trades(Leg& leg, const char* buf, size_t len);
     //void handle_level2(const char* json, size_t len);
-    bool send_text(const std::string&);
+    bool send_request(Leg& leg, const char* type, const char* channel);
     std::atomic<bool> running_{false};
     std::unique_ptr<std::thread> run_thread_;
-    FeedState state_{FeedState::Disconnected};
 
 public:
     explicit CoinbaseFeed(const Config& cfg);
@@ -79,5 +340,60 @@ public:
     void start();
     void stop();
     void join();
+    // starts only the writers, for driving the feed without a connection. start() does this itself
+    void start_writers();
+    // one complete l2_data message through the parser into the writers, as the first leg would
+    // record it minus the sequence check. only while the event loop is not running
+    void handle_level2(const char* buf, size_t len) {
+        legs_[0].rx_tsc = stats_tsc();
+        handle_level2_update(legs_[0], buf, len, true, true);
+    }
+    // one fragment of any message as a leg receives it, sequence check included. replaying a
+    // journal goes through here and handle_leg_down
+    void handle_fragment(size_t leg, const char* buf, size_t len, bool first, bool final) {
+        if (first) {
+            legs_[leg].rx_tsc = stats_tsc();
+        }
+        on_fragment(legs_[leg], buf, len, first, final);
+    }
+    // the leg's connection dropped: its message in progress is gone and its products get gap
+    // markers unless the other leg covers them
+    void handle_leg_down(size_t leg) { reset_leg(legs_[leg], true); }
+    // pipelined mode without a connection, the caller stands in for the event loop: start_parser
+    // starts the parser thread, push_fragment and push_leg_down hand it frames through the ring as
+    // the callbacks would, and finish_parser waits for it to drain the ring and exit
+    void start_parser();
+    void push_fragment(size_t leg, const char* buf, size_t len, bool first, bool final);
+    void push_leg_down(size_t leg);
+    void finish_parser();
+
+    // the products recorded, in configured order less the ones whose price does not fit their scale
+    const std::vector<std::string>& products() const noexcept { return products_; }
+    const L2Writer& writer(size_t i) const noexcept { return *writers_[i]; }
+    // one complete market_trades message into the trade writers, false if it is not one
+    bool handle_market_trades(const char* buf, size_t len) { return handle_trades(legs_[0], buf, len); }
+    // complete websocket messages received on all legs
+    uint64_t messages() const noexcept { return messages_.load(std::memory_order_relaxed); }
+    // sequence gaps seen on any leg, each one triggers a resubscribe of that leg
+    uint64_t seq_gaps() const noexcept { return seq_gaps_.load(std::memory_order_relaxed); }
+    // connections re-established after a close or error
+    uint64_t reconnects() const noexcept { return reconnects_.load(std::memory_order_relaxed); }
+    // events dropped in redundant mode because the other leg delivered them first
+    uint64_t arb_dropped() const noexcept { return arb_dropped_.load(std::memory_order_relaxed); }
+    // trades handed to the trade writers, after dropping repeats
+    uint64_t trades() const noexcept { return trades_.load(std::memory_order_relaxed); }
+    // levels and trades dropped because their price does not fit the product's scale
+    uint64_t price_overflows() const noexcept { return price_overflows_.load(std::memory_order_relaxed); }
+    // requests framed for the leg that lws has not written yet, oldest first
+    size_t pending_requests(size_t leg) const noexcept { return legs_[leg].tx_tail - legs_[leg].tx_head; }
+    std::string_view pending_request(size_t leg, size_t i) const noexcept {
+        const Leg& l = legs_[leg];
+        const uint32_t s = (l.tx_head + static_cast<uint32_t>(i)) % kTxSlots;
+        return {reinterpret_cast<const char*>(l.tx_slot[s].data() + LWS_PRE), l.tx_len[s]};
+    }
+    // times the event loop found the pipeline ring full and waited for the parser thread
+    uint64_t ring_stalls() const noexcept { return ring_stalls_.load(std::memory_order_relaxed); }
+    // null unless Config::journal is set
+    const FrameJournal* journal() const noexcept { return journal_.get(); }
 };
 
@@ -0,0 +1,244 @@
+#include "col_file.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+bool ColFile::mkdir_p(const std::string& dir) {
+    char tmp[PATH_MAX];
+    std::snprintf(tmp, sizeof(tmp), "%s", dir.c_str());
+    size_t n = std::strlen(tmp);
+    if (!n) {
+        return true;
+    }
+    if (tmp[n - 1] == '/') {
+        tmp[n - 1] = '\0';
+    }
+    for (char* p = tmp + 1; *p; ++p) {
+        if (*p == '/') {
+            *p = '\0';
+            ::mkdir(tmp, 0755);
+            *p = '/';
+        }
+    }
+    ::mkdir(tmp, 0755);
+    return true;
+}
+
+bool ColFile::preallocate(int fd, size_t off, size_t bytes) {
+#if defined(_POSIX_C_SOURCE) && (_POSIX_C_SOURCE >= 200112L)
+    int rc = ::posix_fallocate(fd, (off_t)off, (off_t)bytes);
+    if (rc == 0) {
+        return true;
+    }
+#endif
+    return ::ftruncate(fd, (off_t)(off + bytes)) == 0;
+}
+
+bool ColFile::create(const std::string& file, const ColFileHeader& h, uint64_t capacity, const ColMapOpt& m) {
+    const size_t slash = file.rfind('/');
+    if (slash != std::string::npos) {
+        (void)mkdir_p(file.substr(0, slash));
+    }
+    path = file;
+    fd = ::open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    hdr = h;
+    std::memcpy(hdr.magic, "COLHR\n", 6);
+    hdr.header_size = sizeof(ColFileHeader);
+    hdr.version = COLF_VERSION;
+    hdr.rows = 0;
+    if (!add_extent(capacity, m)) {
+        release();
+        return false;
+    }
+    return true;
+}
+
+// faults in the pages of the first `rows` rows of every column, so the hour starts on resident
+// pages instead of taking a fault per page on the writer thread
+static void prefault_columns(const ColExtent& e, const ColFileHeader& h, uint64_t rows) {
+    for (uint32_t c = 0; c < h.col_count; ++c) {
+        uint8_t* p = e.map + (e.col_off[c] - e.file_off);
+        const size_t len = static_cast<size_t>(l2col_align(rows * h.cols[c].width));
+#ifdef MADV_POPULATE_WRITE
+        if (::madvise(p, len, MADV_POPULATE_WRITE) == 0) {
+            continue;
+        }
+#endif
+        // the file is fresh, its pages read as zero
+        for (size_t off = 0; off < len; off += L2COL_ALIGN) {
+            reinterpret_cast<volatile uint8_t*>(p)[off] = 0;
+        }
+    }
+}
+
+bool ColFile::add_extent(uint64_t capacity, const ColMapOpt& m) {
+    ColExtent e;
+    if (!extents.empty()) {
+        const ColExtent& prev = extents.back();
+        e.file_off = prev.file_off + prev.bytes;
+        e.row_base = prev.row_base + prev.capacity;
+    }
+    e.capacity = capacity;
+
+    // the first page holds the file or extent header, every column starts page aligned
+    uint64_t off = e.file_off + L2COL_ALIGN;
+    for (uint32_t c = 0; c < hdr.col_count; ++c) {
+        e.col_off[c] = off;
+        off = l2col_align(off + capacity * hdr.cols[c].width);
+    }
+    e.bytes = off - e.file_off;
+    e.map_bytes = static_cast<size_t>(m.columns ? e.bytes : L2COL_ALIGN);
+
+    if (!preallocate(fd, e.file_off, e.bytes)) {
+        return false;
+    }
+    void* p = ::mmap(nullptr, e.map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t)e.file_off);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    e.map = static_cast<uint8_t*>(p);
+    if (m.huge_pages && m.columns) {
+        (void)::madvise(e.map, e.map_bytes, MADV_HUGEPAGE);
+    }
+    if (m.prefault_rows && m.columns) {
+        prefault_columns(e, hdr, std::min(capacity, m.prefault_rows));
+    }
+
+    if (extents.empty()) {
+        hdr.capacity = capacity;
+        hdr.first_capacity = capacity;
+        for (uint32_t c = 0; c < hdr.col_count; ++c) {
+            hdr.cols[c].off = e.col_off[c];
+        }
+        hdr.extent_count = 1;
+        hdr.next_extent = 0;
+    }
+    else {
+        ColExtentHeader xh{};
+        std::memcpy(xh.magic, "COLEX\n", 6);
+        xh.index = static_cast<uint16_t>(extents.size());
+        xh.capacity = capacity;
+        std::memcpy(xh.col_off, e.col_off, sizeof(xh.col_off));
+        std::memcpy(e.map, &xh, sizeof(xh));
+
+        // the previous extent is full from here on, link it forward
+        ColExtent& prev = extents.back();
+        if (extents.size() == 1) {
+            hdr.next_extent = e.file_off;
+        }
+        else {
+            auto* ph = reinterpret_cast<ColExtentHeader*>(prev.map);
+            ph->rows = prev.capacity;
+            ph->next = e.file_off;
+        }
+        hdr.extent_count += 1;
+        hdr.capacity += capacity;
+    }
+    extents.push_back(e);
+    write_header();
+    return true;
+}
+
+void ColFile::write_header() noexcept {
+    std::memcpy(base(), &hdr, offsetof(ColFileHeader, live));
+}
+
+void ColFile::write_rows() noexcept {
+    if (uint8_t* b = base()) {
+        std::memcpy(b + offsetof(ColFileHeader, rows), &hdr.rows, sizeof(hdr.rows));
+    }
+}
+
+void ColFile::publish(uint64_t committed) noexcept {
+    if (uint8_t* b = base()) {
+        auto* h = reinterpret_cast<ColFileHeader*>(b);
+        std::atomic_ref<uint64_t>(h->live.committed).store(committed, std::memory_order_release);
+    }
+}
+
+// shrinks the last extent to the rows it holds. the columns stay where they are, so a tail that
+// has the file mapped keeps reading valid rows: the unused tail of each column but the last is
+// punched out, the file is truncated after the last one
+void ColFile::trim_last_extent(uint64_t rows) noexcept {
+    ColExtent& e = extents.back();
+    const uint64_t used = rows - e.row_base;
+
+    if (used < e.capacity) {
+        for (uint32_t c = 0; c + 1 < hdr.col_count; ++c) {
+            const uint64_t lo = l2col_align(e.col_off[c] + used * hdr.cols[c].width);
+            const uint64_t hi = e.col_off[c + 1];
+            // filesystems without hole punching keep the blocks allocated, nothing else changes
+            if (hi > lo) {
+                (void)::fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)lo, (off_t)(hi - lo));
+            }
+        }
+        e.capacity = used;
+        hdr.capacity = e.row_base + used;
+    }
+
+    if (extents.size() == 1) {
+        hdr.first_capacity = e.capacity;
+    }
+    else {
+        auto* xh = reinterpret_cast<ColExtentHeader*>(e.map);
+        xh->rows = used;
+        xh->capacity = e.capacity;
+    }
+}
+
+void ColFile::finish() {
+    if (!extents.empty()) {
+        trim_last_extent(hdr.rows);
+
+        const ColExtent& last = extents.back();
+        const uint32_t lc = hdr.col_count - 1;
+        const uint64_t file_end = last.col_off[lc] + last.capacity * hdr.cols[lc].width;
+        // the index goes after the last column, the header points at it
+        const uint64_t index_off = (file_end + alignof(ColIndexEntry) - 1) & ~(alignof(ColIndexEntry) - 1);
+        hdr.index_off = index.empty() ? 0 : index_off;
+        hdr.index_count = static_cast<uint32_t>(index.size());
+        write_header();
+
+        for (auto& e : extents) {
+            ::msync(e.map, e.map_bytes, MS_SYNC);
+            ::munmap(e.map, e.map_bytes);
+        }
+        extents.clear();
+        (void)::ftruncate(fd, (off_t)file_end);
+        if (!index.empty()) {
+            const size_t bytes = index.size() * sizeof(ColIndexEntry);
+            if (::pwrite(fd, index.data(), bytes, (off_t)index_off) != static_cast<ssize_t>(bytes)) {
+                // readers of the l2 schema fall back to scanning for MARK_CHECKPOINT rows
+                hdr.index_count = 0;
+                (void)::pwrite(fd, &hdr.index_count, sizeof(hdr.index_count),
+                               (off_t)offsetof(ColFileHeader, index_count));
+            }
+        }
+        // tails move on to the next hour once they see this
+        const uint32_t closed = 1;
+        const size_t closed_off = offsetof(ColFileHeader, live) + offsetof(ColLive, closed);
+        (void)::pwrite(fd, &closed, sizeof(closed), (off_t)closed_off);
+    }
+    ::fsync(fd);
+}
+
+void ColFile::release() noexcept {
+    for (auto& e : extents) {
+        ::munmap(e.map, e.map_bytes);
+    }
+    extents.clear();
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "col_schema.h"
+
+// an extent of an hour file being written: `capacity` rows of every column from row_base on
+struct ColExtent {
+    uint64_t file_off{0};
+    uint64_t row_base{0};
+    uint64_t capacity{0};
+    uint64_t col_off[COLF_MAX_COLS]{};
+    // header page plus columns, only the header page is mapped when the columns are not
+    uint64_t bytes{0};
+    uint8_t* map{nullptr};
+    size_t map_bytes{0};
+};
+
+// how add_extent maps a new extent
+struct ColMapOpt {
+    // false maps the header page only, for writers that write the columns with pwrite
+    bool columns{true};
+    bool huge_pages{false};
+    // rows of every column faulted in right away
+    uint64_t prefault_rows{0};
+};
+
+// the write side of an hour file of any schema, L2Writer's and ColWriter's: extents chained as
+// the hour grows, the header and its live block, and the close that trims the last extent. the
+// columns are the ones hdr describes, a writer stores into them through the extents' col_off.
+// none of it touches writer state, so a file can be created and finished on another thread
+struct ColFile {
+    int fd{-1};
+    std::string path;
+    ColFileHeader hdr{};
+    std::vector<ColExtent> extents;
+    // written after the last column on close, see ColFileHeader::index_off
+    std::vector<ColIndexEntry> index;
+
+    // creates path, its directories included, with the columns, product and hour h describes and
+    // a first extent of `capacity` rows. false leaves the file released
+    bool create(const std::string& file, const ColFileHeader& h, uint64_t capacity, const ColMapOpt& m);
+    // appends an extent of `capacity` rows and links it in
+    bool add_extent(uint64_t capacity, const ColMapOpt& m);
+    // column c of the newest extent, as a pointer into its mapping
+    uint8_t* column(uint32_t c) const noexcept {
+        const ColExtent& e = extents.back();
+        return e.map + (e.col_off[c] - e.file_off);
+    }
+    uint8_t* base() const noexcept { return extents.empty() ? nullptr : extents.front().map; }
+
+    // everything up to the live block, which only ever gets atomic stores
+    void write_header() noexcept;
+    // hdr.rows into the mapped header, for an fsync mid hour
+    void write_rows() noexcept;
+    void publish(uint64_t committed) noexcept;
+    // hdr.rows is final: trims the last extent, writes the header and index and marks the file
+    // closed. the file is synced but stays open
+    void finish();
+    // unmaps and closes without touching the contents
+    void release() noexcept;
+
+    static bool mkdir_p(const std::string& dir);
+    static bool preallocate(int fd, size_t off, size_t bytes);
+
+private:
+    void trim_last_extent(uint64_t rows) noexcept;
+};
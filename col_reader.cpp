@@ -0,0 +1,209 @@
+#include "col_reader.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+ColHourFile::~ColHourFile() {
+    close();
+}
+
+ColHourFile::ColHourFile(ColHourFile&& o) noexcept {
+    *this = std::move(o);
+}
+
+ColHourFile& ColHourFile::operator=(ColHourFile&& o) noexcept {
+    if (this != &o) {
+        close();
+        map_ = std::exchange(o.map_, nullptr);
+        map_bytes_ = std::exchange(o.map_bytes_, 0);
+        hdr_ = o.hdr_;
+        segs_ = std::move(o.segs_);
+        index_ = std::exchange(o.index_, {});
+        error_ = std::move(o.error_);
+    }
+    return *this;
+}
+
+void ColHourFile::close() {
+    if (map_) {
+        ::munmap(const_cast<uint8_t*>(map_), map_bytes_);
+    }
+    map_ = nullptr;
+    map_bytes_ = 0;
+    hdr_ = ColFileHeader{};
+    segs_.clear();
+    index_ = {};
+}
+
+void ColHourFile::prefetch() const {
+    if (map_) {
+        (void)::madvise(const_cast<uint8_t*>(map_), map_bytes_, MADV_WILLNEED);
+    }
+}
+
+bool ColHourFile::fail(const std::string& path, const char* why) {
+    error_ = path + ": " + why;
+    close();
+    return false;
+}
+
+std::string ColHourFile::schema() const {
+    return {hdr_.schema, strnlen(hdr_.schema, sizeof(hdr_.schema))};
+}
+
+std::string ColHourFile::col_name(uint32_t c) const {
+    return {hdr_.cols[c].name, strnlen(hdr_.cols[c].name, sizeof(hdr_.cols[c].name))};
+}
+
+int ColHourFile::col_index(const std::string& name) const noexcept {
+    for (uint32_t c = 0; c < hdr_.col_count; ++c) {
+        if (name.size() <= sizeof(hdr_.cols[c].name) &&
+            std::strncmp(hdr_.cols[c].name, name.c_str(), sizeof(hdr_.cols[c].name)) == 0) {
+            return static_cast<int>(c);
+        }
+    }
+    return -1;
+}
+
+// every column of `capacity` rows must lie in the file at its type's alignment
+bool ColHourFile::add_segment(uint64_t row_base, uint64_t rows, uint64_t capacity, const uint64_t* col_off) {
+    ColSegment s;
+    s.row_base = row_base;
+    s.rows = rows;
+    for (uint32_t c = 0; c < hdr_.col_count; ++c) {
+        const uint64_t w = hdr_.cols[c].width;
+        if (col_off[c] % w || col_off[c] + capacity * w > map_bytes_) {
+            return false;
+        }
+        s.col[c] = map_ + col_off[c];
+    }
+    if (rows) {
+        segs_.push_back(s);
+    }
+    return true;
+}
+
+bool ColHourFile::open(const std::string& path, bool sequential) {
+    close();
+    error_.clear();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return fail(path, std::strerror(errno));
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ColFileHeader)) {
+        ::close(fd);
+        return fail(path, "too short for a header");
+    }
+    void* m = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        return fail(path, std::strerror(errno));
+    }
+    map_ = static_cast<const uint8_t*>(m);
+    map_bytes_ = static_cast<size_t>(st.st_size);
+    if (sequential) {
+        (void)::madvise(m, map_bytes_, MADV_SEQUENTIAL);
+    }
+
+    // committed is loaded before the header is copied, so the extents it describes cover the rows
+    const auto& mapped = *reinterpret_cast<const ColFileHeader*>(map_);
+    const bool closed = colf_closed(mapped.live);
+    const uint64_t committed = colf_committed(mapped.live);
+    std::memcpy(&hdr_, map_, sizeof(hdr_));
+    if (std::memcmp(hdr_.magic, "COLHR\n", 6) != 0) {
+        return fail(path, "bad magic");
+    }
+    if (hdr_.version < 1 || hdr_.version > COLF_VERSION) {
+        return fail(path, "unsupported version");
+    }
+    if (hdr_.header_size != sizeof(ColFileHeader)) {
+        return fail(path, "bad header size");
+    }
+    if (!hdr_.col_count || hdr_.col_count > COLF_MAX_COLS) {
+        return fail(path, "bad column count");
+    }
+    for (uint32_t c = 0; c < hdr_.col_count; ++c) {
+        const auto t = static_cast<ColType>(hdr_.cols[c].type);
+        if (hdr_.cols[c].type < static_cast<uint8_t>(ColType::U8) || hdr_.cols[c].type > static_cast<uint8_t>(ColType::F64) ||
+            col_type_width(t) != hdr_.cols[c].width) {
+            return fail(path, "bad column type");
+        }
+    }
+    if (static_cast<ColType>(hdr_.cols[0].type) != ColType::U64) {
+        return fail(path, "first column is not a ts");
+    }
+    const bool live = !closed;
+    if (live) {
+        hdr_.rows = committed;
+    }
+    if (hdr_.rows > hdr_.capacity) {
+        return fail(path, "rows exceed capacity");
+    }
+
+    uint64_t col_off[COLF_MAX_COLS]{};
+    for (uint32_t c = 0; c < hdr_.col_count; ++c) {
+        col_off[c] = hdr_.cols[c].off;
+    }
+    uint64_t remaining = hdr_.rows;
+    uint64_t n = std::min(remaining, hdr_.first_capacity);
+    if (!add_segment(0, n, n, col_off)) {
+        return fail(path, "column outside the file");
+    }
+    remaining -= n;
+
+    uint64_t next = hdr_.next_extent;
+    uint64_t row_base = hdr_.first_capacity;
+    for (uint32_t i = 1; i < hdr_.extent_count && remaining; ++i) {
+        if (!next || next + sizeof(ColExtentHeader) > map_bytes_) {
+            // the writer added the extent after the file was mapped, stop at the rows before it
+            if (live && next) {
+                hdr_.rows -= remaining;
+                remaining = 0;
+                break;
+            }
+            return fail(path, "broken extent chain");
+        }
+        ColExtentHeader xh{};
+        std::memcpy(&xh, map_ + next, sizeof(xh));
+        if (std::memcmp(xh.magic, "COLEX\n", 6) != 0 || xh.index != i) {
+            return fail(path, "bad extent header");
+        }
+        n = std::min(remaining, xh.capacity);
+        if (!add_segment(row_base, n, n, xh.col_off)) {
+            return fail(path, "extent column outside the file");
+        }
+        remaining -= n;
+        row_base += xh.capacity;
+        next = xh.next;
+    }
+    if (remaining) {
+        return fail(path, "rows beyond the last extent");
+    }
+
+    if (hdr_.version >= 2 && hdr_.index_count) {
+        const uint64_t bytes = uint64_t{hdr_.index_count} * sizeof(ColIndexEntry);
+        if (hdr_.index_off % alignof(ColIndexEntry) == 0 && hdr_.index_off + bytes <= map_bytes_) {
+            index_ = {reinterpret_cast<const ColIndexEntry*>(map_ + hdr_.index_off), hdr_.index_count};
+        }
+    }
+    return true;
+}
+
+// segments hold rows in order, the one holding row i is the last whose row_base <= i
+const ColSegment& ColHourFile::segment_of(uint64_t i) const noexcept {
+    auto it = std::upper_bound(segs_.begin(), segs_.end(), i,
+                               [](uint64_t v, const ColSegment& s) { return v < s.row_base; });
+    return *(it - 1);
+}
+
+uint64_t ColHourFile::ts(uint64_t i) const noexcept {
+    const ColSegment& s = segment_of(i);
+    return reinterpret_cast<const uint64_t*>(s.col[0])[i - s.row_base];
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+#include "col_schema.h"
+
+// read side of the schema hour files. the columns come from the header, so one reader opens a
+// file of any schema, the l2 book's included, and typed access checks the element type against
+// the file's
+
+// one extent worth of rows, [row_base, row_base + rows) of the hour, with a base pointer per column
+struct ColSegment {
+    uint64_t row_base{0};
+    uint64_t rows{0};
+    const uint8_t* col[COLF_MAX_COLS]{};
+
+    size_t size() const noexcept { return static_cast<size_t>(rows); }
+};
+
+class ColHourFile {
+public:
+    ColHourFile() = default;
+    ~ColHourFile();
+    ColHourFile(ColHourFile&& o) noexcept;
+    ColHourFile& operator=(ColHourFile&& o) noexcept;
+    ColHourFile(const ColHourFile&) = delete;
+    ColHourFile& operator=(const ColHourFile&) = delete;
+
+    // maps and validates the file, on failure error() says why. sequential hints the kernel to
+    // read ahead aggressively. an hour still being written is a snapshot of the rows committed at
+    // this call
+    bool open(const std::string& path, bool sequential = false);
+    void close();
+    // asks the kernel to start reading the whole file in
+    void prefetch() const;
+
+    bool is_open() const noexcept { return map_ != nullptr; }
+    const std::string& error() const noexcept { return error_; }
+    const ColFileHeader& header() const noexcept { return hdr_; }
+    uint64_t rows() const noexcept { return hdr_.rows; }
+    uint64_t hour_s() const noexcept { return hdr_.hour_epoch_start; }
+    uint8_t price_decimals() const noexcept { return hdr_.price_decimals; }
+    uint8_t qty_decimals() const noexcept { return hdr_.qty_decimals; }
+    std::string schema() const;
+    uint32_t col_count() const noexcept { return hdr_.col_count; }
+    std::string col_name(uint32_t c) const;
+    ColType col_type(uint32_t c) const noexcept { return static_cast<ColType>(hdr_.cols[c].type); }
+    // index of the column called name, -1 when the file has none
+    int col_index(const std::string& name) const noexcept;
+    const std::vector<ColSegment>& segments() const noexcept { return segs_; }
+    // empty for files that were never closed, predate v2 or whose schema keeps no index
+    std::span<const ColIndexEntry> index() const noexcept { return index_; }
+
+    // column c of a segment as T, empty when the column is not stored as T
+    template <typename T>
+    std::span<const T> column(const ColSegment& s, uint32_t c) const noexcept {
+        if (c >= hdr_.col_count || col_type(c) != col_type_of<T>()) {
+            return {};
+        }
+        return {reinterpret_cast<const T*>(s.col[c]), s.size()};
+    }
+
+    // true when the file's columns are the schema's, by name and type, in order
+    template <typename Schema>
+    bool matches() const noexcept {
+        return Schema::matches(hdr_);
+    }
+
+    // row i as the schema's row struct, the file must match the schema
+    template <typename Schema>
+    typename Schema::row_type row(uint64_t i) const noexcept {
+        const ColSegment& s = segment_of(i);
+        return Schema::gather(s.col, i - s.row_base);
+    }
+
+    // ts in ns of row i, the first column of every schema
+    uint64_t ts(uint64_t i) const noexcept;
+
+private:
+    const uint8_t* map_{nullptr};
+    size_t map_bytes_{0};
+    ColFileHeader hdr_{};
+    std::vector<ColSegment> segs_;
+    std::span<const ColIndexEntry> index_;
+    std::string error_;
+
+    bool fail(const std::string& path, const char* why);
+    bool add_segment(uint64_t row_base, uint64_t rows, uint64_t capacity, const uint64_t* col_off);
+    const ColSegment& segment_of(uint64_t i) const noexcept;
+};
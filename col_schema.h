@@ -0,0 +1,314 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// hour files of any row type, the l2 book's included. a schema lists the members of a row struct
+// that become columns, in file order, and everything the hot loop needs (column pointers, the
+// scatter) is generated from it at compile time. the file header describes every column by name
+// and type, so ColHourFile reads any schema without knowing it. the layout: a header page, page
+// aligned columns, extents chained as the hour grows, the unused tail trimmed on close and a live
+// block for readers of the open hour. ColFile in col_file.h writes it.
+
+static constexpr uint64_t L2COL_ALIGN = 4096;
+
+inline constexpr uint64_t l2col_align(uint64_t v) noexcept {
+    return (v + L2COL_ALIGN - 1) & ~(L2COL_ALIGN - 1);
+}
+
+// hour files live at base/yyyymmdd/hh00.bin, named by local time
+inline std::string l2col_date_dir(const std::string& base, uint64_t hour_s) {
+    time_t tt = static_cast<time_t>(hour_s);
+    struct tm tm{};
+    localtime_r(&tt, &tm);
+    // room for three ints of any value, the compiler cannot tell the year has 4 digits
+    char buf[36];
+    std::snprintf(buf, sizeof(buf), "%04d%02d%02d",
+                  tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+    if (base.empty()) {
+        return buf;
+    }
+    return base.back() == '/' ? base + buf : base + '/' + buf;
+}
+
+inline std::string l2col_hour_path(const std::string& base, uint64_t hour_s) {
+    time_t tt = static_cast<time_t>(hour_s);
+    struct tm tm{};
+    localtime_r(&tt, &tm);
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "/%02d00.bin", tm.tm_hour);
+    return l2col_date_dir(base, hour_s) + buf;
+}
+
+// column element types a file can describe
+enum class ColType : uint8_t { U8 = 1, U16, U32, U64, I8, I16, I32, I64, F32, F64 };
+
+template <typename T>
+constexpr ColType col_type_of() noexcept {
+    if constexpr (std::is_same_v<T, uint8_t>) {
+        return ColType::U8;
+    }
+    else if constexpr (std::is_same_v<T, uint16_t>) {
+        return ColType::U16;
+    }
+    else if constexpr (std::is_same_v<T, uint32_t>) {
+        return ColType::U32;
+    }
+    else if constexpr (std::is_same_v<T, uint64_t>) {
+        return ColType::U64;
+    }
+    else if constexpr (std::is_same_v<T, int8_t>) {
+        return ColType::I8;
+    }
+    else if constexpr (std::is_same_v<T, int16_t>) {
+        return ColType::I16;
+    }
+    else if constexpr (std::is_same_v<T, int32_t>) {
+        return ColType::I32;
+    }
+    else if constexpr (std::is_same_v<T, int64_t>) {
+        return ColType::I64;
+    }
+    else if constexpr (std::is_same_v<T, float>) {
+        return ColType::F32;
+    }
+    else {
+        static_assert(std::is_same_v<T, double>, "column members must be fixed width integers or floats");
+        return ColType::F64;
+    }
+}
+
+inline constexpr uint32_t col_type_width(ColType t) noexcept {
+    switch (t) {
+        case ColType::U8: case ColType::I8: return 1;
+        case ColType::U16: case ColType::I16: return 2;
+        case ColType::U32: case ColType::I32: case ColType::F32: return 4;
+        case ColType::U64: case ColType::I64: case ColType::F64: return 8;
+    }
+    return 0;
+}
+
+inline const char* col_type_name(ColType t) noexcept {
+    static constexpr const char* names[] = {"?", "u8", "u16", "u32", "u64", "i8", "i16", "i32", "i64", "f32", "f64"};
+    const auto i = static_cast<size_t>(t);
+    return i < sizeof(names) / sizeof(names[0]) ? names[i] : "?";
+}
+
+static constexpr uint32_t COLF_MAX_COLS = 16;
+// v2: the (ts, row) index after the last column
+static constexpr uint16_t COLF_VERSION = 2;
+
+// committed rows are fully stored in the columns, published with release after every batch.
+// closed is set once the hour file is final: rows, index and trimmed extents
+struct alignas(64) ColLive {
+    uint64_t committed;
+    uint32_t closed;
+    uint32_t _pad32{0};
+    uint8_t pad[64 - 8 - 4 - 4];
+};
+
+// readers load the live block of a mapped header through these, the mapping may be read only
+inline uint64_t colf_committed(const ColLive& l) noexcept {
+    return std::atomic_ref<uint64_t>(const_cast<uint64_t&>(l.committed)).load(std::memory_order_acquire);
+}
+
+inline bool colf_closed(const ColLive& l) noexcept {
+    return std::atomic_ref<uint32_t>(const_cast<uint32_t&>(l.closed)).load(std::memory_order_acquire) != 0;
+}
+
+// an entry of the index, `row` counts from the start of the hour across extents. the l2 book
+// indexes its checkpoints, other schemas have none
+struct ColIndexEntry {
+    uint64_t ts_ns;
+    uint64_t row;
+};
+
+static_assert(sizeof(ColIndexEntry) == 16, "index entry must be 16 bytes");
+
+// a column: its name, element type and width, and where it starts in the first extent
+struct ColDesc {
+    char name[14];
+    uint8_t type;
+    uint8_t width;
+    uint64_t off;
+};
+
+static_assert(sizeof(ColDesc) == 24, "column descriptor must be 24 bytes");
+
+struct alignas(64) ColFileHeader {
+    char magic[6];  // "COLHR\n"
+    uint16_t header_size;
+    uint16_t version;
+    uint16_t col_count;
+    // scales of the fixed point columns, the schema says which those are
+    uint8_t price_decimals;
+    uint8_t qty_decimals;
+    uint16_t _pad16{0};
+    // the schema name is also the file extension, hh00.<schema>
+    char schema[16];
+    char product[16];
+    uint64_t hour_epoch_start;
+    // set on close, an open file has its rows in live.committed
+    uint64_t rows;
+    // rows of all extents, and of the first one
+    uint64_t capacity;
+    uint64_t first_capacity;
+    uint32_t extent_count;
+    uint32_t _pad_ext{0};
+    uint64_t next_extent;
+    // v2: index_count ColIndexEntry records at index_off after the last column. only written on
+    // close, a file that was never closed has index_count 0
+    uint64_t index_off;
+    uint32_t index_count;
+    uint32_t _pad_index{0};
+    uint8_t pad[128 - 6 - 2 - 2 - 2 - 1 - 1 - 2 - 16 - 16 - 8 - 8 - 8 - 8 - 4 - 4 - 8 - 8 - 4 - 4];
+    ColDesc cols[COLF_MAX_COLS];
+    // progress of the open hour for tailing readers, the writer only ever stores to it atomically
+    ColLive live;
+};
+
+static_assert(sizeof(ColFileHeader) == 576, "header must be 576 bytes");
+static_assert(offsetof(ColFileHeader, cols) == 128, "column descriptors must start at 128");
+static_assert(offsetof(ColFileHeader, live) == 512, "live block must have a cache line of its own");
+
+// header at the start of every extent after the first
+struct alignas(64) ColExtentHeader {
+    char magic[6];  // "COLEX\n"
+    uint16_t index;
+    uint32_t _pad32{0};
+    uint64_t rows;
+    uint64_t capacity;
+    uint64_t next;
+    uint64_t col_off[COLF_MAX_COLS];
+};
+
+static_assert(sizeof(ColExtentHeader) == 192, "extent header must be 192 bytes");
+
+// base/yyyymmdd/hh00.<ext>, next to the l2 hour file of the same hour
+inline std::string colf_hour_path(const std::string& base, uint64_t hour_s, const char* ext) {
+    std::string p = l2col_hour_path(base, hour_s);
+    p.replace(p.size() - 3, 3, ext);
+    return p;
+}
+
+// a string literal as a template argument, for column and schema names
+template <size_t N>
+struct ColName {
+    char s[N]{};
+    constexpr ColName(const char (&v)[N]) noexcept {
+        for (size_t i = 0; i < N; ++i) {
+            s[i] = v[i];
+        }
+    }
+};
+
+template <typename M>
+struct col_member;
+
+template <typename R, typename T>
+struct col_member<T R::*> {
+    using row = R;
+    using type = T;
+};
+
+// one column, Member of the row struct stored under Name
+template <auto Member, ColName Name>
+struct Col {
+    using row_type = typename col_member<decltype(Member)>::row;
+    using type = typename col_member<decltype(Member)>::type;
+    static constexpr ColType kind = col_type_of<type>();
+    static constexpr const char* name = Name.s;
+    static_assert(sizeof(Name.s) <= sizeof(ColDesc::name), "column names have at most 13 characters");
+
+    static type get(const row_type& r) noexcept { return r.*Member; }
+    static void set(row_type& r, type v) noexcept { r.*Member = v; }
+};
+
+// the row type, its columns in file order, and the schema name. the first column is the row's
+// time in unix ns, it decides the hour a row goes to. files are hh00.<name> unless a schema
+// derived from this one sets ext
+template <ColName Name, typename Row, typename... Cols>
+struct ColSchema {
+    using row_type = Row;
+    using first_col = std::tuple_element_t<0, std::tuple<Cols...>>;
+    // typed pointers to row 0 of every column of an extent
+    using Pointers = std::tuple<typename Cols::type*...>;
+
+    static constexpr const char* name = Name.s;
+    static constexpr const char* ext = Name.s;
+    static constexpr uint32_t count = sizeof...(Cols);
+    static constexpr std::array<ColType, count> types{Cols::kind...};
+    static constexpr std::array<uint32_t, count> widths{static_cast<uint32_t>(sizeof(typename Cols::type))...};
+    static constexpr std::array<const char*, count> names{Cols::name...};
+
+    static_assert(count >= 1 && count <= COLF_MAX_COLS, "a schema has 1 to 16 columns");
+    static_assert(sizeof(Name.s) <= sizeof(ColFileHeader::schema), "schema names have at most 15 characters");
+    static_assert((std::is_same_v<typename Cols::row_type, Row> && ...), "every column must be a member of Row");
+    static_assert(first_col::kind == ColType::U64, "the first column is the row's ts in ns");
+
+    static uint64_t ts(const Row& r) noexcept { return first_col::get(r); }
+
+    // column pointers into an extent mapped at map
+    static Pointers pointers(uint8_t* map, uint64_t file_off, const uint64_t (&col_off)[COLF_MAX_COLS]) noexcept {
+        return [&]<size_t... I>(std::index_sequence<I...>) {
+            return Pointers{reinterpret_cast<typename Cols::type*>(map + (col_off[I] - file_off))...};
+        }(std::make_index_sequence<count>{});
+    }
+
+    // stores n rows at row k of the columns, one plain loop per column
+    static void scatter(const Row* rows, size_t n, const Pointers& p, uint64_t k) noexcept {
+        [&]<size_t... I>(std::index_sequence<I...>) {
+            (scatter_col<Cols>(rows, n, std::get<I>(p) + k), ...);
+        }(std::make_index_sequence<count>{});
+    }
+
+    // row k back from column base pointers, as a reader has them
+    static Row gather(const uint8_t* const* cols, uint64_t k) noexcept {
+        Row r{};
+        [&]<size_t... I>(std::index_sequence<I...>) {
+            (Cols::set(r, reinterpret_cast<const typename Cols::type*>(cols[I])[k]), ...);
+        }(std::make_index_sequence<count>{});
+        return r;
+    }
+
+    // true when the header's columns are this schema's, by name and type, in order
+    static bool matches(const ColFileHeader& h) noexcept {
+        if (h.col_count != count || std::strncmp(h.schema, name, sizeof(h.schema))) {
+            return false;
+        }
+        for (uint32_t c = 0; c < count; ++c) {
+            if (h.cols[c].type != static_cast<uint8_t>(types[c]) ||
+                std::strncmp(h.cols[c].name, names[c], sizeof(h.cols[c].name))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // the header's column descriptors, offsets are filled in by the writer
+    static void describe(ColFileHeader& h) noexcept {
+        h.col_count = static_cast<uint16_t>(count);
+        std::memcpy(h.schema, name, std::strlen(name));
+        for (uint32_t c = 0; c < count; ++c) {
+            std::memcpy(h.cols[c].name, names[c], std::strlen(names[c]));
+            h.cols[c].type = static_cast<uint8_t>(types[c]);
+            h.cols[c].width = static_cast<uint8_t>(widths[c]);
+        }
+    }
+
+private:
+    template <typename C>
+    static void scatter_col(const Row* __restrict rows, size_t n, typename C::type* __restrict dst) noexcept {
+        for (size_t i = 0; i < n; ++i) {
+            dst[i] = C::get(rows[i]);
+        }
+    }
+};
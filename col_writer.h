@@ -0,0 +1,274 @@
+#pragma once
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include "affinity.h"
+#include "col_file.h"
+#include "col_schema.h"
+#include "spill.h"
+#include "spsc.h"
+#include "wait_strategy.h"
+
+struct ColWriterOpt {
+    std::string base_dir;
+    std::string product;
+    // first extent of every hour, later extents double up to max_extent_rows
+    uint64_t initial_rows_per_hr{1ull << 16};
+    uint64_t max_extent_rows{1ull << 24};
+    uint32_t fsync_every_rows{0};
+    int cpu{-1};
+    WaitMode wait{WaitMode::Park};
+    uint32_t spin_polls{4096};
+    // recorded in the header for the schema's fixed point columns
+    uint8_t price_decimals{2};
+    uint8_t qty_decimals{8};
+    // rows with ts outside [record_from_ns, record_until_ns) are dropped without opening their
+    // hour, see L2WriterOpt
+    uint64_t record_from_ns{0};
+    uint64_t record_until_ns{~0ull};
+    // see L2WriterOpt::spill_rows, lost rows are only counted
+    size_t spill_rows{1u << 18};
+    uint64_t spill_file_bytes{1ull << 28};
+
+    ColWriterOpt(std::string base, std::string prod) : base_dir(std::move(base)), product(std::move(prod)) {}
+};
+
+// the hour file writer for any ColSchema: rows go through an spsc queue to a writer thread that
+// stores them into mapped, page aligned columns of base/yyyymmdd/hh00.<ext>. channels that carry
+// a fraction of the book's rows use it as is. L2Writer writes the l2 book's files through the
+// same ColFile and adds its checkpoints, top of book and Direct backend
+template <typename Schema, size_t QueueCapacity = (1ull << 16)>
+class ColWriter {
+public:
+    using Row = typename Schema::row_type;
+
+    explicit ColWriter(const ColWriterOpt& opt)
+        : opt_(opt), spill_(SpillOpt{opt.base_dir, opt.spill_rows, opt.spill_file_bytes}),
+          waiter_(opt.wait, opt.spin_polls) {}
+
+    ~ColWriter() {
+        stop();
+        join();
+    }
+
+    ColWriter(const ColWriter&) = delete;
+    ColWriter& operator=(const ColWriter&) = delete;
+
+    void start() {
+        bool expected = false;
+        if (!running_.compare_exchange_strong(expected, true)) {
+            return;
+        }
+        stop_.store(false, std::memory_order_release);
+        thread_ = std::make_unique<std::thread>(&ColWriter::run, this);
+        (void)pin_thread(*thread_, opt_.cpu, "ColWriter");
+    }
+
+    void stop() {
+        stop_.store(true, std::memory_order_release);
+        waiter_.wake();
+    }
+
+    void join() {
+        if (thread_ && thread_->joinable()) {
+            thread_->join();
+        }
+        thread_.reset();
+        running_.store(false, std::memory_order_release);
+    }
+
+    bool lock_queue() noexcept { return queue_.lock_memory(); }
+
+    // false only when the row is lost, a full queue spills it like L2Writer's does
+    bool enqueue(const Row& r) noexcept {
+        bool ok = !spill_.active() && queue_.enqueue(r);
+        if (!ok) [[unlikely]] {
+            ok = spill_.push(r);
+        }
+        waiter_.notify();
+        return ok;
+    }
+
+    uint64_t rows() const noexcept { return rows_.load(std::memory_order_acquire); }
+    uint64_t dropped() const noexcept { return dropped_.load(std::memory_order_relaxed); }
+    uint64_t overflowed() const noexcept { return spill_.overflowed(); }
+    uint64_t spilled() const noexcept { return spill_.spilled(); }
+    uint64_t spill_lost() const noexcept { return spill_.lost(); }
+    // rows persisted since start, across hour files
+    uint64_t persisted() const noexcept { return persisted_.load(std::memory_order_relaxed); }
+    uint64_t rotations() const noexcept { return rotations_.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t kBatchRows = 4096;
+
+    LockFreeQueue<Row, QueueCapacity> queue_;
+    ColWriterOpt opt_;
+    SpillQueue<Row> spill_;
+    typename SpillQueue<Row>::Chunk spill_chunk_;
+    Waiter waiter_;
+    std::unique_ptr<std::thread> thread_;
+    std::atomic<bool> running_{false};
+    std::atomic<bool> stop_{false};
+
+    ColFile file_;
+    uint64_t hour_start_{~0ull};
+    // rows [ext_base_, ext_end_) are in the newest extent, ptrs_ point at ext_base_
+    uint64_t ext_base_{0};
+    uint64_t ext_end_{0};
+    typename Schema::Pointers ptrs_{};
+    uint32_t last_sync_{0};
+    std::atomic<uint64_t> rows_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> persisted_{0};
+    std::atomic<uint64_t> rotations_{0};
+
+    static uint64_t hour_start_from_ns(uint64_t ts_ns) noexcept {
+        const uint64_t s = ts_ns / 1'000'000'000ull;
+        return (s / 3600ull) * 3600ull;
+    }
+
+    void run() {
+        while (true) {
+            auto batch = queue_.read_span(kBatchRows);
+            if (batch.empty()) {
+                // the queue is drained, what overflowed it comes next
+                if (spill_.active() && spill_.take(spill_chunk_)) {
+                    waiter_.reset();
+                    persist(spill_chunk_.rows.data(), spill_chunk_.rows.size());
+                    publish_committed();
+                    continue;
+                }
+                // the producer's last rows may have landed after the read above, they are only known to be
+                // visible once stop is seen
+                if (stop_.load(std::memory_order_acquire)) {
+                    if (queue_.empty() && !spill_.active()) {
+                        break;
+                    }
+                    continue;
+                }
+                waiter_.idle([this] {
+                    return !queue_.empty() || spill_.active() || stop_.load(std::memory_order_relaxed);
+                });
+                continue;
+            }
+            waiter_.reset();
+            persist(batch.first.data(), batch.first.size());
+            persist(batch.second.data(), batch.second.size());
+            publish_committed();
+            queue_.commit_read(batch.size());
+            // rows overflowing meanwhile wait in memory, the oldest move to the spill file from here
+            if (spill_.active()) {
+                spill_.offload();
+            }
+
+            if (opt_.fsync_every_rows && last_sync_ >= opt_.fsync_every_rows && file_.fd >= 0) {
+                file_.write_rows();
+                ::fdatasync(file_.fd);
+                last_sync_ = 0;
+            }
+        }
+        close_file();
+    }
+
+    bool in_window(uint64_t ts) const noexcept { return ts >= opt_.record_from_ns && ts < opt_.record_until_ns; }
+
+    void persist(const Row* rows, size_t n) {
+        size_t i = 0;
+        while (i < n) {
+            if (!in_window(Schema::ts(rows[i]))) {
+                ++i;
+                continue;
+            }
+            const uint64_t h = hour_start_from_ns(Schema::ts(rows[i]));
+            if (hour_start_ != h) {
+                if (!open_file(h)) {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    ++i;
+                    continue;
+                }
+                rotations_.fetch_add(1, std::memory_order_relaxed);
+                last_sync_ = 0;
+            }
+            // longest run that stays inside the open hour
+            size_t j = i + 1;
+            while (j < n && hour_start_from_ns(Schema::ts(rows[j])) == h && in_window(Schema::ts(rows[j]))) {
+                ++j;
+            }
+            const size_t done = append(rows + i, j - i);
+            persisted_.fetch_add(done, std::memory_order_relaxed);
+            dropped_.fetch_add(j - i - done, std::memory_order_relaxed);
+            i = j;
+        }
+    }
+
+    size_t append(const Row* rows, size_t n) {
+        size_t i = 0;
+        while (i < n) {
+            const uint64_t idx = rows_.load(std::memory_order_relaxed);
+            if (idx >= ext_end_ &&
+                !add_extent(std::min(opt_.max_extent_rows, file_.extents.back().capacity * 2))) {
+                break;
+            }
+            const size_t take = static_cast<size_t>(std::min<uint64_t>(n - i, ext_end_ - idx));
+            Schema::scatter(rows + i, take, ptrs_, idx - ext_base_);
+            rows_.store(idx + take, std::memory_order_release);
+            file_.hdr.rows = idx + take;
+            last_sync_ += static_cast<uint32_t>(take);
+            i += take;
+        }
+        return i;
+    }
+
+    void publish_committed() noexcept { file_.publish(rows_.load(std::memory_order_relaxed)); }
+
+    bool open_file(uint64_t hour_s) {
+        close_file();
+        ColFileHeader h{};
+        Schema::describe(h);
+        h.price_decimals = opt_.price_decimals;
+        h.qty_decimals = opt_.qty_decimals;
+        std::memcpy(h.product, opt_.product.data(), std::min(opt_.product.size(), sizeof(h.product)));
+        h.hour_epoch_start = hour_s;
+        const std::string path = colf_hour_path(opt_.base_dir, hour_s, Schema::ext);
+        if (!file_.create(path, h, opt_.initial_rows_per_hr, ColMapOpt{})) {
+            std::cerr << "[ColWriter] " << path << ": " << std::strerror(errno) << '\n';
+            return false;
+        }
+        rows_.store(0, std::memory_order_release);
+        hour_start_ = hour_s;
+        enter_extent();
+        return true;
+    }
+
+    bool add_extent(uint64_t capacity) {
+        if (!file_.add_extent(capacity, ColMapOpt{})) {
+            return false;
+        }
+        enter_extent();
+        return true;
+    }
+
+    // points the columns at the start of the newest extent
+    void enter_extent() noexcept {
+        const ColExtent& e = file_.extents.back();
+        ext_base_ = e.row_base;
+        ext_end_ = e.row_base + e.capacity;
+        ptrs_ = Schema::pointers(e.map, e.file_off, e.col_off);
+    }
+
+    void close_file() {
+        if (file_.fd < 0) {
+            return;
+        }
+        file_.finish();
+        file_.release();
+        hour_start_ = ~0ull;
+    }
+};
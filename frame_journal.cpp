@@ -0,0 +1,288 @@
+#include "frame_journal.h"
+#include "affinity.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t realtime_ns() noexcept {
+    timespec ts{};
+    ::clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+static uint64_t monotonic_ns() noexcept {
+    timespec ts{};
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// the type of an l2_data message is in its first event, well inside the first fragment
+static bool is_snapshot(const char* buf, size_t len) noexcept {
+    static constexpr char CHANNEL[] = R"({"channel":"l2_data")";
+    static constexpr char TYPE[] = R"("type":"snapshot")";
+    if (len < sizeof(CHANNEL) - 1 || std::memcmp(buf, CHANNEL, sizeof(CHANNEL) - 1) != 0) {
+        return false;
+    }
+    return ::memmem(buf, std::min<size_t>(len, 512), TYPE, sizeof(TYPE) - 1) != nullptr;
+}
+
+FrameJournal::FrameJournal(const FrameJournalOpt& opt)
+    : opt_(opt), ring_(opt.ring_bytes), waiter_(opt.wait) {
+    // the batch always takes one more record whole
+    batch_.reserve(opt_.batch_bytes + frame_record_bytes(ring_.max_payload()));
+}
+
+FrameJournal::~FrameJournal() {
+    stop();
+    join();
+}
+
+void FrameJournal::start() {
+    if (thread_) {
+        return;
+    }
+    thread_ = std::make_unique<std::thread>(&FrameJournal::run, this);
+    (void)pin_thread(*thread_, opt_.cpu, "FrameJournal");
+}
+
+void FrameJournal::stop() {
+    stopping_.store(true, std::memory_order_release);
+    waiter_.wake();
+}
+
+void FrameJournal::join() {
+    if (thread_ && thread_->joinable()) {
+        thread_->join();
+    }
+}
+
+// copies the fragment into the ring. a full ring means the disk is behind, the loop waits for
+// room rather than lose a frame
+void FrameJournal::append(uint16_t leg, const char* buf, size_t len, uint8_t flags) {
+    const uint64_t now = realtime_ns();
+    // a fragment longer than a record goes in pieces, the first and final flags on the outer ones
+    while (len > ring_.max_payload()) {
+        const size_t n = ring_.max_payload();
+        while (!ring_.push(buf, n, leg, flags & ~JRNL_FINAL, now)) {
+            _mm_pause();
+        }
+        buf += n;
+        len -= n;
+        flags &= ~JRNL_FIRST;
+    }
+    if (!ring_.push(buf, len, leg, flags, now)) {
+        stalls_.store(stalls_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        waiter_.notify();
+        while (!ring_.push(buf, len, leg, flags, now)) {
+            _mm_pause();
+        }
+    }
+    waiter_.notify();
+}
+
+void FrameJournal::run() {
+    ByteRing::Record r;
+    for (;;) {
+        if (ring_.front(r)) {
+            waiter_.reset();
+            take(r);
+            ring_.pop();
+            continue;
+        }
+        // the ring is idle, what has waited flush_ms goes out now
+        if (!batch_.empty() && monotonic_ns() - batch_since_ns_ >= opt_.flush_ms * 1'000'000ull) {
+            flush();
+        }
+        if (stopping_.load(std::memory_order_acquire) && ring_.empty()) {
+            break;
+        }
+        waiter_.idle([&] { return !ring_.empty() || stopping_.load(std::memory_order_relaxed); });
+    }
+    close_hour();
+}
+
+void FrameJournal::take(const ByteRing::Record& r) {
+    const uint8_t leg = static_cast<uint8_t>(r.tag & 1);
+    const uint8_t flags = static_cast<uint8_t>(r.flags);
+    const uint64_t hour_s = r.stamp / 1'000'000'000ull / 3600 * 3600;
+    const bool between = !in_message_[0] && !in_message_[1];
+    if (fd_ < 0 || (hour_s != hour_s_ && between && (flags & JRNL_FIRST))) {
+        close_hour();
+        if (!open_hour(hour_s)) {
+            lost_bytes_.fetch_add(frame_record_bytes(r.len), std::memory_order_relaxed);
+            return;
+        }
+    }
+    if (flags & JRNL_LEG_DOWN) {
+        in_message_[leg] = 0;
+    }
+    else {
+        in_message_[leg] = !(flags & JRNL_FINAL);
+    }
+    if (flags & JRNL_FIRST) {
+        ++hdr_.messages;
+        hdr_.snapshots += is_snapshot(r.data, r.len);
+    }
+
+    if (batch_.empty()) {
+        batch_since_ns_ = monotonic_ns();
+    }
+    FrameRecord fr{};
+    fr.recv_ns = r.stamp;
+    fr.len = r.len;
+    fr.leg = leg;
+    fr.flags = flags;
+    const size_t at = batch_.size();
+    const size_t bytes = frame_record_bytes(r.len);
+    batch_.resize(at + bytes);
+    std::memcpy(batch_.data() + at, &fr, sizeof(fr));
+    std::memcpy(batch_.data() + at + sizeof(fr), r.data, r.len);
+    std::memset(batch_.data() + at + sizeof(fr) + r.len, 0, bytes - sizeof(fr) - r.len);
+    ++hdr_.frames;
+    hdr_.bytes += bytes;
+    frames_.store(frames_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (batch_.size() >= opt_.batch_bytes) {
+        flush();
+    }
+}
+
+// one write per batch at the end of the file, a short write is finished by the loop
+void FrameJournal::flush() {
+    size_t off = 0;
+    while (off < batch_.size()) {
+        const ssize_t n = ::write(fd_, batch_.data() + off, batch_.size() - off);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            std::cerr << "[FrameJournal] " << opt_.name << ": lost " << batch_.size() - off << " bytes: "
+                << std::strerror(errno) << '\n';
+            lost_bytes_.fetch_add(batch_.size() - off, std::memory_order_relaxed);
+            break;
+        }
+        off += static_cast<size_t>(n);
+        bytes_.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+    }
+    batch_.clear();
+}
+
+bool FrameJournal::open_hour(uint64_t hour_s) {
+    const std::string path = frame_journal_path(opt_.dir, hour_s);
+    if (!ColFile::mkdir_p(std::filesystem::path(path).parent_path().string())) {
+        std::cerr << "[FrameJournal] cannot create the directory of " << path << '\n';
+        return false;
+    }
+    // a journal is never reopened: an hour the process comes back to gets its own file
+    std::string p = path;
+    int fd = -1;
+    for (int k = 1; fd < 0; ++k) {
+        fd = ::open(p.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0644);
+        if (fd < 0 && (errno != EEXIST || k > 99)) {
+            std::cerr << "[FrameJournal] " << p << ": " << std::strerror(errno) << '\n';
+            return false;
+        }
+        if (fd < 0) {
+            p = path + "." + std::to_string(k);
+        }
+    }
+    FrameJournalHeader h{};
+    std::memcpy(h.magic, "L2FRM\n", 6);
+    h.header_size = sizeof(FrameJournalHeader);
+    h.version = FRAME_JOURNAL_VERSION;
+    h.legs = opt_.legs;
+    h.hour_epoch_start = hour_s;
+    std::memcpy(h.name, opt_.name.data(), std::min(opt_.name.size(), sizeof(h.name) - 1));
+    std::memcpy(h.products, opt_.products.data(), std::min(opt_.products.size(), sizeof(h.products) - 1));
+    if (::write(fd, &h, sizeof(h)) != static_cast<ssize_t>(sizeof(h))) {
+        std::cerr << "[FrameJournal] " << p << ": " << std::strerror(errno) << '\n';
+        ::close(fd);
+        return false;
+    }
+    hdr_ = h;
+    fd_ = fd;
+    hour_s_ = hour_s;
+    return true;
+}
+
+// the header is rewritten with the final counts once every record is in the file
+void FrameJournal::close_hour() {
+    if (fd_ < 0) {
+        return;
+    }
+    flush();
+    hdr_.closed = 1;
+    if (::pwrite(fd_, &hdr_, sizeof(hdr_), 0) != static_cast<ssize_t>(sizeof(hdr_))) {
+        std::cerr << "[FrameJournal] " << opt_.name << ": header not updated: " << std::strerror(errno) << '\n';
+    }
+    ::fdatasync(fd_);
+    ::close(fd_);
+    fd_ = -1;
+    hour_s_ = ~0ull;
+}
+
+FrameJournalFile::~FrameJournalFile() {
+    close();
+}
+
+void FrameJournalFile::close() {
+    if (map_) {
+        ::munmap(const_cast<uint8_t*>(map_), map_bytes_);
+    }
+    map_ = nullptr;
+    map_bytes_ = 0;
+    hdr_ = FrameJournalHeader{};
+}
+
+bool FrameJournalFile::fail(const std::string& path, const char* why) {
+    error_ = path + ": " + why;
+    close();
+    return false;
+}
+
+bool FrameJournalFile::open(const std::string& path) {
+    close();
+    error_.clear();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return fail(path, std::strerror(errno));
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(FrameJournalHeader)) {
+        ::close(fd);
+        return fail(path, "too short for a header");
+    }
+    void* m = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        return fail(path, std::strerror(errno));
+    }
+    map_ = static_cast<const uint8_t*>(m);
+    map_bytes_ = static_cast<size_t>(st.st_size);
+    // replay reads it front to back once
+    ::madvise(const_cast<uint8_t*>(map_), map_bytes_, MADV_SEQUENTIAL);
+
+    std::memcpy(&hdr_, map_, sizeof(hdr_));
+    if (std::memcmp(hdr_.magic, "L2FRM\n", 6) != 0) {
+        return fail(path, "bad magic");
+    }
+    if (hdr_.version < 1 || hdr_.version > FRAME_JOURNAL_VERSION) {
+        return fail(path, "unsupported version");
+    }
+    if (hdr_.header_size != sizeof(FrameJournalHeader)) {
+        return fail(path, "bad header size");
+    }
+    if (hdr_.legs < 1 || hdr_.legs > 2) {
+        return fail(path, "bad leg count");
+    }
+    hdr_.name[sizeof(hdr_.name) - 1] = 0;
+    hdr_.products[sizeof(hdr_.products) - 1] = 0;
+    return true;
+}
@@ -0,0 +1,182 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "l2_writer.h"
+#include "spsc.h"
+#include "wait_strategy.h"
+
+// every websocket payload of a connection as it was received, so what the parser dropped or got
+// wrong can be decoded again. one append-only file per connection and hour of receive time,
+// base/journal/<name>/yyyymmdd/hh00.frames: a header page, then records back to back, each a
+// FrameRecord and its payload padded to 8 bytes. records are only ever written whole, a reader of
+// an open or torn file stops at the first one that runs past its end.
+
+static constexpr uint16_t FRAME_JOURNAL_VERSION = 1;
+
+// flags of a record. a leg drop has no payload, replay drops the leg's message in progress and
+// marks its gaps as the recording did
+enum : uint8_t { JRNL_FIRST = 1, JRNL_FINAL = 2, JRNL_LEG_DOWN = 4 };
+
+struct FrameJournalHeader {
+    char magic[8];  // "L2FRM\n"
+    uint16_t header_size;
+    uint16_t version;
+    // 1 or 2, a journal of a redundant connection has both legs' frames
+    uint16_t legs;
+    uint16_t _pad16{0};
+    uint64_t hour_epoch_start;
+    // set on close, with the counts below final. an open file has its records up to its size
+    uint32_t closed;
+    uint32_t _pad32{0};
+    uint64_t frames;
+    uint64_t messages;
+    // messages that are l2_data snapshots, an hour with some can be replayed without the ones before
+    uint64_t snapshots;
+    // record bytes after the header
+    uint64_t bytes;
+    char name[32];
+    // the connection's products and their scales, "BTC-USD=2:8,ETH-USD=2:8"
+    char products[4096 - 96];
+};
+
+static_assert(sizeof(FrameJournalHeader) == 4096, "journal header must be one page");
+
+struct FrameRecord {
+    // wall clock when lws handed the fragment over
+    uint64_t recv_ns;
+    uint32_t len;
+    uint8_t leg;
+    uint8_t flags;
+    uint16_t _pad{0};
+};
+
+static_assert(sizeof(FrameRecord) == 16, "frame record header must be 16 bytes");
+
+inline constexpr size_t frame_record_bytes(size_t len) noexcept {
+    return sizeof(FrameRecord) + ((len + 7) & ~size_t{7});
+}
+
+// dir/yyyymmdd/hh00.frames
+inline std::string frame_journal_path(const std::string& dir, uint64_t hour_s) {
+    std::string p = l2col_hour_path(dir, hour_s);
+    p.replace(p.size() - 3, 3, "frames");
+    return p;
+}
+
+struct FrameJournalOpt {
+    // base/journal/<name>
+    std::string dir;
+    std::string name;
+    // written into every header, see FrameJournalHeader::products
+    std::string products;
+    uint16_t legs{1};
+    // between the event loop and the journal thread. a full ring makes the loop wait
+    size_t ring_bytes{16u << 20};
+    // records are gathered into writes of this size, or whatever is there once the ring has been
+    // idle for flush_ms
+    size_t batch_bytes{1u << 20};
+    uint32_t flush_ms{200};
+    int cpu{-1};
+    WaitMode wait{WaitMode::Park};
+};
+
+class FrameJournal {
+public:
+    explicit FrameJournal(const FrameJournalOpt& opt);
+    ~FrameJournal();
+    FrameJournal(const FrameJournal&) = delete;
+    FrameJournal& operator=(const FrameJournal&) = delete;
+
+    void start();
+    // the thread writes what is in the ring, closes the hour and exits
+    void stop();
+    void join();
+
+    // event loop side: copies one fragment in with the time it is called at
+    void append(uint16_t leg, const char* buf, size_t len, uint8_t flags);
+
+    uint64_t frames() const noexcept { return frames_.load(std::memory_order_relaxed); }
+    uint64_t bytes() const noexcept { return bytes_.load(std::memory_order_relaxed); }
+    // times append found the ring full and waited
+    uint64_t stalls() const noexcept { return stalls_.load(std::memory_order_relaxed); }
+    // record bytes a failed write lost
+    uint64_t lost_bytes() const noexcept { return lost_bytes_.load(std::memory_order_relaxed); }
+
+private:
+    void run();
+    void take(const ByteRing::Record& r);
+    bool open_hour(uint64_t hour_s);
+    void close_hour();
+    void flush();
+
+    FrameJournalOpt opt_;
+    ByteRing ring_;
+    Waiter waiter_;
+    std::unique_ptr<std::thread> thread_;
+    std::atomic<bool> stopping_{false};
+
+    // journal thread only
+    int fd_{-1};
+    uint64_t hour_s_{~0ull};
+    FrameJournalHeader hdr_{};
+    std::vector<char> batch_;
+    uint64_t batch_since_ns_{0};
+    // per leg, a message is between its first and final fragment. an hour only changes between
+    // messages so every file replays on its own
+    uint8_t in_message_[2]{};
+
+    std::atomic<uint64_t> frames_{0};
+    std::atomic<uint64_t> bytes_{0};
+    std::atomic<uint64_t> stalls_{0};
+    std::atomic<uint64_t> lost_bytes_{0};
+};
+
+// read side: maps a journal and walks its records in order
+class FrameJournalFile {
+public:
+    FrameJournalFile() = default;
+    ~FrameJournalFile();
+    FrameJournalFile(const FrameJournalFile&) = delete;
+    FrameJournalFile& operator=(const FrameJournalFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    const std::string& error() const noexcept { return error_; }
+    const FrameJournalHeader& header() const noexcept { return hdr_; }
+    uint64_t hour_s() const noexcept { return hdr_.hour_epoch_start; }
+
+    // calls f(const FrameRecord&, const char* payload) for every whole record, stops early when
+    // f returns false. returns the records visited
+    template <typename F>
+    uint64_t for_each(F&& f) const {
+        uint64_t n = 0;
+        size_t off = sizeof(FrameJournalHeader);
+        while (off + sizeof(FrameRecord) <= map_bytes_) {
+            const auto* r = reinterpret_cast<const FrameRecord*>(map_ + off);
+            const size_t bytes = frame_record_bytes(r->len);
+            if (off + bytes > map_bytes_) {
+                break;
+            }
+            ++n;
+            if (!f(*r, reinterpret_cast<const char*>(r + 1))) {
+                break;
+            }
+            off += bytes;
+        }
+        return n;
+    }
+
+private:
+    const uint8_t* map_{nullptr};
+    size_t map_bytes_{0};
+    FrameJournalHeader hdr_{};
+    std::string error_;
+
+    bool fail(const std::string& path, const char* why);
+};
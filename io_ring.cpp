@@ -0,0 +1,120 @@
+#include "io_ring.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+IoRing::~IoRing() {
+    release();
+}
+
+void IoRing::release() noexcept {
+    if (sqes_) {
+        ::munmap(sqes_, sqes_bytes_);
+    }
+    if (cq_map_ && cq_map_ != sq_map_) {
+        ::munmap(cq_map_, cq_bytes_);
+    }
+    if (sq_map_) {
+        ::munmap(sq_map_, sq_bytes_);
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+    fd_ = -1;
+    sq_map_ = nullptr;
+    cq_map_ = nullptr;
+    sqes_ = nullptr;
+}
+
+bool IoRing::init(uint32_t entries) {
+    release();
+    io_uring_params p{};
+    fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+    if (fd_ < 0) {
+        return false;
+    }
+    sq_bytes_ = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    cq_bytes_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    // kernels since 5.4 share one mapping for both rings
+    const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        sq_bytes_ = cq_bytes_ = std::max(sq_bytes_, cq_bytes_);
+    }
+    sq_map_ = ::mmap(nullptr, sq_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (sq_map_ == MAP_FAILED) {
+        sq_map_ = nullptr;
+        release();
+        return false;
+    }
+    cq_map_ = single ? sq_map_ :
+        ::mmap(nullptr, cq_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+    sqes_bytes_ = p.sq_entries * sizeof(io_uring_sqe);
+    void* s = ::mmap(nullptr, sqes_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (cq_map_ == MAP_FAILED || s == MAP_FAILED) {
+        cq_map_ = cq_map_ == MAP_FAILED ? nullptr : cq_map_;
+        release();
+        return false;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(s);
+
+    auto* sq = static_cast<uint8_t*>(sq_map_);
+    sq_head_ = reinterpret_cast<uint32_t*>(sq + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<uint32_t*>(sq + p.sq_off.tail);
+    sq_array_ = reinterpret_cast<uint32_t*>(sq + p.sq_off.array);
+    sq_mask_ = *reinterpret_cast<uint32_t*>(sq + p.sq_off.ring_mask);
+    sq_entries_ = p.sq_entries;
+    auto* cq = static_cast<uint8_t*>(cq_map_);
+    cq_head_ = reinterpret_cast<uint32_t*>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<uint32_t*>(cq + p.cq_off.tail);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    cq_mask_ = *reinterpret_cast<uint32_t*>(cq + p.cq_off.ring_mask);
+    to_submit_ = 0;
+    return true;
+}
+
+bool IoRing::write(int fd, const void* buf, uint32_t len, uint64_t off, uint64_t user_data) noexcept {
+    if (fd_ < 0) {
+        const ssize_t n = ::pwrite(fd, buf, len, static_cast<off_t>(off));
+        done_.emplace_back(user_data, n < 0 ? -errno : static_cast<int32_t>(n));
+        return true;
+    }
+    const uint32_t tail = *sq_tail_;
+    if (tail - std::atomic_ref<uint32_t>(*sq_head_).load(std::memory_order_acquire) >= sq_entries_) {
+        return false;
+    }
+    const uint32_t idx = tail & sq_mask_;
+    io_uring_sqe& e = sqes_[idx];
+    std::memset(&e, 0, sizeof(e));
+    e.opcode = IORING_OP_WRITE;
+    e.fd = fd;
+    e.addr = reinterpret_cast<uint64_t>(buf);
+    e.len = len;
+    e.off = off;
+    e.user_data = user_data;
+    sq_array_[idx] = idx;
+    std::atomic_ref<uint32_t>(*sq_tail_).store(tail + 1, std::memory_order_release);
+    ++to_submit_;
+    return true;
+}
+
+bool IoRing::submit(bool wait) noexcept {
+    if (fd_ < 0) {
+        return true;
+    }
+    while (to_submit_ || wait) {
+        const long n = ::syscall(__NR_io_uring_enter, fd_, to_submit_, wait ? 1u : 0u,
+                                 wait ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        to_submit_ -= static_cast<uint32_t>(n);
+        wait = false;
+    }
+    return true;
+}
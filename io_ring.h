@@ -0,0 +1,73 @@
+#pragma once
+#include <linux/io_uring.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// just enough io_uring for the writer, over the raw syscalls: queued writes and their
+// completions. when the kernel refuses a ring (too old, seccomp in a container) every write is
+// done with pwrite as it is queued and completes right away, callers see the same interface.
+class IoRing {
+public:
+    IoRing() = default;
+    ~IoRing();
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    // sets up a ring of `entries` submissions, false means the pwrite fallback is in use
+    bool init(uint32_t entries);
+    bool uring() const noexcept { return fd_ >= 0; }
+
+    // queues a write of len bytes at off, false when the submission ring is full
+    bool write(int fd, const void* buf, uint32_t len, uint64_t off, uint64_t user_data) noexcept;
+    // hands the queued writes to the kernel and, when wait is set, blocks until at least one
+    // completion is ready. returns false on a ring error other than an interrupt
+    bool submit(bool wait) noexcept;
+
+    // calls f(user_data, res) for every ready completion, res is bytes written or -errno
+    template <typename F>
+    size_t reap(F&& f) {
+        size_t n = 0;
+        if (fd_ < 0) {
+            for (const auto& [ud, res] : done_) {
+                f(ud, res);
+                ++n;
+            }
+            done_.clear();
+            return n;
+        }
+        uint32_t head = *cq_head_;
+        const uint32_t tail = std::atomic_ref<uint32_t>(*cq_tail_).load(std::memory_order_acquire);
+        for (; head != tail; ++head, ++n) {
+            const io_uring_cqe& c = cqes_[head & cq_mask_];
+            f(static_cast<uint64_t>(c.user_data), c.res);
+        }
+        std::atomic_ref<uint32_t>(*cq_head_).store(head, std::memory_order_release);
+        return n;
+    }
+
+private:
+    int fd_{-1};
+    void* sq_map_{nullptr};
+    void* cq_map_{nullptr};
+    size_t sq_bytes_{0};
+    size_t cq_bytes_{0};
+    io_uring_sqe* sqes_{nullptr};
+    size_t sqes_bytes_{0};
+    uint32_t* sq_head_{nullptr};
+    uint32_t* sq_tail_{nullptr};
+    uint32_t* sq_array_{nullptr};
+    uint32_t sq_mask_{0};
+    uint32_t sq_entries_{0};
+    uint32_t* cq_head_{nullptr};
+    uint32_t* cq_tail_{nullptr};
+    io_uring_cqe* cqes_{nullptr};
+    uint32_t cq_mask_{0};
+    uint32_t to_submit_{0};
+    // completions of the pwrite fallback
+    std::vector<std::pair<uint64_t, int32_t>> done_;
+
+    void release() noexcept;
+};
@@ -0,0 +1,313 @@
+#include "l2_agg.h"
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include "l2_compact.h"
+
+void L2AggSide::merge(const L2AggSide& o) noexcept {
+    updates += o.updates;
+    deletes += o.deletes;
+    qty += o.qty;
+    px_min = std::min(px_min, o.px_min);
+    px_max = std::max(px_max, o.px_max);
+}
+
+void L2AggResult::merge(const L2AggResult& o) {
+    for (int s = 0; s < 2; ++s) {
+        side[s].merge(o.side[s]);
+    }
+    if (buckets.size() < o.buckets.size()) {
+        buckets.resize(o.buckets.size());
+    }
+    for (size_t k = 0; k < o.buckets.size(); ++k) {
+        for (int s = 0; s < 2; ++s) {
+            buckets[k].updates[s] += o.buckets[k].updates[s];
+            buckets[k].deletes[s] += o.buckets[k].deletes[s];
+        }
+    }
+    rows += o.rows;
+    bytes += o.bytes;
+}
+
+void l2_agg_rows_scalar(const uint32_t* px, const int64_t* qty, const uint8_t* side, size_t n,
+                        const L2AggFilter& f, L2AggSide (&out)[2]) {
+    uint64_t updates[2]{};
+    uint64_t deletes[2]{};
+    int64_t sum[2]{};
+    for (size_t i = 0; i < n; ++i) {
+        const uint8_t sd = side[i];
+        const uint32_t p = px[i];
+        if ((sd & f.exclude) || p < f.px_lo || p > f.px_hi) {
+            continue;
+        }
+        const int s = sd & SIDE_BID;
+        ++updates[s];
+        deletes[s] += qty[i] == 0;
+        sum[s] += qty[i];
+        out[s].px_min = std::min(out[s].px_min, p);
+        out[s].px_max = std::max(out[s].px_max, p);
+    }
+    for (int s = 0; s < 2; ++s) {
+        out[s].updates += updates[s];
+        out[s].deletes += deletes[s];
+        out[s].qty += sum[s];
+    }
+}
+
+template <typename T>
+__attribute__((target("avx2"))) static T hsum(__m256i v) noexcept {
+    alignas(32) T lanes[32 / sizeof(T)];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), v);
+    T s = 0;
+    for (T x : lanes) {
+        s += x;
+    }
+    return s;
+}
+
+// 8 rows per step. the side bytes widen to dwords and give a keep mask per book side, which
+// selects the rows for the counts and price bounds and, widened again to qwords, for the qty sums
+// and deletes
+__attribute__((target("avx2")))
+void l2_agg_rows_avx2(const uint32_t* px, const int64_t* qty, const uint8_t* side, size_t n,
+                      const L2AggFilter& f, L2AggSide (&out)[2]) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi32(-1);
+    const __m256i bid_bit = _mm256_set1_epi32(SIDE_BID);
+    const __m256i exclude = _mm256_set1_epi32(f.exclude);
+    const __m256i lo = _mm256_set1_epi32(static_cast<int>(f.px_lo));
+    const __m256i hi = _mm256_set1_epi32(static_cast<int>(f.px_hi));
+    __m256i updates[2] = {zero, zero};
+    __m256i deletes[2] = {zero, zero};
+    __m256i sum[2] = {zero, zero};
+    __m256i mn[2] = {ones, ones};
+    __m256i mx[2] = {zero, zero};
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256i sd = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(side + i)));
+        const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(px + i));
+        const __m256i q0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(qty + i));
+        const __m256i q1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(qty + i + 4));
+
+        __m256i keep = _mm256_cmpeq_epi32(_mm256_and_si256(sd, exclude), zero);
+        keep = _mm256_and_si256(keep, _mm256_cmpeq_epi32(_mm256_max_epu32(p, lo), p));
+        keep = _mm256_and_si256(keep, _mm256_cmpeq_epi32(_mm256_min_epu32(p, hi), p));
+        const __m256i bid = _mm256_cmpeq_epi32(_mm256_and_si256(sd, bid_bit), bid_bit);
+        const __m256i m[2] = {_mm256_andnot_si256(bid, keep), _mm256_and_si256(bid, keep)};
+        const __m256i z0 = _mm256_cmpeq_epi64(q0, zero);
+        const __m256i z1 = _mm256_cmpeq_epi64(q1, zero);
+
+        for (int s = 0; s < 2; ++s) {
+            const __m256i m0 = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(m[s]));
+            const __m256i m1 = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(m[s], 1));
+            // masks are -1 per selected lane, subtracting them counts
+            updates[s] = _mm256_sub_epi32(updates[s], m[s]);
+            deletes[s] = _mm256_sub_epi64(deletes[s], _mm256_and_si256(z0, m0));
+            deletes[s] = _mm256_sub_epi64(deletes[s], _mm256_and_si256(z1, m1));
+            sum[s] = _mm256_add_epi64(sum[s], _mm256_and_si256(q0, m0));
+            sum[s] = _mm256_add_epi64(sum[s], _mm256_and_si256(q1, m1));
+            mn[s] = _mm256_min_epu32(mn[s], _mm256_blendv_epi8(ones, p, m[s]));
+            mx[s] = _mm256_max_epu32(mx[s], _mm256_and_si256(p, m[s]));
+        }
+    }
+
+    for (int s = 0; s < 2; ++s) {
+        alignas(32) uint32_t lanes_mn[8];
+        alignas(32) uint32_t lanes_mx[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes_mn), mn[s]);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes_mx), mx[s]);
+        const uint64_t u = hsum<uint32_t>(updates[s]);
+        out[s].updates += u;
+        out[s].deletes += hsum<uint64_t>(deletes[s]);
+        out[s].qty += hsum<int64_t>(sum[s]);
+        if (u) {
+            out[s].px_min = std::min(out[s].px_min, *std::min_element(lanes_mn, lanes_mn + 8));
+            out[s].px_max = std::max(out[s].px_max, *std::max_element(lanes_mx, lanes_mx + 8));
+        }
+    }
+    l2_agg_rows_scalar(px + i, qty + i, side + i, n - i, f, out);
+}
+
+l2_agg_fn l2_agg_select(const char** name) noexcept {
+    __builtin_cpu_init();
+    const bool avx2 = __builtin_cpu_supports("avx2");
+    if (name) {
+        *name = avx2 ? "avx2" : "scalar";
+    }
+    return avx2 ? &l2_agg_rows_avx2 : &l2_agg_rows_scalar;
+}
+
+namespace {
+
+// rows [r0, r1) of one hour
+struct AggChunk {
+    uint32_t file;
+    uint64_t r0;
+    uint64_t r1;
+};
+
+// a thread's share of the chunks. the owner takes from the front, idle threads steal from the back
+struct AggQueue {
+    std::mutex mu;
+    std::deque<AggChunk> chunks;
+
+    bool take(AggChunk& c, bool steal) {
+        std::lock_guard<std::mutex> lk(mu);
+        if (chunks.empty()) {
+            return false;
+        }
+        if (steal) {
+            c = chunks.back();
+            chunks.pop_back();
+        }
+        else {
+            c = chunks.front();
+            chunks.pop_front();
+        }
+        return true;
+    }
+};
+
+}  // namespace
+
+// one chunk into a thread's partial result. with buckets the rows of a segment are cut where the
+// ts crosses a bucket edge, found by binary search, and each piece goes through the kernel alone
+static void agg_chunk(const L2StoredHour& f, const AggChunk& c, const L2AggQuery& q, const L2AggFilter& filter,
+                      l2_agg_fn kernel, L2AggResult& part) {
+    part.rows += c.r1 - c.r0;
+    part.bytes += (c.r1 - c.r0) * (sizeof(uint32_t) + sizeof(int64_t) + sizeof(uint8_t));
+    f.for_each_segment(c.r0, c.r1, [&](const L2Segment& s) {
+        if (!q.bucket_ns) {
+            kernel(s.price.data(), s.qty.data(), s.side.data(), s.size(), filter, part.side);
+            return;
+        }
+        const uint64_t last = part.buckets.size() - 1;
+        size_t i = 0;
+        while (i < s.size()) {
+            // rows are in arrival order, a ts that steps back lands in the bucket being filled
+            const uint64_t ts = std::max(s.ts[i], q.t0_ns);
+            const uint64_t k = std::min((ts - q.t0_ns) / q.bucket_ns, last);
+            const uint64_t edge = q.t0_ns + (k + 1) * q.bucket_ns;
+            const size_t j = k == last ? s.size()
+                : static_cast<size_t>(std::lower_bound(s.ts.begin() + i + 1, s.ts.end(), edge) - s.ts.begin());
+            L2AggSide piece[2];
+            kernel(s.price.data() + i, s.qty.data() + i, s.side.data() + i, j - i, filter, piece);
+            for (int sd = 0; sd < 2; ++sd) {
+                part.buckets[k].updates[sd] += piece[sd].updates;
+                part.buckets[k].deletes[sd] += piece[sd].deletes;
+                part.side[sd].merge(piece[sd]);
+            }
+            i = j;
+        }
+    });
+}
+
+// the price bounds in ticks, rounded inward
+static uint32_t to_ticks(double px, uint8_t decimals, bool up) noexcept {
+    const double t = px * std::pow(10.0, decimals);
+    const double r = up ? std::ceil(t - 1e-6) : std::floor(t + 1e-6);
+    return static_cast<uint32_t>(std::clamp(r, 0.0, 4294967295.0));
+}
+
+bool l2_aggregate(const std::string& product_dir, const L2AggQuery& q, L2AggResult& out, std::string& error) {
+    out = L2AggResult{};
+    if (q.t1_ns <= q.t0_ns) {
+        error = "empty time range";
+        return false;
+    }
+    if (q.bucket_ns) {
+        const uint64_t n = (q.t1_ns - q.t0_ns + q.bucket_ns - 1) / q.bucket_ns;
+        if (n > (1ull << 24)) {
+            error = "more than 16M buckets";
+            return false;
+        }
+        out.buckets.resize(n);
+    }
+
+    // every hour is opened up front, the chunks point into them. an hour whose raw file was
+    // compacted away is decoded from its l2z file
+    std::vector<L2StoredHour> files;
+    std::vector<AggChunk> chunks;
+    const uint64_t first_h = q.t0_ns / 1'000'000'000ull / 3600 * 3600;
+    const uint64_t last_h = (q.t1_ns - 1) / 1'000'000'000ull / 3600 * 3600;
+    for (uint64_t h = first_h; h <= last_h; h += 3600) {
+        const std::string path = l2col_hour_path(product_dir, h);
+        L2StoredHour f;
+        if (!f.open(product_dir, h)) {
+            if (std::filesystem::exists(path)) {
+                error = f.raw.error();
+                return false;
+            }
+            if (std::filesystem::exists(l2z_path_for(path))) {
+                error = l2z_path_for(path) + ": not a readable l2z file";
+                return false;
+            }
+            ++out.missing;
+            continue;
+        }
+        out.compacted += f.compacted;
+        if (files.empty()) {
+            out.price_decimals = f.price_decimals;
+            out.qty_decimals = f.qty_decimals;
+        }
+        else if (f.price_decimals != out.price_decimals || f.qty_decimals != out.qty_decimals) {
+            error = path + ": scales differ from the earlier hours";
+            return false;
+        }
+        const auto [r0, r1] = f.range(q.t0_ns, q.t1_ns);
+        for (uint64_t r = r0; r < r1; r += q.chunk_rows) {
+            chunks.push_back({static_cast<uint32_t>(files.size()), r, std::min(r1, r + q.chunk_rows)});
+        }
+        files.push_back(std::move(f));
+    }
+    out.hours = files.size();
+
+    L2AggFilter filter;
+    filter.exclude = ROW_MARKER | ROW_CHECKPOINT | (q.snapshots ? 0 : ROW_SNAPSHOT);
+    filter.px_lo = to_ticks(q.px_lo, out.price_decimals, true);
+    filter.px_hi = std::isinf(q.px_hi) ? filter.px_hi : to_ticks(q.px_hi, out.price_decimals, false);
+    const l2_agg_fn kernel = l2_agg_select();
+
+    // each thread starts on a contiguous run of chunks, so it reads its hours front to back
+    const size_t threads = std::max<size_t>(1, std::min<size_t>(q.threads, chunks.size()));
+    std::vector<AggQueue> queues(threads);
+    for (size_t t = 0; t < threads; ++t) {
+        const size_t a = chunks.size() * t / threads;
+        const size_t b = chunks.size() * (t + 1) / threads;
+        queues[t].chunks.assign(chunks.begin() + a, chunks.begin() + b);
+    }
+    std::vector<L2AggResult> parts(threads);
+    auto work = [&](size_t t) {
+        L2AggResult& part = parts[t];
+        part.buckets.resize(out.buckets.size());
+        AggChunk c;
+        while (true) {
+            bool got = queues[t].take(c, false);
+            for (size_t k = 1; k < threads && !got; ++k) {
+                got = queues[(t + k) % threads].take(c, true);
+            }
+            // nothing is ever added, empty queues everywhere means done
+            if (!got) {
+                break;
+            }
+            agg_chunk(files[c.file], c, q, filter, kernel, part);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < threads; ++t) {
+        pool.emplace_back(work, t);
+    }
+    work(0);
+    for (auto& th : pool) {
+        th.join();
+    }
+    for (const auto& p : parts) {
+        out.merge(p);
+    }
+    return true;
+}
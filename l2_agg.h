@@ -0,0 +1,85 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+#include "l2_reader.h"
+
+// aggregates over a product's level rows in a time range, straight from the mapped columns: per
+// book side the level updates, the deletes among them (qty 0), the qty the updates set their
+// levels to and the range of prices they touched, and update counts per time bucket. the hours
+// are cut into row chunks that a pool of threads scans in parallel, and the partial results are
+// summed. ts is only binary searched, the kernels read price, qty and side.
+
+struct L2AggSide {
+    uint64_t updates{0};
+    uint64_t deletes{0};
+    // sum of the qty of every update, in the product's qty units
+    __int128 qty{0};
+    uint32_t px_min{std::numeric_limits<uint32_t>::max()};
+    uint32_t px_max{0};
+
+    void merge(const L2AggSide& o) noexcept;
+};
+
+struct L2AggBucket {
+    uint64_t updates[2]{};
+    uint64_t deletes[2]{};
+};
+
+struct L2AggQuery {
+    uint64_t t0_ns{0};
+    uint64_t t1_ns{0};
+    // per bucket counts from t0 on, 0 skips them
+    uint64_t bucket_ns{0};
+    // snapshot levels count as updates too. checkpoint and marker rows never do
+    bool snapshots{false};
+    // only rows with px_lo <= price <= px_hi, in the product's units
+    double px_lo{0};
+    double px_hi{std::numeric_limits<double>::infinity()};
+    unsigned threads{1};
+    // hours are cut into chunks of this many rows, the unit a thread takes or steals
+    uint64_t chunk_rows{1ull << 20};
+};
+
+struct L2AggResult {
+    // indexed by SIDE_ASK and SIDE_BID
+    L2AggSide side[2];
+    std::vector<L2AggBucket> buckets;
+    // rows in the window, including the ones the filter left out
+    uint64_t rows{0};
+    // bytes of price, qty and side the kernels read
+    uint64_t bytes{0};
+    // hours read, the compacted ones among them decoded from their l2z file
+    uint64_t hours{0};
+    uint64_t compacted{0};
+    // hours in the range with neither file
+    uint64_t missing{0};
+    uint8_t price_decimals{2};
+    uint8_t qty_decimals{8};
+
+    void merge(const L2AggResult& o);
+};
+
+// rows of the kernel's filter, prices in ticks
+struct L2AggFilter {
+    uint8_t exclude{0};
+    uint32_t px_lo{0};
+    uint32_t px_hi{std::numeric_limits<uint32_t>::max()};
+};
+
+using l2_agg_fn = void (*)(const uint32_t* px, const int64_t* qty, const uint8_t* side, size_t n,
+                           const L2AggFilter& f, L2AggSide (&out)[2]);
+
+void l2_agg_rows_scalar(const uint32_t* px, const int64_t* qty, const uint8_t* side, size_t n,
+                        const L2AggFilter& f, L2AggSide (&out)[2]);
+void l2_agg_rows_avx2(const uint32_t* px, const int64_t* qty, const uint8_t* side, size_t n,
+                      const L2AggFilter& f, L2AggSide (&out)[2]);
+// picked once per process from cpuid
+l2_agg_fn l2_agg_select(const char** name = nullptr) noexcept;
+
+// scans product_dir/yyyymmdd/hh00.bin, or hh00.l2z once the raw file is compacted away, for every
+// hour touching [t0, t1). hours with neither file are skipped and counted in missing, hours whose
+// scales differ from the first one found are an error. false with error set on failure
+bool l2_aggregate(const std::string& product_dir, const L2AggQuery& q, L2AggResult& out, std::string& error);
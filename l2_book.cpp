@@ -0,0 +1,296 @@
+#include "l2_book.h"
+#include <algorithm>
+#include <iterator>
+
+FlatBook::FlatBook(uint32_t window_ticks) : window_((std::max(window_ticks, 4096u) + 4095u) & ~4095u) {
+    for (Side& s : side_) {
+        s.qty.assign(window_, 0);
+        s.bits.assign(window_ / 64, 0);
+        s.summary.assign(window_ / 4096, 0);
+    }
+}
+
+void FlatBook::clear() {
+    // keeps the center, a resync lands close to where the book was
+    for (Side& s : side_) {
+        for (size_t w = 0; w < s.bits.size(); ++w) {
+            for (uint64_t b = s.bits[w]; b; b &= b - 1) {
+                s.qty[w * 64 + static_cast<size_t>(__builtin_ctzll(b))] = 0;
+            }
+            s.bits[w] = 0;
+        }
+        std::fill(s.summary.begin(), s.summary.end(), 0);
+        s.far.clear();
+        s.count = 0;
+    }
+}
+
+void FlatBook::apply(uint32_t price, int64_t qty, bool bid) {
+    if (!centered_) {
+        recenter(price);
+    }
+    Side& s = side_[bid];
+    const uint32_t off = price - base_;
+    if (price >= base_ && off < window_) {
+        int64_t& q = s.qty[off];
+        if (qty == 0) {
+            if (q != 0) {
+                q = 0;
+                clear_bit(s, off);
+                // the market left the window on this side, bring its best level back in
+                if (--s.count == 0 && !s.far.empty()) {
+                    recenter(bid ? s.far.rbegin()->first : s.far.begin()->first);
+                }
+            }
+            return;
+        }
+        if (q == 0) {
+            set_bit(s, off);
+            ++s.count;
+        }
+        q = qty;
+        return;
+    }
+
+    if (qty == 0) {
+        s.far.erase(price);
+        return;
+    }
+    // a bid above the window or an ask below it is the inside of the book, recenter on it
+    const bool inside = bid ? price >= base_ + window_ : price < base_;
+    if (inside) {
+        recenter(price);
+        apply(price, qty, bid);
+        return;
+    }
+    s.far[price] = qty;
+}
+
+void FlatBook::recenter(uint32_t center) {
+    // base + window stays representable so the window end never wraps
+    const uint32_t new_base = std::min(center > window_ / 2 ? center - window_ / 2 : 0, UINT32_MAX - window_);
+    ++recenters_;
+    for (Side& s : side_) {
+        // everything in the window goes to the map, then the new window takes its range back out
+        for (size_t w = 0; w < s.bits.size(); ++w) {
+            for (uint64_t b = s.bits[w]; b; b &= b - 1) {
+                const size_t off = w * 64 + static_cast<size_t>(__builtin_ctzll(b));
+                s.far[base_ + static_cast<uint32_t>(off)] = s.qty[off];
+                s.qty[off] = 0;
+            }
+            s.bits[w] = 0;
+        }
+        std::fill(s.summary.begin(), s.summary.end(), 0);
+        s.count = 0;
+
+        auto it = s.far.lower_bound(new_base);
+        while (it != s.far.end() && it->first - new_base < window_) {
+            const uint32_t off = it->first - new_base;
+            s.qty[off] = it->second;
+            set_bit(s, off);
+            ++s.count;
+            it = s.far.erase(it);
+        }
+    }
+    base_ = new_base;
+    centered_ = true;
+}
+
+bool FlatBook::window_best(const Side& s, bool bid, uint32_t& off) const noexcept {
+    if (!s.count) {
+        return false;
+    }
+    const size_t n = s.summary.size();
+    for (size_t k = 0; k < n; ++k) {
+        const size_t i = bid ? n - 1 - k : k;
+        const uint64_t sw = s.summary[i];
+        if (!sw) {
+            continue;
+        }
+        const size_t w = i * 64 + static_cast<size_t>(bid ? 63 - __builtin_clzll(sw) : __builtin_ctzll(sw));
+        const uint64_t b = s.bits[w];
+        off = static_cast<uint32_t>(w * 64 + static_cast<size_t>(bid ? 63 - __builtin_clzll(b) : __builtin_ctzll(b)));
+        return true;
+    }
+    return false;
+}
+
+bool FlatBook::best_bid(L2Level& out) const noexcept {
+    const Side& s = side_[1];
+    uint32_t off;
+    // far bids above the window are only left behind by a recenter on the ask side
+    if (!s.far.empty() && s.far.rbegin()->first >= base_ + window_) {
+        out = {s.far.rbegin()->first, s.far.rbegin()->second};
+        return true;
+    }
+    if (window_best(s, true, off)) {
+        out = {base_ + off, s.qty[off]};
+        return true;
+    }
+    if (!s.far.empty()) {
+        out = {s.far.rbegin()->first, s.far.rbegin()->second};
+        return true;
+    }
+    return false;
+}
+
+bool FlatBook::best_ask(L2Level& out) const noexcept {
+    const Side& s = side_[0];
+    uint32_t off;
+    if (!s.far.empty() && s.far.begin()->first < base_) {
+        out = {s.far.begin()->first, s.far.begin()->second};
+        return true;
+    }
+    if (window_best(s, false, off)) {
+        out = {base_ + off, s.qty[off]};
+        return true;
+    }
+    if (!s.far.empty()) {
+        out = {s.far.begin()->first, s.far.begin()->second};
+        return true;
+    }
+    return false;
+}
+
+size_t FlatBook::top(bool bid, size_t n, L2Level* out) const {
+    const Side& s = side_[bid];
+    size_t got = 0;
+
+    // far levels on the inside of the window come first. they only exist after a recenter on the
+    // other side crossed them, the usual book has none
+    auto far_in = bid ? s.far.lower_bound(base_ + window_) : s.far.begin();
+    const auto far_in_end = bid ? s.far.end() : s.far.lower_bound(base_);
+    if (bid) {
+        for (auto it = s.far.rbegin(); it != std::make_reverse_iterator(far_in) && got < n; ++it) {
+            out[got++] = {it->first, it->second};
+        }
+    }
+    else {
+        for (auto it = far_in; it != far_in_end && got < n; ++it) {
+            out[got++] = {it->first, it->second};
+        }
+    }
+
+    // window levels best first, one bitmap word at a time
+    const size_t words = s.bits.size();
+    size_t from_window = 0;
+    for (size_t k = 0; k < words && got < n && from_window < s.count; ++k) {
+        const size_t w = bid ? words - 1 - k : k;
+        // whole empty groups of 64 words are skipped on the summary
+        if (!s.summary[w >> 6]) {
+            k += bid ? (w & 63) : 63 - (w & 63);
+            continue;
+        }
+        uint64_t b = s.bits[w];
+        while (b && got < n) {
+            const uint32_t bit = static_cast<uint32_t>(bid ? 63 - __builtin_clzll(b) : __builtin_ctzll(b));
+            b &= ~(1ull << bit);
+            const uint32_t off = static_cast<uint32_t>(w * 64) + bit;
+            out[got++] = {base_ + off, s.qty[off]};
+            ++from_window;
+        }
+    }
+
+    // then the deep levels behind the window
+    if (bid) {
+        for (auto it = std::make_reverse_iterator(far_in); it != s.far.rend() && got < n; ++it) {
+            out[got++] = {it->first, it->second};
+        }
+    }
+    else {
+        for (auto it = far_in_end; it != s.far.end() && got < n; ++it) {
+            out[got++] = {it->first, it->second};
+        }
+    }
+    return got;
+}
+
+L2BookReplay::L2BookReplay(std::string product_dir, uint32_t max_back_hours)
+    : dir_(std::move(product_dir)), max_back_hours_(max_back_hours) {}
+
+bool L2BookReplay::find_start(uint64_t ts_ns, uint64_t& hour_s, uint64_t& row) {
+    const uint64_t first_h = (ts_ns / 1'000'000'000ull) / 3600ull * 3600ull;
+    for (uint32_t back = 0; back <= max_back_hours_ && back * 3600ull <= first_h; ++back) {
+        const uint64_t h = first_h - back * 3600ull;
+        L2StoredHour hr;
+        if (!hr.open(dir_, h)) {
+            continue;
+        }
+        const uint64_t limit = back == 0 ? hr.lower_bound(ts_ns) : hr.rows;
+
+        // last indexed checkpoint before the limit, then look for a later resync by scanning the
+        // side column backwards. without an index the scan covers the whole hour
+        uint64_t lo = 0;
+        bool have_ckpt = false;
+        for (auto it = hr.ckpts.rbegin(); it != hr.ckpts.rend(); ++it) {
+            if (it->row < limit) {
+                lo = it->row + 1;
+                have_ckpt = true;
+                break;
+            }
+        }
+        for (uint64_t i = limit; i-- > lo;) {
+            const L2Row r = hr.row(i);
+            if ((r.side & ROW_MARKER) && (r.price == MARK_RESYNC || r.price == MARK_CHECKPOINT)) {
+                hour_s = h;
+                row = i;
+                return true;
+            }
+        }
+        if (have_ckpt) {
+            hour_s = h;
+            row = lo - 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+void L2BookReplay::apply(const L2Segment& s, FlatBook& book) {
+    const size_t n = s.size();
+    size_t i = 0;
+    if (skip_) {
+        const size_t k = static_cast<size_t>(std::min<uint64_t>(skip_, n));
+        skip_ -= k;
+        i = k;
+    }
+    for (; i < n; ++i) {
+        const uint8_t side = s.side[i];
+        if (!(side & ROW_MARKER)) {
+            book.apply(s.price[i], s.qty[i], side & SIDE_BID);
+            continue;
+        }
+        switch (s.price[i]) {
+        case MARK_RESYNC:
+            book.clear();
+            valid_ = true;
+            break;
+        case MARK_GAP:
+            valid_ = false;
+            break;
+        case MARK_CHECKPOINT:
+            // a book that is already valid matches the checkpoint, skip its levels
+            if (valid_) {
+                const uint64_t levels = static_cast<uint64_t>(s.qty[i]);
+                const size_t k = static_cast<size_t>(std::min<uint64_t>(levels, n - i - 1));
+                skip_ = levels - k;
+                i += k;
+            }
+            else {
+                book.clear();
+                valid_ = true;
+            }
+            break;
+        default: break;
+        }
+    }
+    rows_replayed_ += n;
+}
+
+bool L2BookReplay::book_at(uint64_t ts_ns, FlatBook& out) {
+    bool valid = false;
+    if (!sample(ts_ns, ts_ns + 1, 1, out, [&](uint64_t, const FlatBook&, bool v) { valid = v; })) {
+        return false;
+    }
+    return valid;
+}
@@ -0,0 +1,164 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "l2_compact.h"
+#include "l2_reader.h"
+
+struct L2Level {
+    uint32_t price;
+    int64_t qty;
+};
+
+// l2 book for replay. levels within window_ticks of a center live in flat qty arrays indexed by
+// price - base, with a two level bitmap (one bit per tick, one bit per 64 ticks) so the best level
+// and the top of book are found with a few count-leading-zeros. levels outside the window, the
+// deep end of a snapshot, go to an ordered map. the window recenters when the market walks out of
+// it, so the inside of the book never lives in the map.
+class FlatBook {
+public:
+    // window_ticks is rounded up to a multiple of 4096
+    explicit FlatBook(uint32_t window_ticks = 1u << 16);
+
+    void clear();
+    // qty 0 removes the level
+    void apply(uint32_t price, int64_t qty, bool bid);
+
+    bool best_bid(L2Level& out) const noexcept;
+    bool best_ask(L2Level& out) const noexcept;
+    // up to n best levels of a side, best first. returns how many were written
+    size_t top(bool bid, size_t n, L2Level* out) const;
+    size_t levels(bool bid) const noexcept {
+        const Side& s = side_[bid];
+        return s.count + s.far.size();
+    }
+    uint64_t recenters() const noexcept { return recenters_; }
+
+private:
+    struct Side {
+        std::vector<int64_t> qty;
+        std::vector<uint64_t> bits;
+        std::vector<uint64_t> summary;
+        std::map<uint32_t, int64_t> far;
+        size_t count{0};
+    };
+
+    uint32_t window_;
+    uint32_t base_{0};
+    bool centered_{false};
+    uint64_t recenters_{0};
+    Side side_[2];
+
+    void recenter(uint32_t center);
+    bool window_best(const Side& s, bool bid, uint32_t& off) const noexcept;
+
+    static void set_bit(Side& s, uint32_t off) noexcept {
+        s.bits[off >> 6] |= 1ull << (off & 63);
+        s.summary[off >> 12] |= 1ull << ((off >> 6) & 63);
+    }
+    static void clear_bit(Side& s, uint32_t off) noexcept {
+        uint64_t& w = s.bits[off >> 6];
+        w &= ~(1ull << (off & 63));
+        if (!w) {
+            s.summary[off >> 12] &= ~(1ull << ((off >> 6) & 63));
+        }
+    }
+};
+
+// rebuilds a product's book from its hour files (or their .l2z copies) as of any time. replay starts
+// from the last checkpoint or resync before the requested time, looking back up to max_back_hours.
+class L2BookReplay {
+public:
+    explicit L2BookReplay(std::string product_dir, uint32_t max_back_hours = 24);
+
+    // scales of the last hour opened, price and qty in the book are in these units
+    uint8_t price_decimals() const noexcept { return price_decimals_; }
+    uint8_t qty_decimals() const noexcept { return qty_decimals_; }
+
+    // the book just before ts_ns, i.e. after every row with ts < ts_ns. false if no starting
+    // point was found or the book was not trustworthy (a gap without a later resync)
+    bool book_at(uint64_t ts_ns, FlatBook& out);
+
+    // calls f(uint64_t sample_ts, const FlatBook&, bool valid) at t0, t0 + step, ... < t1, every
+    // time with the book after all rows before that sample
+    template <typename F>
+    bool sample(uint64_t t0_ns, uint64_t t1_ns, uint64_t step_ns, FlatBook& book, F&& f);
+
+    // rows applied by the last call, for throughput numbers
+    uint64_t rows_replayed() const noexcept { return rows_replayed_; }
+
+private:
+    std::string dir_;
+    uint32_t max_back_hours_;
+    uint64_t rows_replayed_{0};
+    uint8_t price_decimals_{L2COL_V3_PRICE_DECIMALS};
+    uint8_t qty_decimals_{L2COL_V3_QTY_DECIMALS};
+    bool valid_{false};
+    // rows of a checkpoint still to skip because the book was already valid when it started
+    uint64_t skip_{0};
+
+    // hour and row to start replay from for ts_ns
+    bool find_start(uint64_t ts_ns, uint64_t& hour_s, uint64_t& row);
+    void apply(const L2Segment& s, FlatBook& book);
+    // replays from (hour_s, row) to t1, calling on_sample at each step boundary
+    template <typename F>
+    void replay(uint64_t hour_s, uint64_t row, uint64_t t0, uint64_t t1, uint64_t step, FlatBook& book, F&& f);
+};
+
+template <typename F>
+void L2BookReplay::replay(uint64_t hour_s, uint64_t row, uint64_t t0, uint64_t t1, uint64_t step,
+                          FlatBook& book, F&& f) {
+    uint64_t next = t0;
+    const uint64_t last_h = ((t1 - 1) / 1'000'000'000ull) / 3600ull * 3600ull;
+    for (uint64_t h = hour_s; h <= last_h && next < t1; h += 3600) {
+        L2StoredHour hr;
+        if (!hr.open(dir_, h)) {
+            continue;
+        }
+        price_decimals_ = hr.price_decimals;
+        qty_decimals_ = hr.qty_decimals;
+        uint64_t r = h == hour_s ? row : 0;
+        while (r < hr.rows && next < t1) {
+            // rows up to the next sample point go through in whole segment slices
+            const uint64_t stop = hr.lower_bound(next);
+            if (stop > r) {
+                for (const auto& s : hr.segs) {
+                    if (s.row_base + s.size() > r && s.row_base < stop) {
+                        apply(s.slice(r, stop), book);
+                    }
+                }
+                r = stop;
+            }
+            if (r < hr.rows) {
+                // the next row is at or after the sample point, emit every sample it passes
+                const uint64_t ts = hr.row(r).ts_ns;
+                while (next < t1 && next <= ts) {
+                    f(next, static_cast<const FlatBook&>(book), valid_);
+                    next += step;
+                }
+            }
+        }
+    }
+    // hours ran out before t1, the book stays as it is for the remaining samples
+    while (next < t1) {
+        f(next, static_cast<const FlatBook&>(book), valid_);
+        next += step;
+    }
+}
+
+template <typename F>
+bool L2BookReplay::sample(uint64_t t0_ns, uint64_t t1_ns, uint64_t step_ns, FlatBook& book, F&& f) {
+    uint64_t hour_s = 0;
+    uint64_t row = 0;
+    book.clear();
+    rows_replayed_ = 0;
+    valid_ = false;
+    skip_ = 0;
+    if (!step_ns || t1_ns <= t0_ns || !find_start(t0_ns, hour_s, row)) {
+        return false;
+    }
+    replay(hour_s, row, t0_ns, t1_ns, step_ns, book, f);
+    return true;
+}
@@ -0,0 +1,740 @@
+#include "l2_compact.h"
+#include <emmintrin.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+constexpr double kInvPow10[9] = {1e0, 1e-1, 1e-2, 1e-3, 1e-4, 1e-5, 1e-6, 1e-7, 1e-8};
+// v1 qty blocks holding raw float bits
+constexpr uint8_t kQtyRaw = 0xff;
+constexpr uint32_t kQtyMaxScale = 18;
+constexpr int64_t kPow10i[kQtyMaxScale + 1] = {
+    1, 10, 100, 1'000, 10'000, 100'000, 1'000'000, 10'000'000, 100'000'000, 1'000'000'000,
+    10'000'000'000, 100'000'000'000, 1'000'000'000'000, 10'000'000'000'000, 100'000'000'000'000,
+    1'000'000'000'000'000, 10'000'000'000'000'000, 100'000'000'000'000'000, 1'000'000'000'000'000'000};
+constexpr size_t kHead = 4;
+
+inline uint32_t bits_for(uint32_t v) noexcept {
+    return v ? 32u - static_cast<uint32_t>(__builtin_clz(v)) : 0u;
+}
+
+inline uint32_t zigzag32(int32_t d) noexcept {
+    return (static_cast<uint32_t>(d) << 1) ^ static_cast<uint32_t>(d >> 31);
+}
+
+inline uint64_t zigzag64(int64_t d) noexcept {
+    return (static_cast<uint64_t>(d) << 1) ^ static_cast<uint64_t>(d >> 63);
+}
+
+inline size_t packed_bytes(uint32_t w) noexcept {
+    return size_t{16} * w;
+}
+
+// appends 128 values of width w as 4*w words, value i in lane i % 4
+void pack(const uint32_t* in, uint32_t w, std::vector<uint8_t>& out) {
+    const size_t at = out.size();
+    out.resize(at + packed_bytes(w), 0);
+    if (!w) {
+        return;
+    }
+    auto* words = reinterpret_cast<uint32_t*>(out.data() + at);
+    const uint32_t mask = w == 32 ? ~0u : (1u << w) - 1;
+    for (uint32_t lane = 0; lane < 4; ++lane) {
+        for (uint32_t k = 0; k < L2Z_BLOCK / 4; ++k) {
+            const uint32_t v = in[4 * k + lane] & mask;
+            const uint32_t off = k * w;
+            const uint32_t word = off >> 5;
+            const uint32_t sh = off & 31;
+            words[4 * word + lane] |= v << sh;
+            if (sh + w > 32) {
+                words[4 * (word + 1) + lane] |= v >> (32 - sh);
+            }
+        }
+    }
+}
+
+// inverse of pack, four values per step
+void unpack(const uint8_t* in, uint32_t w, uint32_t* out) noexcept {
+    if (!w) {
+        std::memset(out, 0, L2Z_BLOCK * sizeof(uint32_t));
+        return;
+    }
+    const auto* src = reinterpret_cast<const __m128i*>(in);
+    const __m128i mask = _mm_set1_epi32(w == 32 ? -1 : static_cast<int>((1u << w) - 1));
+    for (uint32_t k = 0; k < L2Z_BLOCK / 4; ++k) {
+        const uint32_t off = k * w;
+        const uint32_t word = off >> 5;
+        const uint32_t sh = off & 31;
+        __m128i v = _mm_srl_epi32(_mm_loadu_si128(src + word), _mm_cvtsi32_si128(static_cast<int>(sh)));
+        if (sh + w > 32) {
+            v = _mm_or_si128(v, _mm_sll_epi32(_mm_loadu_si128(src + word + 1),
+                                              _mm_cvtsi32_si128(static_cast<int>(32 - sh))));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * k), _mm_and_si128(v, mask));
+    }
+}
+
+void put_head(std::vector<uint8_t>& out, uint32_t w, uint8_t aux, uint8_t aux2 = 0) {
+    const uint8_t head[kHead] = {static_cast<uint8_t>(w), aux, aux2, 0};
+    out.insert(out.end(), head, head + kHead);
+}
+
+// widths a decoder can unpack and a known qty scale
+bool valid_head(uint32_t col, const uint8_t* head, uint16_t version) noexcept {
+    if (head[0] > 32) {
+        return false;
+    }
+    switch (col) {
+    case COL_TS: return head[1] <= 32;
+    case COL_QTY:
+        if (version >= 2) {
+            return head[1] <= 32 && head[2] <= kQtyMaxScale;
+        }
+        return head[1] < 9 || (head[1] == kQtyRaw && head[0] == 32);
+    default: return true;
+    }
+}
+
+// bytes a block payload takes, from its head
+size_t payload_bytes(uint32_t col, const uint8_t* head, uint16_t version) noexcept {
+    const uint32_t w = head[0];
+    const bool split = col == COL_TS || (col == COL_QTY && version >= 2);
+    return kHead + packed_bytes(w) + (split ? packed_bytes(head[1]) : 0);
+}
+
+// one block's rows, padded to L2Z_BLOCK
+struct BlockRows {
+    uint64_t ts[L2Z_BLOCK];
+    uint32_t price[L2Z_BLOCK];
+    int64_t qty[L2Z_BLOCK];
+    uint8_t side[L2Z_BLOCK];
+};
+
+void encode_ts(const BlockRows& b, uint32_t n, std::vector<uint8_t>& out) {
+    uint32_t lo[L2Z_BLOCK]{};
+    uint32_t hi[L2Z_BLOCK]{};
+    uint32_t lo_or = 0;
+    uint32_t hi_or = 0;
+    for (uint32_t i = 1; i < n; ++i) {
+        const uint64_t z = zigzag64(static_cast<int64_t>(b.ts[i] - b.ts[i - 1]));
+        lo[i] = static_cast<uint32_t>(z);
+        hi[i] = static_cast<uint32_t>(z >> 32);
+        lo_or |= lo[i];
+        hi_or |= hi[i];
+    }
+    const uint32_t w_hi = bits_for(hi_or);
+    const uint32_t w_lo = w_hi ? 32 : bits_for(lo_or);
+    put_head(out, w_lo, static_cast<uint8_t>(w_hi));
+    pack(lo, w_lo, out);
+    pack(hi, w_hi, out);
+}
+
+void encode_price(const BlockRows& b, uint32_t n, std::vector<uint8_t>& out) {
+    uint32_t d[L2Z_BLOCK]{};
+    uint32_t d_or = 0;
+    for (uint32_t i = 1; i < n; ++i) {
+        d[i] = zigzag32(static_cast<int32_t>(b.price[i] - b.price[i - 1]));
+        d_or |= d[i];
+    }
+    const uint32_t w = bits_for(d_or);
+    put_head(out, w, 0);
+    pack(d, w, out);
+}
+
+// quantities of one product share a lot size, so their trailing decimal zeros come off first. the
+// rest is stored as is in two 32 bit halves, the high half is empty below 2^32 lots
+void encode_qty(const BlockRows& b, uint32_t n, std::vector<uint8_t>& out) {
+    uint32_t k = kQtyMaxScale;
+    for (uint32_t i = 0; i < n && k; ++i) {
+        while (k && b.qty[i] % kPow10i[k]) {
+            --k;
+        }
+    }
+    uint32_t lo[L2Z_BLOCK]{};
+    uint32_t hi[L2Z_BLOCK]{};
+    uint32_t lo_or = 0;
+    uint32_t hi_or = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        const auto v = static_cast<uint64_t>(b.qty[i] / kPow10i[k]);
+        lo[i] = static_cast<uint32_t>(v);
+        hi[i] = static_cast<uint32_t>(v >> 32);
+        lo_or |= lo[i];
+        hi_or |= hi[i];
+    }
+    const uint32_t w_hi = bits_for(hi_or);
+    const uint32_t w_lo = w_hi ? 32 : bits_for(lo_or);
+    put_head(out, w_lo, static_cast<uint8_t>(w_hi), static_cast<uint8_t>(k));
+    pack(lo, w_lo, out);
+    pack(hi, w_hi, out);
+}
+
+// bid bit in bit 0, the ROW_CHECKPOINT/ROW_SNAPSHOT/ROW_MARKER flags in bits 1..3
+void encode_side(const BlockRows& b, uint32_t n, std::vector<uint8_t>& out) {
+    uint32_t c[L2Z_BLOCK]{};
+    uint8_t all = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        all |= b.side[i];
+    }
+    const bool mapped = (all & 0x1e) == 0;
+    uint32_t c_or = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        const uint32_t s = b.side[i];
+        c[i] = mapped ? (s & 1u) | ((s >> 4) & 0xeu) : s;
+        c_or |= c[i];
+    }
+    const uint32_t w = bits_for(c_or);
+    put_head(out, w, mapped ? 1 : 0);
+    pack(c, w, out);
+}
+
+bool write_all(int fd, const void* p, size_t n) {
+    const auto* b = static_cast<const uint8_t*>(p);
+    while (n) {
+        const ssize_t w = ::write(fd, b, n);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        b += w;
+        n -= static_cast<size_t>(w);
+    }
+    return true;
+}
+
+inline uint64_t align64(uint64_t v) noexcept {
+    return (v + 63) & ~uint64_t{63};
+}
+
+}  // namespace
+
+bool l2z_write(const L2HourFile& in, const std::string& path, std::string& err) {
+    const uint64_t rows = in.rows();
+    const uint32_t blocks = static_cast<uint32_t>((rows + L2Z_BLOCK - 1) / L2Z_BLOCK);
+
+    std::vector<L2ZBlockDir> dir(blocks);
+    std::vector<uint8_t> col[COL_COUNT];
+    col[COL_TS].reserve(rows * 2);
+    col[COL_PX].reserve(rows);
+    col[COL_QTY].reserve(rows * 3);
+    col[COL_SIDE].reserve(rows / 4);
+
+    BlockRows b{};
+    for (uint32_t k = 0; k < blocks; ++k) {
+        const uint64_t r0 = uint64_t{k} * L2Z_BLOCK;
+        const uint64_t r1 = std::min(rows, r0 + L2Z_BLOCK);
+        const auto n = static_cast<uint32_t>(r1 - r0);
+        uint32_t at = 0;
+        in.for_each_segment(r0, r1, [&](const L2Segment& s) {
+            std::memcpy(b.ts + at, s.ts.data(), s.size() * sizeof(uint64_t));
+            std::memcpy(b.price + at, s.price.data(), s.size() * sizeof(uint32_t));
+            std::memcpy(b.qty + at, s.qty.data(), s.qty.size_bytes());
+            std::memcpy(b.side + at, s.side.data(), s.size());
+            at += static_cast<uint32_t>(s.size());
+        });
+
+        L2ZBlockDir& d = dir[k];
+        d.ts_base = b.ts[0];
+        d.px_base = b.price[0];
+        d.rows = n;
+        for (uint32_t c = 0; c < COL_COUNT; ++c) {
+            if (col[c].size() > UINT32_MAX) {
+                err = "column too large";
+                return false;
+            }
+            d.off[c] = static_cast<uint32_t>(col[c].size());
+        }
+        encode_ts(b, n, col[COL_TS]);
+        encode_price(b, n, col[COL_PX]);
+        encode_qty(b, n, col[COL_QTY]);
+        encode_side(b, n, col[COL_SIDE]);
+    }
+
+    L2ZFileHeader hdr{};
+    std::memcpy(hdr.magic, "L2ZIP\n", 6);
+    hdr.version = L2Z_VERSION;
+    std::memcpy(hdr.product, in.header().product, sizeof(hdr.product));
+    hdr.hour_epoch_start = in.hour_s();
+    hdr.rows = rows;
+    hdr.block_rows = L2Z_BLOCK;
+    hdr.blocks = blocks;
+    uint64_t off = sizeof(hdr);
+    hdr.dir_off = off;
+    off = align64(off + dir.size() * sizeof(L2ZBlockDir));
+    for (uint32_t c = 0; c < COL_COUNT; ++c) {
+        hdr.col_off[c] = off;
+        hdr.col_bytes[c] = col[c].size();
+        off = align64(off + col[c].size());
+    }
+    const auto ckpts = in.checkpoints();
+    hdr.ckpt_off = ckpts.empty() ? 0 : off;
+    hdr.ckpt_count = static_cast<uint32_t>(ckpts.size());
+    hdr.price_decimals = in.price_decimals();
+    hdr.qty_decimals = in.qty_decimals();
+
+    const std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        err = tmp + ": " + std::strerror(errno);
+        return false;
+    }
+    static const uint8_t zeros[64] = {};
+    uint64_t pos = 0;
+    auto put = [&](uint64_t at, const void* p, size_t n) {
+        return (at == pos || write_all(fd, zeros, static_cast<size_t>(at - pos))) &&
+            write_all(fd, p, n) && ((pos = at + n), true);
+    };
+    bool ok = put(0, &hdr, sizeof(hdr)) && put(hdr.dir_off, dir.data(), dir.size() * sizeof(L2ZBlockDir));
+    for (uint32_t c = 0; c < COL_COUNT && ok; ++c) {
+        ok = put(hdr.col_off[c], col[c].data(), col[c].size());
+    }
+    if (ok && !ckpts.empty()) {
+        ok = put(hdr.ckpt_off, ckpts.data(), ckpts.size_bytes());
+    }
+    ok = ok && ::fsync(fd) == 0;
+    ::close(fd);
+    if (!ok || ::rename(tmp.c_str(), path.c_str()) != 0) {
+        err = path + ": " + std::strerror(errno);
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+L2ZFile::~L2ZFile() {
+    close();
+}
+
+void L2ZFile::close() {
+    if (map_) {
+        ::munmap(const_cast<uint8_t*>(map_), map_bytes_);
+    }
+    map_ = nullptr;
+    map_bytes_ = 0;
+    hdr_ = {};
+    dir_ = {};
+    ckpts_ = {};
+}
+
+bool L2ZFile::fail(const std::string& path, const char* why) {
+    close();
+    error_ = path + ": " + why;
+    return false;
+}
+
+bool L2ZFile::open(const std::string& path) {
+    close();
+    error_.clear();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return fail(path, std::strerror(errno));
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(L2ZFileHeader)) {
+        ::close(fd);
+        return fail(path, "too short for a header");
+    }
+    void* m = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        return fail(path, std::strerror(errno));
+    }
+    map_ = static_cast<const uint8_t*>(m);
+    map_bytes_ = static_cast<size_t>(st.st_size);
+
+    std::memcpy(&hdr_, map_, sizeof(hdr_));
+    if (std::memcmp(hdr_.magic, "L2ZIP\n", 6) != 0) {
+        return fail(path, "bad magic");
+    }
+    if (hdr_.version < 1 || hdr_.version > L2Z_VERSION || hdr_.block_rows != L2Z_BLOCK) {
+        return fail(path, "unsupported version");
+    }
+    if (hdr_.version < 2) {
+        hdr_.price_decimals = L2COL_V3_PRICE_DECIMALS;
+        hdr_.qty_decimals = L2COL_V3_QTY_DECIMALS;
+    }
+    if (hdr_.blocks != (hdr_.rows + L2Z_BLOCK - 1) / L2Z_BLOCK ||
+        hdr_.dir_off + uint64_t{hdr_.blocks} * sizeof(L2ZBlockDir) > map_bytes_) {
+        return fail(path, "bad block directory");
+    }
+    for (uint32_t c = 0; c < COL_COUNT; ++c) {
+        if (hdr_.col_off[c] + hdr_.col_bytes[c] > map_bytes_) {
+            return fail(path, "column outside the file");
+        }
+    }
+    dir_ = {reinterpret_cast<const L2ZBlockDir*>(map_ + hdr_.dir_off), hdr_.blocks};
+
+    // every payload has to fit its column, decode_block does not check again
+    for (const auto& d : dir_) {
+        if (d.rows == 0 || d.rows > L2Z_BLOCK) {
+            return fail(path, "bad block");
+        }
+        for (uint32_t c = 0; c < COL_COUNT; ++c) {
+            const uint64_t at = d.off[c];
+            const uint8_t* head = map_ + hdr_.col_off[c] + at;
+            if (at + kHead > hdr_.col_bytes[c] || !valid_head(c, head, hdr_.version) ||
+                at + payload_bytes(c, head, hdr_.version) > hdr_.col_bytes[c]) {
+                return fail(path, "block payload outside its column");
+            }
+        }
+    }
+
+    if (hdr_.ckpt_count && hdr_.ckpt_off % alignof(L2CkptEntry) == 0 &&
+        hdr_.ckpt_off + uint64_t{hdr_.ckpt_count} * sizeof(L2CkptEntry) <= map_bytes_) {
+        ckpts_ = {reinterpret_cast<const L2CkptEntry*>(map_ + hdr_.ckpt_off), hdr_.ckpt_count};
+    }
+    return true;
+}
+
+uint32_t L2ZFile::decode_block(uint32_t b, uint64_t* ts, uint32_t* price, int64_t* qty,
+                               uint8_t* side) const noexcept {
+    const L2ZBlockDir& d = dir_[b];
+    alignas(16) uint32_t tmp[L2Z_BLOCK];
+    alignas(16) uint32_t tmp_hi[L2Z_BLOCK];
+
+    // ts: prefix sum of zigzag deltas in 64 bits
+    {
+        const uint8_t* p = map_ + hdr_.col_off[COL_TS] + d.off[COL_TS];
+        const uint32_t w_lo = p[0];
+        const uint32_t w_hi = p[1];
+        unpack(p + kHead, w_lo, tmp);
+        if (!w_hi) {
+            // deltas fit 32 bits: zigzag decode, sign extend to 64 and prefix sum two at a time
+            const __m128i one = _mm_set1_epi32(1);
+            const __m128i zero = _mm_setzero_si128();
+            __m128i carry = _mm_set1_epi64x(static_cast<int64_t>(d.ts_base));
+            for (uint32_t i = 0; i < L2Z_BLOCK; i += 4) {
+                __m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(tmp + i));
+                v = _mm_xor_si128(_mm_srli_epi32(v, 1), _mm_sub_epi32(zero, _mm_and_si128(v, one)));
+                const __m128i sign = _mm_srai_epi32(v, 31);
+                __m128i lo = _mm_unpacklo_epi32(v, sign);
+                __m128i hi = _mm_unpackhi_epi32(v, sign);
+                lo = _mm_add_epi64(_mm_add_epi64(lo, _mm_slli_si128(lo, 8)), carry);
+                carry = _mm_unpackhi_epi64(lo, lo);
+                hi = _mm_add_epi64(_mm_add_epi64(hi, _mm_slli_si128(hi, 8)), carry);
+                carry = _mm_unpackhi_epi64(hi, hi);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(ts + i), lo);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(ts + i + 2), hi);
+            }
+        }
+        else {
+            uint64_t t = d.ts_base;
+            ts[0] = t;
+            unpack(p + kHead + packed_bytes(w_lo), w_hi, tmp_hi);
+            for (uint32_t i = 1; i < d.rows; ++i) {
+                const uint64_t z = tmp[i] | (uint64_t{tmp_hi[i]} << 32);
+                t += (z >> 1) ^ (0ull - (z & 1));
+                ts[i] = t;
+            }
+        }
+    }
+
+    // price: zigzag decode and prefix sum four lanes at a time
+    {
+        const uint8_t* p = map_ + hdr_.col_off[COL_PX] + d.off[COL_PX];
+        unpack(p + kHead, p[0], price);
+        const __m128i one = _mm_set1_epi32(1);
+        const __m128i zero = _mm_setzero_si128();
+        __m128i carry = _mm_set1_epi32(static_cast<int>(d.px_base));
+        for (uint32_t i = 0; i < L2Z_BLOCK; i += 4) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(price + i));
+            v = _mm_xor_si128(_mm_srli_epi32(v, 1), _mm_sub_epi32(zero, _mm_and_si128(v, one)));
+            v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+            v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+            v = _mm_add_epi32(v, carry);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(price + i), v);
+            carry = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+    }
+
+    // side: 4 bit codes back to flag bytes, then narrowed 16 at a time
+    {
+        const uint8_t* p = map_ + hdr_.col_off[COL_SIDE] + d.off[COL_SIDE];
+        const bool mapped = p[1] != 0;
+        unpack(p + kHead, p[0], tmp);
+        const __m128i bid = _mm_set1_epi32(1);
+        const __m128i flags = _mm_set1_epi32(0xe);
+        for (uint32_t i = 0; i < L2Z_BLOCK; i += 16) {
+            __m128i v[4];
+            for (uint32_t j = 0; j < 4; ++j) {
+                v[j] = _mm_load_si128(reinterpret_cast<const __m128i*>(tmp + i + 4 * j));
+                if (mapped) {
+                    v[j] = _mm_or_si128(_mm_and_si128(v[j], bid), _mm_slli_epi32(_mm_and_si128(v[j], flags), 4));
+                }
+            }
+            const __m128i w01 = _mm_packs_epi32(v[0], v[1]);
+            const __m128i w23 = _mm_packs_epi32(v[2], v[3]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(side + i), _mm_packus_epi16(w01, w23));
+        }
+    }
+
+    // qty: both halves joined and the block's power of ten multiplied back in. v1 blocks go through
+    // float first, the side column is already decoded for the marker rows among them
+    {
+        const uint8_t* p = map_ + hdr_.col_off[COL_QTY] + d.off[COL_QTY];
+        if (hdr_.version >= 2) {
+            const uint32_t w_lo = p[0];
+            const uint32_t w_hi = p[1];
+            const int64_t mul = kPow10i[p[2]];
+            unpack(p + kHead, w_lo, tmp);
+            if (!w_hi) {
+                for (uint32_t i = 0; i < L2Z_BLOCK; ++i) {
+                    qty[i] = static_cast<int64_t>(tmp[i]) * mul;
+                }
+            }
+            else {
+                unpack(p + kHead + packed_bytes(w_lo), w_hi, tmp_hi);
+                for (uint32_t i = 0; i < L2Z_BLOCK; ++i) {
+                    qty[i] = static_cast<int64_t>(tmp[i] | (uint64_t{tmp_hi[i]} << 32)) * mul;
+                }
+            }
+        }
+        else {
+            alignas(16) float q[L2Z_BLOCK];
+            const uint8_t scale = p[1];
+            if (scale == kQtyRaw) {
+                unpack(p + kHead, 32, reinterpret_cast<uint32_t*>(q));
+            }
+            else {
+                unpack(p + kHead, p[0], tmp);
+                const __m128d mul = _mm_set1_pd(kInvPow10[scale]);
+                for (uint32_t i = 0; i < L2Z_BLOCK; i += 4) {
+                    const __m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(tmp + i));
+                    const __m128d lo = _mm_mul_pd(_mm_cvtepi32_pd(v), mul);
+                    const __m128d hi = _mm_mul_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(v, _MM_SHUFFLE(3, 2, 3, 2))), mul);
+                    _mm_store_ps(q + i, _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)));
+                }
+            }
+            for (uint32_t i = 0; i < L2Z_BLOCK; ++i) {
+                qty[i] = l2_legacy_qty(q[i], side[i]);
+            }
+        }
+    }
+    return d.rows;
+}
+
+void L2ZFile::decode(uint64_t* ts, uint32_t* price, int64_t* qty, uint8_t* side) const noexcept {
+    const uint32_t full = static_cast<uint32_t>(hdr_.rows / L2Z_BLOCK);
+    for (uint32_t b = 0; b < full; ++b) {
+        const size_t at = size_t{b} * L2Z_BLOCK;
+        decode_block(b, ts + at, price + at, qty + at, side + at);
+    }
+    if (full < hdr_.blocks) {
+        BlockRows last;
+        const uint32_t n = decode_block(full, last.ts, last.price, last.qty, last.side);
+        const size_t at = size_t{full} * L2Z_BLOCK;
+        std::memcpy(ts + at, last.ts, n * sizeof(uint64_t));
+        std::memcpy(price + at, last.price, n * sizeof(uint32_t));
+        std::memcpy(qty + at, last.qty, n * sizeof(int64_t));
+        std::memcpy(side + at, last.side, n);
+    }
+}
+
+uint32_t L2ZFile::block_for(uint64_t ts_ns) const noexcept {
+    // last block starting before ts_ns, its tail may still hold rows at or after it
+    auto it = std::lower_bound(dir_.begin(), dir_.end(), ts_ns,
+                               [](const L2ZBlockDir& d, uint64_t t) { return d.ts_base < t; });
+    return it == dir_.begin() ? 0 : static_cast<uint32_t>(it - dir_.begin() - 1);
+}
+
+bool L2StoredHour::open(const std::string& base, uint64_t h) {
+    hour_s = h;
+    const std::string path = l2col_hour_path(base, h);
+    if (raw.open(path, true)) {
+        segs = raw.segments();
+        ckpts.assign(raw.checkpoints().begin(), raw.checkpoints().end());
+        rows = raw.rows();
+        price_decimals = raw.price_decimals();
+        qty_decimals = raw.qty_decimals();
+        return true;
+    }
+
+    // raw file compacted away, decode the whole hour
+    compacted = true;
+    L2ZFile z;
+    if (!z.open(l2z_path_for(path))) {
+        return false;
+    }
+    rows = z.rows();
+    const auto n = static_cast<size_t>(rows);
+    ts.resize(n);
+    price.resize(n);
+    qty.resize(n);
+    side.resize(n);
+    z.decode(ts.data(), price.data(), qty.data(), side.data());
+    segs.assign(1, L2Segment{0, ts, price, qty, side});
+    ckpts.assign(z.checkpoints().begin(), z.checkpoints().end());
+    price_decimals = z.price_decimals();
+    qty_decimals = z.qty_decimals();
+    return true;
+}
+
+uint64_t L2StoredHour::lower_bound(uint64_t ts_ns) const noexcept {
+    for (const auto& s : segs) {
+        if (s.ts.empty() || s.ts.back() < ts_ns) {
+            continue;
+        }
+        return s.row_base + static_cast<uint64_t>(std::lower_bound(s.ts.begin(), s.ts.end(), ts_ns) - s.ts.begin());
+    }
+    return rows;
+}
+
+std::pair<uint64_t, uint64_t> L2StoredHour::range(uint64_t t0_ns, uint64_t t1_ns) const noexcept {
+    if (t1_ns <= t0_ns) {
+        return {0, 0};
+    }
+    const uint64_t r0 = lower_bound(t0_ns);
+    return {r0, std::max(r0, lower_bound(t1_ns))};
+}
+
+L2Row L2StoredHour::row(uint64_t i) const noexcept {
+    for (const auto& s : segs) {
+        if (i < s.row_base + s.size()) {
+            const size_t k = static_cast<size_t>(i - s.row_base);
+            return {s.ts[k], s.qty[k], s.price[k], s.side[k]};
+        }
+    }
+    return {};
+}
+
+L2Compactor::L2Compactor(bool remove_raw) : remove_raw_(remove_raw) {}
+
+L2Compactor::~L2Compactor() {
+    stop();
+    join();
+}
+
+void L2Compactor::start() {
+    if (thread_) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        stop_ = false;
+    }
+    thread_ = std::make_unique<std::thread>(&L2Compactor::run, this);
+}
+
+void L2Compactor::stop() {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+}
+
+void L2Compactor::join() {
+    if (thread_ && thread_->joinable()) {
+        thread_->join();
+    }
+    thread_.reset();
+}
+
+void L2Compactor::submit(const std::string& hour_path) {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        pending_.push_back(hour_path);
+    }
+    cv_.notify_one();
+}
+
+void L2Compactor::run() {
+    // stay out of the way of the feed and writers, for cpu and for the disk
+    sched_param sp{};
+    if (::pthread_setschedparam(::pthread_self(), SCHED_IDLE, &sp) != 0) {
+        (void)::setpriority(PRIO_PROCESS, static_cast<id_t>(::syscall(SYS_gettid)), 19);
+    }
+    constexpr int IOPRIO_CLASS_IDLE = 3;
+    constexpr int IOPRIO_WHO_PROCESS = 1;
+    (void)::syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << 13);
+
+    while (true) {
+        std::string path;
+        {
+            std::unique_lock<std::mutex> lk(mu_);
+            cv_.wait(lk, [this] { return stop_ || !pending_.empty(); });
+            if (pending_.empty()) {
+                break;
+            }
+            path = std::move(pending_.front());
+            pending_.pop_front();
+        }
+        if (compact(path)) {
+            compacted_.fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+            failed_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+bool L2Compactor::compact(const std::string& hour_path) {
+    L2HourFile in;
+    if (!in.open(hour_path, true)) {
+        std::cerr << "[L2Compactor] " << in.error() << '\n';
+        return false;
+    }
+    const std::string out = l2z_path_for(hour_path);
+    std::string err;
+    if (!l2z_write(in, out, err)) {
+        std::cerr << "[L2Compactor] " << err << '\n';
+        return false;
+    }
+
+    // decode everything again before trusting the compressed copy
+    L2ZFile z;
+    if (!z.open(out)) {
+        std::cerr << "[L2Compactor] " << z.error() << '\n';
+        return false;
+    }
+    const auto n = static_cast<size_t>(in.rows());
+    std::vector<uint64_t> ts(n);
+    std::vector<uint32_t> price(n);
+    std::vector<int64_t> qty(n);
+    std::vector<uint8_t> side(n);
+    z.decode(ts.data(), price.data(), qty.data(), side.data());
+    bool same = z.rows() == in.rows();
+    in.for_each_segment(0, in.rows(), [&](const L2Segment& s) {
+        const size_t at = static_cast<size_t>(s.row_base);
+        same = same && std::memcmp(ts.data() + at, s.ts.data(), s.ts.size_bytes()) == 0 &&
+            std::memcmp(price.data() + at, s.price.data(), s.price.size_bytes()) == 0 &&
+            std::memcmp(qty.data() + at, s.qty.data(), s.qty.size_bytes()) == 0 &&
+            std::memcmp(side.data() + at, s.side.data(), s.side.size_bytes()) == 0;
+    });
+    if (!same) {
+        std::cerr << "[L2Compactor] " << out << ": decoded rows differ, keeping the raw file\n";
+        ::unlink(out.c_str());
+        return false;
+    }
+
+    // allocated bytes, the closed hour's trimmed column tails are holes
+    struct stat st{};
+    const uint64_t raw_bytes = ::stat(hour_path.c_str(), &st) == 0 ?
+        std::min(static_cast<uint64_t>(st.st_size), static_cast<uint64_t>(st.st_blocks) * 512) : 0;
+    bytes_in_.fetch_add(raw_bytes, std::memory_order_relaxed);
+    bytes_out_.fetch_add(z.bytes(), std::memory_order_relaxed);
+    std::cout << "[L2Compactor] " << out << ": " << n << " rows, " << raw_bytes << " -> " << z.bytes()
+        << " bytes\n";
+
+    if (remove_raw_) {
+        in.close();
+        ::unlink(hour_path.c_str());
+    }
+    return true;
+}
@@ -0,0 +1,185 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "l2_reader.h"
+
+// compressed form of a closed hour, written next to it as hh00.l2z. rows are cut into blocks
+// of L2Z_BLOCK, every column of a block is coded on its own and bit packed:
+//   ts     zigzag delta from the previous row, low and high 32 bits packed separately
+//   price  zigzag delta from the previous row
+//   qty    divided by the largest power of ten common to the block, low and high 32 bits packed
+//          separately (v1 files hold floats as decimal fixed point or raw bits, widened on decode)
+//   side   4 bit code (bid bit + snapshot/checkpoint/marker flags), raw byte if other bits are set
+// each block starts from the ts/price bases in its directory entry, so any block decodes alone.
+// packed values are interleaved over 4 lanes (value i in lane i % 4) so one SSE2 load, shift and
+// mask yields 4 consecutive values.
+
+static constexpr uint16_t L2Z_VERSION = 2;
+static constexpr uint32_t L2Z_BLOCK = 128;
+
+struct alignas(64) L2ZFileHeader {
+    char magic[6];  // "L2ZIP\n"
+    uint16_t version;
+    char product[16];
+    uint64_t hour_epoch_start;
+    uint64_t rows;
+    uint32_t block_rows;
+    uint32_t blocks;
+    // blocks L2ZBlockDir entries
+    uint64_t dir_off;
+    // per column byte stream of block payloads, block offsets in the directory are relative to these
+    uint64_t col_off[COL_COUNT];
+    uint64_t col_bytes[COL_COUNT];
+    // checkpoint index copied from the hour file, rows keep their numbering
+    uint64_t ckpt_off;
+    uint32_t ckpt_count;
+    // scales copied from the hour file, v1 files imply 2 and 8
+    uint8_t price_decimals;
+    uint8_t qty_decimals;
+    uint16_t _pad16{0};
+    uint8_t pad[256 - 6 - 2 - 16 - 8 - 8 - 4 - 4 - 8 - (8 * COL_COUNT) - (8 * COL_COUNT) - 8 - 4 - 1 - 1 - 2];
+};
+
+static_assert(sizeof(L2ZFileHeader) == 256, "l2z header must be 256 bytes");
+
+struct L2ZBlockDir {
+    uint64_t ts_base;  // ts of the block's first row
+    uint32_t px_base;  // price of the block's first row
+    uint32_t rows;
+    uint32_t off[COL_COUNT];
+};
+
+static_assert(sizeof(L2ZBlockDir) == 32, "l2z block directory entry must be 32 bytes");
+
+inline std::string l2z_path_for(const std::string& hour_path) {
+    const auto dot = hour_path.rfind(".bin");
+    return (dot == std::string::npos ? hour_path : hour_path.substr(0, dot)) + ".l2z";
+}
+
+// encodes an open hour file into path, written to path.tmp and renamed when complete
+bool l2z_write(const L2HourFile& in, const std::string& path, std::string& err);
+
+class L2ZFile {
+public:
+    L2ZFile() = default;
+    ~L2ZFile();
+    L2ZFile(const L2ZFile&) = delete;
+    L2ZFile& operator=(const L2ZFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    const std::string& error() const noexcept { return error_; }
+    const L2ZFileHeader& header() const noexcept { return hdr_; }
+    uint64_t rows() const noexcept { return hdr_.rows; }
+    uint32_t blocks() const noexcept { return hdr_.blocks; }
+    uint8_t price_decimals() const noexcept { return hdr_.price_decimals; }
+    uint8_t qty_decimals() const noexcept { return hdr_.qty_decimals; }
+    std::span<const L2ZBlockDir> directory() const noexcept { return dir_; }
+    std::span<const L2CkptEntry> checkpoints() const noexcept { return ckpts_; }
+    // compressed bytes, header and directory included
+    size_t bytes() const noexcept { return map_bytes_; }
+
+    // decodes block b, every output needs room for L2Z_BLOCK values. returns the rows in the block
+    uint32_t decode_block(uint32_t b, uint64_t* ts, uint32_t* price, int64_t* qty, uint8_t* side) const noexcept;
+    // decodes every row, outputs need room for rows()
+    void decode(uint64_t* ts, uint32_t* price, int64_t* qty, uint8_t* side) const noexcept;
+    // first block that may hold a row with ts >= ts_ns
+    uint32_t block_for(uint64_t ts_ns) const noexcept;
+
+private:
+    const uint8_t* map_{nullptr};
+    size_t map_bytes_{0};
+    L2ZFileHeader hdr_{};
+    std::span<const L2ZBlockDir> dir_;
+    std::span<const L2CkptEntry> ckpts_;
+    std::string error_;
+
+    bool fail(const std::string& path, const char* why);
+};
+
+// one stored hour's columns, from the raw file or, once that is compacted away, decoded from the
+// l2z file. the spans in segs point into raw or the decoded vectors, they stay valid when it moves
+struct L2StoredHour {
+    uint64_t hour_s{0};
+    L2HourFile raw;
+    std::vector<uint64_t> ts;
+    std::vector<uint32_t> price;
+    std::vector<int64_t> qty;
+    std::vector<uint8_t> side;
+    std::vector<L2Segment> segs;
+    std::vector<L2CkptEntry> ckpts;
+    uint64_t rows{0};
+    uint8_t price_decimals{L2COL_V3_PRICE_DECIMALS};
+    uint8_t qty_decimals{L2COL_V3_QTY_DECIMALS};
+    // read from the l2z file
+    bool compacted{false};
+
+    // false when the hour has neither file
+    bool open(const std::string& base, uint64_t hour_s);
+    // first row with ts >= ts_ns, rows when there is none
+    uint64_t lower_bound(uint64_t ts_ns) const noexcept;
+    // rows [first, second) with t0 <= ts < t1
+    std::pair<uint64_t, uint64_t> range(uint64_t t0_ns, uint64_t t1_ns) const noexcept;
+    L2Row row(uint64_t i) const noexcept;
+
+    // calls f(const L2Segment&) for each segment piece of rows [r0, r1), in order
+    template <typename F>
+    void for_each_segment(uint64_t r0, uint64_t r1, F&& f) const {
+        for (const auto& s : segs) {
+            if (s.row_base + s.size() <= r0) {
+                continue;
+            }
+            if (s.row_base >= r1) {
+                break;
+            }
+            f(s.slice(r0, r1));
+        }
+    }
+};
+
+// low priority thread that compacts hour files handed over by writers after they close them.
+// every file is decoded again and compared before the raw file is optionally removed.
+class L2Compactor {
+public:
+    explicit L2Compactor(bool remove_raw = false);
+    ~L2Compactor();
+
+    void start();
+    // compacts what is queued, then exits
+    void stop();
+    void join();
+
+    // called from writer threads after close_file
+    void submit(const std::string& hour_path);
+
+    uint64_t compacted() const noexcept { return compacted_.load(std::memory_order_relaxed); }
+    uint64_t failed() const noexcept { return failed_.load(std::memory_order_relaxed); }
+    uint64_t bytes_in() const noexcept { return bytes_in_.load(std::memory_order_relaxed); }
+    uint64_t bytes_out() const noexcept { return bytes_out_.load(std::memory_order_relaxed); }
+
+private:
+    const bool remove_raw_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<std::string> pending_;
+    bool stop_{false};
+    std::unique_ptr<std::thread> thread_;
+    std::atomic<uint64_t> compacted_{0};
+    std::atomic<uint64_t> failed_{0};
+    std::atomic<uint64_t> bytes_in_{0};
+    std::atomic<uint64_t> bytes_out_{0};
+
+    void run();
+    bool compact(const std::string& hour_path);
+};
@@ -0,0 +1,133 @@
+#include "l2_parser.h"
+#include <immintrin.h>
+
+// every kernel classifies 64 bytes into a bit mask of structural characters, then the set bits
+// are flattened into offsets. [ and ] are { and } with bit 5 clear, so or-ing 0x20 into each byte
+// folds the four brackets into two compares. the last partial block is copied into a block of
+// spaces so the kernels never read past the message.
+
+// writes 8 offsets at a time whether or not that many bits are left, most blocks then take no
+// data dependent branch. out has 64 entries of slack past the last real offset
+static inline __attribute__((always_inline)) size_t flatten(uint64_t m, uint32_t base, uint32_t* out,
+                                                           size_t n) noexcept {
+    const size_t cnt = static_cast<size_t>(__builtin_popcountll(m));
+    uint32_t* o = out + n;
+    for (size_t i = 0; i < cnt; i += 8) {
+        for (int j = 0; j < 8; ++j) {
+            o[i + j] = base + static_cast<uint32_t>(__builtin_ctzll(m | (1ull << 63)));
+            m &= m - 1;
+        }
+    }
+    return n + cnt;
+}
+
+// inlined into each kernel so the block classifier inlines with the kernel's target
+template <uint64_t (*Block)(const char*) noexcept>
+static inline __attribute__((always_inline)) size_t index_blocks(const char* buf, size_t len, uint32_t* out) {
+    size_t n = 0;
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        n = flatten(Block(buf + i), static_cast<uint32_t>(i), out, n);
+    }
+    if (i < len) {
+        alignas(64) char tail[64];
+        std::memset(tail, ' ', sizeof(tail));
+        std::memcpy(tail, buf + i, len - i);
+        n = flatten(Block(tail), static_cast<uint32_t>(i), out, n);
+    }
+    return n;
+}
+
+// exact per byte zero test, 0x80 in every byte of x that is zero
+static inline uint64_t zero_bytes(uint64_t x) noexcept {
+    constexpr uint64_t lo7 = 0x7f7f7f7f7f7f7f7fULL;
+    return ~(((x & lo7) + lo7) | x | lo7);
+}
+
+static inline uint64_t block_swar(const char* p) noexcept {
+    constexpr uint64_t m1 = 0x0101010101010101ULL;
+    uint64_t mask = 0;
+    for (int w = 0; w < 8; ++w) {
+        uint64_t x;
+        std::memcpy(&x, p + w * 8, 8);
+        const uint64_t folded = x | (m1 * 0x20);
+        const uint64_t hit = zero_bytes(x ^ (m1 * '"')) | zero_bytes(folded ^ (m1 * '{')) |
+            zero_bytes(folded ^ (m1 * '}'));
+        // gather the 0x80 bits of the 8 bytes into one byte
+        mask |= (((hit >> 7) * 0x0102040810204080ULL) >> 56) << (w * 8);
+    }
+    return mask;
+}
+
+// pcmpestrm compares every byte against the set and returns the matches as a bit mask
+__attribute__((target("sse4.2")))
+static inline uint64_t block_sse42(const char* p) noexcept {
+    const __m128i set = _mm_setr_epi8('"', '{', '}', '[', ']', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    uint64_t mask = 0;
+    for (int w = 0; w < 4; ++w) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + w * 16));
+        const __m128i m = _mm_cmpestrm(set, 5, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK);
+        mask |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_cvtsi128_si32(m))) << (w * 16);
+    }
+    return mask;
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t block_avx2(const char* p) noexcept {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i open = _mm256_set1_epi8('{');
+    const __m256i close = _mm256_set1_epi8('}');
+    const __m256i bit5 = _mm256_set1_epi8(0x20);
+    uint64_t mask = 0;
+    for (int h = 0; h < 2; ++h) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + h * 32));
+        const __m256i f = _mm256_or_si256(v, bit5);
+        const __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                                            _mm256_or_si256(_mm256_cmpeq_epi8(f, open), _mm256_cmpeq_epi8(f, close)));
+        mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(hit))) << (h * 32);
+    }
+    return mask;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline uint64_t block_avx512(const char* p) noexcept {
+    const __m512i v = _mm512_loadu_si512(p);
+    const __m512i f = _mm512_or_si512(v, _mm512_set1_epi8(0x20));
+    return static_cast<uint64_t>(_mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('"')) |
+                                 _mm512_cmpeq_epi8_mask(f, _mm512_set1_epi8('{')) |
+                                 _mm512_cmpeq_epi8_mask(f, _mm512_set1_epi8('}')));
+}
+
+size_t struct_index_swar(const char* buf, size_t len, uint32_t* out) {
+    return index_blocks<block_swar>(buf, len, out);
+}
+
+__attribute__((target("sse4.2")))
+size_t struct_index_sse42(const char* buf, size_t len, uint32_t* out) {
+    return index_blocks<block_sse42>(buf, len, out);
+}
+
+__attribute__((target("avx2")))
+size_t struct_index_avx2(const char* buf, size_t len, uint32_t* out) {
+    return index_blocks<block_avx2>(buf, len, out);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+size_t struct_index_avx512(const char* buf, size_t len, uint32_t* out) {
+    return index_blocks<block_avx512>(buf, len, out);
+}
+
+std::vector<StructIndexKernel> struct_index_kernels() {
+    __builtin_cpu_init();
+    std::vector<StructIndexKernel> out{{"swar", &struct_index_swar}};
+    if (__builtin_cpu_supports("sse4.2")) {
+        out.push_back({"sse4.2", &struct_index_sse42});
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        out.push_back({"avx2", &struct_index_avx2});
+    }
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        out.push_back({"avx512", &struct_index_avx512});
+    }
+    return out;
+}
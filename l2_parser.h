@@ -0,0 +1,597 @@
+#pragma once
+#include <emmintrin.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// parser for coinbase l2_data messages. one vectorized pass over the message records the offset of
+// every quote, brace and bracket (the structural index), then the event and level fields are read
+// straight off the index instead of searching the bytes again. strings on this channel never hold
+// escapes or structural characters, so every quote in the index opens or closes a string.
+
+// writes the offsets of every " { } [ ] in buf[0, len) to out, in order. out needs room for
+// len + 64 entries, kernels may write past the count. returns the count
+using struct_index_fn = size_t (*)(const char* buf, size_t len, uint32_t* out);
+
+size_t struct_index_swar(const char* buf, size_t len, uint32_t* out);
+size_t struct_index_sse42(const char* buf, size_t len, uint32_t* out);
+size_t struct_index_avx2(const char* buf, size_t len, uint32_t* out);
+size_t struct_index_avx512(const char* buf, size_t len, uint32_t* out);
+
+struct StructIndexKernel {
+    const char* name;
+    struct_index_fn fn;
+};
+
+// every kernel this cpu can run, from cpuid, best last
+std::vector<StructIndexKernel> struct_index_kernels();
+
+inline StructIndexKernel select_struct_index() {
+    return struct_index_kernels().back();
+}
+
+// value of the n <= 8 decimal digits at p, 0 for n = 0. loads the 8 bytes ending at p + n, so
+// 8 - n bytes before p must be readable, which holds for any value inside a message
+inline uint32_t l2_digits8(const char* p, size_t n) noexcept {
+    uint64_t v;
+    std::memcpy(&v, p + n - 8, 8);
+    // bytes before the digits become '0'
+    static constexpr uint64_t keep_n[9] = {0, 0xff00000000000000ull, 0xffff000000000000ull, 0xffffff0000000000ull,
+                                           0xffffffff00000000ull, 0xffffffffff000000ull, 0xffffffffffff0000ull,
+                                           0xffffffffffffff00ull, ~0ull};
+    const uint64_t keep = keep_n[n];
+    v = (v & keep) | (0x3030303030303030ull & ~keep);
+    v -= 0x3030303030303030ull;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000ff000000ffull) * (100 + (1000000ull << 32))) +
+         (((v >> 16) & 0x000000ff000000ffull) * (1 + (10000ull << 32)))) >> 32;
+    return static_cast<uint32_t>(v);
+}
+
+// value of 16 digit bytes (0..9, most significant first) in two rounds of pmaddwd
+inline uint64_t l2_digits16(__m128i d) noexcept {
+    const __m128i z = _mm_setzero_si128();
+    const __m128i x10 = _mm_setr_epi16(10, 1, 10, 1, 10, 1, 10, 1);
+    const __m128i two = _mm_packs_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(d, z), x10),
+                                        _mm_madd_epi16(_mm_unpackhi_epi8(d, z), x10));
+    const __m128i four = _mm_madd_epi16(two, _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+    const __m128i eight = _mm_madd_epi16(_mm_packs_epi32(four, four),
+                                         _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+    const auto v = static_cast<uint64_t>(_mm_cvtsi128_si64(eight));
+    return (v & 0xffffffffu) * 100000000u + (v >> 32);
+}
+
+// "0.00412500" -> 412500 for D = 8, "21921.74" -> 2192174 for D = 2: the decimal string in [p, end)
+// as a count of 10^-D units. digits past the D-th are dropped, products quote on their increment
+// so there are none. D is fixed per product, the scale multipliers are immediates. values up to
+// 16 characters, all of them in practice, are one 16 byte load ending at end (inside the message,
+// like l2_digits8's loads): the point is found with a compare, the integer digits move up one byte
+// to close its gap and all digits are read at once, without a data dependent branch
+template <unsigned D>
+inline int64_t l2_decode_fixed(const char* p, const char* end) noexcept {
+    static_assert(D <= 8, "at most 8 fraction digits");
+    static constexpr int64_t scale[9] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+    auto len = static_cast<size_t>(end - p);
+    if (__builtin_expect(len > 16, 0)) {
+        int64_t v = 0;
+        size_t nf = 0;
+        bool frac = false;
+        for (; p < end; ++p) {
+            if (*p == '.') {
+                frac = true;
+                continue;
+            }
+            if (frac && nf == D) {
+                break;
+            }
+            v = v * 10 + (*p - '0');
+            nf += frac;
+        }
+        return v * scale[D - nf];
+    }
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(end - 16));
+    const uint32_t m = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('.')))) >> (16 - len);
+    // no point puts it at len
+    const auto ni = static_cast<size_t>(__builtin_ctz(m | (1u << len)));
+    const bool has_dot = ni < len;
+    size_t nf = len - ni - has_dot;
+    if (__builtin_expect(nf > D, 0)) {
+        len -= nf - D;
+        v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + len - 16));
+        nf = D;
+    }
+
+    // p[i] is byte 16 - len + i of v. masks of bytes >= k are 16 byte windows into a step
+    alignas(64) static constexpr uint8_t step[48] = {0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+                                                     0,    0,    0,    0,    0,    0,    0xff, 0xff, 0xff, 0xff,
+                                                     0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                                                     0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                                                     0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    const auto ge = [](size_t k) noexcept { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(step + 16 - k)); };
+    const size_t first = 16 - len;
+    const size_t dot = first + ni;
+    const __m128i digits = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    const __m128i int_digits = _mm_and_si128(digits, _mm_andnot_si128(ge(dot), ge(first)));
+    const __m128i frac_digits = _mm_and_si128(digits, ge(dot + 1));
+    // the integer digits close the point's gap, without a point they are already in place
+    const __m128i shift = ge(has_dot ? 0 : 16);
+    const __m128i joined = _mm_or_si128(frac_digits, _mm_or_si128(_mm_and_si128(shift, _mm_slli_si128(int_digits, 1)),
+                                                                  _mm_andnot_si128(shift, int_digits)));
+    return static_cast<int64_t>(l2_digits16(joined)) * scale[D - nf];
+}
+
+// prices are stored as 32 bit units, the top value is kept for one that does not fit
+static constexpr uint32_t L2_PRICE_OVERFLOW = 0xffffffffu;
+
+// a price past the product's scale decodes as L2_PRICE_OVERFLOW rather than wrap
+template <unsigned D>
+inline uint32_t l2_decode_price(const char* p, const char* end) noexcept {
+    const int64_t v = l2_decode_fixed<D>(p, end);
+    return static_cast<uint64_t>(v) < L2_PRICE_OVERFLOW ? static_cast<uint32_t>(v) : L2_PRICE_OVERFLOW;
+}
+
+template <unsigned D>
+inline int64_t l2_decode_qty(const char* p, const char* end) noexcept {
+    return l2_decode_fixed<D>(p, end);
+}
+
+static constexpr uint8_t L2_MAX_DECIMALS = 8;
+
+// decimals of a product's price and size increments, 0.01 and 0.00000001 are {2, 8}
+struct L2Decimals {
+    uint8_t price{2};
+    uint8_t qty{8};
+};
+
+// highest price, in whole quote units, a price scale of `decimals` stores
+inline double l2_price_limit(uint8_t decimals) noexcept {
+    double v = L2_PRICE_OVERFLOW - 1;
+    for (uint8_t i = 0; i < decimals; ++i) {
+        v /= 10;
+    }
+    return v;
+}
+
+// a product's field decoders, picked once from its price and size increments
+struct L2Decoder {
+    uint8_t price_decimals;
+    uint8_t qty_decimals;
+    uint32_t (*price)(const char*, const char*) noexcept;
+    int64_t (*qty)(const char*, const char*) noexcept;
+};
+
+// decimals above L2_MAX_DECIMALS are clamped
+inline L2Decoder l2_decoder_for(uint8_t price_decimals, uint8_t qty_decimals) noexcept {
+    static constexpr uint32_t (*price[])(const char*, const char*) noexcept = {
+        &l2_decode_price<0>, &l2_decode_price<1>, &l2_decode_price<2>, &l2_decode_price<3>, &l2_decode_price<4>,
+        &l2_decode_price<5>, &l2_decode_price<6>, &l2_decode_price<7>, &l2_decode_price<8>};
+    static constexpr int64_t (*qty[])(const char*, const char*) noexcept = {
+        &l2_decode_qty<0>, &l2_decode_qty<1>, &l2_decode_qty<2>, &l2_decode_qty<3>, &l2_decode_qty<4>,
+        &l2_decode_qty<5>, &l2_decode_qty<6>, &l2_decode_qty<7>, &l2_decode_qty<8>};
+    const uint8_t pd = std::min(price_decimals, L2_MAX_DECIMALS);
+    const uint8_t qd = std::min(qty_decimals, L2_MAX_DECIMALS);
+    return {pd, qd, price[pd], qty[qd]};
+}
+
+inline int64_t l2_days_from_civil(int y, unsigned m, unsigned d) noexcept {
+    y -= (m <= 2);
+    const int era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned mp = m + (m > 2 ? -3 : 9);
+    const unsigned doy = (153 * mp + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + yoe / 400 + doy;
+    return static_cast<int64_t>(era) * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+// "2023-02-09T20:32:50.714964855Z" -> unix ns, endq is the closing quote
+inline uint64_t l2_parse_rfc3339_ns(const char* ts, const char* endq) noexcept {
+    // levels of a message share their minute, "yyyy-mm-ddThh:mm" is compared as two words and
+    // only parsed when it changes
+    thread_local uint64_t last_prefix[2] = {0, 0};
+    thread_local int64_t last_minute_s = 0;
+    uint64_t prefix[2];
+    std::memcpy(prefix, ts, sizeof(prefix));
+    if (prefix[0] != last_prefix[0] || prefix[1] != last_prefix[1]) {
+        int y = (ts[0] - '0') * 1000 + (ts[1] - '0') * 100 + (ts[2] - '0') * 10 + (ts[3] - '0');
+        int mo = (ts[5] - '0') * 10 + (ts[6] - '0');
+        int d = (ts[8] - '0') * 10 + (ts[9] - '0');
+        int hh = (ts[11] - '0') * 10 + (ts[12] - '0');
+        int mm = (ts[14] - '0') * 10 + (ts[15] - '0');
+        last_minute_s = l2_days_from_civil(y, static_cast<unsigned>(mo), static_cast<unsigned>(d)) * 86400 +
+            hh * 3600 + mm * 60;
+        last_prefix[0] = prefix[0];
+        last_prefix[1] = prefix[1];
+    }
+    const int ss = (ts[17] - '0') * 10 + (ts[18] - '0');
+
+    // up to 9 fraction digits, scaled to ns
+    static constexpr uint32_t pow10[10] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+                                           1000000000};
+    uint32_t frac_ns = 0;
+    const char* s = ts + 19;
+    if (s < endq && *s == '.') {
+        ++s;
+        // the zone designator after the digits
+        const char* e = endq > s && (endq[-1] < '0' || endq[-1] > '9') ? endq - 1 : endq;
+        const size_t n = std::min<size_t>(static_cast<size_t>(e - s), 9);
+        if (n == 9) {
+            frac_ns = l2_digits8(s, 8) * 10u + static_cast<uint32_t>(s[8] - '0');
+        }
+        else if (n) {
+            frac_ns = l2_digits8(s, n) * pow10[9 - n];
+        }
+    }
+    const int64_t secs = last_minute_s + ss;
+    return static_cast<uint64_t>(secs) * 1000000000ULL + frac_ns;
+}
+
+struct L2ParsedEvent {
+    bool snapshot;
+    const char* product;
+    size_t product_len;
+    // raw bytes of the event's first level, empty when its updates array is
+    const char* first_level;
+    size_t first_level_len;
+    // event_time of the first level, 0 without one. it grows from event to event of a product, so
+    // it orders the copies two connections deliver
+    uint64_t ts_ns;
+};
+
+// price and qty in the units of the event's L2Decoder, a price past its scale is L2_PRICE_OVERFLOW
+struct L2ParsedLevel {
+    uint64_t ts_ns;
+    int64_t qty;
+    uint32_t price;
+    bool bid;
+};
+
+// one trade of a market_trades message, price and size in the units of its product's L2Decoder.
+// buy is the side as the exchange reports it
+struct L2ParsedTrade {
+    uint64_t ts_ns;
+    uint64_t trade_id;
+    int64_t size;
+    uint32_t price;
+    bool buy;
+    bool snapshot;
+};
+
+class L2Parser {
+public:
+    L2Parser() : L2Parser(select_struct_index()) {}
+    explicit L2Parser(StructIndexKernel kernel) : kernel_(kernel) {
+        idx_.resize(kIndexReserve);
+        carry_.resize(kCarryPad + kCarryReserve, ' ');
+    }
+
+    // indexes one message and walks its events. on_event(const L2ParsedEvent&) returns the
+    // product's const L2Decoder*, or nullptr when the event's levels are not wanted. wanted levels
+    // go to on_level(const L2ParsedLevel&) in message order.
+    // false if buf is not an l2_data message
+    template <typename E, typename L>
+    bool parse(const char* buf, size_t len, E&& on_event, L&& on_level) {
+        return feed(buf, len, true, true, on_event, on_level);
+    }
+    // the same for a message that arrives in fragments, fed in order with first and final as the
+    // websocket reports them. each fragment is walked as it lands, up to its last closing brace:
+    // levels and event headers have no braces inside, so every level before it is whole. the bytes
+    // after it are copied aside and walked with the head of the next fragment, nothing else is.
+    // false on the first fragment of a message that is not l2_data, nothing is kept then
+    template <typename E, typename L>
+    bool feed(const char* buf, size_t len, bool first, bool final, E&& on_event, L&& on_level);
+    // same for a market_trades message: on_product(const char* id, size_t n) returns the trade's
+    // product decoder or nullptr to skip it, wanted trades go to on_trade(const L2ParsedTrade&).
+    // false if buf is not a market_trades message
+    template <typename P, typename T>
+    bool parse_trades(const char* buf, size_t len, P&& on_product, T&& on_trade);
+
+    const char* kernel_name() const noexcept { return kernel_.name; }
+    // structural characters found in the last piece walked
+    size_t indexed() const noexcept { return n_; }
+    // bytes copied aside between fragments since construction
+    uint64_t carried() const noexcept { return carried_; }
+
+private:
+    static constexpr size_t LEVEL_TOKENS = 18;
+    // room for a websocket fragment of the feed's 8 KB receive buffer plus a carried tail, larger
+    // pieces grow the index once
+    static constexpr size_t kIndexReserve = 16 * 1024 + 64;
+    // a carried tail is at most one level or event header. the pad in front keeps the decoders'
+    // loads that end at a value inside the buffer
+    static constexpr size_t kCarryReserve = 4096;
+    static constexpr size_t kCarryPad = 16;
+
+    StructIndexKernel kernel_;
+    std::vector<uint32_t> idx_;
+    size_t n_{0};
+
+    // where the message being fed stands: in the head of an event, looking for its updates, or
+    // in its updates array. on_event runs at the first level, or at ] for an empty array
+    bool in_updates_{false};
+    bool event_open_{false};
+    bool snapshot_{false};
+    // product of the current event, only read in the piece that holds it
+    const char* product_{nullptr};
+    size_t product_len_{0};
+    const L2Decoder* dec_{nullptr};
+    std::vector<char> carry_;
+    size_t carry_len_{0};
+    uint64_t carried_{0};
+
+    // true if the string opening at token k is the key "key"
+    template <size_t N>
+    bool is_key(const char* buf, size_t len, size_t k, const char (&key)[N]) const noexcept {
+        const uint32_t open = idx_[k];
+        const uint32_t close = idx_[k + 1];
+        return close - open - 1 == N - 1 && close + 1 < len && buf[close + 1] == ':' &&
+            std::memcmp(buf + open + 1, key, N - 1) == 0;
+    }
+
+    void carry(const char* buf, size_t len) {
+        if (kCarryPad + carry_len_ + len > carry_.size()) {
+            carry_.resize(kCarryPad + carry_len_ + len);
+        }
+        std::memcpy(carry_.data() + kCarryPad + carry_len_, buf, len);
+        carry_len_ += len;
+        carried_ += len;
+    }
+
+    // walks buf[0, len), which starts and ends between tokens of the message
+    template <typename E, typename L>
+    void walk(const char* buf, size_t len, E& on_event, L& on_level);
+};
+
+template <typename E, typename L>
+bool L2Parser::feed(const char* buf, size_t len, bool first, bool final, E&& on_event, L&& on_level) {
+    if (first) {
+        static constexpr char PREFIX[] = R"({"channel":"l2_data")";
+        if (len < sizeof(PREFIX) - 1 || std::memcmp(buf, PREFIX, sizeof(PREFIX) - 1)) {
+            return false;
+        }
+        in_updates_ = false;
+        event_open_ = false;
+        product_ = nullptr;
+        dec_ = nullptr;
+        carry_len_ = 0;
+    }
+    // the tail of the last fragment and the head of this one up to its first brace make one piece
+    if (carry_len_) {
+        const auto* brace = static_cast<const char*>(std::memchr(buf, '}', len));
+        const size_t head = brace ? static_cast<size_t>(brace - buf) + 1 : len;
+        carry(buf, head);
+        buf += head;
+        len -= head;
+        if (!brace && !final) {
+            return true;
+        }
+        walk(carry_.data() + kCarryPad, carry_len_, on_event, on_level);
+        carry_len_ = 0;
+    }
+    if (final) {
+        walk(buf, len, on_event, on_level);
+        return true;
+    }
+    const auto* last = static_cast<const char*>(memrchr(buf, '}', len));
+    const size_t whole = last ? static_cast<size_t>(last - buf) + 1 : 0;
+    if (whole) {
+        walk(buf, whole, on_event, on_level);
+    }
+    carry(buf + whole, len - whole);
+    return true;
+}
+
+template <typename E, typename L>
+void L2Parser::walk(const char* buf, size_t len, E& on_event, L& on_level) {
+    if (idx_.size() < len + 64) {
+        idx_.resize(len + 64);
+    }
+    n_ = kernel_.fn(buf, len, idx_.data());
+    const uint32_t* t = idx_.data();
+    const size_t n = n_;
+
+    // one message can carry several events, each for its own product. an event object holds
+    // "type", "product_id" and then "updates", an array of flat objects of four string pairs
+    size_t k = 0;
+    while (k < n) {
+        if (in_updates_) {
+            const char c = buf[t[k]];
+            if (c == ']') {
+                if (event_open_) {
+                    dec_ = on_event(L2ParsedEvent{snapshot_, product_, product_len_, buf + t[k], 0, 0});
+                    event_open_ = false;
+                }
+                in_updates_ = false;
+                product_ = nullptr;
+                ++k;
+                continue;
+            }
+            if (c != '{') {
+                ++k;
+                continue;
+            }
+            // the first level decides whether the event is wanted and tells its copies apart
+            if (event_open_) {
+                size_t e = k + 1;
+                while (e < n && buf[t[e]] != '}') {
+                    ++e;
+                }
+                if (e == n) {
+                    return;
+                }
+                uint64_t ts_ns = 0;
+                for (size_t m = k + 1; m + 3 < e; m += 4) {
+                    if (buf[t[m] + 1] == 'e') {
+                        ts_ns = l2_parse_rfc3339_ns(buf + t[m + 2] + 1, buf + t[m + 3]);
+                        break;
+                    }
+                }
+                dec_ = on_event(L2ParsedEvent{snapshot_, product_, product_len_, buf + t[k], t[e] - t[k] + 1, ts_ns});
+                event_open_ = false;
+            }
+            // each level is { then four key/value string pairs (16 quotes) then }. levels with the
+            // keys in the usual order are read at fixed index offsets, anything else pair by pair
+            // with the keys told apart by their first letter
+            const L2Decoder* dec = dec_;
+            if (k + LEVEL_TOKENS <= n && buf[t[k + LEVEL_TOKENS - 1]] == '}' && buf[t[k + 1] + 1] == 's' &&
+                buf[t[k + 5] + 1] == 'e' && buf[t[k + 9] + 1] == 'p' && buf[t[k + 13] + 1] == 'n') {
+                if (dec) {
+                    const L2ParsedLevel lvl{l2_parse_rfc3339_ns(buf + t[k + 7] + 1, buf + t[k + 8]),
+                                            dec->qty(buf + t[k + 15] + 1, buf + t[k + 16]),
+                                            dec->price(buf + t[k + 11] + 1, buf + t[k + 12]),
+                                            buf[t[k + 3] + 1] == 'b'};
+                    on_level(lvl);
+                }
+                k += LEVEL_TOKENS;
+                continue;
+            }
+            L2ParsedLevel lvl{0, 0, 0, false};
+            size_t m = k + 1;
+            for (; m + 3 < n && buf[t[m]] == '"'; m += 4) {
+                if (!dec) {
+                    continue;
+                }
+                const char* v = buf + t[m + 2] + 1;
+                switch (buf[t[m] + 1]) {
+                case 's': lvl.bid = *v == 'b'; break;
+                case 'e': lvl.ts_ns = l2_parse_rfc3339_ns(v, buf + t[m + 3]); break;
+                case 'p': lvl.price = dec->price(v, buf + t[m + 3]); break;
+                case 'n': lvl.qty = dec->qty(v, buf + t[m + 3]); break;
+                default: break;
+                }
+            }
+            if (m < n && buf[t[m]] == '}') {
+                if (dec) {
+                    on_level(static_cast<const L2ParsedLevel&>(lvl));
+                }
+                ++m;
+            }
+            k = m;
+            continue;
+        }
+
+        if (buf[t[k]] != '"' || k + 1 >= n) {
+            ++k;
+            continue;
+        }
+        // a string value follows its key's closing quote after the colon
+        const bool str_val = t[k + 1] + 2 < len && buf[t[k + 1] + 2] == '"' && k + 3 < n;
+        if (str_val && is_key(buf, len, k, "type")) {
+            snapshot_ = buf[t[k + 2] + 1] == 's';
+            product_ = nullptr;
+            k += 4;
+            continue;
+        }
+        if (str_val && is_key(buf, len, k, "product_id")) {
+            product_ = buf + t[k + 2] + 1;
+            product_len_ = t[k + 3] - t[k + 2] - 1;
+            k += 4;
+            continue;
+        }
+        if (k + 2 < n && buf[t[k + 2]] == '[' && is_key(buf, len, k, "updates")) {
+            in_updates_ = true;
+            // an event without a product has its levels skipped
+            event_open_ = product_ != nullptr;
+            dec_ = nullptr;
+            k += 3;
+            continue;
+        }
+        k += str_val ? 4 : 2;
+    }
+}
+
+template <typename P, typename T>
+bool L2Parser::parse_trades(const char* buf, size_t len, P&& on_product, T&& on_trade) {
+    static constexpr char PREFIX[] = R"({"channel":"market_trades")";
+    if (len < sizeof(PREFIX) - 1 || std::memcmp(buf, PREFIX, sizeof(PREFIX) - 1)) {
+        return false;
+    }
+    if (idx_.size() < len + 64) {
+        idx_.resize(len + 64);
+    }
+    n_ = kernel_.fn(buf, len, idx_.data());
+    const uint32_t* t = idx_.data();
+    const size_t n = n_;
+
+    // an event holds "type" and then "trades", an array of flat objects of six string pairs. each
+    // trade names its own product, the keys are told apart by length and first letter
+    bool snapshot = false;
+    size_t k = 0;
+    while (k + 1 < n) {
+        if (buf[t[k]] != '"') {
+            ++k;
+            continue;
+        }
+        const bool str_val = t[k + 1] + 2 < len && buf[t[k + 1] + 2] == '"' && k + 3 < n;
+        if (str_val && is_key(buf, len, k, "type")) {
+            snapshot = buf[t[k + 2] + 1] == 's';
+            k += 4;
+            continue;
+        }
+        if (!(k + 2 < n && buf[t[k + 2]] == '[' && is_key(buf, len, k, "trades"))) {
+            k += str_val ? 4 : 2;
+            continue;
+        }
+
+        size_t j = k + 3;
+        while (j < n && buf[t[j]] == '{') {
+            L2ParsedTrade tr{0, 0, 0, 0, false, snapshot};
+            const char* product = nullptr;
+            size_t product_len = 0;
+            const char* px[2] = {nullptr, nullptr};
+            const char* sz[2] = {nullptr, nullptr};
+            size_t m = j + 1;
+            for (; m + 3 < n && buf[t[m]] == '"'; m += 4) {
+                const char* key = buf + t[m] + 1;
+                const size_t key_len = t[m + 1] - t[m] - 1;
+                const char* v = buf + t[m + 2] + 1;
+                const char* v_end = buf + t[m + 3];
+                switch (key[0]) {
+                case 't':
+                    if (key_len == 8) {
+                        for (; v < v_end && *v >= '0' && *v <= '9'; ++v) {
+                            tr.trade_id = tr.trade_id * 10 + static_cast<uint64_t>(*v - '0');
+                        }
+                    }
+                    else {
+                        tr.ts_ns = l2_parse_rfc3339_ns(v, v_end);
+                    }
+                    break;
+                case 'p':
+                    if (key_len == 10) {
+                        product = v;
+                        product_len = static_cast<size_t>(v_end - v);
+                    }
+                    else {
+                        px[0] = v;
+                        px[1] = v_end;
+                    }
+                    break;
+                case 's':
+                    if (key_len == 4 && key[2] == 'z') {
+                        sz[0] = v;
+                        sz[1] = v_end;
+                    }
+                    else {
+                        tr.buy = *v == 'B';
+                    }
+                    break;
+                default: break;
+                }
+            }
+            if (m >= n || buf[t[m]] != '}') {
+                return true;
+            }
+            j = m + 1;
+            const L2Decoder* dec = product ? on_product(product, product_len) : nullptr;
+            if (dec && px[0] && sz[0] && tr.ts_ns) {
+                tr.price = dec->price(px[0], px[1]);
+                tr.size = dec->qty(sz[0], sz[1]);
+                on_trade(static_cast<const L2ParsedTrade&>(tr));
+            }
+        }
+        k = j;
+    }
+    return true;
+}
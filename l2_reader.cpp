@@ -0,0 +1,418 @@
+#include "l2_reader.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+L2Segment L2Segment::slice(uint64_t lo, uint64_t hi) const noexcept {
+    const uint64_t b = std::max(lo, row_base) - row_base;
+    const uint64_t e = std::min<uint64_t>(hi, row_base + size()) - row_base;
+    const size_t n = e > b ? static_cast<size_t>(e - b) : 0;
+    return {row_base + b, ts.subspan(b, n), price.subspan(b, n), qty.subspan(b, n), side.subspan(b, n)};
+}
+
+L2HourFile::~L2HourFile() {
+    close();
+}
+
+L2HourFile::L2HourFile(L2HourFile&& o) noexcept {
+    *this = std::move(o);
+}
+
+L2HourFile& L2HourFile::operator=(L2HourFile&& o) noexcept {
+    if (this != &o) {
+        close();
+        map_ = std::exchange(o.map_, nullptr);
+        map_bytes_ = std::exchange(o.map_bytes_, 0);
+        cols_ = std::move(o.cols_);
+        hdr_ = o.hdr_;
+        segs_ = std::move(o.segs_);
+        ckpts_ = std::exchange(o.ckpts_, {});
+        legacy_qty_ = std::move(o.legacy_qty_);
+        error_ = std::move(o.error_);
+    }
+    return *this;
+}
+
+void L2HourFile::close() {
+    if (map_) {
+        ::munmap(const_cast<uint8_t*>(map_), map_bytes_);
+    }
+    map_ = nullptr;
+    map_bytes_ = 0;
+    cols_.close();
+    hdr_ = {};
+    segs_.clear();
+    ckpts_ = {};
+    legacy_qty_.clear();
+}
+
+bool L2HourFile::fail(const std::string& path, const char* why) {
+    close();
+    error_ = path + ": " + why;
+    return false;
+}
+
+bool L2HourFile::add_segment(uint64_t row_base, uint64_t rows, uint16_t version,
+                             const uint64_t (&col_off)[COL_COUNT]) {
+    for (uint32_t c = 0; c < COL_COUNT; ++c) {
+        const uint64_t w = l2col_width(c, version);
+        if (col_off[c] % w || col_off[c] + rows * w > map_bytes_) {
+            return false;
+        }
+    }
+    L2Segment s;
+    s.row_base = row_base;
+    s.ts = {reinterpret_cast<const uint64_t*>(map_ + col_off[COL_TS]), static_cast<size_t>(rows)};
+    s.price = {reinterpret_cast<const uint32_t*>(map_ + col_off[COL_PX]), static_cast<size_t>(rows)};
+    s.side = {map_ + col_off[COL_SIDE], static_cast<size_t>(rows)};
+    if (version >= 4) {
+        s.qty = {reinterpret_cast<const int64_t*>(map_ + col_off[COL_QTY]), static_cast<size_t>(rows)};
+    }
+    else {
+        const auto* q = reinterpret_cast<const float*>(map_ + col_off[COL_QTY]);
+        auto& wide = legacy_qty_.emplace_back(static_cast<size_t>(rows));
+        for (size_t i = 0; i < wide.size(); ++i) {
+            wide[i] = l2_legacy_qty(q[i], s.side[i]);
+        }
+        s.qty = wide;
+    }
+    segs_.push_back(s);
+    return true;
+}
+
+bool L2HourFile::open(const std::string& path, bool sequential) {
+    close();
+    error_.clear();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return fail(path, std::strerror(errno));
+    }
+    char magic[6]{};
+    const bool legacy = ::pread(fd, magic, sizeof(magic), 0) == static_cast<ssize_t>(sizeof(magic)) &&
+        std::memcmp(magic, "L2COL\n", 6) == 0;
+    ::close(fd);
+    return legacy ? open_legacy(path, sequential) : open_schema(path, sequential);
+}
+
+// a file of L2Schema, its columns hand straight over as segments
+bool L2HourFile::open_schema(const std::string& path, bool sequential) {
+    if (!cols_.open(path, sequential)) {
+        error_ = cols_.error();
+        close();
+        return false;
+    }
+    if (!L2Schema::matches(cols_.header())) {
+        return fail(path, "not an l2 hour file");
+    }
+    hdr_ = cols_.header();
+    for (const ColSegment& c : cols_.segments()) {
+        const size_t n = c.size();
+        L2Segment s;
+        s.row_base = c.row_base;
+        s.ts = {reinterpret_cast<const uint64_t*>(c.col[COL_TS]), n};
+        s.price = {reinterpret_cast<const uint32_t*>(c.col[COL_PX]), n};
+        s.qty = {reinterpret_cast<const int64_t*>(c.col[COL_QTY]), n};
+        s.side = {c.col[COL_SIDE], n};
+        segs_.push_back(s);
+    }
+    ckpts_ = cols_.index();
+    return true;
+}
+
+bool L2HourFile::open_legacy(const std::string& path, bool sequential) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return fail(path, std::strerror(errno));
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(L2ColFileHeader)) {
+        ::close(fd);
+        return fail(path, "too short for a header");
+    }
+    void* m = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        return fail(path, std::strerror(errno));
+    }
+    map_ = static_cast<const uint8_t*>(m);
+    map_bytes_ = static_cast<size_t>(st.st_size);
+    if (sequential) {
+        (void)::madvise(m, map_bytes_, MADV_SEQUENTIAL);
+    }
+
+    // an hour still being written reads as the rows committed so far. they are loaded before the
+    // header is copied, so the extents it describes cover them
+    const auto& mapped = *reinterpret_cast<const L2ColFileHeader*>(map_);
+    const bool closed = colf_closed(mapped.live);
+    const uint64_t committed = colf_committed(mapped.live);
+    L2ColFileHeader h{};
+    std::memcpy(&h, map_, sizeof(h));
+    if (h.version < 1 || h.version > L2COL_VERSION) {
+        return fail(path, "unsupported version");
+    }
+    if (h.header_size != sizeof(L2ColFileHeader)) {
+        return fail(path, "bad header size");
+    }
+    const bool live = h.version >= 5 && !closed;
+    if (live) {
+        h.rows = committed;
+    }
+    if (h.rows > h.capacity) {
+        return fail(path, "rows exceed capacity");
+    }
+    if (h.version < 4) {
+        h.price_decimals = L2COL_V3_PRICE_DECIMALS;
+        h.qty_decimals = L2COL_V3_QTY_DECIMALS;
+    }
+
+    // v1 files are a single extent. col_sz may describe more rows than were written
+    const uint64_t cap0 = h.col_sz[COL_TS] / l2col_width(COL_TS);
+    for (uint32_t c = 0; c < COL_COUNT; ++c) {
+        if (h.col_sz[c] < cap0 * l2col_width(c, h.version) || h.col_off[c] + h.col_sz[c] > map_bytes_) {
+            return fail(path, "column outside the file");
+        }
+    }
+    uint64_t remaining = h.rows;
+    uint64_t n = std::min(remaining, cap0);
+    if (!add_segment(0, n, h.version, h.col_off)) {
+        return fail(path, "misaligned column");
+    }
+    remaining -= n;
+
+    const uint32_t extents = h.version >= 2 ? std::max<uint32_t>(h.extent_count, 1) : 1;
+    const uint64_t next0 = h.version >= 2 ? h.next_extent : 0;
+    uint64_t next = next0;
+    uint64_t row_base = cap0;
+    for (uint32_t i = 1; i < extents && remaining; ++i) {
+        if (!next || next + sizeof(L2ColExtentHeader) > map_bytes_) {
+            // the writer added the extent after the file was mapped, stop at the rows before it
+            if (live && next) {
+                h.rows -= remaining;
+                remaining = 0;
+                break;
+            }
+            return fail(path, "broken extent chain");
+        }
+        L2ColExtentHeader xh{};
+        std::memcpy(&xh, map_ + next, sizeof(xh));
+        if (std::memcmp(xh.magic, "L2EXT\n", 6) != 0 || xh.index != i) {
+            return fail(path, "bad extent header");
+        }
+        n = std::min(remaining, xh.capacity);
+        if (!add_segment(row_base, n, h.version, xh.col_off)) {
+            return fail(path, "extent column outside the file");
+        }
+        remaining -= n;
+        row_base += xh.capacity;
+        next = xh.next;
+    }
+    if (remaining) {
+        return fail(path, "rows beyond the last extent");
+    }
+
+    if (h.version >= 3 && h.ckpt_count) {
+        const uint64_t bytes = uint64_t{h.ckpt_count} * sizeof(L2CkptEntry);
+        if (h.ckpt_off % alignof(L2CkptEntry) == 0 && h.ckpt_off + bytes <= map_bytes_) {
+            ckpts_ = {reinterpret_cast<const L2CkptEntry*>(map_ + h.ckpt_off), h.ckpt_count};
+        }
+    }
+
+    // the header a file of L2Schema would have, with the old magic and version
+    L2Schema::describe(hdr_);
+    std::memcpy(hdr_.magic, h.magic, sizeof(hdr_.magic));
+    hdr_.header_size = h.header_size;
+    hdr_.version = h.version;
+    hdr_.price_decimals = h.price_decimals;
+    hdr_.qty_decimals = h.qty_decimals;
+    std::memcpy(hdr_.product, h.product, sizeof(hdr_.product));
+    hdr_.hour_epoch_start = h.hour_epoch_start;
+    hdr_.rows = h.rows;
+    hdr_.capacity = h.capacity;
+    hdr_.first_capacity = cap0;
+    hdr_.extent_count = extents;
+    hdr_.next_extent = next0;
+    hdr_.index_off = h.ckpt_off;
+    hdr_.index_count = static_cast<uint32_t>(ckpts_.size());
+    for (uint32_t c = 0; c < COL_COUNT; ++c) {
+        hdr_.cols[c].off = h.col_off[c];
+    }
+    if (h.version < 4) {
+        hdr_.cols[COL_QTY].type = static_cast<uint8_t>(ColType::F32);
+        hdr_.cols[COL_QTY].width = sizeof(float);
+    }
+    return true;
+}
+
+void L2HourFile::prefetch() const {
+    if (map_) {
+        (void)::madvise(const_cast<uint8_t*>(map_), map_bytes_, MADV_WILLNEED);
+    }
+    cols_.prefetch();
+}
+
+// segments hold rows in order, the one holding row i is the last whose row_base <= i
+template <typename Seg>
+static const Seg& segment_of(const std::vector<Seg>& segs, uint64_t i) noexcept {
+    auto it = std::upper_bound(segs.begin(), segs.end(), i,
+                               [](uint64_t r, const Seg& s) { return r < s.row_base; });
+    return *(it - 1);
+}
+
+L2Row L2HourFile::row(uint64_t i) const noexcept {
+    const L2Segment& s = segment_of(segs_, i);
+    const size_t k = static_cast<size_t>(i - s.row_base);
+    return {s.ts[k], s.qty[k], s.price[k], s.side[k]};
+}
+
+uint64_t L2HourFile::ts(uint64_t i) const noexcept {
+    const L2Segment& s = segment_of(segs_, i);
+    return s.ts[static_cast<size_t>(i - s.row_base)];
+}
+
+uint64_t L2HourFile::lower_bound(uint64_t ts_ns) const noexcept {
+    // first segment whose last ts reaches ts_ns, then binary search inside it
+    for (const auto& s : segs_) {
+        if (s.ts.empty() || s.ts.back() < ts_ns) {
+            continue;
+        }
+        return s.row_base + static_cast<uint64_t>(std::lower_bound(s.ts.begin(), s.ts.end(), ts_ns) - s.ts.begin());
+    }
+    return rows();
+}
+
+std::pair<uint64_t, uint64_t> L2HourFile::range(uint64_t t0_ns, uint64_t t1_ns) const noexcept {
+    if (t1_ns <= t0_ns) {
+        return {0, 0};
+    }
+    const uint64_t r0 = lower_bound(t0_ns);
+    return {r0, std::max(r0, lower_bound(t1_ns))};
+}
+
+bool L2HourFile::checkpoint_before(uint64_t ts_ns, L2CkptEntry& out) const noexcept {
+    auto it = std::upper_bound(ckpts_.begin(), ckpts_.end(), ts_ns,
+                               [](uint64_t t, const L2CkptEntry& e) { return t < e.ts_ns; });
+    if (it == ckpts_.begin()) {
+        return false;
+    }
+    out = *(it - 1);
+    return true;
+}
+
+L2BboFile::~L2BboFile() {
+    close();
+}
+
+void L2BboFile::close() {
+    if (map_) {
+        ::munmap(const_cast<uint8_t*>(map_), map_bytes_);
+    }
+    map_ = nullptr;
+    map_bytes_ = 0;
+    hdr_ = {};
+    rows_ = 0;
+    segs_.clear();
+}
+
+bool L2BboFile::fail(const std::string& path, const char* why) {
+    close();
+    error_ = path + ": " + why;
+    return false;
+}
+
+bool L2BboFile::open(const std::string& path) {
+    close();
+    error_.clear();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return fail(path, std::strerror(errno));
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(L2BboFileHeader)) {
+        ::close(fd);
+        return fail(path, "too short for a header");
+    }
+    void* m = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        return fail(path, std::strerror(errno));
+    }
+    map_ = static_cast<const uint8_t*>(m);
+    map_bytes_ = static_cast<size_t>(st.st_size);
+    std::memcpy(&hdr_, map_, sizeof(hdr_));
+    if (std::memcmp(hdr_.magic, "L2BBO\n", 6) != 0) {
+        return fail(path, "bad magic");
+    }
+    if (hdr_.version < 1 || hdr_.version > L2BBO_VERSION) {
+        return fail(path, "unsupported version");
+    }
+
+    // blocks follow each other to the end of the file, a block the writer has not finished yet
+    // ends the walk
+    const uint32_t cols = l2bbo_cols(hdr_.levels);
+    uint64_t off = sizeof(L2BboFileHeader);
+    while (off + sizeof(L2BboBlockHeader) <= map_bytes_) {
+        L2BboBlockHeader bh{};
+        std::memcpy(&bh, map_ + off, sizeof(bh));
+        if (std::memcmp(bh.magic, "BBOB", 4) != 0 || !bh.rows) {
+            break;
+        }
+        uint64_t bytes = sizeof(bh);
+        for (uint32_t c = 0; c < cols; ++c) {
+            bytes += l2bbo_col_bytes(c, bh.rows);
+        }
+        if (off + bytes > map_bytes_) {
+            break;
+        }
+        const uint8_t* col[BBO_COL_COUNT]{};
+        const uint8_t* at = map_ + off + sizeof(bh);
+        for (uint32_t c = 0; c < cols; ++c) {
+            col[c] = at;
+            at += l2bbo_col_bytes(c, bh.rows);
+        }
+        const size_t n = bh.rows;
+        L2BboSegment s;
+        s.row_base = rows_;
+        s.ts = {reinterpret_cast<const uint64_t*>(col[BBO_TS]), n};
+        s.bid_px = {reinterpret_cast<const uint32_t*>(col[BBO_BID_PX]), n};
+        s.ask_px = {reinterpret_cast<const uint32_t*>(col[BBO_ASK_PX]), n};
+        s.bid_qty = {reinterpret_cast<const int64_t*>(col[BBO_BID_QTY]), n};
+        s.ask_qty = {reinterpret_cast<const int64_t*>(col[BBO_ASK_QTY]), n};
+        if (hdr_.levels) {
+            s.bid_depth = {reinterpret_cast<const int64_t*>(col[BBO_BID_DEPTH]), n};
+            s.ask_depth = {reinterpret_cast<const int64_t*>(col[BBO_ASK_DEPTH]), n};
+        }
+        segs_.push_back(s);
+        rows_ += n;
+        off += bytes;
+    }
+    if (hdr_.rows && hdr_.rows != rows_) {
+        return fail(path, "rows in the header do not match the blocks");
+    }
+    return true;
+}
+
+L2Bbo L2BboFile::row(uint64_t i) const noexcept {
+    const L2BboSegment& s = segment_of(segs_, i);
+    const size_t k = static_cast<size_t>(i - s.row_base);
+    return {s.ts[k], s.bid_px[k], s.ask_px[k], s.bid_qty[k], s.ask_qty[k],
+            s.bid_depth.empty() ? 0 : s.bid_depth[k], s.ask_depth.empty() ? 0 : s.ask_depth[k]};
+}
+
+bool L2BboFile::at(uint64_t ts_ns, L2Bbo& out) const noexcept {
+    // last segment starting at or before ts_ns, then the last row in it that does
+    auto it = std::upper_bound(segs_.begin(), segs_.end(), ts_ns,
+                               [](uint64_t t, const L2BboSegment& s) { return t < s.ts.front(); });
+    if (it == segs_.begin()) {
+        return false;
+    }
+    const L2BboSegment& s = *(it - 1);
+    const size_t k = static_cast<size_t>(std::upper_bound(s.ts.begin(), s.ts.end(), ts_ns) - s.ts.begin());
+    out = row(s.row_base + k - 1);
+    return true;
+}
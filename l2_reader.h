@@ -0,0 +1,203 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+#include "col_reader.h"
+#include "l2_writer.h"
+
+// read side of the l2 hour files. the file is mapped read only and columns are handed out as
+// spans straight into the mapping, nothing is copied. files of L2Schema are opened by
+// ColHourFile like any other schema, files from before it (L2COL v1 to v5) are read here
+
+// one extent worth of rows, [row_base, row_base + ts.size()) of the hour
+struct L2Segment {
+    uint64_t row_base{0};
+    std::span<const uint64_t> ts;
+    std::span<const uint32_t> price;
+    std::span<const int64_t> qty;
+    std::span<const uint8_t> side;
+
+    size_t size() const noexcept { return ts.size(); }
+    // rows [lo, hi) of the hour clipped to this segment, as a segment
+    L2Segment slice(uint64_t lo, uint64_t hi) const noexcept;
+};
+
+class L2HourFile {
+public:
+    L2HourFile() = default;
+    ~L2HourFile();
+    L2HourFile(L2HourFile&& o) noexcept;
+    L2HourFile& operator=(L2HourFile&& o) noexcept;
+    L2HourFile(const L2HourFile&) = delete;
+    L2HourFile& operator=(const L2HourFile&) = delete;
+
+    // maps and validates the file, on failure error() says why. sequential hints the kernel to
+    // read ahead aggressively and drop pages behind the scan. an hour the writer still has open
+    // is a snapshot of the rows committed at this call, L2Tail follows it as it grows
+    bool open(const std::string& path, bool sequential = false);
+    void close();
+    // asks the kernel to start reading the whole file in, for the next file of a scan
+    void prefetch() const;
+
+    bool is_open() const noexcept { return map_ != nullptr || cols_.is_open(); }
+    const std::string& error() const noexcept { return error_; }
+    // an L2COL file's header is given in this form, with its magic and version kept
+    const ColFileHeader& header() const noexcept { return hdr_; }
+    uint64_t rows() const noexcept { return hdr_.rows; }
+    uint64_t hour_s() const noexcept { return hdr_.hour_epoch_start; }
+    // scales of the price and qty columns, files before v4 report the implied 2 and 8
+    uint8_t price_decimals() const noexcept { return hdr_.price_decimals; }
+    uint8_t qty_decimals() const noexcept { return hdr_.qty_decimals; }
+    const std::vector<L2Segment>& segments() const noexcept { return segs_; }
+    // empty for files that were never closed or predate v3
+    std::span<const L2CkptEntry> checkpoints() const noexcept { return ckpts_; }
+
+    L2Row row(uint64_t i) const noexcept;
+    uint64_t ts(uint64_t i) const noexcept;
+    // first row with ts >= ts_ns. rows are in arrival order, which is time order as long as the
+    // exchange stamps are monotone per product
+    uint64_t lower_bound(uint64_t ts_ns) const noexcept;
+    // rows [first, second) with t0 <= ts < t1
+    std::pair<uint64_t, uint64_t> range(uint64_t t0_ns, uint64_t t1_ns) const noexcept;
+    // last checkpoint at or before ts_ns, or false when the index has none
+    bool checkpoint_before(uint64_t ts_ns, L2CkptEntry& out) const noexcept;
+
+    // calls f(const L2Segment&) for each segment piece of rows [r0, r1), in order
+    template <typename F>
+    void for_each_segment(uint64_t r0, uint64_t r1, F&& f) const {
+        for (const auto& s : segs_) {
+            const uint64_t end = s.row_base + s.size();
+            if (end <= r0) {
+                continue;
+            }
+            if (s.row_base >= r1) {
+                break;
+            }
+            f(s.slice(r0, r1));
+        }
+    }
+
+private:
+    // L2COL files are mapped here, the others are in cols_
+    const uint8_t* map_{nullptr};
+    size_t map_bytes_{0};
+    ColHourFile cols_;
+    ColFileHeader hdr_{};
+    std::vector<L2Segment> segs_;
+    std::span<const L2CkptEntry> ckpts_;
+    // qty columns of files before v4 widened from float, one per segment
+    std::vector<std::vector<int64_t>> legacy_qty_;
+    std::string error_;
+
+    bool fail(const std::string& path, const char* why);
+    bool open_schema(const std::string& path, bool sequential);
+    bool open_legacy(const std::string& path, bool sequential);
+    bool add_segment(uint64_t row_base, uint64_t rows, uint16_t version, const uint64_t (&col_off)[COL_COUNT]);
+};
+
+// one row of a bbo file, an empty side has price and qty 0
+struct L2Bbo {
+    uint64_t ts_ns;
+    uint32_t bid_px;
+    uint32_t ask_px;
+    int64_t bid_qty;
+    int64_t ask_qty;
+    // qty over the best `levels` levels, 0 when the file has none
+    int64_t bid_depth;
+    int64_t ask_depth;
+};
+
+// one block of a bbo file, the depth columns are empty when the file has no levels
+struct L2BboSegment {
+    uint64_t row_base{0};
+    std::span<const uint64_t> ts;
+    std::span<const uint32_t> bid_px;
+    std::span<const uint32_t> ask_px;
+    std::span<const int64_t> bid_qty;
+    std::span<const int64_t> ask_qty;
+    std::span<const int64_t> bid_depth;
+    std::span<const int64_t> ask_depth;
+
+    size_t size() const noexcept { return ts.size(); }
+};
+
+// top of book written next to an hour file, hh00.bbo, mapped read only like the hour file
+class L2BboFile {
+public:
+    L2BboFile() = default;
+    ~L2BboFile();
+    L2BboFile(const L2BboFile&) = delete;
+    L2BboFile& operator=(const L2BboFile&) = delete;
+
+    // a file the writer still has open is read up to its last whole block
+    bool open(const std::string& path);
+    void close();
+
+    bool is_open() const noexcept { return map_ != nullptr; }
+    const std::string& error() const noexcept { return error_; }
+    const L2BboFileHeader& header() const noexcept { return hdr_; }
+    uint64_t rows() const noexcept { return rows_; }
+    uint64_t hour_s() const noexcept { return hdr_.hour_epoch_start; }
+    uint8_t price_decimals() const noexcept { return hdr_.price_decimals; }
+    uint8_t qty_decimals() const noexcept { return hdr_.qty_decimals; }
+    uint16_t levels() const noexcept { return hdr_.levels; }
+    const std::vector<L2BboSegment>& segments() const noexcept { return segs_; }
+
+    L2Bbo row(uint64_t i) const noexcept;
+    // last row with ts <= ts_ns, the top of book as of ts_ns. false when the hour has none yet
+    bool at(uint64_t ts_ns, L2Bbo& out) const noexcept;
+
+private:
+    const uint8_t* map_{nullptr};
+    size_t map_bytes_{0};
+    L2BboFileHeader hdr_{};
+    uint64_t rows_{0};
+    std::vector<L2BboSegment> segs_;
+    std::string error_;
+
+    bool fail(const std::string& path, const char* why);
+};
+
+// walks base/yyyymmdd/hh00.bin for every hour touching [t0, t1) and calls
+// f(const L2HourFile&, uint64_t r0, uint64_t r1) with the rows of that hour inside the window.
+// missing hours are skipped, the next hour is prefetched while f runs on the current one.
+// returns the number of hour files visited.
+template <typename F>
+size_t l2_scan(const std::string& base, uint64_t t0_ns, uint64_t t1_ns, F&& f) {
+    if (t1_ns <= t0_ns) {
+        return 0;
+    }
+    const uint64_t first_h = (t0_ns / 1'000'000'000ull) / 3600ull * 3600ull;
+    const uint64_t last_h = ((t1_ns - 1) / 1'000'000'000ull) / 3600ull * 3600ull;
+
+    size_t visited = 0;
+    L2HourFile cur;
+    uint64_t h = first_h;
+    bool have = false;
+    for (; h <= last_h && !have; h += 3600) {
+        have = cur.open(l2col_hour_path(base, h), true);
+    }
+    while (have) {
+        L2HourFile next;
+        bool have_next = false;
+        for (; h <= last_h && !have_next; h += 3600) {
+            have_next = next.open(l2col_hour_path(base, h), true);
+        }
+        if (have_next) {
+            next.prefetch();
+        }
+
+        const auto [r0, r1] = cur.range(t0_ns, t1_ns);
+        if (r0 < r1) {
+            f(static_cast<const L2HourFile&>(cur), r0, r1);
+        }
+        ++visited;
+
+        cur = std::move(next);
+        have = have_next;
+    }
+    return visited;
+}
@@ -0,0 +1,208 @@
+#include "l2_tail.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+L2Tail::L2Tail(std::string product_dir) : dir_(std::move(product_dir)) {}
+
+L2Tail::~L2Tail() {
+    detach();
+    if (live_) {
+        ::munmap(const_cast<L2LiveFile*>(live_), sizeof(L2LiveFile));
+    }
+}
+
+bool L2Tail::fail(const std::string& what, const char* why) {
+    error_ = what + ": " + why;
+    return false;
+}
+
+bool L2Tail::map_live() {
+    const std::string path = l2col_live_path(dir_);
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return fail(path, std::strerror(errno));
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(L2LiveFile)) {
+        ::close(fd);
+        return fail(path, "too short");
+    }
+    void* m = ::mmap(nullptr, sizeof(L2LiveFile), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        return fail(path, std::strerror(errno));
+    }
+    const auto* f = static_cast<const L2LiveFile*>(m);
+    if (std::memcmp(f->magic, "L2LIV\n", 6) != 0 || f->version != L2LIVE_VERSION) {
+        ::munmap(m, sizeof(L2LiveFile));
+        return fail(path, "bad magic or version");
+    }
+    live_ = f;
+    error_.clear();
+    return true;
+}
+
+void L2Tail::detach() {
+    for (auto& e : exts_) {
+        ::munmap(const_cast<uint8_t*>(e.map), e.map_bytes);
+    }
+    exts_.clear();
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    pos_ = 0;
+}
+
+bool L2Tail::map_extent(uint64_t file_off, uint64_t row_base, uint64_t capacity, const uint64_t* col_off) {
+    // the last extent of a closed hour ends short of its last page, rows past capacity are never read
+    const uint64_t end = l2col_align(col_off[COL_SIDE] + capacity * L2Schema::widths[COL_SIDE]);
+    for (uint32_t c = 0; c < L2Schema::count; ++c) {
+        if (col_off[c] < file_off + sizeof(ColExtentHeader) || col_off[c] % L2Schema::widths[c] ||
+            col_off[c] + capacity * L2Schema::widths[c] > end) {
+            return false;
+        }
+    }
+    void* m = ::mmap(nullptr, end - file_off, PROT_READ, MAP_SHARED, fd_, (off_t)file_off);
+    if (m == MAP_FAILED) {
+        return false;
+    }
+    Extent e;
+    e.row_base = row_base;
+    e.capacity = capacity;
+    e.file_off = file_off;
+    e.map = static_cast<const uint8_t*>(m);
+    e.map_bytes = static_cast<size_t>(end - file_off);
+    const size_t n = static_cast<size_t>(capacity);
+    e.rows.row_base = row_base;
+    e.rows.ts = {reinterpret_cast<const uint64_t*>(e.map + (col_off[COL_TS] - file_off)), n};
+    e.rows.price = {reinterpret_cast<const uint32_t*>(e.map + (col_off[COL_PX] - file_off)), n};
+    e.rows.qty = {reinterpret_cast<const int64_t*>(e.map + (col_off[COL_QTY] - file_off)), n};
+    e.rows.side = {e.map + (col_off[COL_SIDE] - file_off), n};
+    exts_.push_back(e);
+    return true;
+}
+
+bool L2Tail::attach(uint64_t generation, uint64_t hour_s) {
+    detach();
+    const std::string path = l2col_hour_path(dir_, hour_s);
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        return fail(path, std::strerror(errno));
+    }
+    // the writer filled the header in before it published the hour
+    ColFileHeader h{};
+    const char* why = nullptr;
+    uint64_t col_off[COLF_MAX_COLS]{};
+    if (::pread(fd_, &h, sizeof(h), 0) != static_cast<ssize_t>(sizeof(h)) ||
+        std::memcmp(h.magic, "COLHR\n", 6) != 0 || h.header_size != sizeof(ColFileHeader)) {
+        why = "bad header";
+    }
+    else if (h.version < 1 || h.version > COLF_VERSION || !L2Schema::matches(h)) {
+        why = "not an l2 hour file of a supported version";
+    }
+    else {
+        for (uint32_t c = 0; c < L2Schema::count; ++c) {
+            col_off[c] = h.cols[c].off;
+        }
+        if (!map_extent(0, 0, h.first_capacity, col_off)) {
+            why = "cannot map the first extent";
+        }
+    }
+    if (why) {
+        detach();
+        return fail(path, why);
+    }
+    hdr_ = h;
+    generation_ = generation;
+    error_.clear();
+    return true;
+}
+
+// maps extents down the chain until they hold `rows`. the writer links an extent before it
+// puts rows in it, so the links up to a committed row are already in place
+bool L2Tail::map_through(uint64_t rows) {
+    while (exts_.back().row_base + exts_.back().capacity < rows) {
+        const Extent& last = exts_.back();
+        uint64_t next;
+        if (exts_.size() == 1) {
+            std::memcpy(&next, &mapped().next_extent, sizeof(next));
+        }
+        else {
+            std::memcpy(&next, last.map + offsetof(ColExtentHeader, next), sizeof(next));
+        }
+        ColExtentHeader xh{};
+        if (!next || ::pread(fd_, &xh, sizeof(xh), (off_t)next) != static_cast<ssize_t>(sizeof(xh)) ||
+            std::memcmp(xh.magic, "COLEX\n", 6) != 0 || xh.index != exts_.size()) {
+            return fail(l2col_hour_path(dir_, hdr_.hour_epoch_start), "broken extent chain");
+        }
+        if (!map_extent(next, last.row_base + last.capacity, xh.capacity, xh.col_off)) {
+            return fail(l2col_hour_path(dir_, hdr_.hour_epoch_start), "cannot map an extent");
+        }
+    }
+    return true;
+}
+
+bool L2Tail::seek_end() {
+    if (!live_ && !map_live()) {
+        return false;
+    }
+    uint64_t gen = 0;
+    uint64_t hour = 0;
+    if (exts_.empty() && (!l2col_read_live(*live_, gen, hour) || !attach(gen, hour))) {
+        return false;
+    }
+    pos_ = colf_committed(mapped().live);
+    return true;
+}
+
+uint64_t L2Tail::advance() {
+    pending_.clear();
+    if (!live_ && !map_live()) {
+        return 0;
+    }
+    uint64_t gen = 0;
+    uint64_t hour = 0;
+    if (exts_.empty() && (!l2col_read_live(*live_, gen, hour) || !attach(gen, hour))) {
+        return 0;
+    }
+
+    uint64_t committed = colf_committed(mapped().live);
+    if (committed <= pos_) {
+        // caught up. once the writer has published a newer file this one is final, load its
+        // count once more for rows committed between the two checks, then switch
+        if (!l2col_read_live(*live_, gen, hour) || gen == generation_) {
+            return 0;
+        }
+        committed = colf_committed(mapped().live);
+        if (committed <= pos_) {
+            if (!attach(gen, hour)) {
+                return 0;
+            }
+            committed = colf_committed(mapped().live);
+            if (!committed) {
+                return 0;
+            }
+        }
+    }
+    if (!map_through(committed)) {
+        return 0;
+    }
+
+    for (const auto& e : exts_) {
+        if (e.row_base + e.capacity <= pos_) {
+            continue;
+        }
+        if (e.row_base >= committed) {
+            break;
+        }
+        pending_.push_back(e.rows.slice(pos_, committed));
+    }
+    const uint64_t n = committed - pos_;
+    pos_ = committed;
+    return n;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "l2_reader.h"
+
+// follows the hour file a writer has open, reading straight from its page cache. the writer
+// publishes the committed row count of the file after every batch and points base/live at each
+// hour it opens, poll() hands out the rows added since the last call and moves on to the next
+// hour once the current one is drained and the writer has left it. tails only read, any number
+// of processes can follow the same product.
+//
+// a writer restarted within an hour truncates that hour's file, a tail still mapping it can
+// fault on the pages that went away
+class L2Tail {
+public:
+    // product_dir is the writer's base_dir, the one holding yyyymmdd/hh00.bin and live
+    explicit L2Tail(std::string product_dir);
+    ~L2Tail();
+    L2Tail(const L2Tail&) = delete;
+    L2Tail& operator=(const L2Tail&) = delete;
+
+    // calls f(const L2Segment&) for the rows committed since the last poll, in order, and returns
+    // how many there were. a new tail starts at the first row of the writer's current hour.
+    // segments point into the file and stay valid until the next poll
+    template <typename F>
+    uint64_t poll(F&& f) {
+        const uint64_t n = advance();
+        for (const auto& s : pending_) {
+            f(static_cast<const L2Segment&>(s));
+        }
+        return n;
+    }
+    // skips to the rows committed so far, false while there is no hour to follow yet
+    bool seek_end();
+
+    bool attached() const noexcept { return !exts_.empty(); }
+    const std::string& error() const noexcept { return error_; }
+    uint64_t hour_s() const noexcept { return hdr_.hour_epoch_start; }
+    uint64_t generation() const noexcept { return generation_; }
+    // rows of the current hour handed out so far
+    uint64_t position() const noexcept { return pos_; }
+    uint8_t price_decimals() const noexcept { return hdr_.price_decimals; }
+    uint8_t qty_decimals() const noexcept { return hdr_.qty_decimals; }
+
+private:
+    struct Extent {
+        uint64_t row_base{0};
+        uint64_t capacity{0};
+        uint64_t file_off{0};
+        const uint8_t* map{nullptr};
+        size_t map_bytes{0};
+        L2Segment rows;
+    };
+
+    std::string dir_;
+    const L2LiveFile* live_{nullptr};
+    int fd_{-1};
+    // the header as of attaching, for the fields that do not change while the hour is written
+    ColFileHeader hdr_{};
+    std::vector<Extent> exts_;
+    uint64_t generation_{0};
+    uint64_t pos_{0};
+    std::vector<L2Segment> pending_;
+    std::string error_;
+
+    uint64_t advance();
+    bool map_live();
+    bool attach(uint64_t generation, uint64_t hour_s);
+    void detach();
+    bool map_extent(uint64_t file_off, uint64_t row_base, uint64_t capacity, const uint64_t* col_off);
+    bool map_through(uint64_t rows);
+    const ColFileHeader& mapped() const noexcept {
+        return *reinterpret_cast<const ColFileHeader*>(exts_.front().map);
+    }
+    bool fail(const std::string& what, const char* why);
+};
@@ -1,5 +1,10 @@
 // L2_writer.cpp
 #include "l2_writer.h"
+#include "affinity.h"
+#include "io_ring.h"
+#include "l2_book.h"
+#include "l2_compact.h"
+#include "row_scatter.h"
 #include <algorithm>
 #include <cerrno>
 #include <chrono>
@@ -7,78 +12,41 @@
 #include <cstring>
 #include <ctime>
 #include <cstddef>
+#include <cstdlib>
+#include <iostream>
 #include <fcntl.h>
-#include <linux/limits.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <thread>
+#include <tuple>
 #include <unistd.h>
+#include <utility>
 
 using namespace std::chrono;
 
-static inline std::string join_path(const std::string& a, const std::string& b) {
-    if (a.empty()) {
-        return b;
-    }
-    return a.back() == '/' ? a + b : a + '/' + b;
-}
-
-bool L2Writer::mkdir_p(const std::string& dir) {
-    char tmp[PATH_MAX];
-    std::snprintf(tmp, sizeof(tmp), "%s", dir.c_str());
-    size_t n = std::strlen(tmp);
-    if (!n) {
-        return true;
-    }
-    if (tmp[n - 1] == '/') {
-        tmp[n - 1] = '\0';
-    }
-    for (char* p = tmp + 1; *p; ++p) {
-        if (*p == '/') {
-            *p = '\0';
-            ::mkdir(tmp, 0755);
-            *p = '/';
+L2Writer::L2Writer(const L2WriterOpt& opt)
+    : opt_(opt), spill_(SpillOpt{opt.base_dir, opt.spill_rows, opt.spill_file_bytes}), waiter_(opt.wait, opt.spin_polls),
+      scatter_(select_scatter()), book_(std::make_unique<FlatBook>()) {
+    if (opt_.bbo) {
+        bbo_top_.resize(std::max<size_t>(opt_.bbo_levels, 1));
+        bbo_ts_.reserve(kBboBlockRows);
+        for (uint8_t s : {SIDE_ASK, SIDE_BID}) {
+            bbo_px_[s].reserve(kBboBlockRows);
+            bbo_qty_[s].reserve(kBboBlockRows);
+            bbo_depth_[s].reserve(kBboBlockRows);
         }
     }
-    ::mkdir(tmp, 0755);
-    return true;
-}
-
-std::string L2Writer::date_dir(const std::string& base, uint64_t hour_s) {
-    time_t tt = static_cast<time_t>(hour_s);
-    struct tm tm{};
-    localtime_r(&tt, &tm);
-    char buf[9];
-    std::snprintf(buf, sizeof(buf), "%04d%02d%02d",
-                  tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
-    return join_path(base, buf);
-}
-
-std::string L2Writer::hour_basename(uint64_t hour_s) {
-    time_t tt = static_cast<time_t>(hour_s);
-    struct tm tm{};
-    localtime_r(&tt, &tm);
-    char buf[9];
-    std::snprintf(buf, sizeof(buf), "%02d%02d.bin", tm.tm_hour, 0);
-    return std::string(buf);
-}
-
-bool L2Writer::preallocate(int fd, size_t bytes) {
-#if defined(_POSIX_C_SOURCE) && (_POSIX_C_SOURCE >= 200112L)
-    int rc = ::posix_fallocate(fd, 0, (off_t)bytes);
-    if (rc == 0) {
-        return true;
-    }
-#endif
-    return ::ftruncate(fd, (off_t)bytes) == 0;
 }
 
-L2Writer::L2Writer(const L2WriterOpt& opt) : opt_(opt) {}
-
 L2Writer::~L2Writer() {
     stop();
     join();
+    if (live_) {
+        ::munmap(live_, sizeof(L2LiveFile));
+    }
+    std::free(staging_);
 }
 
 void L2Writer::start() {
@@ -87,11 +55,15 @@ void L2Writer::start() {
         return;
     }
     stop_.store(false, std::memory_order_release);
+    file_stop_ = false;
+    file_thread_ = std::make_unique<std::thread>(&L2Writer::file_worker, this);
     thread_ = std::make_unique<std::thread>(&L2Writer::run, this);
+    (void)pin_thread(*thread_, opt_.cpu, "L2Writer");
 }
 
 void L2Writer::stop() {
     stop_.store(true, std::memory_order_release);
+    waiter_.wake();
 }
 
 void L2Writer::join() {
@@ -99,178 +71,927 @@ void L2Writer::join() {
         thread_->join();
     }
     thread_.reset();
+    // the file thread finishes whatever the writer handed it before it exits
+    if (file_thread_ && file_thread_->joinable()) {
+        {
+            std::lock_guard<std::mutex> lk(file_mu_);
+            file_stop_ = true;
+        }
+        file_cv_.notify_all();
+        file_thread_->join();
+    }
+    file_thread_.reset();
     running_.store(false, std::memory_order_release);
 }
 
-bool L2Writer::open_file(uint64_t hour_s) {
-    close_file();
-
-    const uint64_t cap = capacity_;
-    const uint64_t ts_bytes = cap * sizeof(uint64_t);
-    const uint64_t px_bytes = cap * sizeof(uint32_t);
-    const uint64_t qty_bytes = cap * sizeof(float);
-    const uint64_t side_bytes = cap * sizeof(uint8_t);
-
-    col_off_[COL_TS] = HEADER_SZ;
-    col_sz_[COL_TS] = ts_bytes;
-    col_off_[COL_PX] = col_off_[COL_TS] + col_sz_[COL_TS];
-    col_sz_[COL_PX] = px_bytes;
-    col_off_[COL_QTY] = col_off_[COL_PX] + col_sz_[COL_PX];
-    col_sz_[COL_QTY] = qty_bytes;
-    col_off_[COL_SIDE] = col_off_[COL_QTY] + col_sz_[COL_QTY];
-    col_sz_[COL_SIDE] = side_bytes;
-
-    const size_t file_bytes = static_cast<size_t>(col_off_[COL_SIDE] + col_sz_[COL_SIDE]);
-
-    std::string dir = date_dir(opt_.base_dir, hour_s);
-    (void)mkdir_p(dir);
-    std::string file = join_path(dir, hour_basename(hour_s));
-
-    fd_ = ::open(file.c_str(), O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC, 0644);
-    if (fd_ < 0) {
+uint64_t L2Writer::first_extent_rows(uint64_t hour_s) {
+    // a fresh process learns from the hour files already on disk
+    if (hour_rows_.empty()) {
+        for (uint64_t k = kSizeHistory; k >= 1; --k) {
+            const uint64_t h = hour_s - k * 3600ull;
+            const std::string file = l2col_hour_path(opt_.base_dir, h);
+            int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                continue;
+            }
+            // hours written before L2Schema count too
+            ColFileHeader prev{};
+            L2ColFileHeader old{};
+            if (::pread(fd, &prev, sizeof(prev), 0) == static_cast<ssize_t>(sizeof(prev)) &&
+                std::memcmp(prev.magic, "COLHR\n", 6) == 0) {
+                hour_rows_.push_back(prev.rows);
+            }
+            else if (::pread(fd, &old, sizeof(old), 0) == static_cast<ssize_t>(sizeof(old)) &&
+                     std::memcmp(old.magic, "L2COL\n", 6) == 0) {
+                hour_rows_.push_back(old.rows);
+            }
+            ::close(fd);
+        }
+    }
+    if (hour_rows_.empty()) {
+        return opt_.initial_rows_per_hr;
+    }
+
+    const uint64_t busiest = *std::max_element(hour_rows_.begin(), hour_rows_.end());
+    uint64_t est = static_cast<uint64_t>(static_cast<double>(busiest) * opt_.size_headroom);
+    est = std::clamp(est, opt_.min_rows_per_hr, opt_.max_extent_rows);
+    // whole 64k row steps
+    return (est + 0xffffull) & ~0xffffull;
+}
+
+// creates the hour's file with a first extent of `rows` rows, mapped and headed. it only reads
+// opt_, so the file thread runs it for the next hour while the writer fills this one
+bool L2Writer::create_file(HourFile& f, uint64_t hour_s, uint64_t rows, bool prefault) const {
+    ColFileHeader h{};
+    L2Schema::describe(h);
+    h.price_decimals = opt_.price_decimals;
+    h.qty_decimals = opt_.qty_decimals;
+    std::memcpy(h.product, opt_.product.data(), std::min(opt_.product.size(), sizeof(h.product)));
+    h.hour_epoch_start = hour_s;
+    f.hour_s = hour_s;
+    if (!f.create(colf_hour_path(opt_.base_dir, hour_s, L2Schema::ext), h, rows, map_opt(prefault))) {
         return false;
     }
+    if (opt_.backend == L2Backend::Direct) {
+        f.dfd = ::open(f.path.c_str(), O_RDWR | O_DIRECT | O_CLOEXEC);
+        if (f.dfd < 0) {
+            // tmpfs and a few others, the ring still keeps the writes off this thread
+            f.dfd = f.fd;
+        }
+    }
 
-    if (!preallocate(fd_, file_bytes)) {
+    if (opt_.bbo) {
+        // the hour is recorded without it when this fails
+        const std::string bbo = l2col_bbo_path(opt_.base_dir, hour_s);
+        L2BboFileHeader bh{};
+        std::memcpy(bh.magic, "L2BBO\n", 6);
+        bh.version = L2BBO_VERSION;
+        bh.price_decimals = opt_.price_decimals;
+        bh.qty_decimals = opt_.qty_decimals;
+        bh.levels = opt_.bbo_levels;
+        std::memcpy(bh.product, opt_.product.data(), std::min(opt_.product.size(), sizeof(bh.product)));
+        bh.hour_epoch_start = hour_s;
+        f.bbo_fd = ::open(bbo.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+        if (f.bbo_fd < 0 || ::pwrite(f.bbo_fd, &bh, sizeof(bh), 0) != static_cast<ssize_t>(sizeof(bh))) {
+            std::cerr << "[L2Writer] " << bbo << ": " << std::strerror(errno) << ", hour has no bbo\n";
+            if (f.bbo_fd >= 0) {
+                ::close(f.bbo_fd);
+                f.bbo_fd = -1;
+            }
+        }
+        f.bbo_off = sizeof(bh);
+    }
+    return true;
+}
+
+// the writer side of a new hour: row count, column pointers, and base/live
+void L2Writer::begin_file() {
+    rows_.store(0, std::memory_order_release);
+    if (ring_) {
+        submitted_ = 0;
+        written_ = 0;
+    }
+    hour_start_ = cur_.hour_s;
+    enter_extent();
+    publish_live(cur_.hour_s);
+}
+
+bool L2Writer::open_file(uint64_t hour_s) {
+    retire_file();
+    if (opt_.backend == L2Backend::Direct && !ring_ && !init_direct()) {
         return false;
     }
-    if (!map_file(file_bytes)) {
+    if (!create_file(cur_, hour_s, first_extent_rows(hour_s), false)) {
+        cur_ = HourFile{};
         return false;
     }
+    begin_file();
+    return true;
+}
 
-    std::memset(&hdr_, 0, sizeof(hdr_));
-    std::memcpy(hdr_.magic, "L2COL\n", 6);
-    hdr_.header_size = HEADER_SZ;
-    hdr_.version = 1;
-    std::memset(hdr_.product, 0, sizeof(hdr_.product));
-    std::memcpy(hdr_.product, opt_.product.data(),
-                std::min(opt_.product.size(), sizeof(hdr_.product)));
-    hdr_.hour_epoch_start = hour_s;
-    hdr_.rows = 0;
-    hdr_.capacity = cap;
-    for (int i = 0; i < COL_COUNT; ++i) {
-        hdr_.col_off[i] = col_off_[i];
-        hdr_.col_sz[i] = col_sz_[i];
+// points base/live at the hour just opened. the file is created on the first hour and keeps its
+// generation across restarts, a tail that still follows an old file sees it change either way
+void L2Writer::publish_live(uint64_t hour_s) {
+    if (!live_) {
+        const std::string path = l2col_live_path(opt_.base_dir);
+        const int fd = ::open(path.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+        void* m = MAP_FAILED;
+        if (fd >= 0) {
+            struct stat st{};
+            const bool fresh = ::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(L2LiveFile);
+            if (!fresh || ::ftruncate(fd, sizeof(L2LiveFile)) == 0) {
+                m = ::mmap(nullptr, sizeof(L2LiveFile), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+            ::close(fd);
+        }
+        if (m == MAP_FAILED) {
+            std::cerr << "[L2Writer] " << path << ": " << std::strerror(errno) << ", no live tail\n";
+            return;
+        }
+        live_ = static_cast<L2LiveFile*>(m);
+        if (std::memcmp(live_->magic, "L2LIV\n", 6) != 0 || live_->version != L2LIVE_VERSION) {
+            std::memset(static_cast<void*>(live_), 0, sizeof(L2LiveFile));
+            std::memcpy(live_->magic, "L2LIV\n", 6);
+            live_->version = L2LIVE_VERSION;
+        }
     }
 
-    if (!write_header()) {
+    std::atomic_ref<uint32_t> seq(live_->seq);
+    std::atomic_ref<uint64_t> gen(live_->generation);
+    const uint32_t s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    gen.store(gen.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_ref<uint64_t>(live_->hour_s).store(hour_s, std::memory_order_relaxed);
+    live_->pid = static_cast<uint32_t>(::getpid());
+    seq.store(s + 2, std::memory_order_release);
+}
+
+// Direct writes the columns itself and only keeps the header page mapped
+ColMapOpt L2Writer::map_opt(bool prefault) const noexcept {
+    ColMapOpt m;
+    m.columns = opt_.backend != L2Backend::Direct;
+    m.huge_pages = opt_.huge_pages;
+    m.prefault_rows = prefault ? opt_.prefault_rows : 0;
+    return m;
+}
+
+bool L2Writer::add_extent(uint64_t capacity) {
+    if (!cur_.add_extent(capacity, map_opt(false))) {
         return false;
     }
+    enter_extent();
+    return true;
+}
 
-    ts_ = reinterpret_cast<uint64_t*>(base_ + col_off_[COL_TS]);
-    price_ = reinterpret_cast<uint32_t*>(base_ + col_off_[COL_PX]);
-    qty_ = reinterpret_cast<float*>(base_ + col_off_[COL_QTY]);
-    side_ = reinterpret_cast<uint8_t*>(base_ + col_off_[COL_SIDE]);
+// points the columns at the start of the newest extent
+void L2Writer::enter_extent() {
+    const ColExtent& e = cur_.extents.back();
+    if (opt_.backend == L2Backend::Direct) {
+        start_block(e.row_base);
+        return;
+    }
+    ext_base_ = e.row_base;
+    ext_end_ = e.row_base + e.capacity;
+    cols_ = L2Schema::pointers(e.map, e.file_off, e.col_off);
+}
 
-    rows_.store(0, std::memory_order_release);
-    hour_start_ = hour_s;
-    return true;
+// moves the column pointers past ext_end_: Direct sends the full block off and goes on with the
+// next one while the extent has rows left, otherwise a new extent
+bool L2Writer::next_window() {
+    if (opt_.backend == L2Backend::Direct) {
+        write_block(blocks_[cur_block_], ext_end_ - ext_base_);
+        cur_block_ = (cur_block_ + 1) % blocks_.size();
+        const ColExtent& e = cur_.extents.back();
+        if (ext_end_ < e.row_base + e.capacity) {
+            start_block(ext_end_);
+            return true;
+        }
+    }
+    return add_extent(std::min(opt_.max_extent_rows, cur_.extents.back().capacity * 2));
 }
 
-bool L2Writer::map_file(size_t bytes) {
-    base_ = static_cast<uint8_t*>(::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0));
-    if (base_ == MAP_FAILED) {
-        base_ = nullptr;
+// one allocation for every block, touched here so the hot path never faults on it
+bool L2Writer::init_direct() {
+    const uint64_t rows = (std::max<uint64_t>(opt_.direct_block_rows, 1) + L2COL_ALIGN - 1) & ~(L2COL_ALIGN - 1);
+    const uint32_t n = std::max<uint32_t>(opt_.direct_inflight, 2);
+    uint64_t per_block = 0;
+    for (uint32_t c = 0; c < L2Schema::count; ++c) {
+        per_block += rows * L2Schema::widths[c];
+    }
+    // huge pages want 2MB aligned runs, aligned_alloc wants a size that is a multiple of the alignment
+    const size_t align = opt_.huge_pages ? (2u << 20) : L2COL_ALIGN;
+    const size_t bytes = (per_block * n + align - 1) & ~(align - 1);
+    staging_ = static_cast<uint8_t*>(std::aligned_alloc(align, bytes));
+    if (!staging_) {
         return false;
     }
-    map_bytes_ = bytes;
+    if (opt_.huge_pages) {
+        (void)::madvise(staging_, bytes, MADV_HUGEPAGE);
+    }
+    std::memset(staging_, 0, bytes);
+    blocks_.assign(n, Block{});
+    uint8_t* at = staging_;
+    for (auto& b : blocks_) {
+        for (uint32_t c = 0; c < L2Schema::count; ++c) {
+            b.col[c] = at;
+            at += rows * L2Schema::widths[c];
+        }
+    }
+    opt_.direct_block_rows = static_cast<uint32_t>(rows);
+    ring_ = std::make_unique<IoRing>();
+    if (!ring_->init(n * L2Schema::count)) {
+        std::cerr << "[L2Writer] " << opt_.product << ": no io_uring (" << std::strerror(errno)
+            << "), direct backend writes with pwrite\n";
+    }
     return true;
 }
 
-bool L2Writer::write_header() {
-    std::memcpy(base_, &hdr_, sizeof(hdr_));
-    return true;
+// points the columns at the next staging block for rows from `row` on, waiting for its last
+// write if it is still in flight
+void L2Writer::start_block(uint64_t row) {
+    Block& b = blocks_[cur_block_];
+    while (b.pending) {
+        reap_blocks(true);
+    }
+    const ColExtent& e = cur_.extents.back();
+    b.row_base = row;
+    b.rows = std::min<uint64_t>(opt_.direct_block_rows, e.row_base + e.capacity - row);
+    for (uint32_t c = 0; c < L2Schema::count; ++c) {
+        b.file_off[c] = e.col_off[c] + (row - e.row_base) * L2Schema::widths[c];
+    }
+    ext_base_ = row;
+    ext_end_ = row + b.rows;
+    cols_ = [&]<size_t... I>(std::index_sequence<I...>) {
+        return L2Schema::Pointers{reinterpret_cast<std::tuple_element_t<I, L2Schema::Pointers>>(b.col[I])...};
+    }(std::make_index_sequence<L2Schema::count>{});
 }
 
-bool L2Writer::update_rows_in_header() {
-    std::memcpy(base_ + offsetof(L2ColFileHeader, rows), &hdr_.rows, sizeof(hdr_.rows));
-    return true;
+// queues the block's first `rows` rows of every column. lengths are rounded up to whole pages
+// for O_DIRECT, what follows the rows in the last page is overwritten or trimmed later
+void L2Writer::write_block(Block& b, uint64_t rows) {
+    if (!rows) {
+        return;
+    }
+    // an earlier write of the same block may still be in flight after an idle flush, two writes
+    // to the same pages must not race
+    while (b.pending) {
+        reap_blocks(true);
+    }
+    const uint64_t idx = static_cast<uint64_t>(&b - blocks_.data());
+    for (uint32_t c = 0; c < L2Schema::count; ++c) {
+        b.len[c] = static_cast<uint32_t>(l2col_align(rows * L2Schema::widths[c]));
+        while (!ring_->write(cur_.dfd, b.col[c], b.len[c], b.file_off[c], idx * L2Schema::count + c)) {
+            (void)ring_->submit(true);
+            reap_blocks(false);
+        }
+        ++b.pending;
+    }
+    submitted_ = b.row_base + rows;
+    if (!ring_->submit(false)) {
+        std::cerr << "[L2Writer] " << cur_.path << ": io_uring_enter: " << std::strerror(errno) << '\n';
+    }
+}
+
+// collects finished writes. a failed or short one is redone with a plain pwrite, so the file
+// only misses rows when that fails too. written_ ends at the first block still in flight.
+// every write in flight belongs to cur_, a file is drained before it is retired
+void L2Writer::reap_blocks(bool wait) {
+    if (wait) {
+        (void)ring_->submit(true);
+    }
+    ring_->reap([this](uint64_t ud, int32_t res) {
+        Block& b = blocks_[ud / L2Schema::count];
+        const uint32_t c = static_cast<uint32_t>(ud % L2Schema::count);
+        if (res != static_cast<int32_t>(b.len[c]) &&
+            ::pwrite(cur_.fd, b.col[c], b.len[c], (off_t)b.file_off[c]) != static_cast<ssize_t>(b.len[c])) {
+            std::cerr << "[L2Writer] " << cur_.path << ": lost a block of column " << c << ": "
+                << std::strerror(res < 0 ? -res : errno) << '\n';
+        }
+        --b.pending;
+    });
+    uint64_t w = submitted_;
+    for (const auto& b : blocks_) {
+        if (b.pending) {
+            w = std::min(w, b.row_base);
+        }
+    }
+    written_ = w;
+}
+
+// writes what the current block holds so far and waits for every write, written_ is then rows_
+void L2Writer::drain_blocks() {
+    write_block(blocks_[cur_block_], rows_.load(std::memory_order_relaxed) - ext_base_);
+    for (const auto& b : blocks_) {
+        while (b.pending) {
+            reap_blocks(true);
+        }
+    }
+}
+
+void L2Writer::publish_committed() noexcept {
+    cur_.publish(ring_ ? written_ : rows_.load(std::memory_order_relaxed));
+}
+
+// closes a file the writer is done with, f.hdr.rows is final: trims it, writes the header and
+// checkpoint index, syncs it and hands it to the compactor
+void L2Writer::finish_file(HourFile& f) const {
+    f.finish();
+    if (f.bbo_fd >= 0) {
+        (void)::pwrite(f.bbo_fd, &f.bbo_rows, sizeof(f.bbo_rows), (off_t)offsetof(L2BboFileHeader, rows));
+        ::fsync(f.bbo_fd);
+    }
+    release_file(f);
+    if (opt_.compactor && f.hdr.rows) {
+        opt_.compactor->submit(f.path);
+    }
+}
+
+// unmaps and closes without touching the contents
+void L2Writer::release_file(HourFile& f) {
+    if (f.dfd >= 0 && f.dfd != f.fd) {
+        ::close(f.dfd);
+    }
+    if (f.bbo_fd >= 0) {
+        ::close(f.bbo_fd);
+    }
+    f.dfd = -1;
+    f.bbo_fd = -1;
+    f.release();
+}
+
+void L2Writer::unlink_file(const HourFile& f) const {
+    (void)::unlink(f.path.c_str());
+    if (f.bbo_fd >= 0) {
+        (void)::unlink(l2col_bbo_path(opt_.base_dir, f.hour_s).c_str());
+    }
 }
 
-void L2Writer::close_file() {
-    if (fd_ < 0) {
+// takes the open hour off the writer. its last rows are written and committed first, the file
+// thread, or this one when there is none, then finishes it
+void L2Writer::retire_file() {
+    if (cur_.fd < 0) {
         return;
     }
-    hdr_.rows = rows_.load(std::memory_order_acquire);
-    (void)update_rows_in_header();
-    ::msync(base_, map_bytes_, MS_SYNC);
-    ::munmap(base_, map_bytes_); base_ = nullptr; map_bytes_ = 0;
-    ::fsync(fd_); ::close(fd_); fd_ = -1;
-    ts_ = nullptr; price_ = nullptr; qty_ = nullptr; side_ = nullptr;
+    cur_.hdr.rows = rows_.load(std::memory_order_acquire);
+    if (!cur_.extents.empty()) {
+        if (ring_) {
+            drain_blocks();
+        }
+        // before the next hour is published, a tail that sees it switch has every row of this one
+        publish_committed();
+        flush_bbo();
+        hour_rows_.push_back(cur_.hdr.rows);
+        if (hour_rows_.size() > kSizeHistory) {
+            hour_rows_.erase(hour_rows_.begin());
+        }
+    }
+    HourFile f = std::exchange(cur_, HourFile{});
+    cols_ = {};
+    ext_base_ = 0; ext_end_ = 0;
     rows_.store(0, std::memory_order_release);
     hour_start_ = ~0ull;
+
+    if (!file_thread_) {
+        finish_file(f);
+        return;
+    }
+    FileJob job;
+    job.file = std::move(f);
+    {
+        std::lock_guard<std::mutex> lk(file_mu_);
+        file_jobs_.push_back(std::move(job));
+    }
+    file_cv_.notify_one();
+}
+
+// prepares hours ahead and finishes the ones the writer retired, in the order they were asked for
+void L2Writer::file_worker() {
+    while (true) {
+        FileJob job;
+        {
+            std::unique_lock<std::mutex> lk(file_mu_);
+            file_cv_.wait(lk, [this] { return file_stop_ || !file_jobs_.empty(); });
+            if (file_jobs_.empty()) {
+                break;
+            }
+            job = std::move(file_jobs_.front());
+            file_jobs_.pop_front();
+            preparing_ = job.prepare_hour;
+        }
+        if (job.prepare_hour == ~0ull) {
+            if (job.release) {
+                release_file(job.file);
+            }
+            else {
+                finish_file(job.file);
+            }
+            continue;
+        }
+
+        HourFile f;
+        if (!create_file(f, job.prepare_hour, job.prepare_rows, true)) {
+            std::cerr << "[L2Writer] " << f.path << ": cannot prepare: " << std::strerror(errno) << '\n';
+            f = HourFile{};
+        }
+        {
+            std::lock_guard<std::mutex> lk(file_mu_);
+            if (f.fd >= 0) {
+                std::swap(ready_, f);
+            }
+            preparing_ = ~0ull;
+        }
+        file_cv_.notify_all();
+        // a prepared hour nobody took
+        if (f.fd >= 0) {
+            unlink_file(f);
+            release_file(f);
+        }
+    }
+}
+
+// asks for the next hour's file once the stream is close enough to it
+void L2Writer::maybe_prepare(uint64_t ts_ns) {
+    if (!file_thread_ || !opt_.prepare_ahead_s || hour_start_ == ~0ull) {
+        return;
+    }
+    const uint64_t next = hour_start_ + 3600;
+    if (prepare_sent_ == next || ts_ns / 1'000'000'000ull + opt_.prepare_ahead_s < next ||
+        next * 1'000'000'000ull >= opt_.record_until_ns) {
+        return;
+    }
+    prepare_sent_ = next;
+    FileJob job;
+    job.prepare_hour = next;
+    job.prepare_rows = first_extent_rows(next);
+    {
+        std::lock_guard<std::mutex> lk(file_mu_);
+        file_jobs_.push_back(std::move(job));
+    }
+    file_cv_.notify_one();
+}
+
+// hands over the prepared file for hour_s, waiting when it is still being prepared. false when
+// there is none, a prepared file for another hour is dropped then. its path is unlinked right
+// away, before this thread can create a file there, the file thread unmaps and closes it
+bool L2Writer::take_prepared(uint64_t hour_s, HourFile& out) {
+    if (!file_thread_) {
+        return false;
+    }
+    HourFile stale;
+    {
+        std::unique_lock<std::mutex> lk(file_mu_);
+        std::erase_if(file_jobs_, [&](const FileJob& j) { return j.prepare_hour == hour_s; });
+        file_cv_.wait(lk, [&] { return preparing_ != hour_s; });
+        if (ready_.fd >= 0 && ready_.hour_s == hour_s) {
+            out = std::exchange(ready_, HourFile{});
+            return true;
+        }
+        if (ready_.fd < 0) {
+            return false;
+        }
+        stale = std::exchange(ready_, HourFile{});
+    }
+    unlink_file(stale);
+    FileJob job;
+    job.file = std::move(stale);
+    job.release = true;
+    {
+        std::lock_guard<std::mutex> lk(file_mu_);
+        file_jobs_.push_back(std::move(job));
+    }
+    file_cv_.notify_one();
+    return false;
+}
+
+// at shutdown: no more prepares, and a prepared hour that never came is removed
+void L2Writer::drop_prepared() {
+    if (!file_thread_) {
+        return;
+    }
+    HourFile f;
+    {
+        std::unique_lock<std::mutex> lk(file_mu_);
+        std::erase_if(file_jobs_, [](const FileJob& j) { return j.prepare_hour != ~0ull; });
+        file_cv_.wait(lk, [this] { return preparing_ == ~0ull; });
+        f = std::exchange(ready_, HourFile{});
+    }
+    if (f.fd >= 0) {
+        unlink_file(f);
+        release_file(f);
+    }
+    prepare_sent_ = ~0ull;
 }
 
+// the next hour's file is normally prepared already, the writer only swaps it in and hands the
+// old one to the file thread. without one it opens the hour itself
 bool L2Writer::rotate_to_hour(uint64_t hour_s) {
-    return open_file(hour_s);
+    rotations_.fetch_add(1, std::memory_order_relaxed);
+    HourFile next;
+    if (!take_prepared(hour_s, next)) {
+        return open_file(hour_s);
+    }
+    retire_file();
+    cur_ = std::move(next);
+    begin_file();
+    prepared_rotations_.fetch_add(1, std::memory_order_relaxed);
+    return true;
 }
 
-void L2Writer::run() {
-    uint32_t last_sync = 0;
+// writes rows at the end of the open hour, adding extents as they fill. returns how many fit
+size_t L2Writer::append(const L2Row* rows, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        const uint64_t idx = rows_.load(std::memory_order_relaxed);
+        if (idx >= ext_end_ && !next_window()) {
+            break;
+        }
+        const size_t take = static_cast<size_t>(std::min<uint64_t>(n - i, ext_end_ - idx));
+        const uint64_t k = idx - ext_base_;
+        scatter_(rows + i, take, std::get<COL_TS>(cols_) + k, std::get<COL_PX>(cols_) + k,
+                 std::get<COL_QTY>(cols_) + k, std::get<COL_SIDE>(cols_) + k);
+        rows_.store(idx + take, std::memory_order_release);
+        cur_.hdr.rows = idx + take;
+        last_sync_ += static_cast<uint32_t>(take);
+        i += take;
+    }
+    return i;
+}
 
-    while (true) {
-        if (stop_.load(std::memory_order_acquire)) {
-            if (auto row = queue_.dequeue()) {
-                const uint64_t h = hour_start_from_ns(row->ts_ns);
-                if (hour_start_ != h) {
-                    if (!rotate_to_hour(h)) {
-                        dropped_.fetch_add(1, std::memory_order_relaxed);
-                        continue;
-                    }
-                    last_sync = 0;
-                }
-                uint64_t idx = rows_.load(std::memory_order_relaxed);
-                if (idx >= capacity_) {
-                    dropped_.fetch_add(1, std::memory_order_relaxed);
-                    continue;
+void L2Writer::apply_to_book(const L2Row* rows, size_t n) noexcept {
+    for (size_t i = 0; i < n; ++i) {
+        const L2Row& r = rows[i];
+        if (r.side & ROW_MARKER) {
+            if (r.price == MARK_RESYNC) {
+                book_->clear();
+                book_valid_ = true;
+                in_snapshot_ = true;
+            }
+            else if (r.price == MARK_GAP) {
+                book_valid_ = false;
+                if (opt_.bbo) {
+                    bbo_push(r.ts_ns, BboTop{});
                 }
-                ts_[idx] = row->ts_ns;
-                price_[idx] = row->price;
-                qty_[idx] = row->qty;
-                side_[idx] = row->side;
-                rows_.store(idx + 1, std::memory_order_release);
-                hdr_.rows = idx + 1;
-                continue;
-            } else {
-                break;
             }
+            continue;
+        }
+        const bool snapshot_done = in_snapshot_ && !(r.side & ROW_SNAPSHOT);
+        if (snapshot_done) {
+            in_snapshot_ = false;
+        }
+        book_->apply(r.price, r.qty, r.side & SIDE_BID);
+        if (opt_.bbo) {
+            bbo_apply(r, snapshot_done);
         }
+    }
+}
 
-        auto row = queue_.dequeue();
-        if (!row) {
-            std::this_thread::sleep_for(std::chrono::microseconds(50));
-            continue;
+// the first row after a snapshot writes the top of book it built, later rows only when they
+// can have moved it
+void L2Writer::bbo_apply(const L2Row& r, bool force) noexcept {
+    const uint8_t s = r.side & SIDE_BID;
+    if (!book_valid_ || in_snapshot_) {
+        return;
+    }
+    if (!force && (s == SIDE_BID ? r.price < bbo_edge_[s] : r.price > bbo_edge_[s])) {
+        return;
+    }
+    bbo_emit(r.ts_ns, force);
+}
+
+// reads the top of book off book_ and writes a row when it changed, or when forced
+void L2Writer::bbo_emit(uint64_t ts_ns, bool force) noexcept {
+    BboTop t;
+    const size_t want = bbo_top_.size();
+    for (uint8_t s : {SIDE_ASK, SIDE_BID}) {
+        const size_t n = book_->top(s == SIDE_BID, want, bbo_top_.data());
+        if (n) {
+            t.px[s] = bbo_top_[0].price;
+            t.qty[s] = bbo_top_[0].qty;
+        }
+        if (opt_.bbo_levels) {
+            for (size_t i = 0; i < n; ++i) {
+                t.depth[s] += bbo_top_[i].qty;
+            }
         }
+        // with fewer levels than watched any price can get into the top
+        bbo_edge_[s] = n == want ? bbo_top_[n - 1].price : s == SIDE_BID ? 0 : UINT32_MAX;
+    }
+    if (force || !(t == bbo_last_)) {
+        bbo_push(ts_ns, t);
+    }
+}
+
+void L2Writer::bbo_push(uint64_t ts_ns, const BboTop& t) noexcept {
+    bbo_last_ = t;
+    bbo_ts_.push_back(ts_ns);
+    for (uint8_t s : {SIDE_ASK, SIDE_BID}) {
+        bbo_px_[s].push_back(t.px[s]);
+        bbo_qty_[s].push_back(t.qty[s]);
+        bbo_depth_[s].push_back(t.depth[s]);
+    }
+    if (bbo_ts_.size() == kBboBlockRows) {
+        flush_bbo();
+    }
+}
+
+// appends the buffered rows to the hour's bbo file as one block
+void L2Writer::flush_bbo() {
+    const size_t n = bbo_ts_.size();
+    if (!n) {
+        return;
+    }
+    if (cur_.bbo_fd >= 0) {
+        static constexpr uint8_t zeros[8]{};
+        L2BboBlockHeader bh{};
+        std::memcpy(bh.magic, "BBOB", 4);
+        bh.rows = static_cast<uint32_t>(n);
+        bh.first_ts = bbo_ts_.front();
+        const void* cols[BBO_COL_COUNT] = {bbo_ts_.data(), bbo_px_[SIDE_BID].data(), bbo_px_[SIDE_ASK].data(),
+                                           bbo_qty_[SIDE_BID].data(), bbo_qty_[SIDE_ASK].data(),
+                                           bbo_depth_[SIDE_BID].data(), bbo_depth_[SIDE_ASK].data()};
+        iovec iov[1 + 2 * BBO_COL_COUNT];
+        int k = 0;
+        iov[k++] = {&bh, sizeof(bh)};
+        size_t bytes = sizeof(bh);
+        for (uint32_t c = 0; c < l2bbo_cols(opt_.bbo_levels); ++c) {
+            const size_t len = n * l2bbo_width(c);
+            const size_t padded = l2bbo_col_bytes(c, n);
+            iov[k++] = {const_cast<void*>(cols[c]), len};
+            if (padded > len) {
+                iov[k++] = {const_cast<uint8_t*>(zeros), padded - len};
+            }
+            bytes += padded;
+        }
+        if (::pwritev(cur_.bbo_fd, iov, k, (off_t)cur_.bbo_off) == static_cast<ssize_t>(bytes)) {
+            cur_.bbo_off += bytes;
+            cur_.bbo_rows += n;
+        }
+        else {
+            // the next block goes to the same offset
+            std::cerr << "[L2Writer] " << opt_.product << ": lost " << n << " bbo rows: " << std::strerror(errno) << '\n';
+        }
+    }
+    bbo_ts_.clear();
+    for (uint8_t s : {SIDE_ASK, SIDE_BID}) {
+        bbo_px_[s].clear();
+        bbo_qty_[s].clear();
+        bbo_depth_[s].clear();
+    }
+}
+
+bool L2Writer::checkpoint_due(uint64_t ts_ns) const noexcept {
+    return (opt_.checkpoint_every_rows && rows_since_ckpt_ >= opt_.checkpoint_every_rows) ||
+        (opt_.checkpoint_every_s && ts_ns - last_ckpt_ns_ >= opt_.checkpoint_every_s * 1'000'000'000ull);
+}
 
-        const uint64_t h = hour_start_from_ns(row->ts_ns);
+// restates the whole book: a MARK_CHECKPOINT row carrying the level count, then one
+// ROW_CHECKPOINT row per level, all stamped ts_ns. skipped while the book is not trusted, the
+// next resync and snapshot serve readers just as well
+void L2Writer::checkpoint(uint64_t ts_ns) {
+    rows_since_ckpt_ = 0;
+    last_ckpt_ns_ = ts_ns;
+    if (!book_valid_ || in_snapshot_) {
+        return;
+    }
+
+    const size_t levels = book_->levels(false) + book_->levels(true);
+    ckpt_rows_.clear();
+    ckpt_rows_.reserve(levels + 1);
+    ckpt_rows_.push_back({ts_ns, static_cast<int64_t>(levels), MARK_CHECKPOINT, ROW_MARKER});
+    // each side best first, so the levels come out sorted by price
+    for (uint8_t s : {SIDE_BID, SIDE_ASK}) {
+        ckpt_levels_.resize(book_->levels(s == SIDE_BID));
+        const size_t n = book_->top(s == SIDE_BID, ckpt_levels_.size(), ckpt_levels_.data());
+        for (size_t i = 0; i < n; ++i) {
+            ckpt_rows_.push_back({ts_ns, ckpt_levels_[i].qty, ckpt_levels_[i].price,
+                                  static_cast<uint8_t>(ROW_CHECKPOINT | s)});
+        }
+    }
+
+    const uint64_t at = rows_.load(std::memory_order_relaxed);
+    if (append(ckpt_rows_.data(), ckpt_rows_.size()) == ckpt_rows_.size()) {
+        cur_.index.push_back({ts_ns, at});
+        checkpoints_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void L2Writer::persist(const L2Row* rows, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        if (rows[i].ts_ns < opt_.record_from_ns) {
+            // before the window the rows only build the book
+            size_t j = i + 1;
+            while (j < n && rows[j].ts_ns < opt_.record_from_ns) {
+                ++j;
+            }
+            apply_to_book(rows + i, j - i);
+            if (hour_start_ == ~0ull) {
+                // no file yet to take their top of book rows
+                flush_bbo();
+            }
+            i = j;
+            continue;
+        }
+        if (rows[i].ts_ns >= opt_.record_until_ns) {
+            ++i;
+            continue;
+        }
+        const uint64_t h = hour_start_from_ns(rows[i].ts_ns);
         if (hour_start_ != h) {
+            const uint64_t t0 = stats_tsc();
+            const auto w0 = opt_.rotate_latency ? steady_clock::now() : steady_clock::time_point{};
             if (!rotate_to_hour(h)) {
                 dropped_.fetch_add(1, std::memory_order_relaxed);
+                ++i;
                 continue;
             }
-            last_sync = 0;
+            if (opt_.rotate_latency) {
+                opt_.rotate_latency->record(static_cast<uint64_t>(
+                    duration_cast<nanoseconds>(steady_clock::now() - w0).count()));
+            }
+            if constexpr (kStageStats) {
+                if (opt_.stats) {
+                    const uint64_t cycles = stats_tsc() - t0;
+                    opt_.stats->rotate.record_single(cycles);
+                    opt_.stats->last_rotate.store(cycles, std::memory_order_relaxed);
+                    opt_.stats->rotations.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            last_sync_ = 0;
+            // and with its top of book, unknown while the book is
+            if (opt_.bbo) {
+                if (book_valid_ && !in_snapshot_) {
+                    bbo_emit(rows[i].ts_ns, true);
+                }
+                else {
+                    bbo_push(rows[i].ts_ns, BboTop{});
+                }
+            }
+            // every hour opens with the book as it stands so it can be read on its own, unless
+            // the hour opens on a resync that replaces the book anyway
+            const bool opens_on_resync = (rows[i].side & ROW_MARKER) && rows[i].price == MARK_RESYNC;
+            if (!opens_on_resync) {
+                checkpoint(rows[i].ts_ns);
+            }
+        }
+
+        // longest run that stays inside the open hour
+        const uint64_t lo = std::max<uint64_t>(h * 1'000'000'000ull, opt_.record_from_ns);
+        const uint64_t hi = std::min<uint64_t>(h * 1'000'000'000ull + 3600ull * 1'000'000'000ull, opt_.record_until_ns);
+        size_t j = i + 1;
+        while (j < n && rows[j].ts_ns >= lo && rows[j].ts_ns < hi) {
+            ++j;
+        }
+
+        // cut the run where a row triggered checkpoint is due
+        while (i < j) {
+            size_t take = j - i;
+            if (opt_.checkpoint_every_rows) {
+                const uint64_t left = opt_.checkpoint_every_rows -
+                    std::min(rows_since_ckpt_, opt_.checkpoint_every_rows - 1);
+                take = static_cast<size_t>(std::min<uint64_t>(take, left));
+            }
+            apply_to_book(rows + i, take);
+            const size_t done = append(rows + i, take);
+            if (done < take) {
+                dropped_.fetch_add(j - i - done, std::memory_order_relaxed);
+            }
+            persisted_.store(persisted_.load(std::memory_order_relaxed) + done, std::memory_order_relaxed);
+            if (opt_.persist_latency) {
+                const uint64_t now = static_cast<uint64_t>(
+                    duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count());
+                for (size_t r = i; r < i + done; ++r) {
+                    opt_.persist_latency->record(now > rows[r].ts_ns ? now - rows[r].ts_ns : 0);
+                }
+            }
+            if (done < take) {
+                break;
+            }
+            rows_since_ckpt_ += take;
+            i += take;
+            if (checkpoint_due(rows[i - 1].ts_ns)) {
+                checkpoint(rows[i - 1].ts_ns);
+            }
         }
+        i = j;
+    }
+}
 
-        uint64_t idx = rows_.load(std::memory_order_relaxed);
-        if (idx >= capacity_) {
-            dropped_.fetch_add(1, std::memory_order_relaxed);
+void L2Writer::run() {
+    last_sync_ = 0;
+
+    while (true) {
+        auto batch = queue_.read_span(kBatchRows);
+        if (batch.empty()) {
+            // the queue is drained, what overflowed it comes next
+            if (spill_.active() && spill_.take(spill_chunk_)) {
+                waiter_.reset();
+                persist_spilled();
+                continue;
+            }
+            // the producer's last rows may have landed after the read above, they are only known to be
+            // visible once stop is seen
+            if (stop_.load(std::memory_order_acquire)) {
+                if (queue_.empty() && !spill_.active()) {
+                    break;
+                }
+                continue;
+            }
+            // Direct keeps a partly filled block in memory, tails get its rows when the queue runs dry
+            if (ring_ && cur_.fd >= 0 && submitted_ < rows_.load(std::memory_order_relaxed)) {
+                drain_blocks();
+                publish_committed();
+            }
+            waiter_.idle([this] {
+                return !queue_.empty() || spill_.active() || stop_.load(std::memory_order_relaxed);
+            });
             continue;
         }
+        waiter_.reset();
+        const size_t depth = kStageStats && opt_.stats ? queue_.size() : 0;
 
-        ts_[idx] = row->ts_ns;
-        price_[idx] = row->price;
-        qty_[idx] = row->qty;
-        side_[idx] = row->side;
+        persist(batch.first.data(), batch.first.size());
+        persist(batch.second.data(), batch.second.size());
+        if (ring_ && cur_.fd >= 0) {
+            reap_blocks(false);
+        }
+        publish_committed();
+        maybe_prepare((batch.second.empty() ? batch.first : batch.second).back().ts_ns);
+        if constexpr (kStageStats) {
+            if (opt_.stats) {
+                publish_stats(batch.first, batch.second, depth);
+            }
+        }
+        queue_.commit_read(batch.size());
+        // rows overflowing meanwhile wait in memory, the oldest move to the spill file from here
+        if (spill_.active()) {
+            spill_.offload();
+        }
+        maybe_sync();
+    }
 
-        rows_.store(idx + 1, std::memory_order_release);
-        hdr_.rows = idx + 1;
+    retire_file();
+    drop_prepared();
+}
 
-        if (opt_.fsync_every_rows && ++last_sync >= opt_.fsync_every_rows) {
-            (void)update_rows_in_header();
-            ::fdatasync(fd_);
-            last_sync = 0;
+// a chunk of rows taken back from the spill, persisted like a batch from the queue. rows lost
+// after it leave a gap marker, the book is not known past them
+void L2Writer::persist_spilled() {
+    const auto& rows = spill_chunk_.rows;
+    persist(rows.data(), rows.size());
+    if (!rows.empty()) {
+        spill_ts_ = rows.back().ts_ns;
+    }
+    if (spill_chunk_.lost && spill_ts_) {
+        const L2Row gap{spill_ts_, 0, MARK_GAP, ROW_MARKER};
+        gaps_.fetch_add(1, std::memory_order_relaxed);
+        persist(&gap, 1);
+    }
+    if (ring_ && cur_.fd >= 0) {
+        reap_blocks(false);
+    }
+    publish_committed();
+    if (spill_ts_) {
+        maybe_prepare(spill_ts_);
+    }
+    if constexpr (kStageStats) {
+        if (opt_.stats) {
+            publish_stats(rows, {}, 0);
         }
     }
+    maybe_sync();
+}
 
-    close_file();
+void L2Writer::maybe_sync() {
+    if (opt_.fsync_every_rows && last_sync_ >= opt_.fsync_every_rows) {
+        if (ring_ && cur_.fd >= 0) {
+            drain_blocks();
+            publish_committed();
+        }
+        cur_.write_rows();
+        ::fdatasync(cur_.fd);
+        if (cur_.bbo_fd >= 0) {
+            flush_bbo();
+            ::fdatasync(cur_.bbo_fd);
+        }
+        last_sync_ = 0;
+    }
+}
+
+// persist stage of every row in the batch, then the counters l2_stats shows
+void L2Writer::publish_stats(std::span<const L2Row> a, std::span<const L2Row> b, size_t depth) noexcept {
+    ProductStats& st = *opt_.stats;
+    const uint64_t now = stats_tsc();
+    for (auto part : {a, b}) {
+        for (const L2Row& r : part) {
+            st.stage[STAGE_PERSIST].record_single(stats_stamp_age(r.stamp, now));
+        }
+    }
+    st.queue_depth.store(depth, std::memory_order_relaxed);
+    st.rows.store(rows_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    st.persisted.store(persisted_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    st.dropped.store(dropped_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    st.spilled.store(spill_.spilled(), std::memory_order_relaxed);
+    st.spill_lost.store(spill_.lost(), std::memory_order_relaxed);
 }
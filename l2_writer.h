@@ -1,35 +1,163 @@
 #pragma once
 #include <atomic>
+#include <cmath>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <span>
 #include <string>
 #include <thread>
+#include <vector>
+#include "col_file.h"
+#include "col_schema.h"
+#include "latency_histogram.h"
+#include "spill.h"
 #include "spsc.h"
+#include "stage_stats.h"
+#include "wait_strategy.h"
 
+class FlatBook;
+class IoRing;
+class L2Compactor;
+struct L2Level;
+
+// how the writer gets rows into the hour file
+enum class L2Backend : uint8_t {
+    Mmap,    // stores into a shared mapping, the kernel writes dirty pages back when it likes
+    Direct,  // stages blocks of rows in memory and writes them with io_uring, O_DIRECT if possible
+};
+
+inline const char* l2_backend_name(L2Backend b) noexcept {
+    return b == L2Backend::Direct ? "direct" : "mmap";
+}
+
+inline bool parse_l2_backend(const char* s, L2Backend& out) noexcept {
+    for (L2Backend b : {L2Backend::Mmap, L2Backend::Direct}) {
+        if (std::strcmp(s, l2_backend_name(b)) == 0) {
+            out = b;
+            return true;
+        }
+    }
+    return false;
+}
+
+// columns of L2Schema, in file order
 enum : uint32_t { COL_TS = 0, COL_PX = 1, COL_QTY = 2, COL_SIDE = 3, COL_COUNT = 4 };
 
+// side byte: bit 0 is the book side. marker rows set ROW_MARKER and carry a MARK_* kind in the
+// price column, they tell readers about stream events rather than book levels. level rows that
+// came from a snapshot message set ROW_SNAPSHOT, levels restated by a writer checkpoint set
+// ROW_CHECKPOINT, plain updates set neither.
+enum : uint8_t { SIDE_ASK = 0, SIDE_BID = 1, ROW_CHECKPOINT = 0x20, ROW_SNAPSHOT = 0x40, ROW_MARKER = 0x80 };
+enum : uint32_t {
+    MARK_GAP = 1,         // messages were lost before this point, the book is no longer trustworthy
+    MARK_RESYNC = 2,      // a snapshot follows, readers reset their book here
+    MARK_CHECKPOINT = 3,  // qty holds n, the next n rows are the full book at this ts
+};
+
+// price is in ticks of 10^-price_decimals and qty in units of 10^-qty_decimals of the product,
+// both set per product in L2WriterOpt and recorded in the hour file header
 struct L2Row {
     uint64_t ts_ns;
+    int64_t qty;
     uint32_t price;
-    float qty;
     uint8_t side;
+    // enqueue tsc for the persist stage in DATA_WRITER_STATS builds, see stage_stats.h. never persisted
+    uint8_t stamp[3]{};
 };
 
+// base/yyyymmdd/hh00.bin
+struct L2Schema : ColSchema<"l2", L2Row,
+                            Col<&L2Row::ts_ns, "ts">,
+                            Col<&L2Row::price, "price">,
+                            Col<&L2Row::qty, "qty">,
+                            Col<&L2Row::side, "side">> {
+    static constexpr const char* ext = "bin";
+};
+
+static_assert(L2Schema::count == COL_COUNT, "COL_* index the columns of L2Schema");
+
 struct L2WriterOpt {
     std::string base_dir;
     std::string product;
-    static constexpr uint64_t rows_per_hr = 1ull << 24;
+    // first extent size when there is no row history for the product yet
+    uint64_t initial_rows_per_hr{1ull << 20};
+    // bounds for learned first-extent sizes, and the cap on a single extent
+    uint64_t min_rows_per_hr{1ull << 16};
+    uint64_t max_extent_rows{1ull << 24};
+    // learned size is the busiest of the last hours times this
+    double size_headroom{1.25};
     uint32_t fsync_every_rows{0};
+    int cpu{-1};
+    // how the writer waits on an empty queue, spin for latency critical products, park for the tail
+    WaitMode wait{WaitMode::Park};
+    uint32_t spin_polls{4096};
+    // when set, every persisted row records wall clock at persist minus its ts_ns
+    LatencyHistogram* persist_latency{nullptr};
+    // when set, every hour rotation records the ns the writer thread spent in it
+    LatencyHistogram* rotate_latency{nullptr};
+    // full book checkpoints: one at every hour open, then after this many rows or seconds of
+    // stream, 0 disables either trigger
+    uint64_t checkpoint_every_rows{1ull << 18};
+    uint32_t checkpoint_every_s{60};
+    // closed hour files are handed to it for compaction when set
+    L2Compactor* compactor{nullptr};
+    // fixed point scales of the product's price and qty
+    uint8_t price_decimals{2};
+    uint8_t qty_decimals{8};
+    // stats builds record the persist stage and publish the counters here when set
+    ProductStats* stats{nullptr};
+    // Direct stages direct_block_rows rows of every column per block (rounded up to a multiple of
+    // 4096) and keeps at most direct_inflight blocks being written. its rows count as committed
+    // for tails once their block is on disk, and closing an hour no longer msyncs the columns
+    L2Backend backend{L2Backend::Mmap};
+    uint32_t direct_block_rows{1u << 16};
+    uint32_t direct_inflight{4};
+    // once the stream is within prepare_ahead_s of the next hour, a background thread creates
+    // that hour's file, allocates it and faults in the pages of its first prefault_rows rows, and
+    // rotation only swaps files. 0 opens every hour on the writer thread. closed hours are
+    // synced and finished on that thread either way
+    uint32_t prepare_ahead_s{60};
+    uint64_t prefault_rows{1ull << 18};
+    // MADV_HUGEPAGE on the column mappings and Direct's staging blocks. file backed huge pages
+    // need a filesystem that has them (tmpfs with huge=), elsewhere only the staging gains
+    bool huge_pages{false};
+    // keeps the book as rows are persisted and writes every change of the top of book to hh00.bbo
+    // next to the hour file, see L2BboFileHeader. bbo_levels > 0 adds the qty summed over the best
+    // bbo_levels levels of each side, and a change of that counts too
+    bool bbo{false};
+    uint16_t bbo_levels{0};
+    // only rows with ts in [record_from_ns, record_until_ns) are written. earlier ones still build
+    // the book, so the first hour written opens with the checkpoint a full run would have given
+    // it, later ones are dropped and no hour past the window is opened or prepared. a replay of
+    // one hour of a journal sets them, the defaults write everything
+    uint64_t record_from_ns{0};
+    uint64_t record_until_ns{~0ull};
+    // rows the queue has no room for wait in memory, up to spill_rows, and are persisted in order
+    // once the queue is drained. while the writer is busy it moves the oldest to an unlinked file in
+    // base_dir, up to spill_file_bytes. rows that find memory full are lost and leave a gap marker
+    // where they were, see SpillQueue
+    size_t spill_rows{1u << 20};
+    uint64_t spill_file_bytes{1ull << 30};
 
     L2WriterOpt(std::string base, std::string prod) : base_dir(std::move(base)), product(std::move(prod)) {}
 };
 
+// hour files written before the l2 book became a ColSchema, magic "L2COL\n". L2HourFile still
+// reads every version of them, nothing writes them anymore
 struct alignas(64) L2ColFileHeader {
     char magic[6];
     uint16_t header_size;
     uint16_t version;
-    uint16_t pad16{0};
+    // v4: decimals of the price and qty columns. before v4 price had 2 and qty was a float
+    uint8_t price_decimals;
+    uint8_t qty_decimals;
     uint32_t _pad32{0};
     char product[16];
     uint64_t hour_epoch_start;
@@ -37,10 +165,184 @@ struct alignas(64) L2ColFileHeader {
     uint64_t capacity;
     uint64_t col_off[COL_COUNT];
     uint64_t col_sz[COL_COUNT];
-    uint8_t pad[256 - 6 - 2 - 2 - 2 - 4 - 16 - 8 - 8 - 8 - (8 * COL_COUNT) - (8 * COL_COUNT)];
+    // v2: col_off/col_sz describe the first extent, further extents are chained from next_extent
+    uint32_t extent_count;
+    uint32_t _pad_ext{0};
+    uint64_t next_extent;
+    // v3: checkpoint index, ckpt_count L2CkptEntry records at ckpt_off after the last column.
+    // only written on close, a file that was never closed has ckpt_count 0
+    uint64_t ckpt_off;
+    uint32_t ckpt_count;
+    uint32_t _pad_ckpt{0};
+    uint8_t pad[192 - 6 - 2 - 2 - 1 - 1 - 4 - 16 - 8 - 8 - 8 - (8 * COL_COUNT) - (8 * COL_COUNT) - 4 - 4 - 8 - 8 - 4 - 4];
+    // v5: progress of the open hour for tailing readers, on a cache line of its own. the writer
+    // only ever stores to it atomically
+    ColLive live;
 };
 
 static_assert(sizeof(L2ColFileHeader) == 256, "header must be 256 bytes");
+static_assert(offsetof(L2ColFileHeader, live) == 192, "live block must have the last cache line");
+
+// header at the start of every extent after the first. columns follow at page aligned offsets,
+// each extent holding `capacity` rows of every column.
+struct alignas(64) L2ColExtentHeader {
+    char magic[6];
+    uint16_t index;
+    uint64_t rows;
+    uint64_t capacity;
+    uint64_t col_off[COL_COUNT];
+    uint64_t next;
+};
+
+static_assert(sizeof(L2ColExtentHeader) == 64, "extent header must be 64 bytes");
+
+// a MARK_CHECKPOINT row, the l2 schema's index entries
+using L2CkptEntry = ColIndexEntry;
+
+// the last L2COL version
+static constexpr uint16_t L2COL_VERSION = 5;
+
+// column widths of a file version, qty went from float to int64 in v4
+inline constexpr uint64_t l2col_width(uint32_t col, uint16_t version = L2COL_VERSION) noexcept {
+    constexpr uint64_t w[COL_COUNT] = {sizeof(uint64_t), sizeof(uint32_t), sizeof(int64_t), sizeof(uint8_t)};
+    return col == COL_QTY && version < 4 ? sizeof(float) : w[col];
+}
+
+// decimals implied by files before v4
+static constexpr uint8_t L2COL_V3_PRICE_DECIMALS = 2;
+static constexpr uint8_t L2COL_V3_QTY_DECIMALS = 8;
+
+// a float qty of an old file in units of 10^-8, marker rows keep their count as is
+inline int64_t l2_legacy_qty(float q, uint8_t side) noexcept {
+    return side & ROW_MARKER ? std::llround(q) : std::llround(static_cast<double>(q) * 1e8);
+}
+
+// writes v as a decimal with `decimals` digits after the point, returns the length. digits are
+// written by hand, snprintf with a runtime width warns about truncation for any buffer size
+inline int l2_format_fixed(char* out, size_t n, int64_t v, uint8_t decimals) noexcept {
+    char buf[24 + 256];
+    char* e = buf + sizeof(buf);
+    char* b = e;
+    uint64_t a = v < 0 ? 0 - static_cast<uint64_t>(v) : static_cast<uint64_t>(v);
+    for (uint8_t i = 0; i < decimals; ++i) {
+        *--b = static_cast<char>('0' + a % 10);
+        a /= 10;
+    }
+    if (decimals) {
+        *--b = '.';
+    }
+    do {
+        *--b = static_cast<char>('0' + a % 10);
+        a /= 10;
+    } while (a);
+    if (v < 0) {
+        *--b = '-';
+    }
+    const size_t len = static_cast<size_t>(e - b);
+    if (n) {
+        const size_t k = len < n ? len : n - 1;
+        std::memcpy(out, b, k);
+        out[k] = '\0';
+    }
+    return static_cast<int>(len);
+}
+
+// base/live names the hour file the writer has open. it is rewritten in place under a seqlock:
+// seq is odd while an update is in progress, readers retry when it is odd or moved under them.
+// generation counts hour files opened, across writer restarts, so a reader can tell a new file
+// for the same hour apart from the one it has
+struct alignas(64) L2LiveFile {
+    char magic[6];  // "L2LIV\n"
+    uint16_t version;
+    uint32_t seq;
+    uint32_t pid;
+    uint64_t generation;
+    uint64_t hour_s;
+    uint8_t pad[64 - 6 - 2 - 4 - 4 - 8 - 8];
+};
+
+static_assert(sizeof(L2LiveFile) == 64, "live file must be 64 bytes");
+
+static constexpr uint16_t L2LIVE_VERSION = 1;
+
+inline std::string l2col_live_path(const std::string& base) {
+    return base.empty() ? "live" : base.back() == '/' ? base + "live" : base + "/live";
+}
+
+// top of book next to an hour file, hh00.bbo: one row per change of the best bid or ask, written
+// in blocks as they fill and on every fsync. a block is an L2BboBlockHeader and its columns, ts,
+// bid_px, ask_px, bid_qty, ask_qty and, when levels is set, bid_depth and ask_depth, each padded to
+// 8 bytes. an empty side has price and qty 0, a row with both prices 0 also follows a gap: the book
+// is unknown until the snapshot after the next resync. each hour opens with the top of book as it
+// stands. rows in the header is set on close, an open file is read up to its last whole block
+struct alignas(64) L2BboFileHeader {
+    char magic[6];  // "L2BBO\n"
+    uint16_t version;
+    uint8_t price_decimals;
+    uint8_t qty_decimals;
+    uint16_t levels;
+    uint32_t _pad32{0};
+    char product[16];
+    uint64_t hour_epoch_start;
+    uint64_t rows;
+    uint8_t pad[64 - 6 - 2 - 1 - 1 - 2 - 4 - 16 - 8 - 8];
+};
+
+static_assert(sizeof(L2BboFileHeader) == 64, "bbo header must be 64 bytes");
+
+struct L2BboBlockHeader {
+    char magic[4];  // "BBOB"
+    uint32_t rows;
+    uint64_t first_ts;
+};
+
+static_assert(sizeof(L2BboBlockHeader) == 16, "bbo block header must be 16 bytes");
+
+static constexpr uint16_t L2BBO_VERSION = 1;
+
+enum : uint32_t {
+    BBO_TS = 0, BBO_BID_PX = 1, BBO_ASK_PX = 2, BBO_BID_QTY = 3, BBO_ASK_QTY = 4,
+    BBO_BID_DEPTH = 5, BBO_ASK_DEPTH = 6, BBO_COL_COUNT = 7,
+};
+
+inline constexpr uint64_t l2bbo_width(uint32_t col) noexcept {
+    return col == BBO_BID_PX || col == BBO_ASK_PX ? sizeof(uint32_t) : sizeof(uint64_t);
+}
+
+// columns in a block of a file with `levels`
+inline constexpr uint32_t l2bbo_cols(uint16_t levels) noexcept {
+    return levels ? BBO_COL_COUNT : BBO_BID_DEPTH;
+}
+
+inline constexpr uint64_t l2bbo_col_bytes(uint32_t col, uint64_t rows) noexcept {
+    return (rows * l2bbo_width(col) + 7) & ~uint64_t{7};
+}
+
+inline std::string l2col_bbo_path(const std::string& base, uint64_t hour_s) {
+    std::string p = l2col_hour_path(base, hour_s);
+    p.replace(p.size() - 3, 3, "bbo");
+    return p;
+}
+
+// consistent generation and hour of a mapped live file, false while the writer has not
+// published one yet
+inline bool l2col_read_live(const L2LiveFile& f, uint64_t& generation, uint64_t& hour_s) noexcept {
+    std::atomic_ref<uint32_t> seq(const_cast<uint32_t&>(f.seq));
+    std::atomic_ref<uint64_t> gen(const_cast<uint64_t&>(f.generation));
+    std::atomic_ref<uint64_t> hour(const_cast<uint64_t&>(f.hour_s));
+    while (true) {
+        const uint32_t s0 = seq.load(std::memory_order_acquire);
+        if (s0 & 1) {
+            continue;
+        }
+        generation = gen.load(std::memory_order_relaxed);
+        hour_s = hour.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seq.load(std::memory_order_relaxed) == s0) {
+            return generation != 0;
+        }
+    }
+}
 
 class L2Writer {
 public:
@@ -51,49 +353,214 @@ public:
     void stop();
     void join();
 
-    bool enqueue(const L2Row& r) noexcept { return queue_.enqueue(r); }
+    // mlocks the queue, see LockFreeQueue::lock_memory
+    bool lock_queue() noexcept { return queue_.lock_memory(); }
+
+    // tsc is when the row counts as enqueued for the persist stage, stats builds only. false only
+    // when the row is lost, a full queue spills it
+    bool enqueue(const L2Row& r, uint64_t tsc = stats_tsc()) noexcept {
+        bool ok;
+        if constexpr (kStageStats) {
+            L2Row s = r;
+            stats_stamp(s.stamp, tsc);
+            ok = put(s);
+        }
+        else {
+            ok = put(r);
+        }
+        waiter_.notify();
+        return ok;
+    }
+    // records a marker row and counts it, marker rows go through the queue to keep their position
+    bool mark_gap(uint64_t ts_ns) noexcept {
+        gaps_.fetch_add(1, std::memory_order_relaxed);
+        return enqueue({ts_ns, 0, MARK_GAP, ROW_MARKER});
+    }
+    bool mark_resync(uint64_t ts_ns) noexcept {
+        resyncs_.fetch_add(1, std::memory_order_relaxed);
+        return enqueue({ts_ns, 0, MARK_RESYNC, ROW_MARKER});
+    }
+
     uint64_t dropped() const noexcept { return dropped_.load(std::memory_order_relaxed); }
+    // rows the queue refused, the ones spilled and persisted later, and the ones lost
+    uint64_t overflowed() const noexcept { return spill_.overflowed(); }
+    uint64_t spilled() const noexcept { return spill_.spilled(); }
+    uint64_t spill_lost() const noexcept { return spill_.lost(); }
+    uint64_t gaps() const noexcept { return gaps_.load(std::memory_order_relaxed); }
+    uint64_t resyncs() const noexcept { return resyncs_.load(std::memory_order_relaxed); }
+    uint64_t checkpoints() const noexcept { return checkpoints_.load(std::memory_order_relaxed); }
     uint64_t rows() const noexcept { return rows_.load(std::memory_order_acquire); }
+    // rows persisted since start, across hour files
+    uint64_t persisted() const noexcept { return persisted_.load(std::memory_order_relaxed); }
     uint64_t hour_s() const noexcept { return hour_start_; }
+    uint64_t rotations() const noexcept { return rotations_.load(std::memory_order_relaxed); }
+    // rotations that found the next hour's file already prepared
+    uint64_t prepared_rotations() const noexcept { return prepared_rotations_.load(std::memory_order_relaxed); }
 
 private:
-    int fd_{-1};
-    uint8_t* base_{nullptr};
-    size_t map_bytes_{0};
-    uint64_t* ts_{nullptr};
-    uint32_t* price_{nullptr};
-    float* qty_{nullptr};
-    uint8_t* side_{nullptr};
-    L2ColFileHeader hdr_{};
-    uint64_t col_off_[COL_COUNT]{};
-    uint64_t col_sz_[COL_COUNT]{};
+    // Direct backend staging: rows [row_base, row_base + rows) of the hour for every column,
+    // written to file_off once full
+    struct Block {
+        uint8_t* col[L2Schema::count]{};
+        uint64_t row_base{0};
+        uint64_t rows{0};
+        uint64_t file_off[L2Schema::count]{};
+        uint32_t len[L2Schema::count]{};
+        // column writes in flight
+        uint32_t pending{0};
+    };
+
+    // an hour file being written, its index holds the checkpoints. the writer's is cur_, the
+    // file thread prepares the next one the same way and finishes the ones the writer is done with
+    struct HourFile : ColFile {
+        // Direct backend: the file again with O_DIRECT, fd where the filesystem refuses it
+        int dfd{-1};
+        uint64_t hour_s{~0ull};
+        // hh00.bbo when L2WriterOpt::bbo is set: where the next block goes and the rows before it
+        int bbo_fd{-1};
+        uint64_t bbo_off{0};
+        uint64_t bbo_rows{0};
+    };
+    // work for the file thread: prepare an hour, or finish or release a file
+    struct FileJob {
+        uint64_t prepare_hour{~0ull};
+        uint64_t prepare_rows{0};
+        HourFile file;
+        bool release{false};
+    };
+
+    HourFile cur_;
+    // rows [ext_base_, ext_end_) are in the current extent, or block for Direct, cols_ point at
+    // ext_base_
+    uint64_t ext_base_{0};
+    uint64_t ext_end_{0};
+    L2Schema::Pointers cols_{};
+    // base/live, mapped once the first hour opens
+    L2LiveFile* live_{nullptr};
+    // Direct backend: the ring writes go through and the staging blocks, used round robin
+    std::unique_ptr<IoRing> ring_;
+    std::vector<Block> blocks_;
+    uint8_t* staging_{nullptr};
+    size_t cur_block_{0};
+    // rows handed to the ring, and the prefix of them that is on disk
+    uint64_t submitted_{0};
+    uint64_t written_{0};
     std::atomic<uint64_t> rows_{0};
     std::atomic<uint64_t> dropped_{0};
-    uint64_t capacity_{L2WriterOpt::rows_per_hr};
+    std::atomic<uint64_t> persisted_{0};
+    std::atomic<uint64_t> gaps_{0};
+    std::atomic<uint64_t> resyncs_{0};
+    std::atomic<uint64_t> checkpoints_{0};
+    std::atomic<uint64_t> rotations_{0};
+    std::atomic<uint64_t> prepared_rotations_{0};
     uint64_t hour_start_{~0ull};
+    // rows of the most recently closed hours, newest last
+    static constexpr size_t kSizeHistory = 3;
+    std::vector<uint64_t> hour_rows_;
     L2WriterOpt opt_;
     static constexpr size_t kQueueCapacity = (1ull << 18);
+    static constexpr size_t kBatchRows = 4096;
     LockFreeQueue<L2Row, kQueueCapacity> queue_;
+    SpillQueue<L2Row> spill_;
+    SpillQueue<L2Row>::Chunk spill_chunk_;
+    // ts of the last spilled row persisted, where a gap marker for rows lost after it goes
+    uint64_t spill_ts_{0};
+    Waiter waiter_;
+    void (*scatter_)(const L2Row*, size_t, uint64_t*, uint32_t*, int64_t*, uint8_t*);
+    uint32_t last_sync_{0};
+    // live book rebuilt from the persisted rows, in a tick indexed window so a row costs no
+    // allocation and checkpoints read it in price order. it is only trusted between a resync and
+    // the next gap, and not while the snapshot after a resync is arriving
+    std::unique_ptr<FlatBook> book_;
+    bool book_valid_{false};
+    bool in_snapshot_{false};
+    // bbo: the top of book as last written, indexed by the side bit.
+    // a level row can only move the top when its price is at or inside bbo_edge_ of its side
+    struct BboTop {
+        uint32_t px[2]{};
+        int64_t qty[2]{};
+        int64_t depth[2]{};
+
+        bool operator==(const BboTop&) const = default;
+    };
+    std::vector<L2Level> bbo_top_;
+    BboTop bbo_last_;
+    uint32_t bbo_edge_[2]{};
+    // rows not yet in the file, one vector per column
+    static constexpr size_t kBboBlockRows = 4096;
+    std::vector<uint64_t> bbo_ts_;
+    std::vector<uint32_t> bbo_px_[2];
+    std::vector<int64_t> bbo_qty_[2];
+    std::vector<int64_t> bbo_depth_[2];
+    uint64_t rows_since_ckpt_{0};
+    uint64_t last_ckpt_ns_{0};
+    std::vector<L2Row> ckpt_rows_;
+    std::vector<L2Level> ckpt_levels_;
     std::unique_ptr<std::thread> thread_;
+    std::mutex file_mu_;
+    std::condition_variable file_cv_;
+    std::deque<FileJob> file_jobs_;
+    // the prepared next hour, and the hour the file thread is preparing right now
+    HourFile ready_;
+    uint64_t preparing_{~0ull};
+    bool file_stop_{false};
+    // last hour the writer asked for
+    uint64_t prepare_sent_{~0ull};
+    std::unique_ptr<std::thread> file_thread_;
     std::atomic<bool> running_{false};
     std::atomic<bool> stop_{false};
 
     void run();
+    // once a row spills every later one does too until the writer has taken them all back, so
+    // the fast path costs one load of a line that only changes when a spill starts or ends
+    bool put(const L2Row& r) noexcept {
+        if (!spill_.active() && queue_.enqueue(r)) [[likely]] {
+            return true;
+        }
+        return spill_.push(r);
+    }
+    void persist_spilled();
+    void maybe_sync();
+    void persist(const L2Row* rows, size_t n);
+    void publish_stats(std::span<const L2Row> a, std::span<const L2Row> b, size_t depth) noexcept;
+    size_t append(const L2Row* rows, size_t n);
+    void apply_to_book(const L2Row* rows, size_t n) noexcept;
+    void bbo_apply(const L2Row& r, bool force) noexcept;
+    void bbo_emit(uint64_t ts_ns, bool force) noexcept;
+    void bbo_push(uint64_t ts_ns, const BboTop& t) noexcept;
+    void flush_bbo();
+    bool checkpoint_due(uint64_t ts_ns) const noexcept;
+    void checkpoint(uint64_t ts_ns);
     bool rotate_to_hour(uint64_t hour_s);
-    void close_file();
-    static constexpr size_t HEADER_SZ = 256;
+    void retire_file();
     bool open_file(uint64_t hour_s);
-    bool map_file(size_t bytes);
-    bool write_header();
-    bool update_rows_in_header();
+    void begin_file();
+    bool add_extent(uint64_t capacity);
+    void enter_extent();
+    bool next_window();
+    bool init_direct();
+    void start_block(uint64_t row);
+    void write_block(Block& b, uint64_t rows);
+    void reap_blocks(bool wait);
+    void drain_blocks();
+    uint64_t first_extent_rows(uint64_t hour_s);
+    void publish_committed() noexcept;
+    void publish_live(uint64_t hour_s);
 
     static inline uint64_t hour_start_from_ns(uint64_t ts_ns) noexcept {
         const uint64_t s = ts_ns / 1'000'000'000ull;
         return (s / 3600ull) * 3600ull;
     }
 
-    static bool mkdir_p(const std::string& dir);
-    static std::string date_dir(const std::string& base, uint64_t hour_s);
-    static std::string hour_basename(uint64_t hour_s);
-    static bool preallocate(int fd, size_t bytes);
+    // file work that does not touch the writer's state, run on the file thread or inline
+    bool create_file(HourFile& f, uint64_t hour_s, uint64_t rows, bool prefault) const;
+    ColMapOpt map_opt(bool prefault) const noexcept;
+    void finish_file(HourFile& f) const;
+    static void release_file(HourFile& f);
+    void unlink_file(const HourFile& f) const;
+
+    void file_worker();
+    void maybe_prepare(uint64_t ts_ns);
+    bool take_prepared(uint64_t hour_s, HourFile& out);
+    void drop_prepared();
 };
@@ -0,0 +1,85 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// log-linear histogram: power of two ranges split into 16 linear sub-buckets, so any recorded
+// value is reported within ~6%. recording is a relaxed fetch_add, safe from several threads.
+class LatencyHistogram {
+public:
+    static constexpr uint32_t kSubBits = 4;
+    static constexpr uint32_t kSub = 1u << kSubBits;
+    static constexpr uint32_t kBuckets = (64 - kSubBits + 1) * kSub;
+
+    static constexpr uint32_t bucket_of(uint64_t v) noexcept {
+        if (v < kSub) {
+            return static_cast<uint32_t>(v);
+        }
+        const uint32_t msb = 63u - static_cast<uint32_t>(__builtin_clzll(v));
+        const uint32_t shift = msb - kSubBits;
+        return (shift + 1) * kSub + static_cast<uint32_t>((v >> shift) & (kSub - 1));
+    }
+
+    // upper edge of a bucket, what percentiles report
+    static constexpr uint64_t bucket_high(uint32_t b) noexcept {
+        if (b < kSub) {
+            return b;
+        }
+        const uint32_t shift = b / kSub - 1;
+        const uint64_t base = (static_cast<uint64_t>(kSub) | (b & (kSub - 1))) << shift;
+        return base + ((1ull << shift) - 1);
+    }
+
+    void record(uint64_t v) noexcept {
+        counts_[bucket_of(v)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // for histograms only one thread records into, a plain store avoids the locked add
+    void record_single(uint64_t v) noexcept {
+        auto& c = counts_[bucket_of(v)];
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const noexcept {
+        uint64_t n = 0;
+        for (const auto& c : counts_) {
+            n += c.load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    // q in [0, 1]
+    uint64_t percentile(double q) const noexcept {
+        const uint64_t total = count();
+        if (!total) {
+            return 0;
+        }
+        const uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total - 1)) + 1;
+        uint64_t seen = 0;
+        for (uint32_t b = 0; b < kBuckets; ++b) {
+            seen += counts_[b].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return bucket_high(b);
+            }
+        }
+        return bucket_high(kBuckets - 1);
+    }
+
+    uint64_t max() const noexcept {
+        for (uint32_t b = kBuckets; b-- > 0;) {
+            if (counts_[b].load(std::memory_order_relaxed)) {
+                return bucket_high(b);
+            }
+        }
+        return 0;
+    }
+
+    void reset() noexcept {
+        for (auto& c : counts_) {
+            c.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, kBuckets> counts_{};
+};
@@ -1,9 +1,14 @@
 #include <csignal>
+#include <cstdlib>
 #include <iostream>
 #include <atomic>
+#include <filesystem>
+#include <sstream>
+#include <string>
 #include <thread>
 #include <chrono>
-#include "coinbase_feed.h"
+#include <vector>
+#include "recorder.h"
 
 std::atomic<bool> shutdown_requested{false};
 
@@ -12,33 +17,223 @@ void signal_handler(int signal) {
     shutdown_requested.store(true);
 }
 
-int main() {
+static void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0
+        << " [--dir PATH] [--connections N] [--feed-cpus LIST] [--writer-cpus LIST]"
+        << " [--wait spin|yield|park] [--spin PRODUCTS] [--endpoint URL] [--redundant]"
+        << " [--compact] [--compact-remove-raw] [--decimals PRODUCT=P:Q] [--no-increment-lookup]"
+        << " [--stats NAME] [--backend mmap|direct] [--huge-pages] [--bbo] [--bbo-levels N] [--trades]"
+        << " [--pipeline] [--parser-cpus LIST] [--ring-mb N] [--journal] [--spill-mb N]"
+        << " [--lock-memory]"
+        << " PRODUCT...\n"
+        << "  PRODUCT may be repeated or comma separated, default BTC-USD\n"
+        << "  LIST is comma separated cpus or ranges, e.g. 2-5,8\n"
+        << "  --wait sets how idle writers and event loops wait (default park), --spin overrides it to spin\n"
+        << "    per product writer\n"
+        << "  --endpoint is a ws:// or wss:// url, default wss://advanced-trade-ws.coinbase.com\n"
+        << "  --redundant keeps two connections per group and records the first copy of every event\n"
+        << "  --compact compresses closed hours to hh00.l2z, --compact-remove-raw also deletes the .bin\n"
+        << "  --decimals fixes a product's price and qty decimals, e.g. BTC-USD=2:8, may be repeated.\n"
+        << "    other products use the exchange's increments unless --no-increment-lookup, then 2:8\n"
+        << "  --stats names the /dev/shm segment l2_stats reads (default data_writer.stats), '' disables it.\n"
+        << "    only builds with DATA_WRITER_STATS record stage latencies\n"
+        << "  --backend direct writes hour files from staged blocks with io_uring and O_DIRECT instead of\n"
+        << "    a shared mapping (default mmap)\n"
+        << "  --huge-pages asks for transparent huge pages on the writers' hour mappings and staging\n"
+        << "  --bbo writes every top of book change to hh00.bbo next to each hour file, --bbo-levels N\n"
+        << "    adds the qty of the best N levels per side\n"
+        << "  --trades also records the market_trades channel to hh00.trades next to each hour file\n"
+        << "  --pipeline parses on a thread per connection instead of the event loop, which only copies\n"
+        << "    frames into a ring of --ring-mb MB (default 4). --parser-cpus pins the parsers and implies it,\n"
+        << "    they wait like the writers\n"
+        << "  --journal also appends every received frame to DIR/journal/c<connection>/yyyymmdd/hh00.frames,\n"
+        << "    which l2_replay decodes again\n"
+        << "  --spill-mb bounds the file each writer spills to once its queue and 1M rows of memory are full\n"
+        << "    (default 1024), 0 spills to memory only\n"
+        << "  --lock-memory mlocks the writer queues and frame rings, needs RLIMIT_MEMLOCK to allow it\n";
+}
+
+static std::vector<std::string> split(const std::string& s, char sep) {
+    std::vector<std::string> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, sep)) {
+        if (!item.empty()) {
+            out.push_back(item);
+        }
+    }
+    return out;
+}
+
+static std::vector<int> parse_cpu_list(const std::string& s) {
+    std::vector<int> cpus;
+    for (const auto& item : split(s, ',')) {
+        const auto dash = item.find('-');
+        if (dash == std::string::npos) {
+            cpus.push_back(std::stoi(item));
+            continue;
+        }
+        const int lo = std::stoi(item.substr(0, dash));
+        const int hi = std::stoi(item.substr(dash + 1));
+        for (int c = lo; c <= hi; ++c) {
+            cpus.push_back(c);
+        }
+    }
+    return cpus;
+}
+
+int main(int argc, char** argv) {
     std::signal(SIGINT, signal_handler);
     std::signal(SIGTERM, signal_handler);
 
-    std::cout << "[main] Starting BTC-USD data recorder...\n";
-
     try {
-        Config config;
-        config.pair = "BTC-USD";
+        RecorderConfig config;
+        if (const char* home = std::getenv("HOME")) {
+            config.base_dir = (std::filesystem::path(home) / "hft-data").string();
+        }
+        else {
+            config.base_dir = "/tmp/hft-data";
+        }
 
-        CoinbaseFeed feed(config);
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const bool has_val = i + 1 < argc;
+            if (arg == "--dir" && has_val) {
+                config.base_dir = argv[++i];
+            }
+            else if (arg == "--connections" && has_val) {
+                config.connections = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--feed-cpus" && has_val) {
+                config.feed_cpus = parse_cpu_list(argv[++i]);
+            }
+            else if (arg == "--writer-cpus" && has_val) {
+                config.writer_cpus = parse_cpu_list(argv[++i]);
+            }
+            else if (arg == "--wait" && has_val) {
+                if (!parse_wait_mode(argv[++i], config.wait)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            }
+            else if (arg == "--backend" && has_val) {
+                if (!parse_l2_backend(argv[++i], config.backend)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            }
+            else if (arg == "--spill-mb" && has_val) {
+                config.spill_mb = std::stoull(argv[++i]);
+            }
+            else if (arg == "--huge-pages") {
+                config.huge_pages = true;
+            }
+            else if (arg == "--bbo") {
+                config.bbo = true;
+            }
+            else if (arg == "--bbo-levels" && has_val) {
+                config.bbo = true;
+                config.bbo_levels = static_cast<uint16_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--trades") {
+                config.trades = true;
+            }
+            else if (arg == "--pipeline") {
+                config.pipeline = true;
+            }
+            else if (arg == "--parser-cpus" && has_val) {
+                config.pipeline = true;
+                config.parser_cpus = parse_cpu_list(argv[++i]);
+            }
+            else if (arg == "--journal") {
+                config.journal = true;
+            }
+            else if (arg == "--lock-memory") {
+                config.lock_memory = true;
+            }
+            else if (arg == "--ring-mb" && has_val) {
+                config.ring_bytes = static_cast<size_t>(std::stoul(argv[++i])) << 20;
+            }
+            else if (arg == "--spin" && has_val) {
+                for (auto& p : split(argv[++i], ',')) {
+                    config.spin_products.push_back(std::move(p));
+                }
+            }
+            else if (arg == "--endpoint" && has_val) {
+                if (!Endpoint::parse(argv[++i], config.endpoint)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            }
+            else if (arg == "--redundant") {
+                config.redundant = true;
+            }
+            else if (arg == "--compact") {
+                config.compact = true;
+            }
+            else if (arg == "--compact-remove-raw") {
+                config.compact = true;
+                config.compact_remove_raw = true;
+            }
+            else if (arg == "--decimals" && has_val) {
+                const std::string v = argv[++i];
+                const auto eq = v.find('=');
+                const auto colon = v.find(':', eq);
+                if (eq == std::string::npos || colon == std::string::npos) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                L2Decimals d;
+                d.price = static_cast<uint8_t>(std::stoul(v.substr(eq + 1, colon - eq - 1)));
+                d.qty = static_cast<uint8_t>(std::stoul(v.substr(colon + 1)));
+                config.decimals[v.substr(0, eq)] = d;
+            }
+            else if (arg == "--no-increment-lookup") {
+                config.lookup_increments = false;
+            }
+            else if (arg == "--stats" && has_val) {
+                config.stats_name = argv[++i];
+                if (!kStageStats && !config.stats_name.empty()) {
+                    std::cerr << "[main] built without DATA_WRITER_STATS, --stats has no effect\n";
+                }
+            }
+            else if (arg == "-h" || arg == "--help") {
+                usage(argv[0]);
+                return 0;
+            }
+            else if (arg.rfind("--", 0) == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            else {
+                for (auto& p : split(arg, ',')) {
+                    config.products.push_back(std::move(p));
+                }
+            }
+        }
+        if (config.products.empty()) {
+            config.products.push_back("BTC-USD");
+        }
+
+        std::cout << "[main] Starting data recorder for " << config.products.size() << " products...\n";
 
-        std::cout << "[main] Starting feed connection...\n";
-        feed.start();
+        Recorder recorder(config);
+
+        std::cout << "[main] Starting " << recorder.connections() << " feed connections...\n";
+        recorder.start();
 
         std::cout << "[main] Recording data. Press Ctrl+C to stop.\n";
-        std::cout << "[main] Data will be saved to ~/hft-data/ directory\n";
+        std::cout << "[main] Data will be saved to " << config.base_dir << "/<product>/\n";
 
         while (!shutdown_requested.load()) {
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
         }
 
-        std::cout << "[main] Stopping feed...\n";
-        feed.stop();
-        feed.join();
+        std::cout << "[main] Stopping feeds...\n";
+        recorder.stop();
+        recorder.join();
 
-        std::cout << "[main] Data recording stopped. Files saved to ~/hft-data/\n";
+        std::cout << "[main] Data recording stopped. Files saved to " << config.base_dir << "\n";
 
     } catch (const std::exception& e) {
         std::cerr << "[main] Error: " << e.what() << std::endl;
@@ -46,4 +241,4 @@ int main() {
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,100 @@
+#include "recorder.h"
+#include <algorithm>
+#include <iostream>
+
+Recorder::Recorder(const RecorderConfig& cfg) {
+    if (cfg.compact) {
+        compactor_ = std::make_unique<L2Compactor>(cfg.compact_remove_raw);
+    }
+    if (kStageStats && !cfg.stats_name.empty()) {
+        stats_ = std::make_unique<StatsSegment>();
+        if (stats_->create(cfg.stats_name, cfg.products)) {
+            std::cout << "[Recorder] stage stats in /dev/shm/" << cfg.stats_name << '\n';
+        }
+        else {
+            std::cerr << "[Recorder] " << stats_->error() << ", running without stats\n";
+            stats_.reset();
+        }
+    }
+    const size_t n_conn = std::max<size_t>(1, std::min<size_t>(cfg.connections, cfg.products.size()));
+
+    std::vector<Config> per_conn(n_conn);
+    for (size_t c = 0; c < n_conn; ++c) {
+        per_conn[c].base_dir = cfg.base_dir;
+        per_conn[c].endpoint = cfg.endpoint;
+        per_conn[c].redundant = cfg.redundant;
+        per_conn[c].persist_latency = cfg.persist_latency;
+        per_conn[c].decimals = cfg.decimals;
+        per_conn[c].lookup_increments = cfg.lookup_increments;
+        per_conn[c].compactor = compactor_.get();
+        per_conn[c].backend = cfg.backend;
+        per_conn[c].huge_pages = cfg.huge_pages;
+        per_conn[c].spill_file_bytes = cfg.spill_mb << 20;
+        per_conn[c].bbo = cfg.bbo;
+        per_conn[c].bbo_levels = cfg.bbo_levels;
+        per_conn[c].trades = cfg.trades;
+        per_conn[c].pipeline = cfg.pipeline;
+        per_conn[c].ring_bytes = cfg.ring_bytes;
+        per_conn[c].parser_wait = cfg.wait;
+        per_conn[c].loop_wait = cfg.wait;
+        per_conn[c].lock_memory = cfg.lock_memory;
+        per_conn[c].journal = cfg.journal;
+        per_conn[c].journal_name = std::string("c").append(std::to_string(c));
+        if (!cfg.parser_cpus.empty()) {
+            per_conn[c].parser_cpu = cfg.parser_cpus[c % cfg.parser_cpus.size()];
+        }
+        per_conn[c].stats = stats_.get();
+        if (!cfg.feed_cpus.empty()) {
+            per_conn[c].cpu = cfg.feed_cpus[c % cfg.feed_cpus.size()];
+        }
+    }
+
+    for (size_t i = 0; i < cfg.products.size(); ++i) {
+        Config& c = per_conn[i % n_conn];
+        c.products.push_back(cfg.products[i]);
+        c.writer_cpus.push_back(cfg.writer_cpus.empty() ? -1 : cfg.writer_cpus[i % cfg.writer_cpus.size()]);
+        const bool spin = std::find(cfg.spin_products.begin(), cfg.spin_products.end(),
+                                    cfg.products[i]) != cfg.spin_products.end();
+        c.writer_waits.push_back(spin ? WaitMode::Spin : cfg.wait);
+    }
+
+    feeds_.reserve(n_conn);
+    for (size_t c = 0; c < n_conn; ++c) {
+        if (per_conn[c].products.empty()) {
+            continue;
+        }
+        std::cout << "[Recorder] connection " << c << ": " << per_conn[c].products.size()
+            << " products, loop cpu " << per_conn[c].cpu;
+        if (per_conn[c].pipeline) {
+            std::cout << ", parser cpu " << per_conn[c].parser_cpu;
+        }
+        std::cout << '\n';
+        feeds_.push_back(std::make_unique<CoinbaseFeed>(per_conn[c]));
+    }
+}
+
+void Recorder::start() {
+    if (compactor_) {
+        compactor_->start();
+    }
+    for (auto& f : feeds_) {
+        f->start();
+    }
+}
+
+void Recorder::stop() {
+    for (auto& f : feeds_) {
+        f->stop();
+    }
+}
+
+void Recorder::join() {
+    for (auto& f : feeds_) {
+        f->join();
+    }
+    // writers hand over their last hour while joining, compact it before returning
+    if (compactor_) {
+        compactor_->stop();
+        compactor_->join();
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "coinbase_feed.h"
+#include "l2_compact.h"
+
+struct RecorderConfig {
+    std::vector<std::string> products;
+    std::string base_dir;
+    Endpoint endpoint;
+    // two connections per product group, first arrival of each event is recorded
+    bool redundant{false};
+    // number of websocket connections / event-loop threads, products are dealt round robin
+    uint32_t connections{1};
+    // cpu per connection, cycled if shorter than connections, empty leaves loops unpinned
+    std::vector<int> feed_cpus;
+    // cpu per product writer, cycled if shorter than products, empty leaves writers unpinned
+    std::vector<int> writer_cpus;
+    // a parser thread per connection behind a frame ring, see Config::pipeline. parser_cpus is
+    // cycled like feed_cpus, the parsers wait like the writers
+    bool pipeline{false};
+    std::vector<int> parser_cpus;
+    size_t ring_bytes{4u << 20};
+    // raw frames of connection c to base/journal/c<c>/, see Config::journal
+    bool journal{false};
+    // writer wait strategy for every product not listed in spin_products, the event loops idle
+    // the same way
+    WaitMode wait{WaitMode::Park};
+    // latency critical products whose writers busy-spin
+    std::vector<std::string> spin_products;
+    // how every writer gets rows into its hour files, see L2Backend
+    L2Backend backend{L2Backend::Mmap};
+    // bound on each writer's spill file in MB, see Config::spill_file_bytes
+    uint64_t spill_mb{1024};
+    // see Config::lock_memory
+    bool lock_memory{false};
+    // MADV_HUGEPAGE on hour file mappings and staging, see L2WriterOpt::huge_pages
+    bool huge_pages{false};
+    // top of book files next to the hour files, see L2WriterOpt::bbo
+    bool bbo{false};
+    uint16_t bbo_levels{0};
+    // market_trades to hh00.trades, see Config::trades
+    bool trades{false};
+    LatencyHistogram* persist_latency{nullptr};
+    // compress every closed hour to hh00.l2z on a background thread
+    bool compact{false};
+    // delete the raw hour file once its compressed copy decodes back identically
+    bool compact_remove_raw{false};
+    // fixed point scales by product id, see Config::decimals
+    std::map<std::string, L2Decimals> decimals;
+    bool lookup_increments{true};
+    // shared memory segment for l2_stats in DATA_WRITER_STATS builds, empty disables it
+    std::string stats_name{"data_writer.stats"};
+};
+
+class Recorder {
+public:
+    explicit Recorder(const RecorderConfig& cfg);
+
+    void start();
+    void stop();
+    void join();
+
+    size_t connections() const noexcept { return feeds_.size(); }
+    const CoinbaseFeed& feed(size_t i) const noexcept { return *feeds_[i]; }
+
+private:
+    std::unique_ptr<StatsSegment> stats_;
+    std::unique_ptr<L2Compactor> compactor_;
+    std::vector<std::unique_ptr<CoinbaseFeed>> feeds_;
+};
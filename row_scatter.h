@@ -0,0 +1,72 @@
+#pragma once
+#include <immintrin.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "l2_writer.h"
+
+// transposes a run of queued rows into the ts/price/qty/side columns
+
+static_assert(sizeof(L2Row) == 24 && offsetof(L2Row, qty) == 8 && offsetof(L2Row, price) == 16 &&
+              offsetof(L2Row, side) == 20, "scatter kernels assume the 24 byte L2Row layout");
+
+using scatter_fn = void (*)(const L2Row*, size_t, uint64_t*, uint32_t*, int64_t*, uint8_t*);
+
+inline void scatter_rows_scalar(const L2Row* rows, size_t n, uint64_t* __restrict ts,
+                                uint32_t* __restrict px, int64_t* __restrict qty,
+                                uint8_t* __restrict side) {
+    for (size_t i = 0; i < n; ++i) {
+        ts[i] = rows[i].ts_ns;
+        px[i] = rows[i].price;
+        qty[i] = rows[i].qty;
+        side[i] = rows[i].side;
+    }
+}
+
+// four rows are three ymm loads of qwords {ts, qty, price|side}, blend + permute regroups them
+__attribute__((target("avx2")))
+inline void scatter_rows_avx2(const L2Row* rows, size_t n, uint64_t* __restrict ts,
+                              uint32_t* __restrict px, int64_t* __restrict qty,
+                              uint8_t* __restrict side) {
+    const __m256i split_px_side = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    const __m128i side_bytes = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1,
+                                             -1, -1, -1, -1, -1, -1, -1, -1);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const auto* src = reinterpret_cast<const __m256i*>(rows + i);
+        const __m256i v0 = _mm256_loadu_si256(src);
+        const __m256i v1 = _mm256_loadu_si256(src + 1);
+        const __m256i v2 = _mm256_loadu_si256(src + 2);
+
+        // ts = {v0[0], v0[3], v1[2], v2[1]}
+        __m256i t = _mm256_blend_epi32(v0, v1, 0x30);
+        t = _mm256_blend_epi32(t, v2, 0x0c);
+        t = _mm256_permute4x64_epi64(t, _MM_SHUFFLE(1, 2, 3, 0));
+
+        // qty = {v0[1], v1[0], v1[3], v2[2]}
+        __m256i q = _mm256_blend_epi32(v1, v0, 0x0c);
+        q = _mm256_blend_epi32(q, v2, 0x30);
+        q = _mm256_permute4x64_epi64(q, _MM_SHUFFLE(2, 3, 0, 1));
+
+        // price|side = {v0[2], v1[1], v2[0], v2[3]}, split into four prices and four side dwords
+        __m256i ps = _mm256_blend_epi32(v2, v0, 0x30);
+        ps = _mm256_blend_epi32(ps, v1, 0x0c);
+        ps = _mm256_permute4x64_epi64(ps, _MM_SHUFFLE(3, 0, 1, 2));
+        ps = _mm256_permutevar8x32_epi32(ps, split_px_side);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(ts + i), t);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(qty + i), q);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(px + i), _mm256_castsi256_si128(ps));
+
+        const uint32_t s4 = static_cast<uint32_t>(
+            _mm_cvtsi128_si32(_mm_shuffle_epi8(_mm256_extracti128_si256(ps, 1), side_bytes)));
+        std::memcpy(side + i, &s4, sizeof(s4));
+    }
+    scatter_rows_scalar(rows + i, n - i, ts + i, px + i, qty + i, side + i);
+}
+
+// picked once per process from cpuid
+inline scatter_fn select_scatter() noexcept {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? &scatter_rows_avx2 : &scatter_rows_scalar;
+}
@@ -0,0 +1,320 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "spsc.h"
+
+// where a writer's rows go while its queue is full. rows are kept in blocks in memory, up to
+// mem_rows, and rows past that are lost. the writer takes the blocks back in order once its queue
+// is empty, and while it is still busy with the queue it moves the oldest full blocks to an
+// unlinked file in dir, up to file_bytes, to make room. the producer never waits on the writer or
+// the file: it only fills blocks and links them in. nothing here is touched until the queue first
+// refuses a row
+struct SpillOpt {
+    std::string dir;
+    // not counting the block being filled
+    size_t mem_rows{1u << 20};
+    // 0 keeps spills in memory only
+    uint64_t file_bytes{1ull << 30};
+};
+
+template <typename T>
+class SpillQueue {
+    static_assert(std::is_trivially_copyable_v<T>, "spilled rows go to the file as bytes");
+
+public:
+    static constexpr size_t kChunkRows = 4096;
+
+    // what take() hands over: rows in order, then how many rows were lost right after them
+    struct Chunk {
+        std::vector<T> rows;
+        uint64_t lost{0};
+    };
+
+    explicit SpillQueue(SpillOpt opt)
+        : opt_(std::move(opt)), max_blocks_(std::max<size_t>(opt_.mem_rows / kChunkRows + 1, 2)),
+          free_(std::make_unique<Block*[]>(max_blocks_)) {}
+    ~SpillQueue() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+    SpillQueue(const SpillQueue&) = delete;
+    SpillQueue& operator=(const SpillQueue&) = delete;
+
+    // set by the first row spilled and cleared when the writer takes the last one. while it is set
+    // the producer spills every row, so no row overtakes the ones waiting here
+    bool active() const noexcept {
+        return pushed_.load(std::memory_order_acquire) != taken_.load(std::memory_order_acquire);
+    }
+
+    // producer: a row the queue had no room for, or that has to wait behind a spill. false when
+    // it is lost
+    bool push(const T& r) {
+        const uint64_t n = pushed_.load(std::memory_order_relaxed) + 1;
+        if (!tail_) {
+            tail_ = next_block();
+            first_.store(tail_, std::memory_order_release);
+        }
+        size_t c = tail_->count.load(std::memory_order_relaxed);
+        if (c == kChunkRows) {
+            Block* b = next_block();
+            if (!b) {
+                bump(tail_->lost, 1, std::memory_order_release);
+                bump(lost_, 1);
+                pushed_.store(n, std::memory_order_release);
+                return false;
+            }
+            tail_->next.store(b, std::memory_order_release);
+            tail_ = b;
+            c = 0;
+        }
+        tail_->rows[c] = r;
+        tail_->count.store(c + 1, std::memory_order_release);
+        bump(spilled_, 1);
+        pushed_.store(n, std::memory_order_release);
+        return true;
+    }
+
+    // writer: the oldest rows into out, false when there are none. out's buffer is reused
+    bool take(Chunk& out) {
+        out.rows.clear();
+        out.lost = 0;
+        if (file_chunks_) {
+            read_chunk(out);
+        }
+        else {
+            while (head() && out.rows.empty() && !out.lost) {
+                // a linked next block means this one is full and its lost count final
+                Block* next = head_->next.load(std::memory_order_acquire);
+                const size_t count = head_->count.load(std::memory_order_acquire);
+                const uint64_t lost = head_->lost.load(std::memory_order_acquire);
+                out.rows.assign(head_->rows + read_, head_->rows + count);
+                out.lost = lost - lost_read_;
+                read_ = count;
+                lost_read_ = lost;
+                if (!next) {
+                    break;
+                }
+                recycle(next);
+            }
+        }
+        const uint64_t n = out.rows.size() + out.lost;
+        taken_.store(taken_.load(std::memory_order_relaxed) + n, std::memory_order_release);
+        return n != 0;
+    }
+
+    // writer, between batches of its queue: while more than half the blocks hold spilled rows, the
+    // oldest full ones go to the file and come back to the producer empty. a row only waits in
+    // memory for the file when the file is full or failed
+    void offload() {
+        if (!opt_.file_bytes || file_failed_) {
+            return;
+        }
+        while (head()) {
+            const size_t idle = max_blocks_ - allocated_.load(std::memory_order_acquire) +
+                static_cast<size_t>(free_write_.load(std::memory_order_relaxed) -
+                                    free_read_.load(std::memory_order_acquire));
+            Block* next = head_->next.load(std::memory_order_acquire);
+            if (idle * 2 >= max_blocks_ || !next || !write_chunk()) {
+                return;
+            }
+            recycle(next);
+        }
+    }
+
+    // rows that did not fit the queue, the sum of the rows kept and the rows lost
+    uint64_t overflowed() const noexcept { return pushed_.load(std::memory_order_relaxed); }
+    uint64_t spilled() const noexcept { return spilled_.load(std::memory_order_relaxed); }
+    // the part of spilled that went through the file
+    uint64_t spilled_to_file() const noexcept { return spilled_to_file_.load(std::memory_order_relaxed); }
+    // rows with no room left anywhere, and spilled rows the file could not give back
+    uint64_t lost() const noexcept {
+        return lost_.load(std::memory_order_relaxed) + read_lost_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr size_t kChunkBytes = kChunkRows * sizeof(T);
+
+    // filled by the producer only. count and lost are published with release stores, next is set
+    // once the block is full and nothing more changes in it
+    struct Block {
+        std::atomic<size_t> count{0};
+        // rows lost right after the last one, while no block was free
+        std::atomic<uint64_t> lost{0};
+        std::atomic<Block*> next{nullptr};
+        T rows[kChunkRows];
+    };
+
+    // a chunk in the file: its rows follow, a chunk always takes kChunkRows rows of room
+    struct FileChunk {
+        uint64_t rows;
+        uint64_t lost;
+    };
+    static constexpr size_t kFileStride = sizeof(FileChunk) + kChunkBytes;
+
+    // single writer per counter, a plain store avoids the locked add
+    static void bump(std::atomic<uint64_t>& c, uint64_t n, std::memory_order o = std::memory_order_relaxed) noexcept {
+        c.store(c.load(std::memory_order_relaxed) + n, o);
+    }
+
+    // producer: a block the writer gave back, else a new one while fewer than max_blocks_ exist
+    Block* next_block() {
+        const uint64_t r = free_read_.load(std::memory_order_relaxed);
+        if (r != free_write_.load(std::memory_order_acquire)) {
+            Block* b = free_[r % max_blocks_];
+            free_read_.store(r + 1, std::memory_order_release);
+            return b;
+        }
+        const size_t n = allocated_.load(std::memory_order_relaxed);
+        if (n == max_blocks_) {
+            return nullptr;
+        }
+        blocks_.push_back(std::make_unique<Block>());
+        allocated_.store(n + 1, std::memory_order_release);
+        return blocks_.back().get();
+    }
+
+    // writer: the block being read, null before the first spill
+    Block* head() noexcept {
+        if (!head_) {
+            head_ = first_.load(std::memory_order_acquire);
+        }
+        return head_;
+    }
+
+    // writer: the head is done with, it goes back to the producer cleared and next is the head
+    void recycle(Block* next) noexcept {
+        head_->count.store(0, std::memory_order_relaxed);
+        head_->lost.store(0, std::memory_order_relaxed);
+        head_->next.store(nullptr, std::memory_order_relaxed);
+        const uint64_t w = free_write_.load(std::memory_order_relaxed);
+        free_[w % max_blocks_] = head_;
+        free_write_.store(w + 1, std::memory_order_release);
+        head_ = next;
+        read_ = 0;
+        lost_read_ = 0;
+    }
+
+    bool open_file() {
+        std::error_code ec;
+        std::filesystem::create_directories(opt_.dir, ec);
+        fd_ = ::open(opt_.dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+        if (fd_ < 0) {
+            // no O_TMPFILE on this filesystem, a named file unlinked right away
+            std::string path = opt_.dir + "/.spill.XXXXXX";
+            fd_ = ::mkstemp(path.data());
+            if (fd_ >= 0) {
+                ::unlink(path.c_str());
+            }
+        }
+        if (fd_ < 0) {
+            std::cerr << "[SpillQueue] no spill file in " << opt_.dir << ": " << std::strerror(errno) << '\n';
+            file_failed_ = true;
+            return false;
+        }
+        return true;
+    }
+
+    // the unread rows of the full head block, and the rows lost after it, to the end of the file
+    bool write_chunk() {
+        if ((file_chunks_ + 1) * kChunkBytes > opt_.file_bytes) {
+            return false;
+        }
+        if (fd_ < 0 && !open_file()) {
+            return false;
+        }
+        FileChunk fc{kChunkRows - read_, head_->lost.load(std::memory_order_acquire) - lost_read_};
+        iovec iov[2] = {{&fc, sizeof(fc)}, {head_->rows + read_, fc.rows * sizeof(T)}};
+        const auto want = static_cast<ssize_t>(sizeof(fc) + fc.rows * sizeof(T));
+        if (::pwritev(fd_, iov, 2, static_cast<off_t>(write_off_)) != want) {
+            std::cerr << "[SpillQueue] spill file write failed: " << std::strerror(errno) << '\n';
+            file_failed_ = true;
+            return false;
+        }
+        write_off_ += kFileStride;
+        ++file_chunks_;
+        file_rows_ += fc.rows;
+        file_lost_ += fc.lost;
+        bump(spilled_to_file_, fc.rows);
+        return true;
+    }
+
+    // a chunk the file cannot give back takes the rest of the file with it: all of it is counted
+    // lost and the file is not used again
+    void read_chunk(Chunk& out) {
+        FileChunk fc{};
+        out.rows.resize(kChunkRows);
+        iovec iov[2] = {{&fc, sizeof(fc)}, {out.rows.data(), kChunkBytes}};
+        const ssize_t got = ::preadv(fd_, iov, 2, static_cast<off_t>(read_off_));
+        if (got >= static_cast<ssize_t>(sizeof(fc)) && fc.rows <= kChunkRows &&
+            static_cast<size_t>(got) >= sizeof(fc) + fc.rows * sizeof(T)) {
+            out.rows.resize(fc.rows);
+            out.lost = fc.lost;
+            file_rows_ -= fc.rows;
+            file_lost_ -= fc.lost;
+            read_off_ += kFileStride;
+            --file_chunks_;
+        }
+        else {
+            std::cerr << "[SpillQueue] spill file read failed: " << std::strerror(errno) << '\n';
+            out.rows.clear();
+            out.lost = file_rows_ + file_lost_;
+            bump(read_lost_, file_rows_);
+            file_rows_ = file_lost_ = 0;
+            file_chunks_ = 0;
+            file_failed_ = true;
+        }
+        // drained, the file starts over and gives its blocks back
+        if (!file_chunks_) {
+            read_off_ = write_off_ = 0;
+            (void)::ftruncate(fd_, 0);
+        }
+    }
+
+    SpillOpt opt_;
+    const size_t max_blocks_;
+    // blocks the writer is done with, on their way back to the producer
+    const std::unique_ptr<Block*[]> free_;
+
+    // producer side
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> pushed_{0};
+    Block* tail_{nullptr};
+    std::vector<std::unique_ptr<Block>> blocks_;
+    std::atomic<size_t> allocated_{0};
+    std::atomic<uint64_t> free_read_{0};
+    std::atomic<Block*> first_{nullptr};
+    std::atomic<uint64_t> spilled_{0};
+    std::atomic<uint64_t> lost_{0};
+
+    // writer side. oldest first: the file's chunks, then head_ from read_ on and the blocks linked
+    // after it. only full blocks from the head go to the file, so every chunk in the file is older
+    // than every row in memory
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> taken_{0};
+    Block* head_{nullptr};
+    size_t read_{0};
+    uint64_t lost_read_{0};
+    std::atomic<uint64_t> free_write_{0};
+    int fd_{-1};
+    bool file_failed_{false};
+    uint64_t read_off_{0};
+    uint64_t write_off_{0};
+    // what the file holds: chunks, their rows and the rows lost after them
+    uint64_t file_chunks_{0};
+    uint64_t file_rows_{0};
+    uint64_t file_lost_{0};
+    std::atomic<uint64_t> spilled_to_file_{0};
+    std::atomic<uint64_t> read_lost_{0};
+};
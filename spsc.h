@@ -1,8 +1,14 @@
 #pragma once
+#include <sys/mman.h>
 #include <array>
 #include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
 #include <optional>
+#include <span>
+#include <type_traits>
 #include <utility>
 
 #ifndef CACHE_LINE_SIZE
@@ -96,6 +102,40 @@ public:
         return result;
     }
 
+    // ready slots as at most two contiguous runs, second is non-empty when the range wraps
+    struct ReadSpan {
+        std::span<T> first;
+        std::span<T> second;
+
+        size_t size() const noexcept { return first.size() + second.size(); }
+        bool empty() const noexcept { return first.empty(); }
+    };
+
+    // exposes up to max_n ready slots in place, consume them with commit_read
+    ReadSpan read_span(size_t max_n) {
+        const size_t curr_head = head_.load(std::memory_order_relaxed);
+        tail_cache_ = tail_.load(std::memory_order_acquire);
+
+        size_t ready = tail_cache_ >= curr_head ? tail_cache_ - curr_head
+                                                : CAPACITY - curr_head + tail_cache_;
+        if (ready > max_n) {
+            ready = max_n;
+        }
+        const size_t n1 = ready < CAPACITY - curr_head ? ready : CAPACITY - curr_head;
+        return {std::span<T>(get_slot(curr_head), n1), std::span<T>(get_slot(0), ready - n1)};
+    }
+
+    // releases the first n slots returned by read_span back to the producer
+    void commit_read(size_t n) {
+        const size_t curr_head = head_.load(std::memory_order_relaxed);
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            for (size_t i = 0; i < n; ++i) {
+                get_slot((curr_head + i) % CAPACITY)->~T();
+            }
+        }
+        head_.store((curr_head + n) % CAPACITY, std::memory_order_release);
+    }
+
     bool empty() const {
         return head_.load(std::memory_order_acquire) ==
             tail_.load(std::memory_order_acquire);
@@ -114,4 +154,134 @@ public:
     }
 
     size_t capacity() const { return CAPACITY - 1; }
+
+    // pins the slots so neither side faults on them, false when mlock is refused
+    bool lock_memory() noexcept { return ::mlock(buffer_.data(), sizeof(buffer_)) == 0; }
+};
+
+// variable length records in one buffer allocated up front, one producer and one consumer. a
+// record is a 16 byte header and its payload padded to 16 bytes; one that would run past the end
+// of the buffer leaves a skip header in the rest and starts again at the front, so every payload
+// is contiguous. positions count bytes from the start and only ever grow.
+class ByteRing {
+    struct alignas(16) Header {
+        uint32_t len;
+        uint16_t tag;
+        uint16_t flags;
+        uint64_t stamp;
+    };
+    static_assert(sizeof(Header) == 16, "record header must be 16 bytes");
+    static constexpr uint16_t SKIP = 0xffff;
+
+    static constexpr size_t record_bytes(size_t len) noexcept {
+        return sizeof(Header) + ((len + 15) & ~size_t{15});
+    }
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head_{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail_{0};
+    alignas(CACHE_LINE_SIZE) size_t head_cache_{0};
+    alignas(CACHE_LINE_SIZE) size_t tail_cache_{0};
+    // bytes of the record front() returned, skips before it included
+    size_t front_bytes_{0};
+    alignas(CACHE_LINE_SIZE) uint8_t* buf_;
+    size_t capacity_;
+    size_t mask_;
+
+    Header* at(size_t pos) noexcept { return reinterpret_cast<Header*>(buf_ + (pos & mask_)); }
+
+public:
+    // one record as the consumer sees it, data is valid until pop()
+    struct Record {
+        const char* data;
+        uint32_t len;
+        uint16_t tag;
+        uint16_t flags;
+        uint64_t stamp;
+    };
+
+    // capacity is rounded up to a power of two, at least 4 KB. the pages are touched here so the
+    // producer never faults on them
+    explicit ByteRing(size_t capacity) {
+        capacity_ = 4096;
+        while (capacity_ < capacity) {
+            capacity_ <<= 1;
+        }
+        mask_ = capacity_ - 1;
+        buf_ = static_cast<uint8_t*>(::operator new(capacity_, std::align_val_t{CACHE_LINE_SIZE}));
+        std::memset(buf_, 0, capacity_);
+    }
+
+    ~ByteRing() { ::operator delete(buf_, std::align_val_t{CACHE_LINE_SIZE}); }
+
+    ByteRing(const ByteRing&) = delete;
+    ByteRing& operator=(const ByteRing&) = delete;
+
+    size_t capacity() const noexcept { return capacity_; }
+    // pins the buffer, false when mlock is refused
+    bool lock_memory() noexcept { return ::mlock(buf_, capacity_) == 0; }
+    // largest payload push() takes, a longer one has to be split by the producer
+    size_t max_payload() const noexcept { return capacity_ / 2 - sizeof(Header); }
+
+    // copies len bytes in as one record, false when the consumer has not freed enough room yet
+    bool push(const void* data, size_t len, uint16_t tag, uint16_t flags, uint64_t stamp) noexcept {
+        const size_t need = record_bytes(len);
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t to_end = capacity_ - (tail & mask_);
+        const size_t total = need <= to_end ? need : to_end + need;
+        if (tail + total - head_cache_ > capacity_) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail + total - head_cache_ > capacity_) {
+                return false;
+            }
+        }
+        if (need > to_end) {
+            at(tail)->tag = SKIP;
+            tail += to_end;
+        }
+        Header* h = at(tail);
+        h->len = static_cast<uint32_t>(len);
+        h->tag = tag;
+        h->flags = flags;
+        h->stamp = stamp;
+        if (len) {
+            std::memcpy(h + 1, data, len);
+        }
+        tail_.store(tail + need, std::memory_order_release);
+        return true;
+    }
+
+    // the oldest record, false when there is none
+    bool front(Record& out) noexcept {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_) {
+                return false;
+            }
+        }
+        size_t pos = head;
+        const Header* h = at(pos);
+        if (h->tag == SKIP) {
+            // the producer only skips to make room for a record, one follows at the front
+            pos += capacity_ - (pos & mask_);
+            h = at(pos);
+        }
+        out = {reinterpret_cast<const char*>(h + 1), h->len, h->tag, h->flags, h->stamp};
+        front_bytes_ = pos - head + record_bytes(h->len);
+        return true;
+    }
+
+    // releases the record front() returned
+    void pop() noexcept {
+        head_.store(head_.load(std::memory_order_relaxed) + front_bytes_, std::memory_order_release);
+    }
+
+    bool empty() const noexcept {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    // bytes in use, skips included
+    size_t size() const noexcept {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
 };
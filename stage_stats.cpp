@@ -0,0 +1,120 @@
+#include "stage_stats.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <thread>
+
+using namespace std::chrono;
+
+static constexpr char STATS_MAGIC[8] = {'L', '2', 'S', 'T', 'A', 'T', 'S', '\n'};
+
+static std::string shm_name(const std::string& name) {
+    return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+
+// tsc ticks per second against the steady clock over 20ms
+static uint64_t measure_tsc_hz() {
+    const auto t0 = steady_clock::now();
+    const uint64_t c0 = __rdtsc();
+    std::this_thread::sleep_for(milliseconds(20));
+    const uint64_t c1 = __rdtsc();
+    const double s = duration<double>(steady_clock::now() - t0).count();
+    return static_cast<uint64_t>(static_cast<double>(c1 - c0) / s);
+}
+
+StatsSegment::~StatsSegment() {
+    if (hdr_) {
+        ::munmap(hdr_, bytes_);
+    }
+}
+
+bool StatsSegment::fail(const std::string& name, const char* why) {
+    error_ = "stats segment " + name + ": " + why + (errno ? std::string(": ") + std::strerror(errno) : "");
+    return false;
+}
+
+bool StatsSegment::create(const std::string& name, const std::vector<std::string>& products) {
+    const std::string shm = shm_name(name);
+    ::shm_unlink(shm.c_str());
+    const int fd = ::shm_open(shm.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        return fail(shm, "shm_open");
+    }
+    bytes_ = sizeof(StatsHeader) + products.size() * sizeof(ProductStats);
+    if (::ftruncate(fd, static_cast<off_t>(bytes_)) != 0) {
+        ::close(fd);
+        return fail(shm, "ftruncate");
+    }
+    void* p = ::mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        return fail(shm, "mmap");
+    }
+    hdr_ = static_cast<StatsHeader*>(p);
+    stats_ = reinterpret_cast<ProductStats*>(hdr_ + 1);
+    for (size_t i = 0; i < products.size(); ++i) {
+        auto* s = new (&stats_[i]) ProductStats{};
+        std::strncpy(s->product, products[i].c_str(), sizeof(s->product) - 1);
+    }
+    hdr_->version = STATS_VERSION;
+    hdr_->products = static_cast<uint32_t>(products.size());
+    hdr_->tsc_hz = measure_tsc_hz();
+    hdr_->created_ns = static_cast<uint64_t>(
+        duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count());
+    hdr_->pid = static_cast<uint32_t>(::getpid());
+    // readers check the magic last
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(hdr_->magic, STATS_MAGIC, sizeof(STATS_MAGIC));
+    return true;
+}
+
+bool StatsSegment::open(const std::string& name) {
+    const std::string shm = shm_name(name);
+    errno = 0;
+    const int fd = ::shm_open(shm.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return fail(shm, "shm_open");
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(StatsHeader)) {
+        ::close(fd);
+        return fail(shm, "too small");
+    }
+    bytes_ = static_cast<size_t>(st.st_size);
+    void* p = ::mmap(nullptr, bytes_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        return fail(shm, "mmap");
+    }
+    hdr_ = static_cast<StatsHeader*>(p);
+    stats_ = reinterpret_cast<ProductStats*>(hdr_ + 1);
+    errno = 0;
+    const char* why = nullptr;
+    if (std::memcmp(hdr_->magic, STATS_MAGIC, sizeof(STATS_MAGIC)) != 0 || hdr_->version != STATS_VERSION) {
+        why = "bad magic or version";
+    }
+    else if (sizeof(StatsHeader) + hdr_->products * sizeof(ProductStats) > bytes_) {
+        why = "truncated";
+    }
+    if (why) {
+        ::munmap(hdr_, bytes_);
+        hdr_ = nullptr;
+        stats_ = nullptr;
+        return fail(shm, why);
+    }
+    return true;
+}
+
+ProductStats* StatsSegment::find(const std::string& product) noexcept {
+    for (size_t i = 0; i < products(); ++i) {
+        if (std::strncmp(stats_[i].product, product.c_str(), sizeof(stats_[i].product)) == 0) {
+            return &stats_[i];
+        }
+    }
+    return nullptr;
+}
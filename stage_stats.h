@@ -0,0 +1,118 @@
+#pragma once
+#include <x86intrin.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "latency_histogram.h"
+
+// per product, per stage latency histograms in a shared memory segment (/dev/shm/<name>) that
+// l2_stats reads while the recorder runs. a level is stamped with the tsc when its websocket
+// callback starts, when its values are decoded, when its row is handed to the writer's queue
+// and when the writer has stored it in the columns. the hooks only exist in builds with
+// DATA_WRITER_STATS, elsewhere stats_tsc() is 0 and every use of it folds away.
+
+#ifdef DATA_WRITER_STATS
+static constexpr bool kStageStats = true;
+#else
+static constexpr bool kStageStats = false;
+#endif
+
+inline uint64_t stats_tsc() noexcept {
+    if constexpr (kStageStats) {
+        return __rdtsc();
+    }
+    else {
+        return 0;
+    }
+}
+
+enum Stage : uint32_t {
+    STAGE_PARSE,    // callback entry to the level decoded
+    STAGE_ENQUEUE,  // level decoded to the row in the writer's queue
+    STAGE_PERSIST,  // row enqueued to stored in the columns
+    STAGE_COUNT
+};
+
+inline const char* stage_name(uint32_t s) noexcept {
+    constexpr const char* names[STAGE_COUNT] = {"parse", "enqueue", "persist"};
+    return s < STAGE_COUNT ? names[s] : "?";
+}
+
+// a row carries tsc bits 8..31 of its enqueue in the 3 spare bytes of L2Row, enough for ages
+// up to 2^32 cycles (over a second) at 256 cycle resolution
+static constexpr uint32_t kStampShift = 8;
+
+inline void stats_stamp(uint8_t (&stamp)[3], uint64_t tsc) noexcept {
+    const uint64_t s = tsc >> kStampShift;
+    stamp[0] = static_cast<uint8_t>(s);
+    stamp[1] = static_cast<uint8_t>(s >> 8);
+    stamp[2] = static_cast<uint8_t>(s >> 16);
+}
+
+inline uint64_t stats_stamp_age(const uint8_t (&stamp)[3], uint64_t tsc) noexcept {
+    const uint32_t then = stamp[0] | (uint32_t{stamp[1]} << 8) | (uint32_t{stamp[2]} << 16);
+    const uint32_t now = static_cast<uint32_t>(tsc >> kStampShift) & 0xffffff;
+    return uint64_t{(now - then) & 0xffffffu} << kStampShift;
+}
+
+// histograms count tsc cycles. stages are recorded by one thread each (the feed's loop for
+// parse and enqueue, the writer for persist), the counters are published by the writer
+struct alignas(64) ProductStats {
+    char product[16];
+    LatencyHistogram stage[STAGE_COUNT];
+    // closing the old hour file and opening the next one
+    LatencyHistogram rotate;
+    // L2Writer::rows(), persisted(), dropped(), spilled() and spill_lost() after the last batch
+    std::atomic<uint64_t> rows;
+    std::atomic<uint64_t> persisted;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> spilled;
+    std::atomic<uint64_t> spill_lost;
+    // rows in the writer's queue when it took the last batch
+    std::atomic<uint64_t> queue_depth;
+    std::atomic<uint64_t> rotations;
+    std::atomic<uint64_t> last_rotate;
+};
+
+static constexpr uint32_t STATS_VERSION = 2;
+
+struct alignas(64) StatsHeader {
+    char magic[8];  // "L2STATS\n"
+    uint32_t version;
+    uint32_t products;
+    // measured at creation, converts the histograms' cycles to ns
+    uint64_t tsc_hz;
+    uint64_t created_ns;
+    uint32_t pid;
+};
+
+class StatsSegment {
+public:
+    StatsSegment() = default;
+    ~StatsSegment();
+    StatsSegment(const StatsSegment&) = delete;
+    StatsSegment& operator=(const StatsSegment&) = delete;
+
+    // creates the segment for `products`, replacing a stale one of the same name. it is left in
+    // place on exit so the last numbers can still be read
+    bool create(const std::string& name, const std::vector<std::string>& products);
+    // maps an existing segment read only
+    bool open(const std::string& name);
+
+    const std::string& error() const noexcept { return error_; }
+    const StatsHeader& header() const noexcept { return *hdr_; }
+    size_t products() const noexcept { return hdr_ ? hdr_->products : 0; }
+    const ProductStats& at(size_t i) const noexcept { return stats_[i]; }
+    // nullptr when the product is not in the segment
+    ProductStats* find(const std::string& product) noexcept;
+    double ns_per_cycle() const noexcept { return hdr_ && hdr_->tsc_hz ? 1e9 / hdr_->tsc_hz : 1.0; }
+
+private:
+    StatsHeader* hdr_{nullptr};
+    ProductStats* stats_{nullptr};
+    size_t bytes_{0};
+    std::string error_;
+
+    bool fail(const std::string& name, const char* why);
+};
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdio>
+#include <filesystem>
+#include <string>
+
+// what the test executables share: CHECK counts a failure and carries on, main returns
+// check_result() so ctest sees the failures
+inline int& check_failures() {
+    static int n = 0;
+    return n;
+}
+
+#define CHECK(cond)                                                                      \
+    do {                                                                                 \
+        if (!(cond)) {                                                                   \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++check_failures();                                                          \
+        }                                                                                \
+    } while (0)
+
+inline int check_result() {
+    if (check_failures()) {
+        std::fprintf(stderr, "%d checks failed\n", check_failures());
+        return 1;
+    }
+    return 0;
+}
+
+// an empty directory of the test's own under the temp dir, emptied again by every run
+inline std::string test_dir(const char* name) {
+    const auto dir = std::filesystem::temp_directory_path() / ("data_writer_" + std::string(name));
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+    std::filesystem::create_directories(dir, ec);
+    return dir.string();
+}
@@ -0,0 +1,271 @@
+// redundant legs: each event must be recorded once whichever leg delivers it first, two events with
+// the same event time are both recorded, and a leg that drops in the middle of an event either
+// leaves it to the other leg's copy or, when that copy was already dropped, leaves a gap marker
+#include <cstdio>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../coinbase_feed.h"
+#include "../l2_reader.h"
+#include "check.h"
+
+static constexpr uint64_t kHour = 1'675'972'800ull;
+static constexpr L2Decimals kDecimals{2, 8};
+
+struct Level {
+    bool bid;
+    uint64_t px;
+    uint64_t qty;
+};
+
+static std::string fixed(uint64_t v, uint8_t decimals) {
+    char buf[32];
+    l2_format_fixed(buf, sizeof(buf), static_cast<int64_t>(v), decimals);
+    return buf;
+}
+
+static std::string iso(uint64_t ns) {
+    const time_t t = static_cast<time_t>(ns / 1'000'000'000ull);
+    struct tm g{};
+    gmtime_r(&t, &g);
+    char buf[40];
+    std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &g);
+    char frac[16];
+    std::snprintf(frac, sizeof(frac), ".%06luZ", static_cast<unsigned long>(ns % 1'000'000'000ull / 1000));
+    return std::string(buf) + frac;
+}
+
+// ms into the test hour
+static uint64_t at(uint64_t ms) { return kHour * 1'000'000'000ull + ms * 1'000'000ull; }
+
+// levels from px up, alternating sides
+static std::vector<Level> levels(uint64_t px, size_t n, uint64_t qty) {
+    std::vector<Level> out;
+    for (size_t i = 0; i < n; ++i) {
+        out.push_back({i % 2 == 0, px + i, qty + i});
+    }
+    return out;
+}
+
+using Book = std::map<std::pair<bool, uint64_t>, int64_t>;
+
+static void apply(Book& b, const Level& l) {
+    if (l.qty) {
+        b[{l.bid, l.px}] = static_cast<int64_t>(l.qty);
+    }
+    else {
+        b.erase({l.bid, l.px});
+    }
+}
+
+// one product on two legs driven fragment by fragment, each leg with its own sequence_num
+struct Rec {
+    std::string dir;
+    std::unique_ptr<CoinbaseFeed> feed;
+    uint64_t seq[2]{};
+    std::vector<L2Row> rows;
+    size_t gaps{0};
+    size_t resyncs{0};
+
+    explicit Rec(const char* name) : dir(test_dir(name)) {
+        Config cfg;
+        cfg.base_dir = dir;
+        cfg.redundant = true;
+        cfg.lookup_increments = false;
+        cfg.products = {"BTC-USD"};
+        cfg.decimals["BTC-USD"] = kDecimals;
+        feed = std::make_unique<CoinbaseFeed>(cfg);
+        feed->start_writers();
+    }
+
+    std::string msg(size_t leg, const char* type, uint64_t ts, const std::vector<Level>& lv) {
+        std::string m = std::string(R"({"channel":"l2_data","client_id":"","timestamp":")") + iso(ts) +
+            R"(","sequence_num":)" + std::to_string(seq[leg]++) + R"(,"events":[{"type":")" + type +
+            R"(","product_id":"BTC-USD","updates":[)";
+        for (size_t i = 0; i < lv.size(); ++i) {
+            m += std::string(i ? "," : "") + R"({"side":")" + (lv[i].bid ? "bid" : "offer") + R"(","event_time":")" +
+                iso(ts) + R"(","price_level":")" + fixed(lv[i].px, kDecimals.price) + R"(","new_quantity":")" +
+                fixed(lv[i].qty, kDecimals.qty) + R"("})";
+        }
+        return m + "]}]}";
+    }
+
+    void send(size_t leg, const std::string& m) { feed->handle_fragment(leg, m.data(), m.size(), true, true); }
+    // the first n bytes of m, the rest follows with send_rest or is lost with the leg
+    void send_part(size_t leg, const std::string& m, size_t n) { feed->handle_fragment(leg, m.data(), n, true, false); }
+    void send_rest(size_t leg, const std::string& m, size_t n) {
+        feed->handle_fragment(leg, m.data() + n, m.size() - n, false, true);
+    }
+
+    // drains the writer and reads back every row but checkpoints, the book is what the rows after
+    // the last resync leave
+    Book finish() {
+        feed->join();
+        Book b;
+        L2HourFile f;
+        CHECK(f.open(l2col_hour_path(dir + "/BTC-USD", kHour)));
+        for (uint64_t i = 0; i < f.rows(); ++i) {
+            const L2Row r = f.row(i);
+            if (r.side & ROW_CHECKPOINT) {
+                continue;
+            }
+            if (r.side & ROW_MARKER) {
+                gaps += r.price == MARK_GAP;
+                resyncs += r.price == MARK_RESYNC;
+                if (r.price == MARK_RESYNC) {
+                    b.clear();
+                }
+                if (r.price != MARK_CHECKPOINT) {
+                    rows.push_back(r);
+                }
+                continue;
+            }
+            rows.push_back(r);
+            apply(b, {(r.side & 1) != 0, r.price, static_cast<uint64_t>(r.qty)});
+        }
+        return b;
+    }
+};
+
+// both legs deliver every message, in either order: each is recorded once, two updates that share
+// an event time included
+static void check_dedup() {
+    Rec r("arbiter_dedup");
+    Book want;
+    const auto snap = levels(10000, 4, 100);
+    for (const auto& l : snap) {
+        apply(want, l);
+    }
+    const std::string s0 = r.msg(0, "snapshot", at(1), snap);
+    const std::string s1 = r.msg(1, "snapshot", at(1), snap);
+    r.send(0, s0);
+    r.send(1, s1);
+    for (uint64_t k = 0; k < 7; ++k) {
+        // the last two share a time
+        const uint64_t ts = at(10 + std::min<uint64_t>(k, 5));
+        const auto lv = levels(10000 + k, 2, 500 + k);
+        for (const auto& l : lv) {
+            apply(want, l);
+        }
+        const std::string a = r.msg(0, "update", ts, lv);
+        const std::string b = r.msg(1, "update", ts, lv);
+        if (k % 2) {
+            r.send(1, b);
+            r.send(0, a);
+        }
+        else {
+            r.send(0, a);
+            r.send(1, b);
+        }
+    }
+    CHECK(r.feed->arb_dropped() == 1 + 7);
+    CHECK(r.finish() == want);
+    // the resync marker, the snapshot and two levels per update
+    CHECK(r.rows.size() == 1 + 4 + 7 * 2);
+    CHECK(r.gaps == 0);
+    CHECK(r.resyncs == 1);
+}
+
+// leg 0 drops halfway through an update the other leg has yet to deliver: its copy is recorded over
+// the partial one, nothing is lost
+static void check_cut_short() {
+    Rec r("arbiter_cut_short");
+    Book want;
+    const auto snap = levels(10000, 4, 100);
+    const auto up = levels(10000, 12, 700);
+    const auto up2 = levels(10003, 2, 0);
+    for (const auto* lv : {&snap, &up, &up2}) {
+        for (const auto& l : *lv) {
+            apply(want, l);
+        }
+    }
+    r.send(0, r.msg(0, "snapshot", at(1), snap));
+    r.send(1, r.msg(1, "snapshot", at(1), snap));
+    const std::string u = r.msg(0, "update", at(20), up);
+    r.send_part(0, u, u.size() / 2);
+    r.feed->handle_leg_down(0);
+    r.send(1, r.msg(1, "update", at(20), up));
+    r.send(1, r.msg(1, "update", at(30), up2));
+    CHECK(r.finish() == want);
+    CHECK(r.gaps == 0);
+    CHECK(r.resyncs == 1);
+}
+
+// leg 0 drops halfway through an update the other leg already delivered, and dropped: the product
+// gets a gap, and the next snapshot from either leg is recorded as a resync
+static void check_lost() {
+    Rec r("arbiter_lost");
+    const auto snap = levels(10000, 4, 100);
+    const auto up = levels(10000, 12, 700);
+    const auto snap2 = levels(20000, 6, 300);
+    Book want;
+    for (const auto& l : snap2) {
+        apply(want, l);
+    }
+    r.send(0, r.msg(0, "snapshot", at(1), snap));
+    r.send(1, r.msg(1, "snapshot", at(1), snap));
+    const std::string u = r.msg(0, "update", at(20), up);
+    r.send_part(0, u, u.size() / 2);
+    r.send(1, r.msg(1, "update", at(20), up));
+    r.send(1, r.msg(1, "update", at(30), levels(10002, 2, 1)));
+    CHECK(r.feed->arb_dropped() == 1 + 2);
+    r.feed->handle_leg_down(0);
+    // leg 1 is no longer complete either, its updates go on being recorded after the gap
+    r.send(1, r.msg(1, "update", at(40), levels(10004, 2, 2)));
+    r.seq[0] = 0;
+    r.send(0, r.msg(0, "snapshot", at(50), snap2));
+    CHECK(r.finish() == want);
+    CHECK(r.gaps == 1);
+    CHECK(r.resyncs == 2);
+    size_t gap = r.rows.size();
+    size_t resync = 0;
+    for (size_t i = 0; i < r.rows.size(); ++i) {
+        if ((r.rows[i].side & ROW_MARKER) && r.rows[i].price == MARK_GAP) {
+            gap = i;
+        }
+        if ((r.rows[i].side & ROW_MARKER) && r.rows[i].price == MARK_RESYNC) {
+            resync = i;
+        }
+    }
+    CHECK(gap < resync);
+}
+
+// leg 1 delivers two updates while leg 0 is still streaming the first: leg 0 leads until it has
+// recorded both, and going down after that loses nothing
+static void check_catch_up() {
+    Rec r("arbiter_catch_up");
+    Book want;
+    const auto snap = levels(10000, 4, 100);
+    const auto up = levels(10000, 12, 700);
+    const auto up2 = levels(10001, 2, 900);
+    const auto up3 = levels(10005, 2, 0);
+    for (const auto* lv : {&snap, &up, &up2, &up3}) {
+        for (const auto& l : *lv) {
+            apply(want, l);
+        }
+    }
+    r.send(0, r.msg(0, "snapshot", at(1), snap));
+    r.send(1, r.msg(1, "snapshot", at(1), snap));
+    const std::string u = r.msg(0, "update", at(20), up);
+    r.send_part(0, u, u.size() / 2);
+    r.send(1, r.msg(1, "update", at(20), up));
+    r.send(1, r.msg(1, "update", at(30), up2));
+    r.send_rest(0, u, u.size() / 2);
+    r.send(0, r.msg(0, "update", at(30), up2));
+    r.feed->handle_leg_down(0);
+    r.send(1, r.msg(1, "update", at(40), up3));
+    CHECK(r.feed->arb_dropped() == 1 + 2);
+    CHECK(r.finish() == want);
+    CHECK(r.rows.size() == 1 + 4 + 12 + 2 + 2);
+    CHECK(r.gaps == 0);
+}
+
+int main() {
+    check_dedup();
+    check_cut_short();
+    check_lost();
+    check_catch_up();
+    return check_result();
+}
@@ -0,0 +1,219 @@
+// top of book files: a random stream of snapshots, updates, deletes, a gap and the resync after it
+// over two hours, written with bbo on, with and without depth levels. every row of each hour's
+// .bbo must be the change a std::map book kept next to the stream gives, the forced rows at each
+// hour open and snapshot end included, and at() must find the row in force at any ts
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "../l2_reader.h"
+#include "../l2_writer.h"
+#include "check.h"
+
+static constexpr uint64_t kHour = 1'675'972'800ull;
+static constexpr uint64_t kNs = 1'000'000'000ull;
+
+// the book by price per side, and the rows its changes make
+struct RefBook {
+    explicit RefBook(uint16_t n) : levels(n) {}
+
+    uint16_t levels;
+    std::map<uint32_t, int64_t> side[2];
+    bool valid{false};
+    bool in_snapshot{false};
+    L2Bbo last{};
+    bool have_last{false};
+    std::vector<L2Bbo> rows[2];
+    size_t hour{0};
+
+    L2Bbo top(uint64_t ts) const {
+        L2Bbo t{ts, 0, 0, 0, 0, 0, 0};
+        const auto& bids = side[SIDE_BID];
+        const auto& asks = side[SIDE_ASK];
+        if (!bids.empty()) {
+            t.bid_px = bids.rbegin()->first;
+            t.bid_qty = bids.rbegin()->second;
+        }
+        if (!asks.empty()) {
+            t.ask_px = asks.begin()->first;
+            t.ask_qty = asks.begin()->second;
+        }
+        if (levels) {
+            size_t k = 0;
+            for (auto it = bids.rbegin(); it != bids.rend() && k < levels; ++it, ++k) {
+                t.bid_depth += it->second;
+            }
+            k = 0;
+            for (auto it = asks.begin(); it != asks.end() && k < levels; ++it, ++k) {
+                t.ask_depth += it->second;
+            }
+        }
+        return t;
+    }
+
+    static bool same_top(const L2Bbo& a, const L2Bbo& b) {
+        return a.bid_px == b.bid_px && a.ask_px == b.ask_px && a.bid_qty == b.bid_qty && a.ask_qty == b.ask_qty &&
+            a.bid_depth == b.bid_depth && a.ask_depth == b.ask_depth;
+    }
+
+    void push(const L2Bbo& t) {
+        rows[hour].push_back(t);
+        last = t;
+        have_last = true;
+    }
+
+    // the first row of the next hour, before it is applied
+    void open_hour(size_t h, uint64_t ts) {
+        hour = h;
+        push(valid && !in_snapshot ? top(ts) : L2Bbo{ts, 0, 0, 0, 0, 0, 0});
+    }
+
+    void apply(const L2Row& r) {
+        if (r.side & ROW_MARKER) {
+            if (r.price == MARK_RESYNC) {
+                side[0].clear();
+                side[1].clear();
+                valid = true;
+                in_snapshot = true;
+            }
+            else if (r.price == MARK_GAP) {
+                valid = false;
+                push({r.ts_ns, 0, 0, 0, 0, 0, 0});
+            }
+            return;
+        }
+        const bool snapshot_done = in_snapshot && !(r.side & ROW_SNAPSHOT);
+        if (snapshot_done) {
+            in_snapshot = false;
+        }
+        auto& s = side[r.side & SIDE_BID];
+        if (r.qty) {
+            s[r.price] = r.qty;
+        }
+        else {
+            s.erase(r.price);
+        }
+        if (!valid || in_snapshot) {
+            return;
+        }
+        const L2Bbo t = top(r.ts_ns);
+        if (snapshot_done || !have_last || !same_top(t, last)) {
+            push(t);
+        }
+    }
+};
+
+// a snapshot of `n` levels each side around mid
+static void snapshot(std::vector<L2Row>& out, std::mt19937_64& rng, uint64_t& ts, uint32_t mid, int n) {
+    out.push_back({ts, 0, MARK_RESYNC, ROW_MARKER});
+    for (int i = 1; i <= n; ++i) {
+        for (uint8_t s : {SIDE_BID, SIDE_ASK}) {
+            const uint32_t px = s == SIDE_BID ? mid - static_cast<uint32_t>(i) : mid + static_cast<uint32_t>(i);
+            out.push_back({ts, static_cast<int64_t>(1 + rng() % 500), px, static_cast<uint8_t>(s | ROW_SNAPSHOT)});
+        }
+    }
+}
+
+// updates and deletes around mid, many at the top so it changes often, a gap in each
+// hour with a resync after it
+static std::vector<L2Row> stream() {
+    std::mt19937_64 rng(19);
+    std::vector<L2Row> out;
+    uint64_t ts = (kHour + 100) * kNs;
+    const uint32_t mid = 50'000;
+    snapshot(out, rng, ts, mid, 40);
+    for (size_t h = 0; h < 2; ++h) {
+        if (h) {
+            ts = (kHour + 3600 + 1) * kNs;
+        }
+        for (int i = 0; i < 60'000; ++i) {
+            ts += rng() % 3 * 1'000'000;
+            const uint8_t s = rng() & 1;
+            const uint64_t pick = rng() % 8;
+            const uint32_t away = static_cast<uint32_t>(pick < 3 ? 0 : pick < 7 ? rng() % 6 : rng() % 60);
+            const uint32_t px = s == SIDE_BID ? mid - 1 - away : mid + 1 + away;
+            out.push_back({ts, rng() % 3 == 0 ? 0 : static_cast<int64_t>(1 + rng() % 500), px, s});
+            if (i == 25'000) {
+                out.push_back({ts, 0, MARK_GAP, ROW_MARKER});
+                // updates while the book is unknown change nothing in the file
+                for (int k = 0; k < 100; ++k) {
+                    out.push_back({ts, 7, mid - 1, SIDE_BID});
+                }
+                snapshot(out, rng, ts, mid, 30);
+            }
+        }
+    }
+    return out;
+}
+
+static void check_bbo(uint16_t levels) {
+    const std::string dir = test_dir(("bbo_" + std::to_string(levels)).c_str());
+    const std::vector<L2Row> rows = stream();
+    L2WriterOpt opt{dir, "TEST-USD"};
+    opt.initial_rows_per_hr = 1 << 14;
+    opt.checkpoint_every_rows = 20'000;
+    opt.checkpoint_every_s = 0;
+    opt.prepare_ahead_s = 0;
+    opt.bbo = true;
+    opt.bbo_levels = levels;
+    {
+        L2Writer w(opt);
+        w.start();
+        for (const L2Row& r : rows) {
+            CHECK(w.enqueue(r));
+        }
+        w.stop();
+        w.join();
+    }
+
+    RefBook ref(levels);
+    size_t hour = ~size_t{0};
+    for (const L2Row& r : rows) {
+        const size_t h = (r.ts_ns / kNs - kHour) / 3600;
+        if (h != hour) {
+            hour = h;
+            ref.open_hour(h, r.ts_ns);
+        }
+        ref.apply(r);
+    }
+
+    std::mt19937_64 rng(91);
+    for (size_t h = 0; h < 2; ++h) {
+        L2BboFile f;
+        CHECK(f.open(l2col_bbo_path(dir, kHour + h * 3600)));
+        CHECK(f.hour_s() == kHour + h * 3600);
+        CHECK(f.levels() == levels);
+        CHECK(f.header().rows == f.rows());
+        // more changes than one block holds
+        CHECK(f.segments().size() > 1);
+        const std::vector<L2Bbo>& want = ref.rows[h];
+        CHECK(f.rows() == want.size());
+        size_t bad = 0;
+        for (uint64_t i = 0; i < f.rows() && i < want.size(); ++i) {
+            const L2Bbo got = f.row(i);
+            bad += got.ts_ns != want[i].ts_ns || !RefBook::same_top(got, want[i]);
+        }
+        CHECK(bad == 0);
+
+        // the row in force at a ts is the last one at or before it
+        size_t bad_at = 0;
+        for (int k = 0; k < 2000 && !want.empty(); ++k) {
+            const uint64_t ts = want[rng() % want.size()].ts_ns + rng() % 3 - 1;
+            L2Bbo got{};
+            size_t j = want.size();
+            while (j > 0 && want[j - 1].ts_ns > ts) {
+                --j;
+            }
+            const bool found = f.at(ts, got);
+            bad_at += found != (j > 0);
+            bad_at += found && j && (got.ts_ns != want[j - 1].ts_ns || !RefBook::same_top(got, want[j - 1]));
+        }
+        CHECK(bad_at == 0);
+    }
+}
+
+int main() {
+    check_bbo(0);
+    check_bbo(5);
+    return check_result();
+}
@@ -0,0 +1,197 @@
+// book replay: FlatBook against a std::map per side under a random walk that keeps leaving its
+// window, then L2BookReplay over two written hours, the second one only as .l2z, against the rows
+// applied one by one
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "../l2_book.h"
+#include "../l2_compact.h"
+#include "../l2_writer.h"
+#include "check.h"
+
+using RefBook = std::map<uint32_t, int64_t>[2];
+
+static void ref_apply(RefBook& ref, uint32_t price, int64_t qty, bool bid) {
+    if (qty) {
+        ref[bid][price] = qty;
+    }
+    else {
+        ref[bid].erase(price);
+    }
+}
+
+// the n best levels of both sides and the level counts agree
+static bool same_top(const FlatBook& book, const RefBook& ref, size_t n) {
+    if (book.levels(true) != ref[1].size() || book.levels(false) != ref[0].size()) {
+        return false;
+    }
+    std::vector<L2Level> got(n);
+    for (int bid = 0; bid < 2; ++bid) {
+        const size_t k = book.top(bid, n, got.data());
+        if (k != std::min(n, ref[bid].size())) {
+            return false;
+        }
+        size_t i = 0;
+        const auto check = [&](const auto& kv) { return got[i].price == kv.first && got[i].qty == kv.second; };
+        if (bid) {
+            for (auto it = ref[1].rbegin(); i < k; ++it, ++i) {
+                if (!check(*it)) {
+                    return false;
+                }
+            }
+        }
+        else {
+            for (auto it = ref[0].begin(); i < k; ++it, ++i) {
+                if (!check(*it)) {
+                    return false;
+                }
+            }
+        }
+    }
+    L2Level b;
+    L2Level a;
+    return book.best_bid(b) == !ref[1].empty() && book.best_ask(a) == !ref[0].empty() &&
+        (ref[1].empty() || b.price == ref[1].rbegin()->first) && (ref[0].empty() || a.price == ref[0].begin()->first);
+}
+
+static void check_flat_book() {
+    FlatBook book(4096);
+    RefBook ref;
+    std::mt19937_64 rng(11);
+    uint64_t mid = 1'000'000;
+    size_t bad = 0;
+    for (int step = 0; step < 400; ++step) {
+        // now and then the market jumps past the window
+        mid += rng() % 40 == 0 ? (rng() % 20'000) - 10'000 : (rng() % 200) - 100;
+        for (int k = 0; k < 500; ++k) {
+            const bool bid = rng() & 1;
+            // mostly near the inside, some deep levels that only fit the far map
+            const uint32_t off = static_cast<uint32_t>(rng() % 8 == 0 ? rng() % 30'000 : rng() % 300);
+            const uint32_t px = static_cast<uint32_t>(bid ? mid - 1 - off : mid + off);
+            const int64_t qty = rng() % 3 == 0 ? 0 : static_cast<int64_t>(1 + rng() % 1'000'000);
+            book.apply(px, qty, bid);
+            ref_apply(ref, px, qty, bid);
+        }
+        bad += !same_top(book, ref, 25);
+        if (step % 50 == 0) {
+            bad += !same_top(book, ref, book.levels(true) + book.levels(false));
+        }
+    }
+    CHECK(bad == 0);
+    CHECK(book.recenters() > 1);
+    book.clear();
+    CHECK(book.levels(true) == 0 && book.levels(false) == 0);
+}
+
+static void check_replay() {
+    const std::string dir = test_dir("book");
+    const uint64_t h0 = 1'675'972'800ull;
+    const uint64_t t0 = h0 * 1'000'000'000ull;
+    const uint64_t span = 2 * 3600ull * 1'000'000'000ull;
+    {
+        L2WriterOpt opt{dir, "TEST-USD"};
+        opt.checkpoint_every_rows = 20'000;
+        opt.checkpoint_every_s = 0;
+        opt.prepare_ahead_s = 0;
+        L2Writer w(opt);
+        w.start();
+        std::mt19937_64 rng(8);
+        uint64_t ts = t0 + 1000;
+        while (!w.mark_resync(ts)) {
+        }
+        for (int i = 0; i < 2000; ++i) {
+            const bool bid = i & 1;
+            const uint32_t px = bid ? 1'000'000 - 1 - i : 1'000'000 + i;
+            while (!w.enqueue({ts, 1 + static_cast<int64_t>(rng() % 1000), px,
+                               static_cast<uint8_t>((bid ? SIDE_BID : SIDE_ASK) | ROW_SNAPSHOT)})) {
+            }
+        }
+        const int n = 200'000;
+        for (int i = 0; i < n; ++i) {
+            ts = t0 + 1000 + (span - 2000) / n * (i + 1);
+            const uint64_t mid = 1'000'000 + static_cast<uint64_t>(i / 2000) * 40;
+            const bool bid = rng() & 1;
+            const uint32_t off = static_cast<uint32_t>(rng() % 500);
+            const uint32_t px = static_cast<uint32_t>(bid ? mid - 1 - off : mid + off);
+            const int64_t qty = rng() % 3 == 0 ? 0 : 1 + static_cast<int64_t>(rng() % 1000);
+            while (!w.enqueue({ts, qty, px, static_cast<uint8_t>(bid ? SIDE_BID : SIDE_ASK)})) {
+            }
+        }
+        w.stop();
+        w.join();
+    }
+
+    // every row in order, kept to rebuild the reference at any time
+    std::vector<L2Row> rows;
+    for (uint64_t h = h0; h < h0 + 2 * 3600; h += 3600) {
+        L2HourFile f;
+        CHECK(f.open(l2col_hour_path(dir, h)));
+        for (uint64_t i = 0; i < f.rows(); ++i) {
+            rows.push_back(f.row(i));
+        }
+    }
+    // the second hour is only readable compressed
+    {
+        const std::string raw_path = l2col_hour_path(dir, h0 + 3600);
+        L2HourFile raw;
+        CHECK(raw.open(raw_path));
+        std::string err;
+        CHECK(l2z_write(raw, l2z_path_for(raw_path), err));
+        raw.close();
+        std::filesystem::remove(raw_path);
+    }
+
+    RefBook ref;
+    size_t next_row = 0;
+    const auto ref_until = [&](uint64_t ts_ns) {
+        for (; next_row < rows.size() && rows[next_row].ts_ns < ts_ns; ++next_row) {
+            const L2Row& r = rows[next_row];
+            if (r.side & ROW_MARKER) {
+                if (r.price == MARK_RESYNC) {
+                    ref[0].clear();
+                    ref[1].clear();
+                }
+                continue;
+            }
+            if (!(r.side & ROW_CHECKPOINT)) {
+                ref_apply(ref, r.price, r.qty, r.side & SIDE_BID);
+            }
+        }
+    };
+
+    L2BookReplay replay(dir);
+    FlatBook book;
+    size_t samples = 0;
+    size_t bad = 0;
+    const uint64_t step = 7 * 60 * 1'000'000'000ull + 12'345;
+    CHECK(replay.sample(t0 + 5'000'000'000ull, t0 + span, step, book, [&](uint64_t ts, const FlatBook& b, bool valid) {
+        ref_until(ts);
+        ++samples;
+        bad += !valid || !same_top(b, ref, 20);
+    }));
+    CHECK(samples == (span - 5'000'000'000ull + step - 1) / step);
+    CHECK(bad == 0);
+
+    // single points, each starting from the checkpoint before it
+    std::mt19937_64 rng(5);
+    bad = 0;
+    for (int k = 0; k < 20; ++k) {
+        const uint64_t ts = t0 + 5'000'000'000ull + rng() % (span - 5'000'000'000ull);
+        ref[0].clear();
+        ref[1].clear();
+        next_row = 0;
+        ref_until(ts);
+        bad += !replay.book_at(ts, book) || !same_top(book, ref, 20);
+        bad += replay.rows_replayed() > 60'000;
+    }
+    CHECK(bad == 0);
+}
+
+int main() {
+    check_flat_book();
+    check_replay();
+    return check_result();
+}
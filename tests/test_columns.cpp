@@ -0,0 +1,181 @@
+// schema hour files: trades written by a ColWriter across extents and hours must come back
+// row for row through ColHourFile, an l2 hour from L2Writer must open in the same reader with its
+// checkpoint index, and an hour file from before L2Schema must still read through L2HourFile
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+#include "../col_reader.h"
+#include "../col_writer.h"
+#include "../l2_reader.h"
+#include "../l2_writer.h"
+#include "../trades.h"
+#include "check.h"
+
+static constexpr uint64_t kHour = 1'675'972'800ull;
+
+static TradeRow trade(uint64_t i) {
+    // 20000 trades in the first hour, the rest in the next
+    const uint64_t ts = i < 20000 ? kHour * 1'000'000'000ull + i * 100'000'000ull
+                                  : (kHour + 3600) * 1'000'000'000ull + (i - 20000) * 100'000'000ull;
+    return {ts, 1000 + i, static_cast<int64_t>(i * 7 + 1), static_cast<uint32_t>(50000 + i % 300),
+            static_cast<uint8_t>(i % 2 ? TRADE_BUY : TRADE_SELL)};
+}
+
+static void check_trades() {
+    const std::string dir = test_dir("columns_trades");
+    ColWriterOpt opt{dir, "TEST-USD"};
+    opt.initial_rows_per_hr = 1000;
+    opt.max_extent_rows = 4000;
+    {
+        ColWriter<TradeSchema> w(opt);
+        for (uint64_t i = 0; i < 30000; ++i) {
+            CHECK(w.enqueue(trade(i)));
+        }
+        w.start();
+        w.stop();
+        w.join();
+        CHECK(w.persisted() == 30000);
+        CHECK(w.rotations() == 2);
+    }
+
+    uint64_t i = 0;
+    size_t bad = 0;
+    for (uint64_t h : {kHour, kHour + 3600}) {
+        ColHourFile f;
+        CHECK(f.open(colf_hour_path(dir, h, TradeSchema::ext)));
+        CHECK(f.matches<TradeSchema>());
+        CHECK(!f.matches<L2Schema>());
+        CHECK(f.schema() == "trades");
+        CHECK(f.hour_s() == h);
+        CHECK(f.rows() == (h == kHour ? 20000u : 10000u));
+        // 1000, 2000, 4000 and then 4000 row extents, the last one trimmed
+        CHECK(f.segments().size() == (h == kHour ? 7u : 4u));
+        CHECK(f.header().first_capacity == 1000);
+        CHECK(f.header().capacity == f.rows());
+        CHECK(colf_closed(f.header().live));
+        CHECK(f.index().empty());
+        const int id = f.col_index("trade_id");
+        CHECK(id == 3);
+        for (const auto& s : f.segments()) {
+            const auto ids = f.column<uint64_t>(s, static_cast<uint32_t>(id));
+            CHECK(ids.size() == s.size());
+            CHECK(f.column<uint32_t>(s, static_cast<uint32_t>(id)).empty());
+            for (uint64_t k = 0; k < s.rows; ++k) {
+                const TradeRow a = f.row<TradeSchema>(s.row_base + k);
+                const TradeRow b = trade(i++);
+                bad += a.ts_ns != b.ts_ns || a.trade_id != b.trade_id || a.size != b.size || a.price != b.price ||
+                    a.side != b.side || ids[k] != b.trade_id || f.ts(s.row_base + k) != b.ts_ns;
+            }
+        }
+    }
+    CHECK(i == 30000);
+    CHECK(bad == 0);
+
+    // a trades file is not an l2 hour
+    L2HourFile l2;
+    CHECK(!l2.open(colf_hour_path(dir, kHour, TradeSchema::ext)));
+}
+
+static void check_l2() {
+    const std::string dir = test_dir("columns_l2");
+    L2WriterOpt opt{dir, "TEST-USD"};
+    opt.initial_rows_per_hr = 1 << 12;
+    opt.min_rows_per_hr = 1 << 12;
+    opt.checkpoint_every_rows = 5000;
+    opt.checkpoint_every_s = 0;
+    opt.prepare_ahead_s = 0;
+    {
+        L2Writer w(opt);
+        (void)w.mark_resync(kHour * 1'000'000'000ull);
+        for (uint64_t i = 0; i < 40000; ++i) {
+            (void)w.enqueue({kHour * 1'000'000'000ull + i + 1, static_cast<int64_t>(i % 50 + 1),
+                             static_cast<uint32_t>(1000 + i % 400), static_cast<uint8_t>(i % 2)});
+        }
+        w.start();
+        w.stop();
+        w.join();
+    }
+
+    const std::string path = l2col_hour_path(dir, kHour);
+    ColHourFile c;
+    L2HourFile f;
+    CHECK(c.open(path));
+    CHECK(f.open(path));
+    CHECK(c.matches<L2Schema>());
+    CHECK(c.schema() == "l2");
+    CHECK(c.rows() == f.rows());
+    CHECK(c.rows() > 40000);
+    CHECK(c.segments().size() > 1);
+    CHECK(f.header().version == COLF_VERSION);
+    // the checkpoints are the file's index
+    CHECK(!c.index().empty());
+    CHECK(c.index().size() == f.checkpoints().size());
+    size_t bad = 0;
+    for (size_t k = 0; k < c.index().size(); ++k) {
+        bad += c.index()[k].row != f.checkpoints()[k].row;
+        bad += f.row(c.index()[k].row).price != MARK_CHECKPOINT;
+    }
+    for (uint64_t i = 0; i < c.rows(); ++i) {
+        const L2Row a = c.row<L2Schema>(i);
+        const L2Row b = f.row(i);
+        bad += a.ts_ns != b.ts_ns || a.qty != b.qty || a.price != b.price || a.side != b.side;
+    }
+    CHECK(bad == 0);
+}
+
+// a closed v5 file of three rows in one extent, as the writer made them before L2Schema
+static void check_legacy() {
+    const std::string path = test_dir("columns_legacy") + "/0000.bin";
+    L2ColFileHeader h{};
+    std::memcpy(h.magic, "L2COL\n", 6);
+    h.header_size = sizeof(h);
+    h.version = 5;
+    h.price_decimals = 3;
+    h.qty_decimals = 6;
+    std::memcpy(h.product, "OLD-USD", 7);
+    h.hour_epoch_start = kHour;
+    h.rows = 3;
+    h.capacity = 3;
+    for (uint32_t c = 0; c < COL_COUNT; ++c) {
+        h.col_off[c] = L2COL_ALIGN * (c + 1);
+        h.col_sz[c] = 3 * l2col_width(c);
+    }
+    h.extent_count = 1;
+    h.live.committed = 3;
+    h.live.closed = 1;
+    const uint64_t ts[3] = {kHour * 1'000'000'000ull, kHour * 1'000'000'000ull + 5, kHour * 1'000'000'000ull + 9};
+    const uint32_t px[3] = {MARK_RESYNC, 101, 102};
+    const int64_t qty[3] = {0, 7, 8};
+    const uint8_t side[3] = {ROW_MARKER, SIDE_BID, SIDE_ASK};
+    const int fd = ::open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    CHECK(fd >= 0);
+    CHECK(::pwrite(fd, &h, sizeof(h), 0) == static_cast<ssize_t>(sizeof(h)));
+    CHECK(::pwrite(fd, ts, sizeof(ts), (off_t)h.col_off[COL_TS]) == static_cast<ssize_t>(sizeof(ts)));
+    CHECK(::pwrite(fd, px, sizeof(px), (off_t)h.col_off[COL_PX]) == static_cast<ssize_t>(sizeof(px)));
+    CHECK(::pwrite(fd, qty, sizeof(qty), (off_t)h.col_off[COL_QTY]) == static_cast<ssize_t>(sizeof(qty)));
+    CHECK(::pwrite(fd, side, sizeof(side), (off_t)h.col_off[COL_SIDE]) == static_cast<ssize_t>(sizeof(side)));
+    ::close(fd);
+
+    L2HourFile f;
+    CHECK(f.open(path));
+    CHECK(f.rows() == 3);
+    CHECK(f.price_decimals() == 3);
+    CHECK(f.qty_decimals() == 6);
+    CHECK(f.header().version == 5);
+    CHECK(L2Schema::matches(f.header()));
+    CHECK(std::strncmp(f.header().product, "OLD-USD", 7) == 0);
+    for (uint64_t i = 0; i < 3; ++i) {
+        const L2Row r = f.row(i);
+        CHECK(r.ts_ns == ts[i] && r.price == px[i] && r.qty == qty[i] && r.side == side[i]);
+    }
+    // the schema reader only knows the files that describe their columns
+    ColHourFile c;
+    CHECK(!c.open(path));
+}
+
+int main() {
+    check_trades();
+    check_l2();
+    check_legacy();
+    return check_result();
+}
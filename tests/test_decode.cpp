@@ -0,0 +1,113 @@
+// the fixed point decoders against a digit by digit reference, on random decimal strings of every
+// shape a message can hold: with and without a point, more fraction digits than the product keeps,
+// and values past 16 characters that take the slow path. prices past 32 bits must not wrap
+#include <cstring>
+#include <random>
+#include <string>
+#include "../l2_parser.h"
+#include "check.h"
+
+static int64_t reference(const std::string& s, unsigned d) {
+    int64_t v = 0;
+    unsigned nf = 0;
+    bool frac = false;
+    for (char c : s) {
+        if (c == '.') {
+            frac = true;
+        }
+        else if (!frac || nf < d) {
+            v = v * 10 + (c - '0');
+            nf += frac;
+        }
+    }
+    for (; nf < d; ++nf) {
+        v *= 10;
+    }
+    return v;
+}
+
+static std::string random_decimal(std::mt19937_64& rng) {
+    std::string s;
+    const size_t int_digits = 1 + rng() % 10;
+    s.push_back(static_cast<char>('0' + (int_digits > 1 ? 1 + rng() % 9 : rng() % 10)));
+    for (size_t i = 1; i < int_digits; ++i) {
+        s.push_back(static_cast<char>('0' + rng() % 10));
+    }
+    if (rng() % 5) {
+        s.push_back('.');
+        const size_t frac_digits = rng() % 13;
+        for (size_t i = 0; i < frac_digits; ++i) {
+            s.push_back(static_cast<char>('0' + rng() % 10));
+        }
+    }
+    return s;
+}
+
+template <unsigned D>
+static size_t check_decimals(const std::string& s, const char* p, const char* end) {
+    const int64_t want = reference(s, D);
+    const L2Decoder dec = l2_decoder_for(2, D);
+    // prices past 32 bits come back as the overflow value, never wrapped
+    const uint32_t want_px = want < L2_PRICE_OVERFLOW ? static_cast<uint32_t>(want) : L2_PRICE_OVERFLOW;
+    return (l2_decode_fixed<D>(p, end) != want) + (dec.qty(p, end) != want) +
+        (l2_decoder_for(D, 2).price(p, end) != want_px);
+}
+
+template <unsigned... D>
+static size_t check_all(const std::string& s, const char* p, const char* end, std::integer_sequence<unsigned, D...>) {
+    return (check_decimals<D>(s, p, end) + ...);
+}
+
+int main() {
+    std::mt19937_64 rng(13);
+
+    // l2_digits8 for every count, loads reach back before the digits
+    for (int r = 0; r < 10'000; ++r) {
+        char buf[24];
+        std::memset(buf, '"', sizeof(buf));
+        const size_t n = rng() % 9;
+        uint32_t want = 0;
+        for (size_t i = 0; i < n; ++i) {
+            buf[8 + i] = static_cast<char>('0' + rng() % 10);
+            want = want * 10 + static_cast<uint32_t>(buf[8 + i] - '0');
+        }
+        CHECK(l2_digits8(buf + 8, n) == want);
+    }
+
+    // values sit inside a message, the bytes around them are json
+    size_t bad = 0;
+    size_t slow = 0;
+    for (int r = 0; r < 200'000; ++r) {
+        const std::string s = random_decimal(rng);
+        char buf[64];
+        std::memset(buf, rng() & 1 ? '"' : ':', sizeof(buf));
+        std::memcpy(buf + 24, s.data(), s.size());
+        const char* p = buf + 24;
+        bad += check_all(s, p, p + s.size(), std::make_integer_sequence<unsigned, L2_MAX_DECIMALS + 1>{});
+        slow += s.size() > 16;
+    }
+    CHECK(bad == 0);
+    CHECK(slow > 0);
+
+    // the shapes coinbase sends
+    const char msg[] = "{\"price_level\":\"21921.74\",\"new_quantity\":\"0.00412500\",\"p\":\"0.00001234\"}";
+    const char* px = std::strstr(msg, "21921.74");
+    const char* qty = std::strstr(msg, "0.00412500");
+    const char* small = std::strstr(msg, "0.00001234");
+    CHECK(l2_decode_price<2>(px, px + 8) == 2192174);
+    CHECK(l2_decode_qty<8>(qty, qty + 10) == 412500);
+    CHECK(l2_decode_price<8>(small, small + 10) == 1234);
+    CHECK(l2_decode_price<2>(small, small + 10) == 0);
+    CHECK(l2_decoder_for(12, 12).price_decimals == L2_MAX_DECIMALS);
+
+    // the top of a price scale
+    const char big[] = "\"42949672.94\",\"42949672.95\",\"100.00000000\",\"42.94967294\"";
+    const char* top = big + 1;
+    CHECK(l2_decode_price<2>(top, top + 11) == L2_PRICE_OVERFLOW - 1);
+    CHECK(l2_decode_price<2>(top + 14, top + 25) == L2_PRICE_OVERFLOW);
+    CHECK(l2_decode_price<8>(top + 28, top + 40) == L2_PRICE_OVERFLOW);
+    CHECK(l2_decode_price<8>(top + 43, top + 54) == L2_PRICE_OVERFLOW - 1);
+    CHECK(l2_price_limit(2) > 42949672.9 && l2_price_limit(2) < 42949673.0);
+    CHECK(l2_price_limit(8) > 42.949 && l2_price_limit(8) < 42.95);
+    return check_result();
+}
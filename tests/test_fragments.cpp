@@ -0,0 +1,364 @@
+// fragmented messages: the same stream of large snapshots, updates of several events, market
+// trades and other messages, fed to the feed whole and again cut into fragments, a first one too
+// short to stream and later ones of a few bytes included, once with the callbacks parsing and once
+// through the pipelined parser thread. every run must record the levels the messages were built
+// from and the same trades. then the requests a run of gaps frames: each in a send slot of its
+// own, quoted products and channel intact, the slots reused once sent and nothing past the last
+// of them queued
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "../coinbase_feed.h"
+#include "../l2_reader.h"
+#include "check.h"
+
+static constexpr uint64_t kHour = 1'675'972'800ull;
+static constexpr size_t kStreamMin = 256;
+
+struct Product {
+    const char* id;
+    L2Decimals decimals;
+    uint32_t mid;
+};
+
+static const Product kProducts[] = {{"BTC-USD", {2, 8}, 2'300'000}, {"ETH-USD", {4, 6}, 16'000'000},
+                                    {"SOL-USD", {3, 8}, 20'000}};
+
+static std::string fixed(int64_t v, uint8_t decimals) {
+    char buf[32];
+    l2_format_fixed(buf, sizeof(buf), v, decimals);
+    return buf;
+}
+
+static std::string iso(uint64_t ns) {
+    const time_t t = static_cast<time_t>(ns / 1'000'000'000ull);
+    struct tm g{};
+    gmtime_r(&t, &g);
+    char buf[40];
+    std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &g);
+    char frac[16];
+    std::snprintf(frac, sizeof(frac), ".%06luZ", static_cast<unsigned long>(ns % 1'000'000'000ull / 1000));
+    return std::string(buf) + frac;
+}
+
+struct Level {
+    uint64_t ts_ns;
+    int64_t qty;
+    uint32_t price;
+    bool bid;
+
+    bool operator==(const Level&) const = default;
+};
+
+struct Stream {
+    std::vector<std::string> msgs;
+    // by product, in the order sent
+    std::vector<Level> levels[std::size(kProducts)];
+    uint64_t trades{0};
+};
+
+static std::string head(const char* channel, uint64_t ts, uint64_t seq) {
+    return std::string(R"({"channel":")") + channel + R"(","client_id":"","timestamp":")" + iso(ts) +
+        R"(","sequence_num":)" + std::to_string(seq) + R"(,"events":[)";
+}
+
+// a snapshot of every product a few tens of KB long, then updates of one to three events, trades
+// and subscription acks mixed in
+static Stream stream() {
+    std::mt19937_64 rng(21);
+    Stream s;
+    uint64_t ts = (kHour + 60) * 1'000'000'000ull;
+    uint64_t seq = 0;
+    uint64_t trade_id = 1000;
+    s.msgs.push_back(head("subscriptions", ts, seq++) +
+                     R"({"subscriptions":{"level2":["BTC-USD","ETH-USD","SOL-USD"]}}]})");
+    auto level = [&](size_t p, bool bid, uint32_t px, int64_t qty) {
+        const Product& pr = kProducts[p];
+        s.levels[p].push_back({ts, qty, px, bid});
+        return std::string(R"({"side":")") + (bid ? "bid" : "offer") + R"(","event_time":")" + iso(ts) +
+            R"(","price_level":")" + fixed(px, pr.decimals.price) + R"(","new_quantity":")" +
+            fixed(qty, pr.decimals.qty) + R"("})";
+    };
+    for (size_t p = 0; p < std::size(kProducts); ++p) {
+        ts += 1'000'000;
+        std::string m = head("l2_data", ts, seq++) + R"({"type":"snapshot","product_id":")" + kProducts[p].id +
+            R"(","updates":[)";
+        for (uint32_t i = 0; i < 600; ++i) {
+            const bool bid = i & 1;
+            m += std::string(i ? "," : "") +
+                level(p, bid, bid ? kProducts[p].mid - 1 - i / 2 : kProducts[p].mid + i / 2,
+                      static_cast<int64_t>(1 + rng() % 100'000'000));
+        }
+        s.msgs.push_back(m + "]}]}");
+    }
+    for (int k = 0; k < 3000; ++k) {
+        // the exchange's times are to the microsecond
+        ts += (1 + rng() % 50'000) * 1000;
+        const uint64_t kind = rng() % 20;
+        if (kind == 0) {
+            s.msgs.push_back(head("subscriptions", ts, seq++) + R"({"subscriptions":{"market_trades":["BTC-USD"]}}]})");
+            continue;
+        }
+        if (kind < 4) {
+            std::string m = head("market_trades", ts, seq++) + R"({"type":"update","trades":[)";
+            for (uint64_t i = 0, n = 1 + rng() % 4; i < n; ++i) {
+                const Product& pr = kProducts[rng() % std::size(kProducts)];
+                m += std::string(i ? "," : "") + R"({"trade_id":")" + std::to_string(trade_id++) +
+                    R"(","product_id":")" + pr.id + R"(","price":")" + fixed(pr.mid, pr.decimals.price) +
+                    R"(","size":")" + fixed(static_cast<int64_t>(1 + rng() % 1000), pr.decimals.qty) + R"(","side":")" +
+                    (rng() & 1 ? "BUY" : "SELL") + R"(","time":")" + iso(ts) + R"("})";
+                ++s.trades;
+            }
+            s.msgs.push_back(m + "]}]}");
+            continue;
+        }
+        std::string m = head("l2_data", ts, seq++);
+        for (uint64_t e = 0, events = 1 + rng() % 3; e < events; ++e) {
+            const size_t p = rng() % std::size(kProducts);
+            m += std::string(e ? "," : "") + R"({"type":"update","product_id":")" + kProducts[p].id +
+                R"(","updates":[)";
+            for (uint64_t i = 0, n = 1 + rng() % 30; i < n; ++i) {
+                const bool bid = rng() & 1;
+                const uint32_t off = static_cast<uint32_t>(rng() % 400);
+                m += std::string(i ? "," : "") +
+                    level(p, bid, bid ? kProducts[p].mid - 1 - off : kProducts[p].mid + off,
+                          rng() % 3 ? static_cast<int64_t>(rng() % 100'000'000) : 0);
+            }
+            m += "]}";
+        }
+        s.msgs.push_back(m + "]}");
+    }
+    return s;
+}
+
+// where a message is cut: whole, a first fragment too short to stream, or one that streams, with
+// the rest in pieces of a few bytes or of a few KB
+static std::vector<size_t> cuts(std::mt19937_64& rng, size_t len) {
+    std::vector<size_t> out;
+    const uint64_t mode = rng() % 4;
+    if (mode == 0) {
+        return out;
+    }
+    size_t at = mode == 1 ? 1 + rng() % (kStreamMin - 1) : kStreamMin + rng() % 512;
+    const size_t max_piece = mode == 3 ? 8 : 4096;
+    while (at < len) {
+        out.push_back(at);
+        at += 1 + rng() % max_piece;
+    }
+    return out;
+}
+
+static std::unique_ptr<CoinbaseFeed> make_feed(const std::string& dir, bool pipeline) {
+    Config cfg;
+    cfg.base_dir = dir;
+    cfg.lookup_increments = false;
+    cfg.pipeline = pipeline;
+    cfg.trades = true;
+    for (const auto& p : kProducts) {
+        cfg.products.push_back(p.id);
+        cfg.decimals[p.id] = p.decimals;
+    }
+    return std::make_unique<CoinbaseFeed>(cfg);
+}
+
+struct Run {
+    std::vector<L2Row> rows[std::size(kProducts)];
+    uint64_t trades{0};
+};
+
+static Run run(const Stream& s, bool pipeline, bool fragmented) {
+    const std::string name =
+        std::string("fragments_") + (pipeline ? "pipelined" : "direct") + (fragmented ? "_cut" : "_whole");
+    const std::string dir = test_dir(name.c_str());
+    std::unique_ptr<CoinbaseFeed> feed = make_feed(dir, pipeline);
+    feed->start_writers();
+    if (pipeline) {
+        feed->start_parser();
+    }
+    std::mt19937_64 rng(pipeline ? 5 : 7);
+    for (const std::string& m : s.msgs) {
+        const std::vector<size_t> at = fragmented ? cuts(rng, m.size()) : std::vector<size_t>{};
+        size_t from = 0;
+        for (size_t k = 0; k <= at.size(); ++k) {
+            const size_t end = k < at.size() ? at[k] : m.size();
+            if (pipeline) {
+                feed->push_fragment(0, m.data() + from, end - from, k == 0, k == at.size());
+            }
+            else {
+                feed->handle_fragment(0, m.data() + from, end - from, k == 0, k == at.size());
+            }
+            from = end;
+        }
+    }
+    if (pipeline) {
+        feed->finish_parser();
+    }
+    feed->join();
+    CHECK(feed->messages() == s.msgs.size());
+    CHECK(feed->seq_gaps() == 0);
+    CHECK(feed->pending_requests(0) == 0);
+
+    Run out;
+    out.trades = feed->trades();
+    for (size_t p = 0; p < std::size(kProducts); ++p) {
+        L2HourFile f;
+        CHECK(f.open(l2col_hour_path(dir + "/" + kProducts[p].id, kHour)));
+        for (uint64_t i = 0; i < f.rows(); ++i) {
+            L2Row r = f.row(i);
+            if ((r.side & ROW_CHECKPOINT) || ((r.side & ROW_MARKER) && r.price == MARK_CHECKPOINT)) {
+                continue;
+            }
+            // stage stamps are taken on the way through, they differ between runs
+            r.stamp[0] = r.stamp[1] = r.stamp[2] = 0;
+            out.rows[p].push_back(r);
+        }
+    }
+    return out;
+}
+
+static bool same_rows(const std::vector<L2Row>& a, const std::vector<L2Row>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].ts_ns != b[i].ts_ns || a[i].qty != b[i].qty || a[i].price != b[i].price || a[i].side != b[i].side) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void check_fragments() {
+    const Stream s = stream();
+    const Run whole = run(s, false, false);
+    CHECK(whole.trades == s.trades);
+    for (size_t p = 0; p < std::size(kProducts); ++p) {
+        // the snapshot's resync, then every level as it was sent
+        const std::vector<L2Row>& rows = whole.rows[p];
+        CHECK(!rows.empty() && (rows[0].side & ROW_MARKER) && rows[0].price == MARK_RESYNC);
+        std::vector<Level> got;
+        size_t markers = 0;
+        for (const L2Row& r : rows) {
+            if (r.side & ROW_MARKER) {
+                ++markers;
+                continue;
+            }
+            got.push_back({r.ts_ns, r.qty, r.price, (r.side & SIDE_BID) != 0});
+        }
+        CHECK(markers == 1);
+        CHECK(got == s.levels[p]);
+    }
+    for (bool pipeline : {false, true}) {
+        for (bool fragmented : {false, true}) {
+            if (!pipeline && !fragmented) {
+                continue;
+            }
+            const Run r = run(s, pipeline, fragmented);
+            CHECK(r.trades == s.trades);
+            for (size_t p = 0; p < std::size(kProducts); ++p) {
+                CHECK(same_rows(r.rows[p], whole.rows[p]));
+            }
+        }
+    }
+}
+
+// a level2 message of one product at the given sequence number
+static std::string update(uint64_t seq, uint64_t ms) {
+    const uint64_t ts = (kHour + 60) * 1'000'000'000ull + ms * 1'000'000;
+    return head("l2_data", ts, seq) + R"({"type":")" + (ms ? "update" : "snapshot") +
+        R"(","product_id":"BTC-USD","updates":[{"side":"bid","event_time":")" + iso(ts) +
+        R"(","price_level":"100.00","new_quantity":"1.00000000"}]}]})";
+}
+
+static bool well_formed(std::string_view r, size_t k) {
+    static const char* const kTypes[] = {"unsubscribe", "subscribe"};
+    static const char* const kChannels[] = {"level2", "level2", "market_trades", "market_trades"};
+    return r == std::string(R"({"type":")") + kTypes[k % 2] +
+        R"(","product_ids":["BTC-USD","ETH-USD","SOL-USD"],"channel":")" + kChannels[k % 4] + R"("})";
+}
+
+// each gap takes four requests with trades on, the fifth finds every slot waiting and is dropped
+static void check_requests_full() {
+    std::unique_ptr<CoinbaseFeed> feed = make_feed(test_dir("fragments_requests"), false);
+    feed->start_writers();
+    for (uint64_t seq : {0, 2, 4, 6, 8, 10}) {
+        const std::string m = update(seq, seq);
+        feed->handle_fragment(0, m.data(), m.size(), true, true);
+    }
+    CHECK(feed->seq_gaps() == 5);
+    CHECK(feed->pending_requests(0) == 16);
+    size_t bad = 0;
+    for (size_t i = 0; i < feed->pending_requests(0); ++i) {
+        bad += !well_formed(feed->pending_request(0, i), i);
+    }
+    CHECK(bad == 0);
+    feed->join();
+}
+
+// requests are framed on the event loop, the parser thread only flags a gap for it. a leg going
+// down drops what it had waiting, the requests after it are framed in the same slots, wrapping
+static void check_requests_reused() {
+    std::unique_ptr<CoinbaseFeed> feed = make_feed(test_dir("fragments_requests_reused"), true);
+    feed->start_writers();
+    feed->start_parser();
+    uint64_t seq = 0;
+    auto send = [&](uint64_t skip) {
+        seq += skip;
+        const std::string m = update(seq, seq);
+        ++seq;
+        feed->push_fragment(0, m.data(), m.size(), true, true);
+    };
+    // until the loop has framed the gap's resubscribe. a message with no sequence_num to check
+    // hands it the flag without making another gap
+    static constexpr char kNudge[] = R"({"channel":"heartbeats","client_id":"","events":[]})";
+    auto gaps = [&](size_t n) {
+        send(0);
+        for (size_t g = 0; g < n; ++g) {
+            const size_t before = feed->pending_requests(0);
+            send(2);
+            while (feed->pending_requests(0) == before) {
+                feed->push_fragment(0, kNudge, sizeof(kNudge) - 1, true, true);
+                std::this_thread::yield();
+            }
+        }
+    };
+
+    gaps(4);
+    CHECK(feed->pending_requests(0) == 16);
+    std::set<const char*> slots;
+    size_t bad = 0;
+    for (size_t i = 0; i < feed->pending_requests(0); ++i) {
+        const std::string_view r = feed->pending_request(0, i);
+        bad += !well_formed(r, i);
+        slots.insert(r.data());
+    }
+    CHECK(bad == 0);
+    CHECK(slots.size() == 16);
+
+    feed->push_leg_down(0);
+    CHECK(feed->pending_requests(0) == 0);
+    seq = 0;
+    gaps(3);
+    feed->finish_parser();
+    feed->join();
+    CHECK(feed->seq_gaps() == 7);
+    CHECK(feed->pending_requests(0) == 12);
+    for (size_t i = 0; i < feed->pending_requests(0); ++i) {
+        const std::string_view r = feed->pending_request(0, i);
+        bad += !well_formed(r, i) || !slots.count(r.data());
+    }
+    CHECK(bad == 0);
+}
+
+int main() {
+    check_fragments();
+    check_requests_full();
+    check_requests_reused();
+    return check_result();
+}
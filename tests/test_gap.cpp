@@ -0,0 +1,199 @@
+// sequence gaps: a jump in sequence_num gives every product with a complete book a gap marker at
+// its last level and resubscribes the leg, a second jump before the snapshots return marks nothing
+// more, the snapshots are recorded as resyncs, and a leg that goes down marks its products and
+// starts counting again. all of it once with the callbacks parsing and once through the pipelined
+// parser thread
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../coinbase_feed.h"
+#include "../l2_reader.h"
+#include "check.h"
+
+static constexpr uint64_t kHour = 1'675'972'800ull;
+static constexpr L2Decimals kDecimals{2, 8};
+static const std::vector<std::string> kProducts = {"BTC-USD", "ETH-USD", "SOL-USD"};
+
+static std::string fixed(uint64_t v, uint8_t decimals) {
+    char buf[32];
+    l2_format_fixed(buf, sizeof(buf), static_cast<int64_t>(v), decimals);
+    return buf;
+}
+
+static std::string iso(uint64_t ns) {
+    const time_t t = static_cast<time_t>(ns / 1'000'000'000ull);
+    struct tm g{};
+    gmtime_r(&t, &g);
+    char buf[40];
+    std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &g);
+    char frac[16];
+    std::snprintf(frac, sizeof(frac), ".%06luZ", static_cast<unsigned long>(ns % 1'000'000'000ull / 1000));
+    return std::string(buf) + frac;
+}
+
+// ms into the test hour
+static uint64_t at(uint64_t ms) { return kHour * 1'000'000'000ull + ms * 1'000'000ull; }
+
+// one leg, driven either through handle_fragment or through the frame ring
+struct Feed {
+    std::string dir;
+    bool pipelined;
+    std::unique_ptr<CoinbaseFeed> feed;
+    uint64_t seq{0};
+
+    Feed(const char* name, bool pipeline) : dir(test_dir(name)), pipelined(pipeline) {
+        Config cfg;
+        cfg.base_dir = dir;
+        cfg.lookup_increments = false;
+        cfg.pipeline = pipeline;
+        cfg.products = kProducts;
+        for (const auto& p : kProducts) {
+            cfg.decimals[p] = kDecimals;
+        }
+        feed = std::make_unique<CoinbaseFeed>(cfg);
+        feed->start_writers();
+        if (pipelined) {
+            feed->start_parser();
+        }
+    }
+
+    // n levels of the product from px up at ts, in a message that skips `skip` sequence numbers
+    void send(const char* product, const char* type, uint64_t ts, uint64_t px, size_t n, uint64_t skip = 0) {
+        seq += skip;
+        std::string m = std::string(R"({"channel":"l2_data","client_id":"","timestamp":")") + iso(ts) +
+            R"(","sequence_num":)" + std::to_string(seq++) + R"(,"events":[{"type":")" + type +
+            R"(","product_id":")" + product + R"(","updates":[)";
+        for (size_t i = 0; i < n; ++i) {
+            m += std::string(i ? "," : "") + R"({"side":")" + (i % 2 ? "offer" : "bid") + R"(","event_time":")" +
+                iso(ts) + R"(","price_level":")" + fixed(px + i, kDecimals.price) + R"(","new_quantity":")" +
+                fixed(100 + i, kDecimals.qty) + R"("})";
+        }
+        m += "]}]}";
+        if (pipelined) {
+            feed->push_fragment(0, m.data(), m.size(), true, true);
+        }
+        else {
+            feed->handle_fragment(0, m.data(), m.size(), true, true);
+        }
+    }
+
+    void leg_down() {
+        if (pipelined) {
+            feed->push_leg_down(0);
+        }
+        else {
+            feed->handle_leg_down(0);
+        }
+        seq = 0;
+    }
+
+    void finish() {
+        if (pipelined) {
+            feed->finish_parser();
+        }
+        feed->join();
+    }
+
+    // the product's markers in order, 'R' resync and 'G' gap, with the ts of each gap, and its
+    // level rows
+    std::string markers(const char* product, std::vector<uint64_t>& gap_ts, uint64_t& levels) const {
+        std::string out;
+        levels = 0;
+        L2HourFile f;
+        if (!f.open(l2col_hour_path(dir + "/" + product, kHour))) {
+            return "none";
+        }
+        for (uint64_t i = 0; i < f.rows(); ++i) {
+            const L2Row r = f.row(i);
+            if (r.side & ROW_CHECKPOINT) {
+                continue;
+            }
+            if (!(r.side & ROW_MARKER)) {
+                ++levels;
+            }
+            else if (r.price == MARK_RESYNC) {
+                out += 'R';
+            }
+            else if (r.price == MARK_GAP) {
+                out += 'G';
+                gap_ts.push_back(r.ts_ns);
+            }
+        }
+        return out;
+    }
+};
+
+static void check_gaps(bool pipeline) {
+    Feed f(pipeline ? "gap_pipelined" : "gap_direct", pipeline);
+    f.send("BTC-USD", "snapshot", at(1), 10000, 4);
+    f.send("ETH-USD", "snapshot", at(2), 20000, 4);
+    f.send("BTC-USD", "update", at(3), 10001, 1);
+    f.send("ETH-USD", "update", at(4), 20001, 2);
+    // two messages lost: both books get a gap at their last level, SOL-USD never had one
+    f.send("BTC-USD", "update", at(5), 10002, 1, 2);
+    f.send("ETH-USD", "update", at(6), 20002, 1);
+    // lost again before the snapshots came back, nothing more to mark
+    f.send("BTC-USD", "update", at(7), 10003, 1, 1);
+    f.send("BTC-USD", "snapshot", at(8), 10000, 3);
+    f.send("ETH-USD", "snapshot", at(9), 20000, 3);
+    f.finish();
+
+    CHECK(f.feed->seq_gaps() == 2);
+    // each gap unsubscribes and subscribes level2 again, for every product. the parser thread only
+    // raises a flag for the loop, two gaps before the loop sees it take one resubscribe
+    const size_t requests = f.feed->pending_requests(0);
+    CHECK(requests == 4 || (pipeline && requests == 2));
+    for (size_t i = 0; i < requests && i < 4; ++i) {
+        const std::string_view r = f.feed->pending_request(0, i);
+        CHECK(r.find(i % 2 ? R"("type":"subscribe")" : R"("type":"unsubscribe")") != std::string_view::npos);
+        CHECK(r.find(R"("channel":"level2")") != std::string_view::npos);
+        for (const auto& p : kProducts) {
+            CHECK(r.find('"' + p + '"') != std::string_view::npos);
+        }
+    }
+
+    std::vector<uint64_t> gaps;
+    uint64_t levels = 0;
+    CHECK(f.markers("BTC-USD", gaps, levels) == "RGR");
+    CHECK(levels == 4 + 1 + 1 + 1 + 3);
+    CHECK(gaps.size() == 1 && gaps[0] == at(3));
+    gaps.clear();
+    CHECK(f.markers("ETH-USD", gaps, levels) == "RGR");
+    CHECK(levels == 4 + 2 + 1 + 3);
+    CHECK(gaps.size() == 1 && gaps[0] == at(4));
+    CHECK(f.markers("SOL-USD", gaps, levels) == "none");
+}
+
+// a leg going down drops its pending requests, marks its books and starts the sequence over
+static void check_leg_down(bool pipeline) {
+    Feed f(pipeline ? "gap_down_pipelined" : "gap_down_direct", pipeline);
+    f.send("BTC-USD", "snapshot", at(1), 10000, 4);
+    f.send("ETH-USD", "snapshot", at(2), 20000, 4);
+    f.send("BTC-USD", "update", at(3), 10001, 1);
+    f.leg_down();
+    f.send("BTC-USD", "snapshot", at(10), 10000, 2);
+    f.send("BTC-USD", "update", at(11), 10005, 1);
+    f.finish();
+
+    CHECK(f.feed->seq_gaps() == 0);
+    CHECK(f.feed->pending_requests(0) == 0);
+    std::vector<uint64_t> gaps;
+    uint64_t levels = 0;
+    CHECK(f.markers("BTC-USD", gaps, levels) == "RGR");
+    CHECK(levels == 4 + 1 + 2 + 1);
+    CHECK(gaps.size() == 1 && gaps[0] == at(3));
+    gaps.clear();
+    CHECK(f.markers("ETH-USD", gaps, levels) == "RG");
+    CHECK(gaps.size() == 1 && gaps[0] == at(2));
+}
+
+int main() {
+    for (bool pipeline : {false, true}) {
+        check_gaps(pipeline);
+        check_leg_down(pipeline);
+    }
+    return check_result();
+}
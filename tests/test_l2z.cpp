@@ -0,0 +1,130 @@
+// l2z round trip: an hour written by L2Writer, with markers, checkpoints and several extents, is
+// compacted both directly and by L2Compactor, and every decoded row must equal the raw hour's
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+#include "../l2_compact.h"
+#include "../l2_reader.h"
+#include "../l2_writer.h"
+#include "check.h"
+
+static constexpr uint64_t kHourS = 1'700'000'000ull / 3600 * 3600;
+
+static void write_hour(const std::string& dir, size_t rows, L2Compactor* compactor) {
+    L2WriterOpt opt{dir, "TEST-USD"};
+    // small extents so the hour spans several
+    opt.initial_rows_per_hr = 1u << 16;
+    opt.min_rows_per_hr = 1u << 16;
+    opt.max_extent_rows = 1u << 16;
+    opt.checkpoint_every_rows = 40'000;
+    opt.checkpoint_every_s = 0;
+    opt.prepare_ahead_s = 0;
+    opt.compactor = compactor;
+    L2Writer w(opt);
+    w.start();
+
+    std::mt19937_64 rng(11);
+    uint64_t ts = kHourS * 1'000'000'000ull;
+    uint32_t mid = 6'000'000;
+    for (size_t i = 0; i < rows; ++i) {
+        ts += rng() % 100'000 + (i % 7 == 0 ? 0 : 1);
+        if (i % 50'000 == 25'000) {
+            while (!w.mark_gap(ts)) {
+            }
+            while (!w.mark_resync(ts)) {
+            }
+        }
+        if (rng() % 8 == 0) {
+            mid += (rng() & 1) ? 1 : -1;
+        }
+        const bool bid = rng() & 1;
+        const uint32_t px = bid ? mid - static_cast<uint32_t>(rng() % 300) : mid + static_cast<uint32_t>(rng() % 300);
+        const int64_t qty = rng() % 4 == 0 ? 0 : static_cast<int64_t>(rng() % 5'000'000'000ull);
+        const uint8_t flags = i % 50'000 >= 25'000 && i % 50'000 < 25'100 ? ROW_SNAPSHOT : 0;
+        while (!w.enqueue({ts, qty, px, static_cast<uint8_t>(bid | flags)})) {
+        }
+    }
+    w.stop();
+    w.join();
+}
+
+static void check_same(const L2HourFile& raw, const L2ZFile& z) {
+    CHECK(z.rows() == raw.rows());
+    CHECK(z.price_decimals() == raw.price_decimals());
+    CHECK(z.qty_decimals() == raw.qty_decimals());
+    CHECK(z.checkpoints().size() == raw.checkpoints().size());
+    for (size_t k = 0; k < z.checkpoints().size() && k < raw.checkpoints().size(); ++k) {
+        CHECK(z.checkpoints()[k].ts_ns == raw.checkpoints()[k].ts_ns);
+        CHECK(z.checkpoints()[k].row == raw.checkpoints()[k].row);
+    }
+    if (z.rows() != raw.rows()) {
+        return;
+    }
+    const size_t n = raw.rows();
+    std::vector<uint64_t> ts(n);
+    std::vector<uint32_t> px(n);
+    std::vector<int64_t> qty(n);
+    std::vector<uint8_t> side(n);
+    z.decode(ts.data(), px.data(), qty.data(), side.data());
+    size_t bad = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const L2Row r = raw.row(i);
+        bad += r.ts_ns != ts[i] || r.price != px[i] || r.qty != qty[i] || r.side != side[i];
+    }
+    CHECK(bad == 0);
+
+    // a block decoded on its own matches the same rows
+    uint64_t bts[L2Z_BLOCK];
+    uint32_t bpx[L2Z_BLOCK];
+    int64_t bqty[L2Z_BLOCK];
+    uint8_t bside[L2Z_BLOCK];
+    const uint32_t b = z.blocks() / 2;
+    const uint32_t m = z.decode_block(b, bts, bpx, bqty, bside);
+    CHECK(m > 0);
+    for (uint32_t i = 0; i < m; ++i) {
+        const size_t r = static_cast<size_t>(b) * L2Z_BLOCK + i;
+        CHECK(bts[i] == ts[r] && bpx[i] == px[r] && bqty[i] == qty[r] && bside[i] == side[r]);
+    }
+}
+
+int main() {
+    const size_t rows = 200'003;
+
+    // direct
+    {
+        const std::string dir = test_dir("l2z");
+        write_hour(dir, rows, nullptr);
+        const std::string raw_path = l2col_hour_path(dir, kHourS);
+        L2HourFile raw;
+        CHECK(raw.open(raw_path));
+        CHECK(raw.segments().size() > 1);
+        CHECK(raw.checkpoints().size() > 1);
+        std::string err;
+        const std::string z_path = l2z_path_for(raw_path);
+        CHECK(l2z_write(raw, z_path, err));
+        L2ZFile z;
+        CHECK(z.open(z_path));
+        CHECK(z.bytes() < raw.rows() * (8 + 4 + 8 + 1));
+        check_same(raw, z);
+    }
+
+    // handed over by the writer when the hour closes, the raw file is kept to compare against
+    {
+        const std::string dir = test_dir("l2z_compactor");
+        L2Compactor c(false);
+        c.start();
+        write_hour(dir, rows, &c);
+        c.stop();
+        c.join();
+        CHECK(c.compacted() == 1);
+        CHECK(c.failed() == 0);
+        const std::string raw_path = l2col_hour_path(dir, kHourS);
+        L2HourFile raw;
+        CHECK(raw.open(raw_path));
+        L2ZFile z;
+        CHECK(z.open(l2z_path_for(raw_path)));
+        check_same(raw, z);
+    }
+    return check_result();
+}
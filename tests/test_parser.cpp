@@ -0,0 +1,241 @@
+// the l2 parser: every structural index kernel this cpu runs against a byte by byte reference on
+// random buffers at every length up to a few vectors and at every start offset, then messages of
+// several events, wanted and not, parsed whole and fed in fragments split at every byte or at
+// random, with each kernel. the events and levels handed out must be the ones the message was
+// built from
+#include <cstdio>
+#include <ctime>
+#include <random>
+#include <string>
+#include <vector>
+#include "../l2_parser.h"
+#include "../l2_writer.h"
+#include "check.h"
+
+static constexpr uint64_t kHour = 1'675'972'800ull;
+
+static size_t reference_index(const char* buf, size_t len, uint32_t* out) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; ++i) {
+        const char c = buf[i];
+        if (c == '"' || c == '{' || c == '}' || c == '[' || c == ']') {
+            out[n++] = static_cast<uint32_t>(i);
+        }
+    }
+    return n;
+}
+
+static void check_index() {
+    const auto kernels = struct_index_kernels();
+    CHECK(!kernels.empty() && std::string(kernels.front().name) == "swar");
+    CHECK(std::string(select_struct_index().name) == kernels.back().name);
+    std::mt19937_64 rng(12);
+    // structural characters, the bytes next to them and the same with the high bit set
+    static constexpr char kBytes[] = {'"', '{', '}', '[', ']', '!', '#', 'z', '|', '~', 'Z', '\\', ':', ',',
+                                      '0', ' ', '\x80', '\xa2', '\xdb', '\xdd', '\xfb', '\xfd'};
+    std::vector<size_t> lengths;
+    for (size_t n = 0; n <= 200; ++n) {
+        lengths.push_back(n);
+    }
+    for (size_t n : {511ul, 4096ul, 9001ul}) {
+        lengths.push_back(n);
+    }
+    std::vector<char> buf(9001 + 8);
+    std::vector<uint32_t> want(buf.size() + 64);
+    std::vector<uint32_t> got(buf.size() + 64);
+    size_t bad = 0;
+    for (size_t n : lengths) {
+        for (size_t off = 0; off < 4; ++off) {
+            // sparse and dense runs of structure
+            const uint64_t density = rng() % 4;
+            for (size_t i = 0; i < n; ++i) {
+                buf[off + i] = rng() % 4 < density ? kBytes[rng() % 5] : kBytes[rng() % std::size(kBytes)];
+            }
+            const size_t count = reference_index(buf.data() + off, n, want.data());
+            for (const auto& k : kernels) {
+                const size_t c = k.fn(buf.data() + off, n, got.data());
+                bad += c != count || !std::equal(want.begin(), want.begin() + count, got.begin());
+            }
+        }
+    }
+    CHECK(bad == 0);
+}
+
+static std::string fixed(int64_t v, uint8_t decimals) {
+    char buf[32];
+    l2_format_fixed(buf, sizeof(buf), v, decimals);
+    return buf;
+}
+
+static std::string iso(uint64_t ns) {
+    const time_t t = static_cast<time_t>(ns / 1'000'000'000ull);
+    struct tm g{};
+    gmtime_r(&t, &g);
+    char buf[40];
+    std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &g);
+    char frac[16];
+    std::snprintf(frac, sizeof(frac), ".%06luZ", static_cast<unsigned long>(ns % 1'000'000'000ull / 1000));
+    return std::string(buf) + frac;
+}
+
+struct Product {
+    const char* id;
+    // null for a product whose levels are not wanted
+    const L2Decoder* dec;
+};
+
+struct Event {
+    std::string product;
+    bool snapshot;
+    std::string first_level;
+    uint64_t ts_ns;
+
+    bool operator==(const Event&) const = default;
+};
+
+struct Level {
+    uint64_t ts_ns;
+    int64_t qty;
+    uint32_t price;
+    bool bid;
+
+    bool operator==(const Level&) const = default;
+};
+
+struct Parsed {
+    std::vector<Event> events;
+    std::vector<Level> levels;
+
+    bool operator==(const Parsed&) const = default;
+};
+
+// {"channel":"l2_data"
+static constexpr size_t kPrefix = 20;
+
+static const L2Decoder kDec28 = l2_decoder_for(2, 8);
+static const L2Decoder kDec46 = l2_decoder_for(4, 6);
+static const Product kProducts[] = {{"BTC-USD", &kDec28}, {"ETH-USD", &kDec46}, {"DOGE-USD", nullptr}};
+
+// a message of a few events with 0 to 40 levels each, and what parsing it must give
+static std::string message(std::mt19937_64& rng, uint64_t seq, Parsed& want) {
+    std::string m = R"({"channel":"l2_data","client_id":"","timestamp":"2023-02-09T20:00:00.000001Z","sequence_num":)" +
+        std::to_string(seq) + R"(,"events":[)";
+    const size_t events = 1 + rng() % 4;
+    for (size_t e = 0; e < events; ++e) {
+        const Product& p = kProducts[rng() % std::size(kProducts)];
+        const bool snapshot = rng() % 3 == 0;
+        const size_t n = rng() % 8 == 0 ? 0 : 1 + rng() % 40;
+        m += std::string(e ? "," : "") + R"({"type":")" + (snapshot ? "snapshot" : "update") + R"(","product_id":")" +
+            p.id + R"(","updates":[)";
+        Event ev{p.id, snapshot, "", 0};
+        for (size_t i = 0; i < n; ++i) {
+            const uint64_t ts = kHour * 1'000'000'000ull + (seq * 1000 + i) * 1000;
+            const uint8_t pd = p.dec ? p.dec->price_decimals : 2;
+            const uint8_t qd = p.dec ? p.dec->qty_decimals : 8;
+            const uint32_t px = static_cast<uint32_t>(1 + rng() % 100'000'000);
+            // deletes, whole units and values with every fraction digit set
+            const int64_t qty = rng() % 5 == 0 ? 0 : static_cast<int64_t>(rng() % 1'000'000'000'000ull);
+            const bool bid = rng() & 1;
+            const std::string level = R"({"side":")" + std::string(bid ? "bid" : "offer") + R"(","event_time":")" +
+                iso(ts) + R"(","price_level":")" + fixed(px, pd) + R"(","new_quantity":")" + fixed(qty, qd) + R"("})";
+            if (i == 0) {
+                ev.first_level = level;
+                ev.ts_ns = ts;
+            }
+            m += (i ? "," : "") + level;
+            if (p.dec) {
+                want.levels.push_back({ts, qty, px, bid});
+            }
+        }
+        want.events.push_back(ev);
+        m += "]}";
+    }
+    return m + "]}";
+}
+
+// parses pieces of m in order, the pieces cut at `cuts`
+static bool feed(L2Parser& parser, const std::string& m, const std::vector<size_t>& cuts, Parsed& out) {
+    bool ok = true;
+    size_t at = 0;
+    for (size_t k = 0; k <= cuts.size(); ++k) {
+        const size_t end = k < cuts.size() ? cuts[k] : m.size();
+        ok &= parser.feed(
+            m.data() + at, end - at, k == 0, k == cuts.size(),
+            [&](const L2ParsedEvent& ev) -> const L2Decoder* {
+                out.events.push_back({std::string(ev.product, ev.product_len), ev.snapshot,
+                                      std::string(ev.first_level, ev.first_level_len), ev.ts_ns});
+                for (const auto& p : kProducts) {
+                    if (out.events.back().product == p.id) {
+                        return p.dec;
+                    }
+                }
+                return nullptr;
+            },
+            [&](const L2ParsedLevel& l) { out.levels.push_back({l.ts_ns, l.qty, l.price, l.bid}); });
+        at = end;
+    }
+    return ok;
+}
+
+static void check_messages() {
+    std::mt19937_64 rng(21);
+    size_t bad = 0;
+    size_t runs = 0;
+    for (const auto& k : struct_index_kernels()) {
+        L2Parser parser(k);
+        CHECK(std::string(parser.kernel_name()) == k.name);
+        for (uint64_t seq = 0; seq < 60; ++seq) {
+            Parsed want;
+            const std::string m = message(rng, seq, want);
+            CHECK(!want.events.empty());
+            Parsed whole;
+            bad += !feed(parser, m, {}, whole) || !(whole == want);
+
+            // one cut at every byte for the short messages, random cuts for all of them, small
+            // pieces included that hold no brace at all. the first piece holds the channel, the
+            // feed waits for the whole message when it does not
+            std::vector<std::vector<size_t>> splits;
+            if (m.size() < 1500) {
+                for (size_t c = kPrefix; c < m.size(); ++c) {
+                    splits.push_back({c});
+                }
+            }
+            for (int s = 0; s < 20; ++s) {
+                std::vector<size_t> cuts;
+                size_t at = kPrefix - 1;
+                const size_t max_piece = s % 2 ? 8 : 700;
+                while (true) {
+                    at += 1 + rng() % max_piece;
+                    if (at >= m.size()) {
+                        break;
+                    }
+                    cuts.push_back(at);
+                }
+                splits.push_back(cuts);
+            }
+            for (const auto& cuts : splits) {
+                Parsed got;
+                bad += !feed(parser, m, cuts, got) || !(got == want);
+                ++runs;
+            }
+        }
+        // not l2_data, and a first fragment too short to tell, then a message parsed as usual
+        const std::string trades = R"({"channel":"market_trades","client_id":"","events":[]})";
+        bad += parser.parse(trades.data(), trades.size(), [](const L2ParsedEvent&) { return &kDec28; },
+                            [](const L2ParsedLevel&) {});
+        Parsed want;
+        const std::string m = message(rng, 99, want);
+        Parsed got;
+        bad += feed(parser, m, {kPrefix - 1}, got);
+        got = {};
+        bad += !feed(parser, m, {kPrefix, kPrefix + 1, kPrefix + 2}, got) || !(got == want);
+    }
+    CHECK(bad == 0);
+    CHECK(runs > 0);
+}
+
+int main() {
+    check_index();
+    check_messages();
+    return check_result();
+}
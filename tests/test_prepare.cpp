@@ -0,0 +1,187 @@
+// hours prepared ahead: rows over four hours with the file thread preparing each next hour must
+// rotate by swapping files, hand a tail following the writer every row across each swap, and
+// leave hour files that read back the same as the ones a writer opening every hour itself leaves.
+// a prepared hour the stream jumps past, or never reaches before shutdown, is removed, and the
+// hours after it are opened as usual
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../l2_reader.h"
+#include "../l2_tail.h"
+#include "../l2_writer.h"
+#include "../latency_histogram.h"
+#include "check.h"
+
+static constexpr uint64_t kHour = 1'675'972'800ull;
+static constexpr uint64_t kNs = 1'000'000'000ull;
+static constexpr uint64_t kHours = 4;
+static constexpr uint64_t kRowsPerHour = 60'000;
+
+static L2WriterOpt options(const std::string& dir, uint32_t prepare_ahead_s) {
+    L2WriterOpt opt{dir, "TEST-USD"};
+    opt.initial_rows_per_hr = 1000;
+    opt.min_rows_per_hr = 1000;
+    opt.max_extent_rows = 30'000;
+    opt.checkpoint_every_rows = 25'000;
+    opt.checkpoint_every_s = 0;
+    opt.prepare_ahead_s = prepare_ahead_s;
+    opt.prefault_rows = 4096;
+    return opt;
+}
+
+// a row every 50 ms from 10 minutes into each hour to its end
+static L2Row row(uint64_t i) {
+    const uint64_t h = i / kRowsPerHour;
+    const uint64_t ts = (kHour + h * 3600 + 600) * kNs + i % kRowsPerHour * 50'000'000;
+    return L2Row{ts, static_cast<int64_t>(1 + i % 31), static_cast<uint32_t>(2000 + i % 150),
+                 static_cast<uint8_t>(i & 1)};
+}
+
+struct Seen {
+    uint64_t hour_s;
+    L2Row row;
+};
+
+static std::vector<Seen> from_files(const std::string& dir) {
+    std::vector<Seen> out;
+    for (uint64_t h = 0; h < kHours; ++h) {
+        L2HourFile f;
+        CHECK(f.open(l2col_hour_path(dir, kHour + h * 3600)));
+        for (uint64_t i = 0; i < f.rows(); ++i) {
+            out.push_back({kHour + h * 3600, f.row(i)});
+        }
+    }
+    return out;
+}
+
+static bool same(const std::vector<Seen>& a, const std::vector<Seen>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        const L2Row& x = a[i].row;
+        const L2Row& y = b[i].row;
+        if (a[i].hour_s != b[i].hour_s || x.ts_ns != y.ts_ns || x.qty != y.qty || x.price != y.price ||
+            x.side != y.side) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void check_rotations() {
+    const std::string ref = test_dir("prepare_ref");
+    {
+        L2Writer w(options(ref, 0));
+        CHECK(w.mark_resync(row(0).ts_ns));
+        w.start();
+        for (uint64_t i = 0; i < kHours * kRowsPerHour; ++i) {
+            CHECK(w.enqueue(row(i)));
+        }
+        w.stop();
+        w.join();
+        CHECK(w.rotations() == kHours);
+        CHECK(w.prepared_rotations() == 0);
+    }
+
+    const std::string dir = test_dir("prepare_ahead");
+    LatencyHistogram rotate;
+    L2WriterOpt opt = options(dir, 1800);
+    opt.rotate_latency = &rotate;
+    std::vector<Seen> seen;
+    std::atomic<bool> done{false};
+    {
+        L2Writer w(opt);
+        CHECK(w.mark_resync(row(0).ts_ns));
+        w.start();
+        std::thread follower([&] {
+            L2Tail t(dir);
+            auto take = [&](const L2Segment& s) {
+                for (size_t k = 0; k < s.size(); ++k) {
+                    seen.push_back({t.hour_s(), {s.ts[k], s.qty[k], s.price[k], s.side[k]}});
+                }
+            };
+            while (!done.load()) {
+                if (!t.poll(take)) {
+                    std::this_thread::yield();
+                }
+            }
+            while (t.poll(take)) {
+            }
+        });
+        for (uint64_t i = 0; i < kHours * kRowsPerHour; ++i) {
+            CHECK(w.enqueue(row(i)));
+            if (i % 2000 == 0) {
+                // time for the file thread to prepare the next hour before the stream gets there
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+        }
+        w.stop();
+        w.join();
+        done.store(true);
+        follower.join();
+        CHECK(w.rotations() == kHours);
+        // every hour after the first was waiting when the stream got to it
+        CHECK(w.prepared_rotations() == kHours - 1);
+    }
+    CHECK(rotate.count() == kHours);
+
+    const std::vector<Seen> want = from_files(ref);
+    CHECK(want.size() > kHours * kRowsPerHour);
+    CHECK(same(from_files(dir), want));
+    CHECK(same(seen, want));
+    // nothing prepared is left behind past the last hour
+    CHECK(!std::filesystem::exists(l2col_hour_path(dir, kHour + kHours * 3600)));
+}
+
+// the stream jumps from the first hour past the prepared second one, and stops within the
+// prepare window of the hour after the last
+static void check_skip() {
+    const std::string dir = test_dir("prepare_skip");
+    L2Writer w(options(dir, 1800));
+    const uint64_t t0 = (kHour + 3000) * kNs;
+    const uint64_t t3 = (kHour + 3 * 3600 + 3000) * kNs;
+    CHECK(w.mark_resync(t0));
+    w.start();
+    auto at = [](uint64_t t, uint64_t i) {
+        return L2Row{t + i * 1'000'000, 1, static_cast<uint32_t>(100 + i % 10), static_cast<uint8_t>(i & 1)};
+    };
+    for (uint64_t i = 0; i < 20'000; ++i) {
+        CHECK(w.enqueue(at(t0, i)));
+    }
+    // until the writer has the rows, and the file thread the second hour ready
+    const std::string second = l2col_hour_path(dir, kHour + 3600);
+    for (int k = 0; k < 5000 && (w.persisted() < 20'000 || !std::filesystem::exists(second)); ++k) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(std::filesystem::exists(second));
+    for (uint64_t i = 0; i < 20'000; ++i) {
+        CHECK(w.enqueue(at(t3, i)));
+    }
+    w.stop();
+    w.join();
+    CHECK(w.rotations() == 2);
+    CHECK(w.prepared_rotations() == 0);
+
+    CHECK(!std::filesystem::exists(second));
+    CHECK(!std::filesystem::exists(l2col_hour_path(dir, kHour + 2 * 3600)));
+    CHECK(!std::filesystem::exists(l2col_hour_path(dir, kHour + 4 * 3600)));
+    for (uint64_t h : {kHour, kHour + 3 * 3600}) {
+        L2HourFile f;
+        CHECK(f.open(l2col_hour_path(dir, h)));
+        uint64_t levels = 0;
+        for (uint64_t i = 0; i < f.rows(); ++i) {
+            levels += !(f.row(i).side & (ROW_MARKER | ROW_CHECKPOINT));
+        }
+        CHECK(levels == 20'000);
+    }
+}
+
+int main() {
+    check_rotations();
+    check_skip();
+    return check_result();
+}
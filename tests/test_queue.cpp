@@ -0,0 +1,197 @@
+// batch drain: read_span over a LockFreeQueue whose ready slots wrap the end of the buffer, partial
+// commits, slots of a type with a destructor, and a producer thread against a consumer that only
+// takes spans. then the avx2 scatter kernel against the scalar one at every length up to a few
+// steps, and rows pushed through L2Writer by a producer thread while it drains in batches across
+// small extents, which must come back in order from the hour file
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../l2_reader.h"
+#include "../l2_writer.h"
+#include "../row_scatter.h"
+#include "../spsc.h"
+#include "check.h"
+
+static void check_wrap() {
+    LockFreeQueue<uint64_t, 16> q;
+    CHECK(q.capacity() == 15);
+    CHECK(q.read_span(8).empty());
+    uint64_t next_in = 0;
+    uint64_t next_out = 0;
+    size_t bad = 0;
+    size_t wrapped = 0;
+    // every head position, with every fill level
+    for (size_t lap = 0; lap < 16 * 16; ++lap) {
+        const size_t fill = lap % 16;
+        while (q.size() < fill && q.enqueue(next_in)) {
+            ++next_in;
+        }
+        bad += q.size() < fill;
+        const auto all = q.read_span(100);
+        bad += all.size() != q.size();
+        wrapped += !all.second.empty();
+        // second is only used once first runs to the end of the buffer
+        bad += !all.second.empty() && all.first.data() + all.first.size() != all.second.data() + 16;
+        const auto part = q.read_span(lap % 5);
+        bad += part.size() != std::min<size_t>(lap % 5, q.size());
+        uint64_t want = next_out;
+        for (auto run : {part.first, part.second}) {
+            for (uint64_t v : run) {
+                bad += v != want++;
+            }
+        }
+        q.commit_read(part.size());
+        next_out += part.size();
+    }
+    CHECK(bad == 0);
+    CHECK(wrapped > 16);
+    CHECK(next_out > 16 * 16);
+}
+
+// commit_read runs the destructors of the slots it releases, the queue's own those of the rest
+static void check_destroy() {
+    auto held = std::make_shared<int>(0);
+    {
+        LockFreeQueue<std::shared_ptr<int>, 8> q;
+        for (int lap = 0; lap < 3; ++lap) {
+            for (int i = 0; i < 6; ++i) {
+                CHECK(q.enqueue(held));
+            }
+            CHECK(held.use_count() == 7);
+            const auto s = q.read_span(4);
+            CHECK(s.size() == 4);
+            q.commit_read(4);
+            CHECK(held.use_count() == 3);
+            q.commit_read(q.read_span(8).size());
+            CHECK(held.use_count() == 1);
+        }
+        CHECK(q.enqueue(held));
+        CHECK(q.enqueue(held));
+    }
+    CHECK(held.use_count() == 1);
+}
+
+static void check_threads() {
+    static constexpr uint64_t kRows = 2'000'000;
+    auto q = std::make_unique<LockFreeQueue<uint64_t, 1024>>();
+    std::thread producer([&] {
+        for (uint64_t i = 0; i < kRows; ++i) {
+            while (!q->enqueue(i)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    uint64_t want = 0;
+    size_t bad = 0;
+    size_t spans = 0;
+    while (want < kRows) {
+        const auto s = q->read_span(64);
+        for (auto run : {s.first, s.second}) {
+            for (uint64_t v : run) {
+                bad += v != want++;
+            }
+        }
+        spans += !s.empty();
+        q->commit_read(s.size());
+        if (s.empty()) {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    CHECK(bad == 0);
+    CHECK(q->empty());
+    CHECK(spans > 0 && spans < kRows);
+}
+
+static void check_scatter() {
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx2")) {
+        std::printf("no avx2 on this cpu, scatter comparison skipped\n");
+        return;
+    }
+    std::mt19937_64 rng(2);
+    std::vector<L2Row> rows(1000 + 3);
+    for (auto& r : rows) {
+        r = {rng(), static_cast<int64_t>(rng()), static_cast<uint32_t>(rng()), static_cast<uint8_t>(rng())};
+    }
+    size_t bad = 0;
+    for (size_t n = 0; n <= 1000; n = n < 40 ? n + 1 : n + 240) {
+        for (size_t off : {0ul, 1ul, 3ul}) {
+            // one spare slot past the end catches a store out of bounds
+            std::vector<uint64_t> ts[2] = {std::vector<uint64_t>(n + 1, 7), std::vector<uint64_t>(n + 1, 7)};
+            std::vector<uint32_t> px[2] = {std::vector<uint32_t>(n + 1, 7), std::vector<uint32_t>(n + 1, 7)};
+            std::vector<int64_t> qty[2] = {std::vector<int64_t>(n + 1, 7), std::vector<int64_t>(n + 1, 7)};
+            std::vector<uint8_t> side[2] = {std::vector<uint8_t>(n + 1, 7), std::vector<uint8_t>(n + 1, 7)};
+            scatter_rows_scalar(rows.data() + off, n, ts[0].data(), px[0].data(), qty[0].data(), side[0].data());
+            scatter_rows_avx2(rows.data() + off, n, ts[1].data(), px[1].data(), qty[1].data(), side[1].data());
+            bad += ts[0] != ts[1] || px[0] != px[1] || qty[0] != qty[1] || side[0] != side[1];
+            for (size_t i = 0; i < n; ++i) {
+                const L2Row& r = rows[off + i];
+                bad += ts[0][i] != r.ts_ns || px[0][i] != r.price || qty[0][i] != r.qty || side[0][i] != r.side;
+            }
+            bad += ts[1][n] != 7 || px[1][n] != 7 || qty[1][n] != 7 || side[1][n] != 7;
+        }
+    }
+    CHECK(bad == 0);
+}
+
+static void check_writer() {
+    static constexpr uint64_t kHour = 1'675'972'800ull;
+    static constexpr uint64_t kRows = 600'000;
+    const std::string dir = test_dir("queue_writer");
+    L2WriterOpt opt{dir, "TEST-USD"};
+    opt.initial_rows_per_hr = 1000;
+    opt.min_rows_per_hr = 1000;
+    opt.max_extent_rows = 50'000;
+    opt.checkpoint_every_s = 0;
+    opt.prepare_ahead_s = 0;
+    auto row = [](uint64_t i) {
+        return L2Row{kHour * 1'000'000'000ull + i * 1000, static_cast<int64_t>(i % 97),
+                     static_cast<uint32_t>(100'000 + i % 5000), static_cast<uint8_t>(i % 2)};
+    };
+    {
+        L2Writer w(opt);
+        w.start();
+        // more rows than the queue holds, so the writer's spans wrap its end many times. a writer
+        // that falls behind spills the rest, which keeps them in order as well
+        std::thread producer([&] {
+            for (uint64_t i = 0; i < kRows; ++i) {
+                CHECK(w.enqueue(row(i)));
+                if (i % 4096 == 0) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        producer.join();
+        w.stop();
+        w.join();
+    }
+    L2HourFile f;
+    CHECK(f.open(l2col_hour_path(dir, kHour)));
+    CHECK(f.segments().size() > 3);
+    uint64_t i = 0;
+    size_t bad = 0;
+    for (uint64_t k = 0; k < f.rows(); ++k) {
+        const L2Row r = f.row(k);
+        if (r.side & (ROW_CHECKPOINT | ROW_MARKER)) {
+            continue;
+        }
+        const L2Row want = row(i++);
+        bad += r.ts_ns != want.ts_ns || r.qty != want.qty || r.price != want.price || r.side != want.side;
+    }
+    CHECK(i == kRows);
+    CHECK(bad == 0);
+}
+
+int main() {
+    check_wrap();
+    check_destroy();
+    check_threads();
+    check_scatter();
+    check_writer();
+    return check_result();
+}
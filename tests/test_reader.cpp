@@ -0,0 +1,251 @@
+// the hour file reader: an hour spread over many extents with runs of equal timestamps, where
+// lower_bound, range, for_each_segment and checkpoint_before must agree with a linear scan at every
+// row's ts and around it, l2_scan over a window with a missing hour, and files that are not hour
+// files or lost part of their columns, which must fail to open with a reason instead of being
+// mapped. a file that only lost part of its checkpoint index opens without one
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+#include "../l2_reader.h"
+#include "../l2_writer.h"
+#include "check.h"
+
+static constexpr uint64_t kHour = 1'675'972'800ull;
+static constexpr uint64_t kNs = 1'000'000'000ull;
+
+// rows of hour 0 and hour 2, hour 1 is never written. ts steps by 0 to 3 ms, so runs of equal ts
+static void write_hours(const std::string& dir) {
+    L2WriterOpt opt{dir, "TEST-USD"};
+    opt.initial_rows_per_hr = 1000;
+    opt.min_rows_per_hr = 1000;
+    opt.max_extent_rows = 4000;
+    opt.checkpoint_every_rows = 5000;
+    opt.checkpoint_every_s = 0;
+    opt.prepare_ahead_s = 0;
+    L2Writer w(opt);
+    std::mt19937_64 rng(9);
+    uint64_t ts = kHour * kNs + 5 * kNs;
+    (void)w.mark_resync(ts);
+    for (uint64_t i = 0; i < 40'000; ++i) {
+        if (i == 30'000) {
+            ts = (kHour + 2 * 3600) * kNs + 7 * kNs;
+        }
+        ts += rng() % 4 * 1'000'000;
+        CHECK(w.enqueue({ts, static_cast<int64_t>(rng() % 50), static_cast<uint32_t>(1000 + rng() % 300),
+                         static_cast<uint8_t>(rng() & 1)}));
+    }
+    w.start();
+    w.stop();
+    w.join();
+}
+
+static uint64_t linear_lower_bound(const L2HourFile& f, uint64_t ts) {
+    uint64_t i = 0;
+    while (i < f.rows() && f.ts(i) < ts) {
+        ++i;
+    }
+    return i;
+}
+
+static void check_hour(const L2HourFile& f, std::mt19937_64& rng) {
+    // the segments tile the hour and hand out the same rows as row() and ts()
+    uint64_t next = 0;
+    size_t bad = 0;
+    for (const auto& s : f.segments()) {
+        bad += s.row_base != next;
+        bad += s.price.size() != s.size() || s.qty.size() != s.size() || s.side.size() != s.size();
+        for (size_t k = 0; k < s.size(); k += 7) {
+            const L2Row r = f.row(s.row_base + k);
+            bad += r.ts_ns != s.ts[k] || r.price != s.price[k] || r.qty != s.qty[k] || r.side != s.side[k];
+            bad += f.ts(s.row_base + k) != s.ts[k];
+        }
+        next += s.size();
+    }
+    CHECK(next == f.rows());
+    CHECK(bad == 0);
+
+    // every row's ts, one past it and one before it, and past both ends
+    std::vector<uint64_t> probes = {0, f.ts(0), f.ts(f.rows() - 1) + 1, ~0ull};
+    for (uint64_t i = 0; i < f.rows(); i += 1 + rng() % 50) {
+        probes.push_back(f.ts(i));
+        probes.push_back(f.ts(i) + 1);
+        probes.push_back(f.ts(i) - 1);
+    }
+    std::vector<uint64_t> want(probes.size());
+    {
+        // one pass over the sorted probes stands in for a linear scan per probe
+        std::vector<size_t> order(probes.size());
+        for (size_t k = 0; k < order.size(); ++k) {
+            order[k] = k;
+        }
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return probes[a] < probes[b]; });
+        uint64_t i = 0;
+        for (size_t k : order) {
+            while (i < f.rows() && f.ts(i) < probes[k]) {
+                ++i;
+            }
+            want[k] = i;
+        }
+    }
+    size_t bad_bound = 0;
+    for (size_t k = 0; k < probes.size(); ++k) {
+        bad_bound += f.lower_bound(probes[k]) != want[k];
+    }
+    CHECK(bad_bound == 0);
+    CHECK(f.lower_bound(f.ts(f.rows() / 2)) == linear_lower_bound(f, f.ts(f.rows() / 2)));
+
+    // ranges, and the segment pieces for_each_segment hands out for them
+    size_t bad_range = 0;
+    for (int k = 0; k < 200; ++k) {
+        uint64_t t0 = probes[rng() % probes.size()];
+        uint64_t t1 = probes[rng() % probes.size()];
+        const auto [r0, r1] = f.range(t0, t1);
+        if (t1 <= t0) {
+            bad_range += r0 != 0 || r1 != 0;
+            continue;
+        }
+        bad_range += r0 != f.lower_bound(t0) || r1 != std::max(r0, f.lower_bound(t1));
+        uint64_t at = r0;
+        f.for_each_segment(r0, r1, [&](const L2Segment& s) {
+            bad_range += s.row_base != at || s.size() == 0;
+            for (size_t j = 0; j < s.size(); ++j) {
+                bad_range += s.ts[j] != f.ts(at + j) || s.ts[j] < t0 || s.ts[j] >= t1;
+            }
+            at += s.size();
+        });
+        bad_range += at != r1;
+    }
+    CHECK(bad_range == 0);
+
+    // the checkpoint index against the rows it points at
+    CHECK(!f.checkpoints().empty());
+    size_t bad_ckpt = 0;
+    for (const auto& c : f.checkpoints()) {
+        const L2Row r = f.row(c.row);
+        bad_ckpt += !(r.side & ROW_MARKER) || r.price != MARK_CHECKPOINT || r.ts_ns != c.ts_ns;
+    }
+    for (uint64_t ts : probes) {
+        L2CkptEntry e{};
+        const bool got = f.checkpoint_before(ts, e);
+        const L2CkptEntry* last = nullptr;
+        for (const auto& c : f.checkpoints()) {
+            if (c.ts_ns <= ts) {
+                last = &c;
+            }
+        }
+        bad_ckpt += got != (last != nullptr) || (got && (e.row != last->row || e.ts_ns != last->ts_ns));
+    }
+    CHECK(bad_ckpt == 0);
+}
+
+static void check_ranges() {
+    const std::string dir = test_dir("reader_ranges");
+    write_hours(dir);
+    std::mt19937_64 rng(90);
+    for (uint64_t h : {kHour, kHour + 2 * 3600}) {
+        L2HourFile f;
+        CHECK(f.open(l2col_hour_path(dir, h)));
+        CHECK(f.hour_s() == h);
+        // hour 2 starts with an extent sized from hour 0, it holds the whole hour
+        CHECK(f.segments().size() > (h == kHour ? 5u : 0u));
+        // spans point into the mapping, a move hands them over as they are
+        L2HourFile g(std::move(f));
+        CHECK(!f.is_open());
+        CHECK(g.is_open());
+        check_hour(g, rng);
+    }
+
+    // a window from the middle of hour 0's rows to the middle of hour 2's: two files, the missing
+    // hour is skipped, and the rows handed out are the ones in the window
+    const uint64_t t0 = (kHour + 30) * kNs;
+    const uint64_t t1 = (kHour + 2 * 3600 + 20) * kNs;
+    uint64_t rows = 0;
+    std::vector<uint64_t> hours;
+    const size_t visited = l2_scan(dir, t0, t1, [&](const L2HourFile& f, uint64_t r0, uint64_t r1) {
+        hours.push_back(f.hour_s());
+        rows += r1 - r0;
+        CHECK(r0 < r1);
+        CHECK(f.ts(r0) >= t0 && f.ts(r1 - 1) < t1);
+    });
+    uint64_t want = 0;
+    for (uint64_t h : {kHour, kHour + 2 * 3600}) {
+        L2HourFile f;
+        CHECK(f.open(l2col_hour_path(dir, h)));
+        for (uint64_t i = 0; i < f.rows(); ++i) {
+            want += f.ts(i) >= t0 && f.ts(i) < t1;
+        }
+    }
+    CHECK(visited == 2);
+    CHECK((hours == std::vector<uint64_t>{kHour, kHour + 2 * 3600}));
+    CHECK(rows == want);
+    CHECK(rows > 0);
+    CHECK(l2_scan(dir, t1, t0, [](const L2HourFile&, uint64_t, uint64_t) {}) == 0);
+}
+
+static void copy_prefix(const std::string& from, const std::string& to, uint64_t bytes) {
+    std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing);
+    std::filesystem::resize_file(to, bytes);
+}
+
+// a file that cannot be an hour file is refused with a reason, and the reader opens a good one
+// afterwards
+static void check_bad() {
+    const std::string dir = test_dir("reader_bad");
+    write_hours(dir);
+    const std::string good = l2col_hour_path(dir, kHour);
+    const uint64_t size = std::filesystem::file_size(good);
+    const std::string bad = dir + "/bad.bin";
+
+    L2HourFile f;
+    auto refused = [&](const std::string& path) {
+        const bool opened = f.open(path);
+        const bool ok = !opened && !f.is_open() && !f.error().empty();
+        f.close();
+        return ok;
+    };
+    CHECK(refused(dir + "/missing.bin"));
+    copy_prefix(good, bad, 0);
+    CHECK(refused(bad));
+    copy_prefix(good, bad, 100);
+    CHECK(refused(bad));
+    // the header is whole, the columns are not
+    copy_prefix(good, bad, size / 2);
+    CHECK(refused(bad));
+    // the last column short by a byte, and the index after it
+    uint64_t index_bytes = 0;
+    {
+        L2HourFile g;
+        CHECK(g.open(good));
+        index_bytes = g.checkpoints().size() * sizeof(L2CkptEntry);
+        CHECK(index_bytes > 0);
+    }
+    copy_prefix(good, bad, size - index_bytes - alignof(L2CkptEntry));
+    CHECK(refused(bad));
+    // only the index cut short: the rows are all there, the checkpoints are left to a scan
+    copy_prefix(good, bad, size - 1);
+    CHECK(f.open(bad));
+    CHECK(f.checkpoints().empty());
+    f.close();
+
+    // another magic
+    copy_prefix(good, bad, size);
+    const int fd = ::open(bad.c_str(), O_WRONLY);
+    CHECK(fd >= 0);
+    CHECK(::pwrite(fd, "NOTHR\n", 6, 0) == 6);
+    ::close(fd);
+    CHECK(refused(bad));
+
+    CHECK(f.open(good));
+    CHECK(f.rows() > 0);
+    CHECK(f.error().empty() || f.is_open());
+}
+
+int main() {
+    check_ranges();
+    check_bad();
+    return check_result();
+}
@@ -0,0 +1,180 @@
+// journal replay: l2_data messages go through a feed in random fragments, each fragment also into a
+// FrameJournal the way the event loop hands it over. l2_replay (argv[1]) then decodes the journal
+// again, and its hour files must hold the same level and marker rows as the recorded ones.
+// checkpoints are left out of the comparison, the writer checks for a due one after each batch it
+// takes from its queue, so where they fall depends on thread timing
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../coinbase_feed.h"
+#include "../frame_journal.h"
+#include "../l2_reader.h"
+#include "check.h"
+
+struct TestProduct {
+    const char* id;
+    L2Decimals decimals;
+    uint64_t mid;
+};
+
+static const TestProduct kProducts[] = {{"BTC-USD", {2, 8}, 2'000'000}, {"DOGE-USD", {5, 1}, 8'123}};
+
+static std::string fixed(uint64_t v, uint8_t decimals) {
+    char buf[32];
+    l2_format_fixed(buf, sizeof(buf), static_cast<int64_t>(v), decimals);
+    return buf;
+}
+
+static std::string iso(uint64_t ns) {
+    const time_t t = static_cast<time_t>(ns / 1'000'000'000ull);
+    struct tm g{};
+    gmtime_r(&t, &g);
+    char buf[40];
+    std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &g);
+    char frac[16];
+    std::snprintf(frac, sizeof(frac), ".%06luZ", static_cast<unsigned long>(ns % 1'000'000'000ull / 1000));
+    return std::string(buf) + frac;
+}
+
+// a snapshot of every product, then updates of one product each, seq counting from 0
+static std::vector<std::string> messages(uint64_t hour_s) {
+    std::mt19937_64 rng(23);
+    std::vector<std::string> out;
+    uint64_t seq = 0;
+    uint64_t ts = hour_s * 1'000'000'000ull + 5'000'000'000ull;
+    const auto head = [&](const char* type, const char* product) {
+        return std::string(R"({"channel":"l2_data","client_id":"","timestamp":")") + iso(ts) +
+            R"(","sequence_num":)" + std::to_string(seq++) + R"(,"events":[{"type":")" + type +
+            R"(","product_id":")" + product + R"(","updates":[)";
+    };
+    const auto level = [&](const TestProduct& p, bool bid, uint64_t px, uint64_t qty) {
+        return std::string(R"({"side":")") + (bid ? "bid" : "offer") + R"(","event_time":")" + iso(ts) +
+            R"(","price_level":")" + fixed(px, p.decimals.price) + R"(","new_quantity":")" +
+            fixed(qty, p.decimals.qty) + R"("})";
+    };
+    for (const auto& p : kProducts) {
+        std::string m = head("snapshot", p.id);
+        for (int i = 0; i < 400; ++i) {
+            const bool bid = i & 1;
+            if (i) {
+                m += ',';
+            }
+            m += level(p, bid, bid ? p.mid - 1 - i / 2 : p.mid + i / 2, 1 + rng() % 100'000);
+        }
+        out.push_back(m + "]}]}");
+    }
+    // a level change every few ms for ten minutes, checkpoints included
+    for (int k = 0; k < 20'000; ++k) {
+        ts += 1 + rng() % 60'000'000;
+        const auto& p = kProducts[rng() % std::size(kProducts)];
+        std::string m = head("update", p.id);
+        for (uint64_t i = 0, n = 1 + rng() % 6; i < n; ++i) {
+            const bool bid = rng() & 1;
+            const uint64_t off = rng() % 300;
+            if (i) {
+                m += ',';
+            }
+            m += level(p, bid, bid ? p.mid - 1 - off : p.mid + off, rng() % 3 ? rng() % 100'000 : 0);
+        }
+        out.push_back(m + "]}]}");
+    }
+    return out;
+}
+
+// every row but checkpoints, counted in ckpts
+static std::vector<L2Row> rows_of(const std::string& dir, uint64_t hour_s, size_t& ckpts) {
+    std::vector<L2Row> rows;
+    L2HourFile f;
+    if (!f.open(l2col_hour_path(dir, hour_s))) {
+        std::fprintf(stderr, "%s\n", f.error().c_str());
+        return rows;
+    }
+    ckpts = f.checkpoints().size();
+    for (uint64_t i = 0; i < f.rows(); ++i) {
+        L2Row r = f.row(i);
+        if ((r.side & ROW_CHECKPOINT) || ((r.side & ROW_MARKER) && r.price == MARK_CHECKPOINT)) {
+            continue;
+        }
+        // stage stamps are taken on the way through, they differ between runs
+        r.stamp[0] = r.stamp[1] = r.stamp[2] = 0;
+        rows.push_back(r);
+    }
+    return rows;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s L2_REPLAY\n", argv[0]);
+        return 1;
+    }
+    // the journal names its hour by receive time, recording must not straddle an hour
+    while (std::time(nullptr) % 3600 > 3590) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+    const uint64_t hour_s = static_cast<uint64_t>(std::time(nullptr)) / 3600 * 3600;
+    const std::string dir = test_dir("replay");
+    const std::string rec = dir + "/rec";
+    const std::vector<std::string> msgs = messages(hour_s);
+
+    {
+        Config cfg;
+        cfg.base_dir = rec;
+        cfg.lookup_increments = false;
+        FrameJournalOpt jopt;
+        jopt.dir = rec + "/journal/c0";
+        jopt.name = "c0";
+        for (const auto& p : kProducts) {
+            cfg.products.push_back(p.id);
+            cfg.decimals[p.id] = p.decimals;
+            jopt.products += std::string(jopt.products.empty() ? "" : ",") + p.id + '=' +
+                std::to_string(p.decimals.price) + ':' + std::to_string(p.decimals.qty);
+        }
+        FrameJournal journal(jopt);
+        CoinbaseFeed feed(cfg);
+        journal.start();
+        feed.start_writers();
+        std::mt19937_64 rng(7);
+        for (const auto& m : msgs) {
+            for (size_t off = 0; off < m.size();) {
+                const size_t n = std::min<size_t>(m.size() - off, 1 + rng() % 700);
+                const bool first = off == 0;
+                const bool final = off + n == m.size();
+                journal.append(0, m.data() + off, n, (first ? JRNL_FIRST : 0) | (final ? JRNL_FINAL : 0));
+                feed.handle_fragment(0, m.data() + off, n, first, final);
+                off += n;
+            }
+        }
+        CHECK(feed.messages() == msgs.size());
+        CHECK(feed.seq_gaps() == 0);
+        journal.stop();
+        journal.join();
+        feed.join();
+        CHECK(journal.lost_bytes() == 0);
+    }
+
+    const std::string cmd = std::string("'") + argv[1] + "' '" + rec + "/journal/c0' --from " +
+        std::to_string(hour_s) + " --to " + std::to_string(hour_s + 3600) + " --out '" + dir + "/replay' --threads 2";
+    CHECK(std::system(cmd.c_str()) == 0);
+
+    for (const auto& p : kProducts) {
+        size_t ckpts_a = 0;
+        size_t ckpts_b = 0;
+        const std::vector<L2Row> a = rows_of(rec + "/" + p.id, hour_s, ckpts_a);
+        const std::vector<L2Row> b = rows_of(dir + "/replay/" + p.id, hour_s, ckpts_b);
+        CHECK(a.size() > 1000);
+        CHECK(a.size() == b.size());
+        size_t bad = 0;
+        for (size_t i = 0; i < std::min(a.size(), b.size()); ++i) {
+            bad += std::memcmp(&a[i], &b[i], sizeof(L2Row)) != 0;
+        }
+        CHECK(bad == 0);
+        CHECK(ckpts_a > 1 && ckpts_b > 1);
+    }
+    return check_result();
+}
@@ -0,0 +1,145 @@
+// ByteRing: records of random sizes pushed and popped at random through many laps of a small
+// ring, so records keep landing on the end and leaving skips, then the same with a producer
+// thread. every record must come back whole and in order
+#include <deque>
+#include <random>
+#include <string>
+#include <thread>
+#include "../spsc.h"
+#include "check.h"
+
+static std::string payload(uint64_t i, size_t len) {
+    std::string s(len, '\0');
+    for (size_t k = 0; k < len; ++k) {
+        s[k] = static_cast<char>(i * 31 + k);
+    }
+    return s;
+}
+
+static bool matches(const ByteRing::Record& r, uint64_t i, const std::string& want) {
+    return r.len == want.size() && r.stamp == i && r.tag == static_cast<uint16_t>(i & 0x7fff) &&
+        r.flags == static_cast<uint16_t>(want.size()) && std::memcmp(r.data, want.data(), want.size()) == 0;
+}
+
+static size_t random_len(std::mt19937_64& rng, size_t max_payload) {
+    const uint64_t r = rng() % 100;
+    return r == 0 ? max_payload : r < 3 ? 0 : r < 10 ? rng() % (max_payload + 1) : rng() % 300;
+}
+
+static void check_laps() {
+    ByteRing ring(4096);
+    CHECK(ring.capacity() == 4096);
+    std::mt19937_64 rng(22);
+    std::deque<std::pair<uint64_t, std::string>> held;
+    uint64_t pushed = 0;
+    uint64_t bytes = 0;
+    size_t bad = 0;
+    size_t refused_empty = 0;
+    while (bytes < 400 * ring.capacity()) {
+        if (rng() % 3) {
+            const std::string s = payload(pushed, random_len(rng, ring.max_payload()));
+            if (ring.push(s.data(), s.size(), static_cast<uint16_t>(pushed & 0x7fff), static_cast<uint16_t>(s.size()),
+                          pushed)) {
+                held.emplace_back(pushed++, s);
+                bytes += s.size();
+            }
+            else {
+                // an empty ring takes any record up to max_payload, wherever its position is
+                refused_empty += held.empty();
+            }
+        }
+        else {
+            ByteRing::Record r{};
+            const bool has = ring.front(r);
+            CHECK(has == !held.empty());
+            if (has) {
+                bad += !matches(r, held.front().first, held.front().second);
+                held.pop_front();
+                ring.pop();
+            }
+        }
+        CHECK(ring.size() <= ring.capacity());
+    }
+    while (!held.empty()) {
+        ByteRing::Record r{};
+        CHECK(ring.front(r));
+        bad += !matches(r, held.front().first, held.front().second);
+        held.pop_front();
+        ring.pop();
+    }
+    CHECK(bad == 0);
+    CHECK(refused_empty == 0);
+    CHECK(ring.empty());
+    CHECK(ring.size() == 0);
+}
+
+// a record that needs exactly the bytes left before the end takes them without a skip, one byte
+// of payload more skips to the front
+static void check_end() {
+    ByteRing ring(4096);
+    ByteRing::Record r{};
+    const std::string small = payload(0, 112);
+    // leaves the ring empty 128 bytes before the end of a lap
+    const auto advance = [&] {
+        for (int i = 0; i < 31; ++i) {
+            CHECK(ring.push(small.data(), small.size(), 0, 0, i));
+        }
+        for (int i = 0; i < 31; ++i) {
+            CHECK(ring.front(r) && r.stamp == static_cast<uint64_t>(i));
+            ring.pop();
+        }
+    };
+
+    advance();
+    const std::string fits = payload(1, 112);
+    CHECK(ring.push(fits.data(), fits.size(), 1, 0, 100));
+    CHECK(ring.size() == 128);
+    CHECK(ring.front(r) && r.stamp == 100 && std::memcmp(r.data, fits.data(), fits.size()) == 0);
+    ring.pop();
+
+    advance();
+    const std::string over = payload(2, 113);
+    CHECK(ring.push(over.data(), over.size(), 2, 0, 101));
+    // the skipped bytes count as used until the record after them is popped
+    CHECK(ring.size() == 128 + 144);
+    CHECK(ring.front(r) && r.stamp == 101 && r.len == over.size());
+    CHECK(std::memcmp(r.data, over.data(), over.size()) == 0);
+    ring.pop();
+    CHECK(ring.empty());
+}
+
+static void check_threads() {
+    ByteRing ring(8192);
+    const uint64_t n = 200'000;
+    std::thread producer([&] {
+        std::mt19937_64 rng(7);
+        for (uint64_t i = 0; i < n; ++i) {
+            const std::string s = payload(i, random_len(rng, ring.max_payload()));
+            while (!ring.push(s.data(), s.size(), static_cast<uint16_t>(i & 0x7fff), static_cast<uint16_t>(s.size()),
+                              i)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    std::mt19937_64 rng(7);
+    size_t bad = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+        const std::string want = payload(i, random_len(rng, ring.max_payload()));
+        ByteRing::Record r{};
+        while (!ring.front(r)) {
+            std::this_thread::yield();
+        }
+        bad += !matches(r, i, want);
+        ring.pop();
+    }
+    producer.join();
+    CHECK(bad == 0);
+    CHECK(ring.empty());
+}
+
+int main() {
+    check_laps();
+    check_end();
+    check_threads();
+    return check_result();
+}
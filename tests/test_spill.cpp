@@ -0,0 +1,204 @@
+// spill ordering: a SpillQueue pushed and drained at random through memory and its file must give
+// every row back in push order, with each run of lost rows counted on the chunk right before it,
+// also with a producer thread against the taking one. then a writer whose queue and spill overflow
+// before it starts must persist the rows it kept in order, with a gap marker wherever rows were lost
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include "../l2_reader.h"
+#include "../l2_writer.h"
+#include "../spill.h"
+#include "check.h"
+
+static void check_queue(uint64_t file_chunks) {
+    using Q = SpillQueue<uint64_t>;
+    const std::string dir = test_dir("spill");
+    Q q(SpillOpt{dir, 2 * Q::kChunkRows, file_chunks * Q::kChunkRows * sizeof(uint64_t)});
+    std::mt19937_64 rng(24 + file_chunks);
+    Q::Chunk c;
+    uint64_t next = 0;
+    uint64_t expect = 0;
+    uint64_t kept = 0;
+    uint64_t lost = 0;
+    size_t bad = 0;
+    size_t takes = 0;
+    const auto take = [&] {
+        if (!q.take(c)) {
+            return false;
+        }
+        ++takes;
+        for (uint64_t v : c.rows) {
+            bad += v != expect;
+            expect = v + 1;
+        }
+        kept += c.rows.size();
+        // the lost rows follow the chunk's rows
+        expect += c.lost;
+        lost += c.lost;
+        return true;
+    };
+    for (int step = 0; step < 3000; ++step) {
+        if (rng() % 3) {
+            // the writer moves blocks to the file between batches of its queue, now and then
+            const uint64_t every = 1 + rng() % (2 * Q::kChunkRows);
+            for (uint64_t n = rng() % (3 * Q::kChunkRows); n; --n) {
+                (void)q.push(next++);
+                if (n % every == 0) {
+                    q.offload();
+                }
+            }
+        }
+        else {
+            for (uint64_t n = 1 + rng() % 4; n && take(); --n) {
+            }
+        }
+    }
+    while (take()) {
+    }
+    CHECK(bad == 0);
+    CHECK(!q.active());
+    CHECK(expect == next);
+    CHECK(kept + lost == next);
+    CHECK(q.spilled() == kept);
+    CHECK(q.lost() == lost);
+    CHECK(q.overflowed() == next);
+    CHECK(lost > 0);
+    CHECK(takes > 100);
+    CHECK(file_chunks ? q.spilled_to_file() > 0 : q.spilled_to_file() == 0);
+}
+
+// a producer thread pushing in bursts against a writer thread that takes, or offloads while it is
+// busy elsewhere: every row comes back once and in order, the lost ones counted where they were
+static void check_threads() {
+    using Q = SpillQueue<uint64_t>;
+    const std::string dir = test_dir("spill_threads");
+    Q q(SpillOpt{dir, 4 * Q::kChunkRows, 8 * Q::kChunkRows * sizeof(uint64_t)});
+    static constexpr uint64_t kRows = 4'000'000;
+    std::atomic<bool> done{false};
+    std::thread producer([&] {
+        std::mt19937_64 rng(5);
+        for (uint64_t v = 0; v < kRows;) {
+            for (uint64_t n = 1 + rng() % (6 * Q::kChunkRows); n && v < kRows; --n) {
+                (void)q.push(v++);
+            }
+            if (rng() % 4 == 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(rng() % 200));
+            }
+        }
+        done.store(true, std::memory_order_release);
+    });
+    std::mt19937_64 rng(6);
+    Q::Chunk c;
+    uint64_t expect = 0;
+    uint64_t kept = 0;
+    uint64_t lost = 0;
+    size_t bad = 0;
+    for (;;) {
+        const bool finished = done.load(std::memory_order_acquire);
+        if (rng() % 3 == 0) {
+            q.offload();
+            continue;
+        }
+        if (!q.take(c)) {
+            if (finished && !q.active()) {
+                break;
+            }
+            continue;
+        }
+        for (uint64_t v : c.rows) {
+            bad += v != expect;
+            expect = v + 1;
+        }
+        kept += c.rows.size();
+        expect += c.lost;
+        lost += c.lost;
+    }
+    producer.join();
+    CHECK(bad == 0);
+    CHECK(expect == kRows);
+    CHECK(kept + lost == kRows);
+    CHECK(q.spilled() == kept);
+    CHECK(q.lost() == lost);
+    CHECK(q.overflowed() == kRows);
+    CHECK(q.spilled_to_file() > 0);
+}
+
+static void check_writer() {
+    const std::string dir = test_dir("spill_writer");
+    L2WriterOpt opt{dir, "TEST-USD"};
+    opt.checkpoint_every_rows = 0;
+    opt.checkpoint_every_s = 0;
+    opt.prepare_ahead_s = 0;
+    opt.spill_rows = 4 * 4096;
+    opt.spill_file_bytes = 10ull * 4096 * sizeof(L2Row);
+    const uint64_t hour_s = 1'675'972'800ull;
+    uint64_t pushed = 0;
+    uint64_t lost = 0;
+    {
+        L2Writer w(opt);
+        const auto push = [&](uint64_t n) {
+            for (; n; --n, ++pushed) {
+                (void)w.enqueue({hour_s * 1'000'000'000ull + pushed * 1000, 1, static_cast<uint32_t>(pushed + 1),
+                                 SIDE_BID});
+            }
+        };
+        // fills the queue, then the spill's memory, and loses the rest. the file only takes rows
+        // while the writer runs
+        push((1u << 18) + 20 * 4096 + 1000);
+        CHECK(w.spilled() == 4 * 4096 + 4096);
+        CHECK(w.spill_lost() > 0);
+        w.start();
+        // whatever the writer keeps up with, the rows it persists stay in order
+        for (int r = 0; r < 100; ++r) {
+            push(5000);
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        w.stop();
+        w.join();
+        CHECK(w.persisted() == pushed - w.spill_lost() + w.gaps());
+        CHECK(w.gaps() > 0);
+        lost = w.spill_lost();
+    }
+
+    L2HourFile f;
+    CHECK(f.open(l2col_hour_path(dir, hour_s)));
+    uint64_t levels = 0;
+    uint64_t prev = 0;
+    uint64_t markers = 0;
+    size_t unmarked = 0;
+    size_t bad = 0;
+    bool gap = false;
+    for (uint64_t i = 0; i < f.rows(); ++i) {
+        const L2Row r = f.row(i);
+        if (r.side & ROW_CHECKPOINT) {
+            continue;
+        }
+        if (r.side & ROW_MARKER) {
+            if (r.price == MARK_GAP) {
+                gap = true;
+                ++markers;
+            }
+            continue;
+        }
+        ++levels;
+        bad += r.price <= prev;
+        // rows only go missing behind a gap marker
+        unmarked += r.price != prev + 1 && !gap;
+        gap = false;
+        prev = r.price;
+    }
+    CHECK(bad == 0);
+    CHECK(unmarked == 0);
+    CHECK(markers > 0);
+    CHECK(levels == pushed - lost);
+}
+
+int main() {
+    check_queue(0);
+    check_queue(3);
+    check_threads();
+    check_writer();
+    return check_result();
+}
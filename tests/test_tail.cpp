@@ -0,0 +1,150 @@
+// live tail: a tail thread follows an L2Writer while a producer pushes rows over small extents and
+// into the next hour, and must hand out every row of both hour files in order, moving on to the
+// second hour once the first is drained. a second tail that starts from the end of the rows
+// committed so far gets the rest of them, and a tail with no writer to follow finds nothing
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../l2_reader.h"
+#include "../l2_tail.h"
+#include "../l2_writer.h"
+#include "check.h"
+
+static constexpr uint64_t kHour = 1'675'972'800ull;
+static constexpr uint64_t kNs = 1'000'000'000ull;
+
+struct Seen {
+    uint64_t hour_s;
+    L2Row row;
+};
+
+static void take(const L2Tail& t, const L2Segment& s, std::vector<Seen>& out) {
+    for (size_t k = 0; k < s.size(); ++k) {
+        out.push_back({t.hour_s(), {s.ts[k], s.qty[k], s.price[k], s.side[k]}});
+    }
+}
+
+// every row of the hour files in order, checkpoints and markers included
+static std::vector<Seen> from_files(const std::string& dir) {
+    std::vector<Seen> out;
+    for (uint64_t h : {kHour, kHour + 3600}) {
+        L2HourFile f;
+        CHECK(f.open(l2col_hour_path(dir, h)));
+        for (uint64_t i = 0; i < f.rows(); ++i) {
+            out.push_back({h, f.row(i)});
+        }
+    }
+    return out;
+}
+
+static bool same(const std::vector<Seen>& a, const std::vector<Seen>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        const L2Row& x = a[i].row;
+        const L2Row& y = b[i].row;
+        if (a[i].hour_s != b[i].hour_s || x.ts_ns != y.ts_ns || x.qty != y.qty || x.price != y.price ||
+            x.side != y.side) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void check_follow() {
+    const std::string dir = test_dir("tail_follow");
+    {
+        L2Tail none(dir);
+        CHECK(none.poll([](const L2Segment&) {}) == 0);
+        CHECK(!none.attached());
+        CHECK(!none.error().empty());
+        CHECK(!none.seek_end());
+    }
+
+    L2WriterOpt opt{dir, "TEST-USD"};
+    opt.initial_rows_per_hr = 1000;
+    opt.min_rows_per_hr = 1000;
+    opt.max_extent_rows = 20'000;
+    opt.checkpoint_every_rows = 30'000;
+    opt.checkpoint_every_s = 0;
+    opt.prepare_ahead_s = 0;
+    static constexpr uint64_t kRows = 250'000;
+    static constexpr uint64_t kSecond = 150'000;
+    auto row = [](uint64_t i) {
+        const uint64_t ts = i < kSecond ? (kHour + 10) * kNs + i * 10'000 : (kHour + 3600 + 5) * kNs + i * 1000;
+        return L2Row{ts, static_cast<int64_t>(1 + i % 50), static_cast<uint32_t>(1000 + i % 200),
+                     static_cast<uint8_t>(i & 1)};
+    };
+
+    std::vector<Seen> seen;
+    std::vector<Seen> late;
+    uint64_t late_hour = 0;
+    uint64_t late_pos = 0;
+    uint64_t seen_live = 0;
+    std::atomic<bool> done{false};
+    {
+        L2Writer w(opt);
+        // a known book, so the hours carry checkpoints as well
+        CHECK(w.mark_resync(row(0).ts_ns));
+        w.start();
+        std::thread follower([&] {
+            L2Tail t(dir);
+            while (!done.load()) {
+                if (!t.poll([&](const L2Segment& s) { take(t, s, seen); })) {
+                    std::this_thread::yield();
+                }
+            }
+            seen_live = seen.size();
+            // the writer is gone, what is left of the hour it was on and the next one
+            while (t.poll([&](const L2Segment& s) { take(t, s, seen); })) {
+            }
+        });
+        L2Tail t2(dir);
+        for (uint64_t i = 0; i < kRows; ++i) {
+            while (!w.enqueue(row(i))) {
+                std::this_thread::yield();
+            }
+            if (i % 5000 == 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+            if (i == 100'000) {
+                // let the writer commit part of what it was given before seeking to the end
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                CHECK(t2.seek_end());
+                late_hour = t2.hour_s();
+                late_pos = t2.position();
+            }
+        }
+        w.stop();
+        w.join();
+        done.store(true);
+        follower.join();
+        while (t2.poll([&](const L2Segment& s) { take(t2, s, late); })) {
+        }
+        CHECK(t2.hour_s() == kHour + 3600);
+        CHECK(t2.error().empty());
+    }
+
+    const std::vector<Seen> want = from_files(dir);
+    CHECK(want.size() > kRows + 1);
+    CHECK(same(seen, want));
+    // the tail read rows while they were being written, not only once the writer was done
+    CHECK(seen_live > 0);
+
+    CHECK(late_hour == kHour);
+    CHECK(late_pos > 0);
+    size_t from = 0;
+    while (from < want.size() && want[from].hour_s == kHour && from < late_pos) {
+        ++from;
+    }
+    CHECK(from == late_pos);
+    CHECK(same(late, std::vector<Seen>(want.begin() + static_cast<std::ptrdiff_t>(from), want.end())));
+}
+
+int main() {
+    check_follow();
+    return check_result();
+}
@@ -0,0 +1,133 @@
+// wait strategies: every WaitMode hands values from a producer thread to a consumer that idles on
+// an empty queue, a parked consumer is woken by notify well before its futex timeout however the
+// publish races the park, wake() frees a parked consumer for shutdown, and an L2Writer persists
+// every row in each mode
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include "../l2_reader.h"
+#include "../l2_writer.h"
+#include "../spsc.h"
+#include "../wait_strategy.h"
+#include "check.h"
+
+static constexpr uint64_t kHour = 1'675'972'800ull;
+
+static double since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static void check_names() {
+    for (WaitMode m : {WaitMode::Spin, WaitMode::SpinYield, WaitMode::Park}) {
+        WaitMode got = m == WaitMode::Park ? WaitMode::Spin : WaitMode::Park;
+        CHECK(parse_wait_mode(wait_mode_name(m), got));
+        CHECK(got == m);
+    }
+    WaitMode got = WaitMode::Spin;
+    CHECK(!parse_wait_mode("sleep", got));
+    CHECK(!parse_wait_mode("", got));
+    CHECK(got == WaitMode::Spin);
+}
+
+// the park timeout, a wait that lasts anywhere near it slept through a notify
+static constexpr long kParkNs = 900'000'000;
+
+// the producer pauses now and then so the consumer runs out of spin polls and parks. a notify lost
+// to the race with a park shows as a wait of the full timeout
+static void check_handoff(WaitMode mode, uint32_t spin_polls, uint64_t n) {
+    auto q = std::make_unique<LockFreeQueue<uint64_t, 256>>();
+    Waiter w(mode, spin_polls, kParkNs);
+    std::thread producer([&] {
+        for (uint64_t i = 0; i < n; ++i) {
+            while (!q->enqueue(i)) {
+                std::this_thread::yield();
+            }
+            w.notify();
+            if (i % 97 == 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+    });
+    uint64_t got = 0;
+    size_t bad = 0;
+    size_t slept_through = 0;
+    while (got < n) {
+        if (auto v = q->dequeue()) {
+            bad += *v != got++;
+            w.reset();
+        }
+        else {
+            const auto t0 = std::chrono::steady_clock::now();
+            w.idle([&] { return !q->empty(); });
+            slept_through += since(t0) > 0.5;
+        }
+    }
+    producer.join();
+    CHECK(bad == 0);
+    CHECK(w.mode() == mode);
+    CHECK(slept_through == 0);
+}
+
+// wake() always frees the consumer, however late it comes to park
+static void check_shutdown() {
+    Waiter w(WaitMode::Park, 0, kParkNs);
+    std::atomic<bool> done{false};
+    const auto t0 = std::chrono::steady_clock::now();
+    std::thread consumer([&] {
+        w.idle([] { return false; });
+        done.store(true);
+    });
+    while (!done.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        w.wake();
+    }
+    consumer.join();
+    CHECK(since(t0) < 0.5);
+}
+
+static void check_writer(WaitMode mode) {
+    const std::string dir = test_dir((std::string("wait_writer_") + wait_mode_name(mode)).c_str());
+    L2WriterOpt opt{dir, "TEST-USD"};
+    opt.initial_rows_per_hr = 1 << 14;
+    opt.wait = mode;
+    opt.spin_polls = 64;
+    opt.checkpoint_every_s = 0;
+    opt.prepare_ahead_s = 0;
+    static constexpr uint64_t kRows = 20'000;
+    {
+        L2Writer w(opt);
+        w.start();
+        for (uint64_t i = 0; i < kRows; ++i) {
+            CHECK(w.enqueue({kHour * 1'000'000'000ull + i, 1, static_cast<uint32_t>(100 + i % 7),
+                             static_cast<uint8_t>(i % 2)}));
+            if (i % 1000 == 0) {
+                // long enough for the writer to run out of polls and wait
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        w.stop();
+        w.join();
+    }
+    L2HourFile f;
+    CHECK(f.open(l2col_hour_path(dir, kHour)));
+    uint64_t rows = 0;
+    for (uint64_t k = 0; k < f.rows(); ++k) {
+        rows += !(f.row(k).side & (ROW_CHECKPOINT | ROW_MARKER));
+    }
+    CHECK(rows == kRows);
+}
+
+int main() {
+    check_names();
+    check_handoff(WaitMode::Spin, 4096, 2000);
+    check_handoff(WaitMode::SpinYield, 16, 20'000);
+    check_handoff(WaitMode::Park, 0, 20'000);
+    check_handoff(WaitMode::Park, 64, 20'000);
+    check_shutdown();
+    for (WaitMode m : {WaitMode::Spin, WaitMode::SpinYield, WaitMode::Park}) {
+        check_writer(m);
+    }
+    return check_result();
+}
@@ -0,0 +1,120 @@
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "l2_agg.h"
+
+// aggregates over days of a product's hour files, see l2_agg.h
+
+static void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " PRODUCT_DIR... --from S --to S [--bucket MS] [--threads N] [--snapshots]"
+        << " [--px-lo P] [--px-hi P]\n"
+        << "  S is unix seconds, fractions allowed. prints per book side the level updates, deletes, the qty\n"
+        << "  the updates set and the price range they touched. --bucket also prints update and delete counts\n"
+        << "  per MS milliseconds as csv: bucket_ns,bid_updates,ask_updates,bid_deletes,ask_deletes.\n"
+        << "  snapshot levels only count with --snapshots, --px-lo/--px-hi keep prices inside the bounds\n";
+}
+
+static uint64_t to_ns(const char* s) {
+    return static_cast<uint64_t>(std::stod(s) * 1e9);
+}
+
+static double scaled(__int128 v, uint8_t decimals) {
+    double d = static_cast<double>(v);
+    for (uint8_t i = 0; i < decimals; ++i) {
+        d /= 10;
+    }
+    return d;
+}
+
+static void print_side(const char* name, const L2AggSide& s, const L2AggResult& r) {
+    char lo[32] = "-";
+    char hi[32] = "-";
+    if (s.updates) {
+        l2_format_fixed(lo, sizeof(lo), s.px_min, r.price_decimals);
+        l2_format_fixed(hi, sizeof(hi), s.px_max, r.price_decimals);
+    }
+    std::printf("  %s updates %lu deletes %lu qty %.*f price %s .. %s\n", name, static_cast<unsigned long>(s.updates),
+                static_cast<unsigned long>(s.deletes), r.qty_decimals, scaled(s.qty, r.qty_decimals), lo, hi);
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> dirs;
+    L2AggQuery q;
+    q.threads = std::max(1u, std::thread::hardware_concurrency());
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const bool has_val = i + 1 < argc;
+            if (arg == "--from" && has_val) {
+                q.t0_ns = to_ns(argv[++i]);
+            }
+            else if (arg == "--to" && has_val) {
+                q.t1_ns = to_ns(argv[++i]);
+            }
+            else if (arg == "--bucket" && has_val) {
+                q.bucket_ns = std::stoull(argv[++i]) * 1'000'000ull;
+            }
+            else if (arg == "--threads" && has_val) {
+                q.threads = std::max(1u, static_cast<unsigned>(std::stoul(argv[++i])));
+            }
+            else if (arg == "--snapshots") {
+                q.snapshots = true;
+            }
+            else if (arg == "--px-lo" && has_val) {
+                q.px_lo = std::stod(argv[++i]);
+            }
+            else if (arg == "--px-hi" && has_val) {
+                q.px_hi = std::stod(argv[++i]);
+            }
+            else if (arg.rfind("--", 0) == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            else {
+                dirs.push_back(arg);
+            }
+        }
+    } catch (const std::exception&) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (dirs.empty() || q.t1_ns <= q.t0_ns) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char* kernel = nullptr;
+    (void)l2_agg_select(&kernel);
+    int rc = 0;
+    for (const auto& dir : dirs) {
+        L2AggResult r;
+        std::string error;
+        const auto t0 = std::chrono::steady_clock::now();
+        if (!l2_aggregate(dir, q, r, error)) {
+            std::cerr << "[l2_agg] " << error << '\n';
+            rc = 1;
+            continue;
+        }
+        const double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        std::printf("%s: %lu hours (%lu from l2z, %lu missing), %lu rows, %.1f MB in %.3fs (%.2f GB/s, %s, "
+                    "%u threads)\n",
+                    dir.c_str(), static_cast<unsigned long>(r.hours), static_cast<unsigned long>(r.compacted),
+                    static_cast<unsigned long>(r.missing), static_cast<unsigned long>(r.rows), r.bytes / 1e6, s,
+                    s > 0 ? r.bytes / s / 1e9 : 0.0, kernel, q.threads);
+        print_side("bid", r.side[SIDE_BID], r);
+        print_side("ask", r.side[SIDE_ASK], r);
+        if (q.bucket_ns) {
+            std::printf("bucket_ns,bid_updates,ask_updates,bid_deletes,ask_deletes\n");
+            for (size_t k = 0; k < r.buckets.size(); ++k) {
+                const L2AggBucket& b = r.buckets[k];
+                std::printf("%lu,%lu,%lu,%lu,%lu\n", static_cast<unsigned long>(q.t0_ns + k * q.bucket_ns),
+                            static_cast<unsigned long>(b.updates[SIDE_BID]), static_cast<unsigned long>(b.updates[SIDE_ASK]),
+                            static_cast<unsigned long>(b.deletes[SIDE_BID]), static_cast<unsigned long>(b.deletes[SIDE_ASK]));
+            }
+        }
+    }
+    return rc;
+}
@@ -0,0 +1,175 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "col_reader.h"
+#include "l2_reader.h"
+
+// prints an hour file, its top of book file (.bbo) or a file of any other schema (.trades, ...),
+// or row counts for every hour of a product directory in a time window
+
+static void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " FILE [--rows N]\n"
+        << "  FILE is an hh00.bin hour file, its .bbo, or a file of another schema such as .trades\n"
+        << "       " << argv0 << " --dir PRODUCT_DIR FROM_S TO_S\n"
+        << "  FROM_S/TO_S are unix seconds, the window is [FROM_S, TO_S)\n";
+}
+
+static void print_row(uint64_t i, const L2Row& r, const L2HourFile& f) {
+    if (r.side & ROW_MARKER) {
+        std::printf("%10lu %20lu marker %u %lld\n", static_cast<unsigned long>(i),
+                    static_cast<unsigned long>(r.ts_ns), r.price, static_cast<long long>(r.qty));
+        return;
+    }
+    char px[32];
+    char qty[32];
+    l2_format_fixed(px, sizeof(px), r.price, f.price_decimals());
+    l2_format_fixed(qty, sizeof(qty), r.qty, f.qty_decimals());
+    std::printf("%10lu %20lu %s %12s %16s%s%s\n", static_cast<unsigned long>(i),
+                static_cast<unsigned long>(r.ts_ns), (r.side & SIDE_BID) ? "bid" : "ask", px, qty,
+                (r.side & ROW_SNAPSHOT) ? " snapshot" : "", (r.side & ROW_CHECKPOINT) ? " checkpoint" : "");
+}
+
+static int dump_bbo(const std::string& path, uint64_t max_rows) {
+    L2BboFile f;
+    if (!f.open(path)) {
+        std::cerr << "[l2_dump] " << f.error() << '\n';
+        return 1;
+    }
+    std::printf("%s: %.16s bbo v%u hour %lu rows %lu blocks %zu levels %u decimals %u:%u\n", path.c_str(),
+                f.header().product, f.header().version, static_cast<unsigned long>(f.hour_s()),
+                static_cast<unsigned long>(f.rows()), f.segments().size(), f.levels(), f.price_decimals(),
+                f.qty_decimals());
+    const uint64_t n = std::min(max_rows, f.rows());
+    for (uint64_t i = 0; i < n; ++i) {
+        const L2Bbo b = f.row(i);
+        if (!b.bid_px && !b.ask_px) {
+            std::printf("%10lu %20lu unknown\n", static_cast<unsigned long>(i), static_cast<unsigned long>(b.ts_ns));
+            continue;
+        }
+        char bp[32], bq[32], ap[32], aq[32];
+        l2_format_fixed(bp, sizeof(bp), b.bid_px, f.price_decimals());
+        l2_format_fixed(bq, sizeof(bq), b.bid_qty, f.qty_decimals());
+        l2_format_fixed(ap, sizeof(ap), b.ask_px, f.price_decimals());
+        l2_format_fixed(aq, sizeof(aq), b.ask_qty, f.qty_decimals());
+        std::printf("%10lu %20lu %16s @ %-12s %12s @ %-16s", static_cast<unsigned long>(i),
+                    static_cast<unsigned long>(b.ts_ns), bq, bp, ap, aq);
+        if (f.levels()) {
+            char bd[32], ad[32];
+            l2_format_fixed(bd, sizeof(bd), b.bid_depth, f.qty_decimals());
+            l2_format_fixed(ad, sizeof(ad), b.ask_depth, f.qty_decimals());
+            std::printf(" depth %s / %s", bd, ad);
+        }
+        std::printf("\n");
+    }
+    return 0;
+}
+
+// one cell of a schema file. integer columns called price, size or qty are fixed point in the
+// file's decimals, everything else prints as stored
+static void print_cell(const ColHourFile& f, const ColSegment& s, uint32_t c, uint64_t k) {
+    const uint8_t* p = s.col[c] + k * f.header().cols[c].width;
+    const std::string name = f.col_name(c);
+    const int decimals = name == "price" ? f.price_decimals() : name == "size" || name == "qty" ? f.qty_decimals() : -1;
+    int64_t iv = 0;
+    uint64_t uv = 0;
+    switch (f.col_type(c)) {
+    case ColType::U8: uv = *p; break;
+    case ColType::U16: uv = *reinterpret_cast<const uint16_t*>(p); break;
+    case ColType::U32: uv = *reinterpret_cast<const uint32_t*>(p); break;
+    case ColType::U64: uv = *reinterpret_cast<const uint64_t*>(p); break;
+    case ColType::I8: iv = *reinterpret_cast<const int8_t*>(p); break;
+    case ColType::I16: iv = *reinterpret_cast<const int16_t*>(p); break;
+    case ColType::I32: iv = *reinterpret_cast<const int32_t*>(p); break;
+    case ColType::I64: iv = *reinterpret_cast<const int64_t*>(p); break;
+    case ColType::F32: std::printf(" %g", *reinterpret_cast<const float*>(p)); return;
+    case ColType::F64: std::printf(" %g", *reinterpret_cast<const double*>(p)); return;
+    }
+    const bool is_signed = f.col_type(c) >= ColType::I8;
+    if (decimals >= 0) {
+        char buf[32];
+        l2_format_fixed(buf, sizeof(buf), is_signed ? iv : static_cast<int64_t>(uv), static_cast<uint8_t>(decimals));
+        std::printf(" %16s", buf);
+    }
+    else if (is_signed) {
+        std::printf(" %20lld", static_cast<long long>(iv));
+    }
+    else {
+        std::printf(" %20llu", static_cast<unsigned long long>(uv));
+    }
+}
+
+static int dump_schema_file(const std::string& path, uint64_t max_rows) {
+    ColHourFile f;
+    if (!f.open(path)) {
+        std::cerr << "[l2_dump] " << f.error() << '\n';
+        return 1;
+    }
+    const auto& h = f.header();
+    std::printf("%s: %.16s %s v%u hour %lu rows %lu capacity %lu extents %zu decimals %u:%u\n", path.c_str(),
+                h.product, f.schema().c_str(), h.version, static_cast<unsigned long>(f.hour_s()),
+                static_cast<unsigned long>(f.rows()), static_cast<unsigned long>(h.capacity), f.segments().size(),
+                f.price_decimals(), f.qty_decimals());
+    for (uint32_t c = 0; c < f.col_count(); ++c) {
+        std::printf("  column %u %s %s\n", c, f.col_name(c).c_str(), col_type_name(f.col_type(c)));
+    }
+    uint64_t printed = 0;
+    for (const auto& s : f.segments()) {
+        for (uint64_t k = 0; k < s.rows && printed < max_rows; ++k, ++printed) {
+            std::printf("%10lu", static_cast<unsigned long>(s.row_base + k));
+            for (uint32_t c = 0; c < f.col_count(); ++c) {
+                print_cell(f, s, c, k);
+            }
+            std::printf("\n");
+        }
+    }
+    return 0;
+}
+
+static int dump_file(const std::string& path, uint64_t max_rows) {
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".bbo") == 0) {
+        return dump_bbo(path, max_rows);
+    }
+    if (path.size() < 4 || path.compare(path.size() - 4, 4, ".bin") != 0) {
+        return dump_schema_file(path, max_rows);
+    }
+    L2HourFile f;
+    if (!f.open(path, true)) {
+        std::cerr << "[l2_dump] " << f.error() << '\n';
+        return 1;
+    }
+    const auto& h = f.header();
+    std::printf("%s: %.16s v%u hour %lu rows %lu capacity %lu extents %zu checkpoints %zu decimals %u:%u\n",
+                path.c_str(), h.product, h.version, static_cast<unsigned long>(f.hour_s()),
+                static_cast<unsigned long>(f.rows()), static_cast<unsigned long>(h.capacity),
+                f.segments().size(), f.checkpoints().size(), f.price_decimals(), f.qty_decimals());
+    for (const auto& c : f.checkpoints()) {
+        std::printf("  checkpoint at row %lu ts %lu\n", static_cast<unsigned long>(c.row),
+                    static_cast<unsigned long>(c.ts_ns));
+    }
+    const uint64_t n = std::min(max_rows, f.rows());
+    for (uint64_t i = 0; i < n; ++i) {
+        print_row(i, f.row(i), f);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc >= 5 && std::strcmp(argv[1], "--dir") == 0) {
+        const uint64_t t0 = std::stoull(argv[3]) * 1'000'000'000ull;
+        const uint64_t t1 = std::stoull(argv[4]) * 1'000'000'000ull;
+        uint64_t total = 0;
+        const size_t hours = l2_scan(argv[2], t0, t1, [&](const L2HourFile& f, uint64_t r0, uint64_t r1) {
+            std::printf("hour %lu rows [%lu, %lu)\n", static_cast<unsigned long>(f.hour_s()),
+                        static_cast<unsigned long>(r0), static_cast<unsigned long>(r1));
+            total += r1 - r0;
+        });
+        std::printf("%zu hour files, %lu rows in window\n", hours, static_cast<unsigned long>(total));
+        return 0;
+    }
+    if (argc == 2 || (argc == 4 && std::strcmp(argv[2], "--rows") == 0)) {
+        return dump_file(argv[1], argc == 4 ? std::stoull(argv[3]) : ~0ull);
+    }
+    usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,268 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "coinbase_feed.h"
+#include "frame_journal.h"
+
+// decodes a connection's frame journal again into hour files, an hour per task on a pool of
+// threads. each task replays its hour through a feed of its own that only writes rows of that
+// hour: the hours before it back to the last one with a snapshot build the book first, and the
+// start of the next hour catches the messages that arrived after the hour turned
+
+static void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " JOURNAL_DIR --from S --to S --out DIR [--threads N] [--trades]"
+        << " [--back-hours N] [--grace S]\n"
+        << "  JOURNAL_DIR is base/journal/<connection>, S is unix seconds. every hour in [--from, --to) is\n"
+        << "  written to DIR/<product>/yyyymmdd/hh00.bin with the current parser. --back-hours bounds the\n"
+        << "  search for a snapshot before an hour (default 24), --grace is how far into the next hour\n"
+        << "  late messages are looked for (default 60)\n";
+}
+
+// the parts of one hour: hh00.frames, then hh00.frames.1 and on when the recorder restarted
+static std::vector<std::unique_ptr<FrameJournalFile>> open_hour(const std::string& dir, uint64_t hour_s) {
+    std::vector<std::unique_ptr<FrameJournalFile>> parts;
+    const std::string base = frame_journal_path(dir, hour_s);
+    for (int k = 0; k < 100; ++k) {
+        const std::string p = k ? base + "." + std::to_string(k) : base;
+        if (!std::filesystem::exists(p)) {
+            break;
+        }
+        auto f = std::make_unique<FrameJournalFile>();
+        if (!f->open(p)) {
+            std::cerr << "[l2_replay] " << f->error() << ", skipped\n";
+            continue;
+        }
+        parts.push_back(std::move(f));
+    }
+    return parts;
+}
+
+// closed journals count their snapshots in the header, open ones are looked through
+static bool has_snapshot(const FrameJournalFile& f) {
+    if (f.header().closed) {
+        return f.header().snapshots > 0;
+    }
+    static constexpr char CHANNEL[] = R"({"channel":"l2_data")";
+    static constexpr char TYPE[] = R"("type":"snapshot")";
+    bool found = false;
+    f.for_each([&](const FrameRecord& r, const char* p) {
+        if ((r.flags & JRNL_FIRST) && r.len >= sizeof(CHANNEL) - 1 && std::memcmp(p, CHANNEL, sizeof(CHANNEL) - 1) == 0 &&
+            ::memmem(p, std::min<size_t>(r.len, 512), TYPE, sizeof(TYPE) - 1)) {
+            found = true;
+        }
+        return !found;
+    });
+    return found;
+}
+
+// "BTC-USD=2:8,ETH-USD=2:8" into products and their scales
+static void parse_products(const char* s, Config& cfg) {
+    std::string list(s);
+    size_t start = 0;
+    while (start < list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        const std::string item = list.substr(start, end - start);
+        const auto eq = item.find('=');
+        const auto colon = item.find(':', eq);
+        if (eq != std::string::npos && colon != std::string::npos) {
+            L2Decimals d;
+            d.price = static_cast<uint8_t>(std::stoul(item.substr(eq + 1, colon - eq - 1)));
+            d.qty = static_cast<uint8_t>(std::stoul(item.substr(colon + 1)));
+            cfg.products.push_back(item.substr(0, eq));
+            cfg.decimals[cfg.products.back()] = d;
+        }
+        start = end + 1;
+    }
+}
+
+struct HourResult {
+    uint64_t frames{0};
+    uint64_t rows{0};
+    uint64_t trades{0};
+    uint64_t warm_from{0};
+    bool ok{false};
+};
+
+// the feed's constructor and destructor set up and tear down libcurl's globals
+static std::mutex feed_mu;
+
+static HourResult replay_hour(const std::string& dir, const std::string& out, uint64_t hour_s, bool trades,
+                              uint32_t back_hours, uint64_t grace_s) {
+    HourResult res;
+    auto parts = open_hour(dir, hour_s);
+    if (parts.empty()) {
+        return res;
+    }
+
+    // the book at the hour's start comes from the last snapshot before it
+    uint64_t warm = hour_s;
+    std::vector<std::vector<std::unique_ptr<FrameJournalFile>>> before;
+    for (uint32_t back = 1; back <= back_hours; ++back) {
+        auto p = open_hour(dir, hour_s - back * 3600ull);
+        if (p.empty()) {
+            break;
+        }
+        warm = hour_s - back * 3600ull;
+        const bool snap = std::any_of(p.begin(), p.end(), [](const auto& f) { return has_snapshot(*f); });
+        before.push_back(std::move(p));
+        if (snap) {
+            break;
+        }
+    }
+    std::reverse(before.begin(), before.end());
+    auto after = open_hour(dir, hour_s + 3600);
+    res.warm_from = warm;
+
+    Config cfg;
+    parse_products(parts.front()->header().products, cfg);
+    cfg.redundant = parts.front()->header().legs == 2;
+    cfg.base_dir = out;
+    cfg.lookup_increments = false;
+    cfg.trades = trades;
+    cfg.record_from_ns = hour_s * 1'000'000'000ull;
+    cfg.record_until_ns = (hour_s + 3600) * 1'000'000'000ull;
+
+    std::unique_ptr<CoinbaseFeed> feed;
+    {
+        std::lock_guard<std::mutex> lk(feed_mu);
+        feed = std::make_unique<CoinbaseFeed>(cfg);
+    }
+    feed->start_writers();
+    const uint64_t late_until = (hour_s + 3600 + grace_s) * 1'000'000'000ull;
+    auto play = [&](const FrameJournalFile& f, uint64_t until_ns) {
+        res.frames += f.for_each([&](const FrameRecord& r, const char* p) {
+            if (r.recv_ns >= until_ns && (r.flags & JRNL_FIRST)) {
+                return false;
+            }
+            if (r.flags & JRNL_LEG_DOWN) {
+                feed->handle_leg_down(r.leg);
+            }
+            else {
+                feed->handle_fragment(r.leg, p, r.len, r.flags & JRNL_FIRST, r.flags & JRNL_FINAL);
+            }
+            return true;
+        });
+    };
+    for (const auto& hour : before) {
+        for (const auto& f : hour) {
+            play(*f, ~0ull);
+        }
+    }
+    for (const auto& f : parts) {
+        play(*f, ~0ull);
+    }
+    for (const auto& f : after) {
+        play(*f, late_until);
+    }
+    feed->join();
+    for (size_t i = 0; i < feed->products().size(); ++i) {
+        res.rows += feed->writer(i).persisted();
+    }
+    res.trades = feed->trades();
+    {
+        std::lock_guard<std::mutex> lk(feed_mu);
+        feed.reset();
+    }
+    res.ok = true;
+    return res;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    const std::string dir = argv[1];
+    std::string out;
+    uint64_t from = 0, to = 0, grace_s = 60;
+    uint32_t threads = std::max(1u, std::thread::hardware_concurrency());
+    uint32_t back_hours = 24;
+    bool trades = false;
+    try {
+        for (int i = 2; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const bool has_val = i + 1 < argc;
+            if (arg == "--from" && has_val) {
+                from = static_cast<uint64_t>(std::stod(argv[++i]));
+            }
+            else if (arg == "--to" && has_val) {
+                to = static_cast<uint64_t>(std::stod(argv[++i]));
+            }
+            else if (arg == "--out" && has_val) {
+                out = argv[++i];
+            }
+            else if (arg == "--threads" && has_val) {
+                threads = std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+            }
+            else if (arg == "--trades") {
+                trades = true;
+            }
+            else if (arg == "--back-hours" && has_val) {
+                back_hours = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--grace" && has_val) {
+                grace_s = std::stoull(argv[++i]);
+            }
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+    } catch (const std::exception&) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (out.empty() || to <= from) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<uint64_t> hours;
+    for (uint64_t h = from / 3600 * 3600; h < to; h += 3600) {
+        hours.push_back(h);
+    }
+    std::vector<HourResult> results(hours.size());
+    std::atomic<size_t> next{0};
+    const auto t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (uint32_t t = 0; t < std::min<size_t>(threads, hours.size()); ++t) {
+        pool.emplace_back([&] {
+            for (size_t i; (i = next.fetch_add(1)) < hours.size();) {
+                results[i] = replay_hour(dir, out, hours[i], trades, back_hours, grace_s);
+            }
+        });
+    }
+    for (auto& t : pool) {
+        t.join();
+    }
+    const double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    uint64_t rows = 0, frames = 0, done = 0;
+    for (size_t i = 0; i < hours.size(); ++i) {
+        const HourResult& r = results[i];
+        if (!r.ok) {
+            continue;
+        }
+        ++done;
+        rows += r.rows;
+        frames += r.frames;
+        std::printf("%lu: %lu rows, %lu trades, %lu frames replayed from %lu\n", static_cast<unsigned long>(hours[i]),
+                    static_cast<unsigned long>(r.rows), static_cast<unsigned long>(r.trades),
+                    static_cast<unsigned long>(r.frames), static_cast<unsigned long>(r.warm_from));
+    }
+    std::printf("%lu of %zu hours, %lu rows from %lu frames in %.1fs\n", static_cast<unsigned long>(done), hours.size(),
+                static_cast<unsigned long>(rows), static_cast<unsigned long>(frames), s);
+    return done ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "stage_stats.h"
+
+// prints the recorder's stage histograms and writer counters from its shared memory segment.
+// the segment is only read, the recorder keeps running undisturbed
+
+static void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [NAME] [--product ID] [--every MS]\n"
+        << "  NAME is the recorder's --stats segment, default data_writer.stats. --every repeats the\n"
+        << "  report every MS milliseconds until interrupted. times are in microseconds\n";
+}
+
+static void print_hist(const char* name, const LatencyHistogram& h, double us_per_cycle) {
+    std::printf("  %-8s %12lu %9.2f %9.2f %9.2f %9.2f %9.2f\n", name, static_cast<unsigned long>(h.count()),
+                h.percentile(0.5) * us_per_cycle, h.percentile(0.9) * us_per_cycle,
+                h.percentile(0.99) * us_per_cycle, h.percentile(0.999) * us_per_cycle, h.max() * us_per_cycle);
+}
+
+static void report(const StatsSegment& seg, const std::string& only) {
+    const auto& h = seg.header();
+    const double us = seg.ns_per_cycle() / 1e3;
+    const auto now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+    std::printf("pid %u, up %.1f s, tsc %.3f GHz, %u products\n", h.pid, (now - h.created_ns) / 1e9,
+                h.tsc_hz / 1e9, h.products);
+    for (size_t i = 0; i < seg.products(); ++i) {
+        const ProductStats& p = seg.at(i);
+        if (!only.empty() && only != p.product) {
+            continue;
+        }
+        std::printf("%.16s rows %lu persisted %lu dropped %lu spilled %lu lost %lu queue %lu rotations %lu"
+                    " last rotate %.2f us\n",
+                    p.product, static_cast<unsigned long>(p.rows.load(std::memory_order_relaxed)),
+                    static_cast<unsigned long>(p.persisted.load(std::memory_order_relaxed)),
+                    static_cast<unsigned long>(p.dropped.load(std::memory_order_relaxed)),
+                    static_cast<unsigned long>(p.spilled.load(std::memory_order_relaxed)),
+                    static_cast<unsigned long>(p.spill_lost.load(std::memory_order_relaxed)),
+                    static_cast<unsigned long>(p.queue_depth.load(std::memory_order_relaxed)),
+                    static_cast<unsigned long>(p.rotations.load(std::memory_order_relaxed)),
+                    p.last_rotate.load(std::memory_order_relaxed) * us);
+        std::printf("  %-8s %12s %9s %9s %9s %9s %9s\n", "stage", "count", "p50", "p90", "p99", "p99.9", "max");
+        for (uint32_t s = 0; s < STAGE_COUNT; ++s) {
+            print_hist(stage_name(s), p.stage[s], us);
+        }
+        print_hist("rotate", p.rotate, us);
+    }
+    std::fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    std::string name = "data_writer.stats";
+    std::string only;
+    long every_ms = 0;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const bool has_val = i + 1 < argc;
+            if (arg == "--product" && has_val) {
+                only = argv[++i];
+            }
+            else if (arg == "--every" && has_val) {
+                every_ms = std::stol(argv[++i]);
+            }
+            else if (arg.rfind("--", 0) == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            else {
+                name = arg;
+            }
+        }
+    } catch (const std::exception&) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    StatsSegment seg;
+    if (!seg.open(name)) {
+        std::cerr << "[l2_stats] " << seg.error() << '\n';
+        return 1;
+    }
+    report(seg, only);
+    while (every_ms > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(every_ms));
+        std::printf("\n");
+        report(seg, only);
+    }
+    return 0;
+}
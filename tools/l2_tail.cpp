@@ -0,0 +1,118 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "l2_tail.h"
+
+// follows the hour the recorder is writing for a product, across hour changes, straight from its
+// page cache. prints every row, or a line a second with the row rate and how far the newest row
+// is behind the wall clock
+
+static void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " PRODUCT_DIR [--rows] [--from-end] [--poll-us N]\n"
+        << "  --rows prints every row, otherwise one summary line a second. --from-end skips the rows\n"
+        << "  the current hour already has. --poll-us sleeps between empty polls, 0 spins (default 100)\n";
+}
+
+static void print_row(uint64_t i, const L2Segment& s, size_t k, const L2Tail& t) {
+    if (s.side[k] & ROW_MARKER) {
+        std::printf("%10lu %20lu marker %u %lld\n", static_cast<unsigned long>(i),
+                    static_cast<unsigned long>(s.ts[k]), s.price[k], static_cast<long long>(s.qty[k]));
+        return;
+    }
+    char px[32];
+    char qty[32];
+    l2_format_fixed(px, sizeof(px), s.price[k], t.price_decimals());
+    l2_format_fixed(qty, sizeof(qty), s.qty[k], t.qty_decimals());
+    std::printf("%10lu %20lu %s %12s %16s%s%s\n", static_cast<unsigned long>(i),
+                static_cast<unsigned long>(s.ts[k]), (s.side[k] & SIDE_BID) ? "bid" : "ask", px, qty,
+                (s.side[k] & ROW_SNAPSHOT) ? " snapshot" : "", (s.side[k] & ROW_CHECKPOINT) ? " checkpoint" : "");
+}
+
+static uint64_t now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+int main(int argc, char** argv) {
+    std::string dir;
+    bool rows = false;
+    bool from_end = false;
+    long poll_us = 100;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--rows") {
+                rows = true;
+            }
+            else if (arg == "--from-end") {
+                from_end = true;
+            }
+            else if (arg == "--poll-us" && i + 1 < argc) {
+                poll_us = std::stol(argv[++i]);
+            }
+            else if (arg.rfind("--", 0) == 0 || !dir.empty()) {
+                usage(argv[0]);
+                return 1;
+            }
+            else {
+                dir = arg;
+            }
+        }
+    } catch (const std::exception&) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (dir.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    L2Tail tail(dir);
+    std::string last_error;
+    uint64_t generation = 0;
+    uint64_t total = 0;
+    uint64_t last_ts = 0;
+    uint64_t next_report = now_ns() + 1'000'000'000ull;
+    uint64_t reported = 0;
+    bool positioned = !from_end;
+    while (true) {
+        if (!positioned) {
+            positioned = tail.seek_end();
+        }
+        const uint64_t n = tail.poll([&](const L2Segment& s) {
+            if (rows) {
+                for (size_t k = 0; k < s.size(); ++k) {
+                    print_row(s.row_base + k, s, k, tail);
+                }
+            }
+            last_ts = s.ts.back();
+        });
+        if (tail.generation() != generation && tail.attached()) {
+            generation = tail.generation();
+            std::fprintf(stderr, "[l2_tail] following hour %lu, generation %lu\n",
+                         static_cast<unsigned long>(tail.hour_s()), static_cast<unsigned long>(generation));
+        }
+        if (!tail.error().empty() && tail.error() != last_error) {
+            last_error = tail.error();
+            std::cerr << "[l2_tail] " << last_error << ", retrying\n";
+        }
+        total += n;
+
+        const uint64_t now = now_ns();
+        if (!rows && now >= next_report) {
+            std::printf("hour %lu row %lu: %lu rows/s, newest row %.1f us behind\n",
+                        static_cast<unsigned long>(tail.hour_s()), static_cast<unsigned long>(tail.position()),
+                        static_cast<unsigned long>(total - reported),
+                        last_ts && now > last_ts ? (now - last_ts) / 1e3 : 0.0);
+            std::fflush(stdout);
+            reported = total;
+            next_report = now + 1'000'000'000ull;
+        }
+        if (!n && poll_us > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(poll_us));
+        }
+    }
+}
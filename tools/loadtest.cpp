@@ -0,0 +1,360 @@
+#include <algorithm>
+#include <csignal>
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "mock_exchange.h"
+#include "l2_reader.h"
+#include "latency_histogram.h"
+#include "recorder.h"
+
+// end to end: mock exchange -> websocket -> feed parse -> queue -> writer persist, in one process.
+// latency is the mock's event_time to the moment a row lands in the mapped column, so it
+// includes the mock's own send path and is an upper bound on receive -> persist.
+
+static std::atomic<bool> shutdown_requested{false};
+
+static void signal_handler(int) {
+    shutdown_requested.store(true);
+}
+
+static void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0
+        << " [--dir PATH] [--products N] [--connections N] [--seconds S] [--warmup S] [--port N]"
+        << " [--rate MSGS] [--updates N] [--burst N --burst-every MS] [--replay FILE]"
+        << " [--wait spin|yield|park] [--redundant] [--pipeline] [--check] [--kill-leg S] [--gap-every N]"
+        << " [--drop-every S]\n"
+        << "  --rate is update messages per second per product, --dir defaults to /dev/shm/l2-loadtest\n"
+        << "  --check also records the mock's stream over single connections to DIR/single and fails unless\n"
+        << "    both recorders hold the same updates, in the same order and without gaps. with --redundant\n"
+        << "    that checks the first arrival dedupe\n"
+        << "  --kill-leg closes one connection of the recorder S seconds into the measured run\n"
+        << "  --gap-every and --drop-every make the mock skip a sequence number every N messages and close\n"
+        << "    each connection every S seconds. without --redundant or --replay the hour files are then read\n"
+        << "    back and every update the mock sent has to be there, with gap markers where it broke off\n";
+}
+
+struct Totals {
+    uint64_t msgs{0};
+    uint64_t rows{0};
+    uint64_t dropped{0};
+    uint64_t spilled{0};
+    uint64_t lost{0};
+    uint64_t gaps{0};
+    uint64_t stalls{0};
+};
+
+static Totals totals(const Recorder& rec) {
+    Totals t;
+    for (size_t c = 0; c < rec.connections(); ++c) {
+        const CoinbaseFeed& f = rec.feed(c);
+        t.msgs += f.messages();
+        t.gaps += f.seq_gaps();
+        t.stalls += f.ring_stalls();
+        for (size_t p = 0; p < f.products().size(); ++p) {
+            t.rows += f.writer(p).persisted();
+            t.dropped += f.writer(p).dropped();
+            t.spilled += f.writer(p).spilled();
+            t.lost += f.writer(p).spill_lost();
+        }
+    }
+    return t;
+}
+
+// the level updates of a product's hour files, snapshots, checkpoints and markers left out
+struct Recorded {
+    std::vector<L2Row> updates;
+    uint64_t gaps{0};
+};
+
+// rows before from_s are left from an earlier run into the same hour
+static Recorded read_product(const std::string& dir, uint64_t from_s, uint64_t to_s) {
+    Recorded out;
+    for (uint64_t h = from_s / 3600 * 3600; h <= to_s; h += 3600) {
+        L2HourFile f;
+        if (!f.open(l2col_hour_path(dir, h), true)) {
+            continue;
+        }
+        for (uint64_t i = 0; i < f.rows(); ++i) {
+            const L2Row r = f.row(i);
+            if (r.ts_ns < from_s * 1'000'000'000ull) {
+                continue;
+            }
+            if (r.side & ROW_MARKER) {
+                out.gaps += r.price == MARK_GAP;
+            }
+            else if (!(r.side & (ROW_SNAPSHOT | ROW_CHECKPOINT))) {
+                out.updates.push_back(r);
+            }
+        }
+    }
+    return out;
+}
+
+// over the time both recorders were subscribed they have to hold the same updates in the same
+// order. event times grow per product, so the window is cut on them
+static bool same_updates(const std::string& product, const Recorded& a, const Recorded& b) {
+    if (a.updates.empty() || b.updates.empty()) {
+        std::cerr << "[loadtest] " << product << ": no updates recorded\n";
+        return false;
+    }
+    const uint64_t from = std::max(a.updates.front().ts_ns, b.updates.front().ts_ns);
+    const uint64_t to = std::min(a.updates.back().ts_ns, b.updates.back().ts_ns);
+    auto window = [&](const Recorded& r) {
+        const auto lo = std::find_if(r.updates.begin(), r.updates.end(),
+                                     [&](const L2Row& x) { return x.ts_ns >= from; });
+        const auto hi = std::find_if(lo, r.updates.end(), [&](const L2Row& x) { return x.ts_ns > to; });
+        return std::make_pair(lo, hi);
+    };
+    const auto [a0, a1] = window(a);
+    const auto [b0, b1] = window(b);
+    const auto mismatch = std::mismatch(a0, a1, b0, b1, [](const L2Row& x, const L2Row& y) {
+        return x.ts_ns == y.ts_ns && x.price == y.price && x.qty == y.qty && x.side == y.side;
+    });
+    const bool same = mismatch.first == a1 && mismatch.second == b1;
+    std::cout << "[loadtest] " << product << ": " << (a1 - a0) << " and " << (b1 - b0)
+        << " updates in the common window, " << (same ? "identical" : "different") << ", gap markers " << a.gaps << " and " << b.gaps << '\n';
+    return same && a0 != a1 && !a.gaps && !b.gaps;
+}
+
+// with one leg every update the mock sent is in the files once. every gap or drop on a connection
+// leaves at most one gap marker per product it carried, none before its first snapshot
+static bool matches_mock(const std::string& product, const Recorded& r, uint64_t updates, uint64_t breaks) {
+    const bool rows_ok = r.updates.size() == updates;
+    const bool gaps_ok = breaks ? r.gaps >= 1 && r.gaps <= breaks : r.gaps == 0;
+    std::cout << "[loadtest] " << product << ": " << r.updates.size() << " of " << updates << " updates sent, "
+        << r.gaps << " gap markers for " << breaks << " gaps and drops" << (rows_ok && gaps_ok ? "" : ", MISMATCH")
+        << '\n';
+    return rows_ok && gaps_ok;
+}
+
+static void wait_connections(const MockExchange& mock, uint64_t n) {
+    for (int i = 0; i < 500 && mock.connections() < n; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+static void print_latency(const LatencyHistogram& h) {
+    std::cout << "[loadtest] persist latency us: p50 " << h.percentile(0.50) / 1000.0
+        << " p99 " << h.percentile(0.99) / 1000.0
+        << " p99.9 " << h.percentile(0.999) / 1000.0
+        << " p99.99 " << h.percentile(0.9999) / 1000.0
+        << " max " << h.max() / 1000.0
+        << " (" << h.count() << " rows)\n";
+}
+
+int main(int argc, char** argv) {
+    std::signal(SIGINT, signal_handler);
+    std::signal(SIGTERM, signal_handler);
+
+    MockExchangeOpt mock_opt;
+    mock_opt.port = 9555;
+    RecorderConfig config;
+    config.base_dir = "/dev/shm/l2-loadtest";
+    uint32_t n_products = 4;
+    uint32_t seconds = 10;
+    uint32_t warmup = 2;
+    bool check = false;
+    uint32_t kill_leg_s = 0;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const bool has_val = i + 1 < argc;
+            if (arg == "--dir" && has_val) {
+                config.base_dir = argv[++i];
+            }
+            else if (arg == "--products" && has_val) {
+                n_products = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--connections" && has_val) {
+                config.connections = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--seconds" && has_val) {
+                seconds = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--warmup" && has_val) {
+                warmup = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--port" && has_val) {
+                mock_opt.port = std::stoi(argv[++i]);
+            }
+            else if (arg == "--rate" && has_val) {
+                mock_opt.rate = std::stod(argv[++i]);
+            }
+            else if (arg == "--updates" && has_val) {
+                mock_opt.updates_per_msg = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--burst" && has_val) {
+                mock_opt.burst = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--burst-every" && has_val) {
+                mock_opt.burst_every_ms = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--replay" && has_val) {
+                mock_opt.replay_file = argv[++i];
+            }
+            else if (arg == "--wait" && has_val) {
+                if (!parse_wait_mode(argv[++i], config.wait)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            }
+            else if (arg == "--redundant") {
+                config.redundant = true;
+            }
+            else if (arg == "--pipeline") {
+                config.pipeline = true;
+            }
+            else if (arg == "--check") {
+                check = true;
+            }
+            else if (arg == "--kill-leg" && has_val) {
+                kill_leg_s = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--gap-every" && has_val) {
+                mock_opt.gap_every = std::stoull(argv[++i]);
+            }
+            else if (arg == "--drop-every" && has_val) {
+                mock_opt.drop_every_s = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else {
+                usage(argv[0]);
+                return arg == "-h" || arg == "--help" ? 0 : 1;
+            }
+        }
+    } catch (const std::exception& e) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < n_products; ++i) {
+        config.products.push_back("LOAD" + std::to_string(i) + "-USD");
+    }
+    Endpoint::parse("ws://127.0.0.1:" + std::to_string(mock_opt.port) + "/", config.endpoint);
+    // mock products quote on the default increments
+    config.lookup_increments = false;
+
+    LatencyHistogram latency;
+    config.persist_latency = &latency;
+
+    MockExchange mock(mock_opt);
+    mock.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    const uint64_t t_start_s = static_cast<uint64_t>(std::time(nullptr));
+
+    // the reference takes the same stream over plain connections, no stats and no latency
+    std::unique_ptr<Recorder> single;
+    if (check) {
+        RecorderConfig ref = config;
+        ref.base_dir = config.base_dir + "/single";
+        ref.redundant = false;
+        ref.persist_latency = nullptr;
+        ref.stats_name.clear();
+        single = std::make_unique<Recorder>(ref);
+        single->start();
+        wait_connections(mock, ref.connections);
+    }
+    const uint64_t first_conn = mock.connections();
+
+    Recorder recorder(config);
+    recorder.start();
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "[loadtest] " << n_products << " products at " << mock_opt.rate << " msgs/s each, "
+        << warmup << "s warmup, " << seconds << "s measured, writing to " << config.base_dir << '\n';
+
+    for (uint32_t s = 0; s < warmup && !shutdown_requested.load(); ++s) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+    latency.reset();
+
+    const auto t0 = std::chrono::steady_clock::now();
+    const Totals start = totals(recorder);
+    Totals prev = start;
+    for (uint32_t s = 0; s < seconds && !shutdown_requested.load(); ++s) {
+        if (kill_leg_s && s == kill_leg_s) {
+            std::cout << "[loadtest] closing connection " << first_conn << '\n';
+            mock.drop(first_conn);
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        const Totals now = totals(recorder);
+        std::cout << "[loadtest] " << now.msgs - prev.msgs << " msgs/s, " << now.rows - prev.rows
+            << " rows/s, dropped " << now.dropped - start.dropped << '\n';
+        prev = now;
+    }
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    const Totals end = totals(recorder);
+
+    // the mock stops making updates and the recorders take what is still on the way, so the files
+    // can be held against what was sent
+    mock.pause();
+    for (int i = 0; i < 100; ++i) {
+        const uint64_t sent = mock.sent();
+        const uint64_t msgs = totals(recorder).msgs + (single ? totals(*single).msgs : 0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (mock.sent() == sent && totals(recorder).msgs + (single ? totals(*single).msgs : 0) == msgs) {
+            break;
+        }
+    }
+
+    recorder.stop();
+    recorder.join();
+    if (single) {
+        single->stop();
+        single->join();
+    }
+    mock.stop();
+    mock.join();
+
+    std::cout << "[loadtest] sent " << mock.sent() << " msgs over " << mock.connections() << " connections\n";
+    std::cout << "[loadtest] received " << (end.msgs - start.msgs) / elapsed << " msgs/s, persisted "
+        << (end.rows - start.rows) / elapsed << " rows/s, dropped " << end.dropped - start.dropped
+        << ", spilled " << end.spilled - start.spilled << ", lost " << end.lost - start.lost
+        << ", seq gaps " << end.gaps - start.gaps;
+    if (config.pipeline) {
+        std::cout << ", ring stalls " << end.stalls - start.stalls;
+    }
+    std::cout << '\n';
+    print_latency(latency);
+
+    uint64_t reconnects = 0;
+    uint64_t arb_dropped = 0;
+    for (size_t c = 0; c < recorder.connections(); ++c) {
+        reconnects += recorder.feed(c).reconnects();
+        arb_dropped += recorder.feed(c).arb_dropped();
+    }
+    if (config.redundant || kill_leg_s || mock_opt.drop_every_s) {
+        std::cout << "[loadtest] reconnects " << reconnects << ", copies dropped " << arb_dropped << '\n';
+    }
+    int rc = 0;
+    if (kill_leg_s && kill_leg_s < seconds && !reconnects) {
+        std::cerr << "[loadtest] the closed connection never came back\n";
+        rc = 1;
+    }
+    const uint64_t t_end_s = static_cast<uint64_t>(std::time(nullptr));
+    if (!config.redundant && mock_opt.replay_file.empty()) {
+        for (const auto& p : config.products) {
+            uint64_t updates = 0;
+            uint64_t breaks = 0;
+            mock.sent_to(p, first_conn, updates, breaks);
+            if (!matches_mock(p, read_product(config.base_dir + "/" + p, t_start_s, t_end_s), updates, breaks)) {
+                rc = 1;
+            }
+        }
+    }
+    if (check) {
+        bool same = true;
+        for (const auto& p : config.products) {
+            const Recorded a = read_product(config.base_dir + "/single/" + p, t_start_s, t_end_s);
+            const Recorded b = read_product(config.base_dir + "/" + p, t_start_s, t_end_s);
+            same &= same_updates(p, a, b);
+        }
+        std::cout << "[loadtest] check " << (same ? "passed" : "FAILED") << '\n';
+        rc |= !same;
+    }
+    return rc;
+}
@@ -0,0 +1,463 @@
+#include "mock_exchange.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+
+using namespace std::chrono;
+
+static inline uint64_t wall_ns() {
+    return static_cast<uint64_t>(
+        duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count());
+}
+
+// rfc3339 with nanoseconds, the recorder keeps all 9 digits so latency can be measured from it.
+// sized for any int the fields could hold, not just the 30 chars of a real timestamp
+static constexpr size_t kTsChars = 96;
+
+static void format_ts(uint64_t ns, char (&out)[kTsChars]) {
+    const time_t sec = static_cast<time_t>(ns / 1'000'000'000ull);
+    struct tm tm{};
+    gmtime_r(&sec, &tm);
+    std::snprintf(out, sizeof(out), "%04d-%02d-%02dT%02d:%02d:%02d.%09uZ",
+                  tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                  static_cast<unsigned>(ns % 1'000'000'000ull));
+}
+
+// one level of an updates array, price in cents and qty in 1e-8
+static void append_level(std::string& out, bool comma, bool bid, const char* ts, uint64_t px, uint64_t qty) {
+    char lvl[160];
+    std::snprintf(lvl, sizeof(lvl),
+                  R"(%s{"side":"%s","event_time":"%s","price_level":"%llu.%02llu","new_quantity":"%llu.%08llu"})",
+                  comma ? "," : "", bid ? "bid" : "offer", ts,
+                  static_cast<unsigned long long>(px / 100), static_cast<unsigned long long>(px % 100),
+                  static_cast<unsigned long long>(qty / 100'000'000),
+                  static_cast<unsigned long long>(qty % 100'000'000));
+    out += lvl;
+}
+
+static lws_protocols mock_protocols[] = {
+    {"json", nullptr, sizeof(void*), 64 * 1024, 0, nullptr, 0},
+    {nullptr, nullptr, 0, 0, 0, nullptr, 0}
+};
+
+MockExchange::MockExchange(const MockExchangeOpt& opt) : opt_(opt) {
+    tick_.self = this;
+    if (!opt_.replay_file.empty()) {
+        std::ifstream in(opt_.replay_file);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (!line.empty()) {
+                replay_.push_back(std::move(line));
+            }
+        }
+        std::cout << "[MockExchange] loaded " << replay_.size() << " messages from " << opt_.replay_file << '\n';
+    }
+}
+
+MockExchange::~MockExchange() {
+    stop();
+    join();
+}
+
+bool MockExchange::start() {
+    if (running_.exchange(true)) {
+        return true;
+    }
+    thread_ = std::make_unique<std::thread>(&MockExchange::run, this);
+    return true;
+}
+
+void MockExchange::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    if (ctx_) {
+        lws_cancel_service(ctx_);
+    }
+}
+
+void MockExchange::join() {
+    if (thread_ && thread_->joinable()) {
+        thread_->join();
+    }
+    thread_.reset();
+}
+
+void MockExchange::run() {
+    mock_protocols[0].callback = &MockExchange::lws_cb;
+    mock_protocols[0].per_session_data_size = sizeof(PSS);
+
+    lws_context_creation_info info{};
+    info.port = opt_.port;
+    info.protocols = mock_protocols;
+    info.user = this;
+
+    ctx_ = lws_create_context(&info);
+    if (!ctx_) {
+        std::cerr << "[MockExchange] unable to listen on port " << opt_.port << '\n';
+        running_ = false;
+        return;
+    }
+    std::cout << "[MockExchange] listening on ws://127.0.0.1:" << opt_.port << '\n';
+
+    lws_sul_schedule(ctx_, 0, &tick_.sul, &MockExchange::tick_cb, LWS_US_PER_MS);
+    while (running_) {
+        lws_service(ctx_, 0);
+    }
+
+    lws_context_destroy(ctx_);
+    ctx_ = nullptr;
+}
+
+// 1ms pacing tick, the streams make what is due and every subscribed session gets a chance to
+// send it
+void MockExchange::tick_cb(lws_sorted_usec_list_t* sul) {
+    MockExchange* self = reinterpret_cast<Tick*>(sul)->self;
+    self->generate(wall_ns());
+    self->trim_log();
+    lws_callback_on_writable_all_protocol(self->ctx_, &mock_protocols[0]);
+    lws_sul_schedule(self->ctx_, 0, &self->tick_.sul, &MockExchange::tick_cb, LWS_US_PER_MS);
+}
+
+// fnv-1a, a product streams the same levels in every run
+static uint64_t seed_of(const std::string& id) noexcept {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (const char c : id) {
+        h = (h ^ static_cast<uint8_t>(c)) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+// a product's stream starts with the first session that asks for it
+int MockExchange::product_index(const std::string& id, uint64_t now) {
+    for (size_t i = 0; i < products_.size(); ++i) {
+        if (products_[i].id == id) {
+            return static_cast<int>(i);
+        }
+    }
+    Product p;
+    p.id = id;
+    p.mid = 3'000'000 + 100'000 * products_.size();
+    p.rng.seed(seed_of(id));
+    for (uint64_t k = 1; k <= opt_.snapshot_levels; ++k) {
+        p.book[1][p.mid - k] = p.rng() % 500'000'000 + 1;
+        p.book[0][p.mid + k] = p.rng() % 500'000'000 + 1;
+    }
+    p.start_ns = now;
+    products_.push_back(std::move(p));
+    return static_cast<int>(products_.size() - 1);
+}
+
+// appends what every stream owes by now to the log
+void MockExchange::generate(uint64_t now) {
+    if (paused_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    if (!replay_.empty()) {
+        if (!replay_start_ns_) {
+            return;
+        }
+        const double elapsed_s = static_cast<double>(now - replay_start_ns_) / 1e9;
+        const double streams = static_cast<double>(std::max<size_t>(products_.size(), 1));
+        const uint64_t due = static_cast<uint64_t>(elapsed_s * opt_.rate * streams);
+        for (; replay_made_ < due; ++replay_made_) {
+            log_.push_back(replay_event(replay_[replay_pos_]));
+            replay_pos_ = (replay_pos_ + 1) % replay_.size();
+        }
+        return;
+    }
+    for (size_t i = 0; i < products_.size(); ++i) {
+        const double elapsed_s = static_cast<double>(now - products_[i].start_ns) / 1e9;
+        uint64_t due = static_cast<uint64_t>(elapsed_s * opt_.rate);
+        if (opt_.burst && opt_.burst_every_ms) {
+            due += static_cast<uint64_t>(elapsed_s * 1000.0 / opt_.burst_every_ms) * opt_.burst;
+        }
+        while (products_[i].made < due) {
+            log_.push_back(update_event(static_cast<int>(i), now));
+        }
+    }
+}
+
+// drops the events every subscribed session has sent
+void MockExchange::trim_log() {
+    uint64_t keep = log_base_ + log_.size();
+    for (const Session* s : sessions_) {
+        if (s->subscribed) {
+            keep = std::min(keep, s->next);
+        }
+    }
+    for (; log_base_ < keep; ++log_base_) {
+        log_.pop_front();
+    }
+}
+
+uint64_t MockExchange::next_seq(Session& s) noexcept {
+    if (opt_.gap_every && s.seq && s.seq % opt_.gap_every == 0) {
+        ++s.seq;
+        ++sent_by_conn_[s.id].breaks;
+    }
+    return s.seq++;
+}
+
+bool MockExchange::write_text(lws* wsi, const std::string& msg) {
+    tx_.resize(LWS_PRE + msg.size());
+    std::memcpy(tx_.data() + LWS_PRE, msg.data(), msg.size());
+    const int n = lws_write(wsi, tx_.data() + LWS_PRE, msg.size(), LWS_WRITE_TEXT);
+    if (n < static_cast<int>(msg.size())) {
+        return false;
+    }
+    sent_.store(sent_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return true;
+}
+
+// a replayed message without sequence_num is all head and goes out as it is
+bool MockExchange::write_event(lws* wsi, Session& s, const Event& e) {
+    char seq[24];
+    const int seq_len = e.tail.empty()
+        ? 0
+        : std::snprintf(seq, sizeof(seq), "%llu", static_cast<unsigned long long>(next_seq(s)));
+    const size_t len = e.head.size() + static_cast<size_t>(seq_len) + e.tail.size();
+    tx_.resize(LWS_PRE + len);
+    unsigned char* p = tx_.data() + LWS_PRE;
+    std::memcpy(p, e.head.data(), e.head.size());
+    std::memcpy(p + e.head.size(), seq, static_cast<size_t>(seq_len));
+    std::memcpy(p + e.head.size() + static_cast<size_t>(seq_len), e.tail.data(), e.tail.size());
+    if (lws_write(wsi, p, len, LWS_WRITE_TEXT) < static_cast<int>(len)) {
+        return false;
+    }
+    sent_.store(sent_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    sent_updates_.store(sent_updates_.load(std::memory_order_relaxed) + e.updates, std::memory_order_relaxed);
+    if (e.product >= 0) {
+        sent_by_conn_[s.id].updates[static_cast<size_t>(e.product)] += e.updates;
+    }
+    return true;
+}
+
+void MockExchange::sent_to(const std::string& product, uint64_t from_conn, uint64_t& updates,
+                           uint64_t& breaks) const {
+    updates = breaks = 0;
+    size_t i = 0;
+    while (i < products_.size() && products_[i].id != product) {
+        ++i;
+    }
+    for (size_t c = from_conn; c < sent_by_conn_.size(); ++c) {
+        const Sent& sent = sent_by_conn_[c];
+        if (i < sent.carried.size() && sent.carried[i]) {
+            updates += sent.updates[i];
+            breaks += sent.breaks;
+        }
+    }
+}
+
+void MockExchange::on_subscribe(Session& s, const char* msg, size_t len) {
+    const std::string m(msg, len);
+    if (m.find(R"("channel":"level2")") == std::string::npos) {
+        return;
+    }
+    const bool unsubscribe = m.find(R"("type":"unsubscribe")") != std::string::npos;
+    if (unsubscribe) {
+        s.subscribed = false;
+        s.wants.clear();
+        s.pending.clear();
+        return;
+    }
+    if (m.find(R"("type":"subscribe")") == std::string::npos) {
+        return;
+    }
+
+    static constexpr char IDS_KEY[] = R"("product_ids":[)";
+    const auto ids = m.find(IDS_KEY);
+    if (ids == std::string::npos) {
+        return;
+    }
+    const auto ids_end = m.find(']', ids);
+    size_t p = ids + sizeof(IDS_KEY) - 1;
+    const uint64_t now = wall_ns();
+    if (!replay_.empty() && !replay_start_ns_) {
+        replay_start_ns_ = now;
+    }
+    // what the log holds so far is in the snapshots, the session starts at its end
+    generate(now);
+    s.wants.clear();
+    s.pending.clear();
+    while (true) {
+        const auto q0 = m.find('"', p);
+        if (q0 == std::string::npos || q0 > ids_end) {
+            break;
+        }
+        const auto q1 = m.find('"', q0 + 1);
+        const auto i = static_cast<size_t>(product_index(m.substr(q0 + 1, q1 - q0 - 1), now));
+        Sent& sent = sent_by_conn_[s.id];
+        s.wants.resize(products_.size());
+        sent.carried.resize(products_.size());
+        sent.updates.resize(products_.size());
+        s.wants[i] = sent.carried[i] = 1;
+        s.pending.push_back(snapshot_msg(s, products_[i], now));
+        p = q1 + 1;
+    }
+    s.next = log_base_ + log_.size();
+    s.subscribed = true;
+}
+
+// the product's book as the log left it, bids and then offers, best first
+std::string MockExchange::snapshot_msg(Session& s, const Product& p, uint64_t now) {
+    char ts[kTsChars];
+    format_ts(now, ts);
+    std::string out;
+    out.reserve(128 + (p.book[0].size() + p.book[1].size()) * 110);
+    out += R"({"channel":"l2_data","client_id":"","timestamp":")";
+    out += ts;
+    out += R"(","sequence_num":)";
+    out += std::to_string(next_seq(s));
+    out += R"(,"events":[{"type":"snapshot","product_id":")";
+    out += p.id;
+    out += R"(","updates":[)";
+    bool first = true;
+    auto put = [&](bool bid, uint64_t px, uint64_t qty) {
+        append_level(out, !first, bid, ts, px, qty);
+        first = false;
+    };
+    for (auto it = p.book[1].rbegin(); it != p.book[1].rend(); ++it) {
+        put(true, it->first, it->second);
+    }
+    for (const auto& [px, qty] : p.book[0]) {
+        put(false, px, qty);
+    }
+    out += "]}]}";
+    return out;
+}
+
+// the product's next update, its event_time is never behind the one before
+MockExchange::Event MockExchange::update_event(int index, uint64_t now) {
+    Product& p = products_[static_cast<size_t>(index)];
+    ++p.made;
+    p.last_ns = std::max(now, p.last_ns + 1);
+
+    // random walk of the mid, levels land within 50 ticks of it
+    if (p.rng() % 8 == 0) {
+        p.mid += (p.rng() & 1) ? 1 : -1;
+    }
+
+    char ts[kTsChars];
+    format_ts(p.last_ns, ts);
+    Event e{index, opt_.updates_per_msg, {}, {}};
+    e.head.reserve(96);
+    e.head += R"({"channel":"l2_data","client_id":"","timestamp":")";
+    e.head += ts;
+    e.head += R"(","sequence_num":)";
+    e.tail.reserve(96 + opt_.updates_per_msg * 110);
+    e.tail += R"(,"events":[{"type":"update","product_id":")";
+    e.tail += p.id;
+    e.tail += R"(","updates":[)";
+    for (uint32_t i = 0; i < opt_.updates_per_msg; ++i) {
+        const bool bid = p.rng() & 1;
+        const uint64_t k = p.rng() % 50 + 1;
+        const uint64_t px = bid ? p.mid - k : p.mid + k;
+        const bool remove = p.rng() % 4 == 0;
+        const uint64_t qty = remove ? 0 : p.rng() % 500'000'000 + 1;
+        if (qty) {
+            p.book[bid][px] = qty;
+        }
+        else {
+            p.book[bid].erase(px);
+        }
+        append_level(e.tail, i, bid, ts, px, qty);
+    }
+    e.tail += "]}]}";
+    return e;
+}
+
+// captured messages keep their payload, only sequence_num is renumbered per session
+MockExchange::Event MockExchange::replay_event(const std::string& msg) const {
+    static constexpr char SEQ_KEY[] = R"("sequence_num":)";
+    const auto k = msg.find(SEQ_KEY);
+    if (k == std::string::npos) {
+        return {-1, 0, msg, {}};
+    }
+    const size_t v = k + sizeof(SEQ_KEY) - 1;
+    size_t e = v;
+    while (e < msg.size() && msg[e] >= '0' && msg[e] <= '9') {
+        ++e;
+    }
+    return {-1, 0, msg.substr(0, v), msg.substr(e)};
+}
+
+int MockExchange::lws_cb(lws* wsi, lws_callback_reasons why, void* user, void* in, size_t len) {
+    auto* pss = static_cast<PSS*>(user);
+    auto* self = static_cast<MockExchange*>(lws_context_user(lws_get_context(wsi)));
+
+    switch (why) {
+    case LWS_CALLBACK_ESTABLISHED:
+        pss->s = new Session();
+        pss->s->id = self->connections_.fetch_add(1, std::memory_order_relaxed);
+        pss->s->connected_ns = wall_ns();
+        self->sessions_.push_back(pss->s);
+        self->sent_by_conn_.emplace_back();
+        break;
+
+    case LWS_CALLBACK_RECEIVE:
+        if (pss && pss->s) {
+            self->on_subscribe(*pss->s, static_cast<const char*>(in), len);
+            lws_callback_on_writable(wsi);
+        }
+        break;
+
+    case LWS_CALLBACK_SERVER_WRITEABLE:
+        {
+            if (!pss || !pss->s || !pss->s->subscribed) {
+                break;
+            }
+            Session& s = *pss->s;
+            const uint64_t now = wall_ns();
+            uint64_t drop = s.id + 1;
+            if (self->drop_.compare_exchange_strong(drop, 0, std::memory_order_relaxed) ||
+                (self->opt_.drop_every_s && now - s.connected_ns >= self->opt_.drop_every_s * 1'000'000'000ull)) {
+                std::cout << "[MockExchange] dropping connection " << s.id << '\n';
+                ++self->sent_by_conn_[s.id].breaks;
+                return -1;
+            }
+
+            // one frame per writeable callback, ask again while more is due
+            if (!s.pending.empty()) {
+                self->write_text(wsi, s.pending.front());
+                s.pending.erase(s.pending.begin());
+                lws_callback_on_writable(wsi);
+                break;
+            }
+            const uint64_t end = self->log_base_ + self->log_.size();
+            while (s.next < end) {
+                const Event& e = self->log_[s.next - self->log_base_];
+                const auto i = static_cast<size_t>(e.product);
+                if (e.product < 0 || (i < s.wants.size() && s.wants[i])) {
+                    break;
+                }
+                ++s.next;
+            }
+            if (s.next < end) {
+                if (self->write_event(wsi, s, self->log_[s.next - self->log_base_])) {
+                    ++s.next;
+                }
+                if (s.next < end) {
+                    lws_callback_on_writable(wsi);
+                }
+            }
+        }
+        break;
+
+    case LWS_CALLBACK_CLOSED:
+        if (pss && pss->s) {
+            auto& v = self->sessions_;
+            v.erase(std::remove(v.begin(), v.end(), pss->s), v.end());
+            delete pss->s;
+            pss->s = nullptr;
+        }
+        break;
+
+    default: break;
+    }
+    return 0;
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include <libwebsockets.h>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// local stand-in for the coinbase advanced trade websocket, level2 channel only.
+// every product is one stream of l2_data updates at a configured rate with optional bursts, or
+// the captured messages of a replay file instead, and every session subscribed to a product gets
+// the same stream: a snapshot of the product's book when it subscribes, then each update in order.
+// only sequence_num differs from session to session.
+struct MockExchangeOpt {
+    int port{9000};
+    // update messages per second per product
+    double rate{1000};
+    uint32_t updates_per_msg{1};
+    // extra messages per product sent back to back every burst_every_ms, on top of the steady rate
+    uint32_t burst{0};
+    uint32_t burst_every_ms{0};
+    uint32_t snapshot_levels{500};
+    // one captured message per line, sent in order and looped instead of synthetic updates
+    std::string replay_file;
+    // skip a sequence number every n messages, exercises gap detection
+    uint64_t gap_every{0};
+    // close each connection after this many seconds, exercises reconnects
+    uint32_t drop_every_s{0};
+};
+
+class MockExchange {
+public:
+    explicit MockExchange(const MockExchangeOpt& opt);
+    ~MockExchange();
+
+    bool start();
+    void stop();
+    void join();
+
+    uint64_t sent() const noexcept { return sent_.load(std::memory_order_relaxed); }
+    uint64_t sent_updates() const noexcept { return sent_updates_.load(std::memory_order_relaxed); }
+    uint64_t connections() const noexcept { return connections_.load(std::memory_order_relaxed); }
+    // closes the n-th connection accepted, counting from 0, the next time it could be written
+    void drop(uint64_t n) noexcept { drop_.store(n + 1, std::memory_order_relaxed); }
+    // stops making updates, the sessions still send what was made
+    void pause() noexcept { paused_.store(true, std::memory_order_relaxed); }
+
+    // what the connections from from_conn on were sent, read once the mock is joined: the update
+    // levels of a product, and the sequence gaps and drops on the connections that carried it
+    void sent_to(const std::string& product, uint64_t from_conn, uint64_t& updates, uint64_t& breaks) const;
+
+private:
+    // one stream per product, its levels come from an rng seeded by the product id
+    struct Product {
+        std::string id;
+        uint64_t mid;  // price * 100
+        std::mt19937_64 rng;
+        // qty * 1e8 by price, indexed by bid, what a snapshot restates
+        std::map<uint64_t, uint64_t> book[2];
+        uint64_t start_ns{0};
+        uint64_t made{0};
+        uint64_t last_ns{0};
+    };
+
+    // a message as every session sends it, its sequence_num goes between head and tail
+    struct Event {
+        int product;  // -1 for a replayed message, which every session gets
+        uint32_t updates;
+        std::string head;
+        std::string tail;
+    };
+
+    struct Session {
+        uint64_t id{0};
+        // by product index
+        std::vector<uint8_t> wants;
+        std::vector<std::string> pending;  // snapshots not sent yet
+        uint64_t seq{0};
+        // index of the next event in the log
+        uint64_t next{0};
+        uint64_t connected_ns{0};
+        bool subscribed{false};
+    };
+
+    // what one connection was sent, by session id
+    struct Sent {
+        // by product index
+        std::vector<uint8_t> carried;
+        std::vector<uint64_t> updates;
+        // sequence numbers skipped, and the close by drop_every_s or drop()
+        uint64_t breaks{0};
+    };
+
+    struct PSS {
+        Session* s;
+    };
+
+    struct Tick {
+        lws_sorted_usec_list_t sul;
+        MockExchange* self;
+    };
+
+    MockExchangeOpt opt_;
+    lws_context* ctx_{nullptr};
+    std::vector<std::string> replay_;
+    std::vector<unsigned char> tx_;
+    std::vector<Product> products_;
+    std::vector<Session*> sessions_;
+    std::vector<Sent> sent_by_conn_;
+    // events not yet sent by every session, log_base_ is the index of the front one
+    std::deque<Event> log_;
+    uint64_t log_base_{0};
+    size_t replay_pos_{0};
+    uint64_t replay_start_ns_{0};
+    uint64_t replay_made_{0};
+    Tick tick_{};
+    std::atomic<uint64_t> sent_{0};
+    std::atomic<uint64_t> sent_updates_{0};
+    std::atomic<uint64_t> connections_{0};
+    std::atomic<uint64_t> drop_{0};
+    std::atomic<bool> paused_{false};
+    std::atomic<bool> running_{false};
+    std::unique_ptr<std::thread> thread_;
+
+    void run();
+    static int lws_cb(lws*, lws_callback_reasons, void*, void*, size_t);
+    static void tick_cb(lws_sorted_usec_list_t* sul);
+    void on_subscribe(Session& s, const char* msg, size_t len);
+    int product_index(const std::string& id, uint64_t now);
+    void generate(uint64_t now);
+    void trim_log();
+    bool write_text(lws* wsi, const std::string& msg);
+    bool write_event(lws* wsi, Session& s, const Event& e);
+    std::string snapshot_msg(Session& s, const Product& p, uint64_t now);
+    Event update_event(int index, uint64_t now);
+    Event replay_event(const std::string& msg) const;
+    uint64_t next_seq(Session& s) noexcept;
+};
@@ -0,0 +1,82 @@
+#include <csignal>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "mock_exchange.h"
+
+static std::atomic<bool> shutdown_requested{false};
+
+static void signal_handler(int) {
+    shutdown_requested.store(true);
+}
+
+static void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0
+        << " [--port N] [--rate MSGS] [--updates N] [--burst N --burst-every MS] [--levels N]"
+        << " [--replay FILE] [--gap-every N] [--drop-every S]\n"
+        << "  --rate is update messages per second per product, every connection gets the same stream\n"
+        << "  --replay sends captured l2_data messages, one per line, instead of synthetic updates\n";
+}
+
+int main(int argc, char** argv) {
+    std::signal(SIGINT, signal_handler);
+    std::signal(SIGTERM, signal_handler);
+
+    MockExchangeOpt opt;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const bool has_val = i + 1 < argc;
+            if (arg == "--port" && has_val) {
+                opt.port = std::stoi(argv[++i]);
+            }
+            else if (arg == "--rate" && has_val) {
+                opt.rate = std::stod(argv[++i]);
+            }
+            else if (arg == "--updates" && has_val) {
+                opt.updates_per_msg = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--burst" && has_val) {
+                opt.burst = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--burst-every" && has_val) {
+                opt.burst_every_ms = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--levels" && has_val) {
+                opt.snapshot_levels = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--replay" && has_val) {
+                opt.replay_file = argv[++i];
+            }
+            else if (arg == "--gap-every" && has_val) {
+                opt.gap_every = std::stoull(argv[++i]);
+            }
+            else if (arg == "--drop-every" && has_val) {
+                opt.drop_every_s = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else {
+                usage(argv[0]);
+                return arg == "-h" || arg == "--help" ? 0 : 1;
+            }
+        }
+    } catch (const std::exception& e) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    MockExchange mock(opt);
+    mock.start();
+
+    uint64_t last = 0;
+    while (!shutdown_requested.load()) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        const uint64_t sent = mock.sent();
+        std::cout << "[mock_exchange] " << sent - last << " msgs/s, " << mock.connections() << " connections\n";
+        last = sent;
+    }
+
+    mock.stop();
+    mock.join();
+    return 0;
+}
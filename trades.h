@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+#include "col_schema.h"
+
+// side of a trade as the market_trades channel reports it
+enum : uint8_t { TRADE_SELL = 0, TRADE_BUY = 1 };
+
+// price in ticks and size in units of the product's decimals, like the l2 rows
+struct TradeRow {
+    uint64_t ts_ns;
+    uint64_t trade_id;
+    int64_t size;
+    uint32_t price;
+    uint8_t side;
+};
+
+// base/yyyymmdd/hh00.trades
+using TradeSchema = ColSchema<"trades", TradeRow,
+                              Col<&TradeRow::ts_ns, "ts">,
+                              Col<&TradeRow::price, "price">,
+                              Col<&TradeRow::size, "size">,
+                              Col<&TradeRow::trade_id, "trade_id">,
+                              Col<&TradeRow::side, "side">>;
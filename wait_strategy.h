@@ -0,0 +1,103 @@
+#pragma once
+#include <immintrin.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include "spsc.h"
+
+// what a consumer does while its queue is empty
+enum class WaitMode : uint8_t {
+    Spin,       // _mm_pause only, lowest wakeup latency, burns the core
+    SpinYield,  // spin, then sched_yield between polls
+    Park,       // spin, then sleep on a futex the producer wakes
+};
+
+inline const char* wait_mode_name(WaitMode m) noexcept {
+    switch (m) {
+    case WaitMode::Spin: return "spin";
+    case WaitMode::SpinYield: return "yield";
+    case WaitMode::Park: return "park";
+    }
+    return "?";
+}
+
+inline bool parse_wait_mode(const char* s, WaitMode& out) noexcept {
+    for (WaitMode m : {WaitMode::Spin, WaitMode::SpinYield, WaitMode::Park}) {
+        if (std::strcmp(s, wait_mode_name(m)) == 0) {
+            out = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+// single consumer waits, single producer notifies. the producer only pays a fence and a load
+// per notify, and only issues a syscall when the consumer has actually parked.
+class Waiter {
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> parked_{0};
+    alignas(CACHE_LINE_SIZE) uint32_t idle_polls_{0};
+    WaitMode mode_;
+    uint32_t spin_polls_;
+    long park_timeout_ns_;
+
+    static void futex_wait(std::atomic<uint32_t>* addr, uint32_t expected, long timeout_ns) noexcept {
+        timespec ts{0, timeout_ns};
+        ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0);
+    }
+
+    static void futex_wake(std::atomic<uint32_t>* addr) noexcept {
+        ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+
+public:
+    explicit Waiter(WaitMode mode, uint32_t spin_polls = 4096, long park_timeout_ns = 10'000'000)
+        : mode_(mode), spin_polls_(spin_polls), park_timeout_ns_(park_timeout_ns) {}
+
+    WaitMode mode() const noexcept { return mode_; }
+
+    // producer side, after publishing
+    void notify() noexcept {
+        if (mode_ != WaitMode::Park) {
+            return;
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked_.load(std::memory_order_relaxed)) {
+            wake();
+        }
+    }
+
+    // unconditional wakeup, used for shutdown
+    void wake() noexcept {
+        parked_.store(0, std::memory_order_relaxed);
+        futex_wake(&parked_);
+    }
+
+    // consumer side, call when work was found
+    void reset() noexcept { idle_polls_ = 0; }
+
+    // consumer side, call when a poll came back empty. ready() is rechecked after announcing
+    // the park so a publish racing with it is never slept through.
+    template <typename Ready>
+    void idle(Ready&& ready) noexcept {
+        if (mode_ == WaitMode::Spin || idle_polls_ < spin_polls_) {
+            ++idle_polls_;
+            _mm_pause();
+            return;
+        }
+        if (mode_ == WaitMode::SpinYield) {
+            ::sched_yield();
+            return;
+        }
+        parked_.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ready()) {
+            futex_wait(&parked_, 1, park_timeout_ns_);
+        }
+        parked_.store(0, std::memory_order_relaxed);
+    }
+};